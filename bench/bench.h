@@ -0,0 +1,29 @@
+// ================ Host benchmark helpers ===========
+// Each benchmark is one executable printing one line per case. With no
+// argument it runs the full count; ctest passes a small one so the
+// benchmarks keep building and running without slowing the gate. Host
+// numbers compare designs; the ESP32 is several times slower.
+#pragma once
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+inline uint64_t benchNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+inline long benchCount(int argc, char **argv, long full)
+{
+    long n = argc > 1 ? atol(argv[1]) : full;
+    return n > 0 ? n : 1;
+}
+// ns per op for ops done in ns
+inline void benchReport(const char *name, uint64_t ns, long ops, const char *per)
+{
+    printf("%-44s %10.1f ns/%s\n", name, (double)ns / ops, per);
+}
+// Keeps the compiler from dropping work whose result is unused.
+static volatile uint32_t benchSink;
@@ -0,0 +1,80 @@
+// Command bus throughput (core/bus.h): an uncontended post+take, then 1
+// to 4 producer threads posting to one consumer thread. A producer that
+// finds the ring full yields and retries, as a task would after a
+// rejected post; an idle consumer yields too. Contended numbers depend on
+// the host's core count, which is printed.
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "core/bus.h"
+#include "bench.h"
+
+static BusRing ring;
+
+static void uncontended(long n)
+{
+    busRingInit(ring);
+    BusMsg m, out;
+    memset(&m, 0, sizeof(m));
+    out = m;
+    uint64_t t0 = benchNowNs();
+    for (long i = 0; i < n; i++)
+    {
+        m.cmd.value = (int16_t)i;
+        busRingPost(ring, m, 0);
+        busRingTake(ring, out);
+        benchSink += out.cmd.value;
+    }
+    benchReport("post+take, one thread", benchNowNs() - t0, n, "msg");
+}
+static void contended(int producers, long each)
+{
+    busRingInit(ring);
+    uint64_t full = 0;
+    std::vector<uint64_t> fulls(producers, 0);
+    std::vector<std::thread> threads;
+    uint64_t t0 = benchNowNs();
+    for (int p = 0; p < producers; p++)
+    {
+        threads.push_back(std::thread([p, each, &fulls]() {
+            BusMsg m;
+            memset(&m, 0, sizeof(m));
+            m.cmd.id = p;
+            for (long i = 0; i < each; i++)
+            {
+                while (!busRingPost(ring, m, 0))
+                {
+                    fulls[p]++;
+                    std::this_thread::yield();
+                }
+            }
+        }));
+    }
+    BusMsg out;
+    for (long got = 0; got < producers * each;)
+    {
+        if (busRingTake(ring, out))
+            got++;
+        else
+            std::this_thread::yield(); // as the owner would block on its notification
+    }
+    uint64_t ns = benchNowNs() - t0;
+    for (int p = 0; p < producers; p++)
+    {
+        threads[p].join();
+        full += fulls[p];
+    }
+    long total = producers * each;
+    printf("%d producer(s) -> 1 consumer                %10.1f ns/msg  %6.2f M msg/s  %.1f%% posts hit a full ring\n",
+           producers, (double)ns / total, total * 1e3 / ns, 100.0 * full / (total + full));
+}
+
+int main(int argc, char **argv)
+{
+    long n = benchCount(argc, argv, 2000000);
+    printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    uncontended(n);
+    for (int p = 1; p <= 4; p++)
+        contended(p, n / p);
+    return 0;
+}
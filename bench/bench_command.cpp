@@ -0,0 +1,35 @@
+// MQTT command parse latency (core/command.h): one command, a four-item
+// batch, and a rejected topic, parsed in place from constant buffers as
+// mqttCallback() does with the PubSubClient buffer.
+#include <string.h>
+#include "core/command.h"
+#include "bench.h"
+
+static const char *PREFIX = "gateway/gw1/cmd/";
+#define BATCH_MAX 16 // CMD_BATCH_MAX in main.cpp
+static GatewayCommand cmds[BATCH_MAX];
+
+static void run(const char *name, const char *topic, const char *payload, long n)
+{
+    unsigned int len = strlen(payload);
+    uint64_t t0 = benchNowNs();
+    for (long i = 0; i < n; i++)
+    {
+        int k = parseCommandMessage(PREFIX, topic, (const uint8_t *)payload, len, cmds, BATCH_MAX);
+        benchSink += k + cmds[0].id;
+    }
+    benchReport(name, benchNowNs() - t0, n, "msg");
+}
+
+int main(int argc, char **argv)
+{
+    long n = benchCount(argc, argv, 2000000);
+    run("node/3/dim 128", "gateway/gw1/cmd/node/3/dim", "128", n);
+    run("relay/all on", "gateway/gw1/cmd/relay/all", "on", n);
+    run("node/2/fade 200,1500,ease", "gateway/gw1/cmd/node/2/fade", "200,1500,ease", n);
+    run("batch, 4 items", "gateway/gw1/cmd/batch",
+        "relay/0=on;node/1/dim=40;node/2/relay=toggle;group/all/dim=90", n);
+    run("legacy esp32/relay/cmd", "esp32/relay/cmd", "all_off", n);
+    run("foreign topic (rejected)", "gateway/other/cmd/node/3/dim", "128", n);
+    return 0;
+}
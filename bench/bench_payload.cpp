@@ -0,0 +1,43 @@
+// JSON vs CBOR for the MQTT node payloads (core/payload.h): one state and
+// one telemetry message per node, as a full resend after reconnect sends
+// them, at 10, 100 and 500 nodes. Reports mean size and encode time.
+#include "core/payload.h"
+#include "bench.h"
+
+static uint8_t buf[128]; // publishChanges() buffer size
+
+static void run(int nodes, bool cbor, long rounds)
+{
+    uint64_t bytes = 0;
+    long msgs = 0;
+    uint64_t t0 = benchNowNs();
+    for (long r = 0; r < rounds; r++)
+    {
+        for (int nid = 1; nid <= nodes; nid++)
+        {
+            PayloadWriter s(buf, sizeof(buf), cbor);
+            schemaNodeState(s, nid, nid & 1, (nid * 37) % 256, true);
+            PayloadWriter t(buf, sizeof(buf), cbor);
+            schemaNodeTelemetry(t, nid, 18.5f + (nid % 70) * 0.17f, 1000 + nid * 13 + r, 0);
+            bytes += s.size() + t.size();
+            msgs += 2;
+            benchSink += buf[3];
+        }
+    }
+    uint64_t ns = benchNowNs() - t0;
+    printf("%5d nodes  %-4s  %6.1f B/msg  %7.1f ns/msg\n", nodes, cbor ? "cbor" : "json", (double)bytes / msgs,
+           (double)ns / msgs);
+}
+
+int main(int argc, char **argv)
+{
+    long n = benchCount(argc, argv, 200000);
+    const int sizes[] = {10, 100, 500};
+    for (int i = 0; i < 3; i++)
+    {
+        long rounds = n / sizes[i] > 0 ? n / sizes[i] : 1; // same message count per size
+        run(sizes[i], false, rounds);
+        run(sizes[i], true, rounds);
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Rule evaluation per uplink with 1,000 rules (core/rules.h).
+//   spread   rules on all 14 sources, an uplink walks its node's ~70
+//   one node every rule on the uplinking node, the worst case
+// Telemetry alternates across the thresholds, so rules keep latching,
+// firing and re-arming instead of short-cutting.
+#include <string.h>
+#include "core/rules.h"
+#include "bench.h"
+
+#define BENCH_RULES 1000
+
+static RuleTable table;
+static RuleStats stats;
+static bool relays[RULE_RELAYS];
+
+static bool fire(const Rule &r)
+{
+    benchSink += r.targetId;
+    return true;
+}
+static void fill(bool oneNode)
+{
+    memset(&table, 0, sizeof(table));
+    for (int i = 0; i < BENCH_RULES; i++)
+    {
+        Rule &r = table.rules[i];
+        r.id = i + 1;
+        r.src = oneNode ? 1 : (i % RULE_BUCKETS < NODE_SLOTS ? 1 + i % RULE_BUCKETS : RULE_SRC_RELAY + i % RULE_BUCKETS - NODE_SLOTS);
+        r.field = r.src >= RULE_SRC_RELAY ? RULE_F_RELAY : RULE_F_TEMP;
+        r.op = i % 2 ? RULE_GT : RULE_LT;
+        r.threshold = r.field == RULE_F_RELAY ? 0.5f : 20 + i % 10;
+        r.hyst = 0.5f;
+        r.guardRelay = i % 3 ? -1 : 0;
+        r.guardOn = 1;
+        r.target = CMD_NODE;
+        r.targetId = 1 + i % NODE_SLOTS;
+        r.action = ACT_ON;
+    }
+    table.count = BENCH_RULES;
+    rulesIndex(table);
+}
+// One uplink: node src reports a temperature, its rules run.
+static void run(const char *name, bool oneNode, long uplinks)
+{
+    fill(oneNode);
+    memset(&stats, 0, sizeof(stats));
+    relays[0] = true;
+    RuleInputs in;
+    in.relays = relays;
+    in.minute = 600;
+    in.fire = fire;
+    uint64_t t0 = benchNowNs();
+    for (long u = 0; u < uplinks; u++)
+    {
+        int src = oneNode ? 0 : u % NODE_SLOTS;
+        float temp = u % 4 < 2 ? 15 : 35;
+        in.fields[RULE_F_TEMP] = temp;
+        in.fields[RULE_F_TIME] = u;
+        in.fields[RULE_F_RELAY] = u & 1;
+        in.fields[RULE_F_DIM] = 128;
+        in.nowMs = u * 10;
+        rulesEval(table, src, in, stats);
+    }
+    uint64_t ns = benchNowNs() - t0;
+    benchReport(name, ns, uplinks, "uplink");
+    printf("%-44s %10.1f rules/uplink, %u fired\n", "", (double)stats.evals / uplinks, stats.fired);
+}
+
+int main(int argc, char **argv)
+{
+    long n = benchCount(argc, argv, 200000);
+    run("1000 rules, 14 sources", false, n);
+    run("1000 rules, one node", true, n);
+    return 0;
+}
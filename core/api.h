@@ -0,0 +1,289 @@
+// ================ Portal request parsing ===========
+// The HTTP API's form arguments into the gateway's records: command
+// args, schedules, rules, groups, scenes and fades. A parser checks
+// every field and only reports what is wrong; the reply, the lock and
+// the post to the owner stay with the handler in main.cpp. Portable: no
+// Arduino headers, the request is behind ApiArgs.
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "command.h"
+#include "groups.h"
+#include "protocol.h"
+#include "rules.h"
+#include "schedule.h"
+
+struct ApiArgs
+{
+    virtual bool has(const char *name) = 0;
+    // The value, "" if absent; valid until the next get().
+    virtual const char *get(const char *name) = 0;
+};
+enum ApiResult
+{
+    API_OK,
+    API_MISSING,   // a required argument is absent
+    API_BAD_ID,    // the record id is out of range
+    API_BAD_VALUE, // any other field
+    API_TOO_MANY   // more list items than the record holds
+};
+// ---------------- Field helpers -------------------
+// Numbers read like the WebServer's toInt()/toFloat(): leading digits,
+// 0 when there are none.
+inline long apiInt(ApiArgs &a, const char *name)
+{
+    return strtol(a.get(name), NULL, 10);
+}
+inline float apiFloat(ApiArgs &a, const char *name)
+{
+    return (float)strtod(a.get(name), NULL);
+}
+inline bool apiIs(ApiArgs &a, const char *name, const char *value)
+{
+    return strcmp(a.get(name), value) == 0;
+}
+// Index of the argument's value in names[], -1 if it is none of them.
+inline int apiIndex(ApiArgs &a, const char *name, const char *const *names, int n)
+{
+    const char *v = a.get(name);
+    for (int i = 0; i < n; i++)
+        if (strcmp(v, names[i]) == 0)
+            return i;
+    return -1;
+}
+inline long apiClamp(long v, long lo, long hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+// ---------------- Command args --------------------
+// target=relay|node|group tid=<id>|all action=on|off|toggle|dim
+// [value=0..255], or target=scene tid=<sid>; shared by schedules and rules.
+inline bool apiCommandArgs(ApiArgs &a, uint8_t &target, uint8_t &action, uint16_t &tid, int16_t &value)
+{
+    int t = apiIndex(a, "target", cmdTargetNames, 4); // index = CmdTarget
+    int act = apiIndex(a, "action", cmdActionNames, 4);
+    if (t == CMD_SCENE && act < 0)
+        act = ACT_ON;
+    if (t < 0 || act < 0)
+        return false;
+    long id = apiInt(a, "tid");
+    if (apiIs(a, "tid", "all"))
+        id = t == CMD_GROUP ? 0 : CMD_ID_ALL; // group 0 = every node
+    if (id < 0 || id > CMD_ID_ALL || !cmdStoredValid(t, id, act))
+        return false;
+    target = t;
+    action = act;
+    tid = id;
+    value = apiClamp(apiInt(a, "value"), 0, 255);
+    return true;
+}
+// ---------------- Schedule ------------------------
+// [id=] kind=once|daily|hourly at=<unix>|HH:MM[:SS]|MM[:SS]
+// [days=0123456 (0 = Sunday, default every day)] + command args.
+inline bool apiSchedEntry(ApiArgs &a, SchedEntry &e)
+{
+    memset(&e, 0, sizeof(e));
+    bool ok = apiCommandArgs(a, e.target, e.action, e.targetId, e.value);
+    if (apiIs(a, "kind", "once"))
+    {
+        e.kind = SCHED_ONCE;
+        e.at = strtoul(a.get("at"), NULL, 10);
+        ok = ok && e.at >= SCHED_CLOCK_MIN;
+    }
+    else if (apiIs(a, "kind", "daily") || apiIs(a, "kind", "hourly"))
+    {
+        e.kind = apiIs(a, "kind", "daily") ? SCHED_DAILY : SCHED_HOURLY;
+        int h = 0, m = 0, s = 0;
+        int n = sscanf(a.get("at"), "%d:%d:%d", &h, &m, &s);
+        if (e.kind == SCHED_DAILY)
+        {
+            ok = ok && n >= 2 && h >= 0 && h < 24 && m >= 0 && m < 60 && s >= 0 && s < 60;
+            e.at = h * 3600 + m * 60 + s;
+        }
+        else
+        {
+            ok = ok && n >= 1 && h >= 0 && h < 60 && m >= 0 && m < 60;
+            e.at = h * 60 + m;
+        }
+        e.days = a.has("days") ? 0 : 0x7F;
+        for (const char *d = a.get("days"); *d; d++)
+        {
+            if (*d < '0' || *d > '6')
+                ok = false;
+            else
+                e.days |= 1u << (*d - '0');
+        }
+        ok = ok && e.days;
+    }
+    else
+    {
+        ok = false;
+    }
+    e.id = apiInt(a, "id");
+    return ok;
+}
+// ---------------- Rule ----------------------------
+// [id=] node=<id> field=temp|time|relay|dim | relay=<0..3>
+// op=gt|ge|lt|le|eq|ne thr= [hyst=] [guardRelay= guardOn=0|1]
+// [from=HH:MM to=HH:MM] [cooldown=<s>] + command args.
+inline bool apiRule(ApiArgs &a, Rule &r)
+{
+    static const char *const fields[RULE_FIELDS] = {"temp", "time", "relay", "dim"};
+    static const char *const ops[] = {"gt", "ge", "lt", "le", "eq", "ne"};
+    memset(&r, 0, sizeof(r));
+    bool ok = apiCommandArgs(a, r.target, r.action, r.targetId, r.value);
+    if (a.has("relay"))
+    {
+        long idx = apiInt(a, "relay");
+        ok = ok && idx >= 0 && idx < RULE_RELAYS;
+        r.src = RULE_SRC_RELAY + idx;
+        r.field = RULE_F_RELAY;
+    }
+    else
+    {
+        long node = apiInt(a, "node");
+        ok = ok && node >= 1 && node <= NODE_SLOTS;
+        r.src = node;
+        int f = apiIndex(a, "field", fields, RULE_FIELDS);
+        ok = ok && f >= 0;
+        r.field = f;
+    }
+    int op = apiIndex(a, "op", ops, 6);
+    ok = ok && op >= 0 && a.has("thr");
+    r.op = op;
+    r.threshold = apiFloat(a, "thr");
+    r.hyst = apiFloat(a, "hyst");
+    if (!(r.hyst > 0.0f))
+        r.hyst = 0.0f;
+    r.guardRelay = -1;
+    if (a.has("guardRelay"))
+    {
+        long g = apiInt(a, "guardRelay");
+        ok = ok && g >= 0 && g < RULE_RELAYS;
+        r.guardRelay = g;
+        r.guardOn = !apiIs(a, "guardOn", "0");
+    }
+    if (a.has("from") || a.has("to"))
+    {
+        int fh = 0, fm = 0, th = 0, tm = 0;
+        ok = ok && sscanf(a.get("from"), "%d:%d", &fh, &fm) == 2 && sscanf(a.get("to"), "%d:%d", &th, &tm) == 2 &&
+             fh >= 0 && fh < 24 && fm >= 0 && fm < 60 && th >= 0 && th < 24 && tm >= 0 && tm < 60;
+        r.fromMin = fh * 60 + fm;
+        r.toMin = th * 60 + tm;
+    }
+    r.cooldownS = apiClamp(apiInt(a, "cooldown"), 0, 65535);
+    r.id = apiInt(a, "id");
+    return ok;
+}
+// ---------------- Group ---------------------------
+// id=1..GROUP_MAX [name=] members=1,2,5
+inline ApiResult apiGroup(ApiArgs &a, NodeGroup &g)
+{
+    memset(&g, 0, sizeof(g));
+    long id = apiInt(a, "id");
+    if (id < 1 || id > GROUP_MAX)
+        return API_BAD_ID;
+    g.id = id;
+    if (a.has("name"))
+        snprintf(g.name, sizeof(g.name), "%s", a.get("name"));
+    else
+        snprintf(g.name, sizeof(g.name), "Group %ld", id);
+    const char *p = a.get("members");
+    while (*p)
+    {
+        char *end;
+        long nid = strtol(p, &end, 10);
+        if (end == p || nid < 1 || nid > NODE_SLOTS)
+            return API_BAD_VALUE;
+        groupAdd(g, nid);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return API_OK;
+}
+// ---------------- Group command -------------------
+// id=<gid>|all action=on|off|toggle|dim [value=]
+inline bool apiGroupSet(ApiArgs &a, GatewayCommand &cmd)
+{
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.target = CMD_GROUP;
+    cmd.id = apiIs(a, "id", "all") ? 0 : (uint16_t)apiInt(a, "id");
+    int act = apiIndex(a, "action", cmdActionNames, 4);
+    if (act < 0 || cmd.id > GROUP_MAX)
+        return false;
+    cmd.action = act;
+    cmd.value = apiClamp(apiInt(a, "value"), 0, 255);
+    return true;
+}
+// ---------------- Scene ---------------------------
+// id=1..255 [name=] entries=node:relay:dim,... | capture=node,node,...
+// relay is 0 or 1, dim 0..255; a malformed entry rejects the whole scene.
+// capture lists nodes only: their relay and dim are 0 here, for the
+// handler to fill in from the live state.
+inline ApiResult apiScene(ApiArgs &a, Scene &sc, bool &capture)
+{
+    memset(&sc, 0, sizeof(sc));
+    long id = apiInt(a, "id");
+    if (id < 1 || id > 255)
+        return API_BAD_ID;
+    sc.id = id;
+    if (a.has("name"))
+        snprintf(sc.name, sizeof(sc.name), "%s", a.get("name"));
+    else
+        snprintf(sc.name, sizeof(sc.name), "Scene %ld", id);
+    capture = a.has("capture");
+    const char *p = a.get(capture ? "capture" : "entries");
+    while (*p)
+    {
+        if (sc.count >= NODE_SLOTS)
+            return API_TOO_MANY;
+        char *end;
+        long nid = strtol(p, &end, 10);
+        long relay = 0, dim = 0;
+        if (end == p || nid < 1 || nid > NODE_SLOTS)
+            return API_BAD_VALUE;
+        if (!capture)
+        {
+            // each field must be there before the parser steps past its ':'
+            const char *f = end + 1;
+            if (*end != ':')
+                return API_BAD_VALUE;
+            relay = strtol(f, &end, 10);
+            if (end == f || (relay != 0 && relay != 1) || *end != ':')
+                return API_BAD_VALUE;
+            f = end + 1;
+            dim = strtol(f, &end, 10);
+            if (end == f || dim < 0 || dim > 255)
+                return API_BAD_VALUE;
+        }
+        SceneEntry &en = sc.entries[sc.count++];
+        en.node = nid;
+        en.relay = relay;
+        en.dim = dim;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return sc.count ? API_OK : API_BAD_VALUE;
+}
+// ---------------- Node fade -----------------------
+// node=<id> value=0..255 [ms=0..60000, default 400] [curve=linear|ease|square]
+inline ApiResult apiNodeFade(ApiArgs &a, GatewayCommand &cmd)
+{
+    memset(&cmd, 0, sizeof(cmd));
+    if (!a.has("node") || !a.has("value"))
+        return API_MISSING;
+    long id = apiInt(a, "node");
+    if (id <= 0 || id > NODE_SLOTS)
+        return API_BAD_ID;
+    long ms = a.has("ms") ? apiInt(a, "ms") : FADE_DEFAULT_MS;
+    int curve = a.has("curve") ? apiIndex(a, "curve", fadeCurveNames, FADE_CURVES) : FADE_LINEAR;
+    if (ms < 0 || ms > FADE_MAX_MS || curve < 0)
+        return API_BAD_VALUE;
+    cmd.target = CMD_NODE;
+    cmd.action = ACT_FADE;
+    cmd.id = id;
+    cmd.value = apiClamp(apiInt(a, "value"), 0, 255);
+    cmd.fadeMs = ms;
+    cmd.curve = curve;
+    return API_OK;
+}
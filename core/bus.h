@@ -0,0 +1,88 @@
+// ================ Command bus ======================
+// Bounded MPSC ring (Vyukov) carrying BusMsg to the state owner: a
+// producer claims a slot by advancing tail with CAS, fills it, then
+// publishes it by bumping the cell sequence. The owner reads cells in
+// order and hands them back by setting the sequence one lap ahead. No
+// locks, no allocation, no priority inversion; a full ring rejects
+// instead of blocking the caller. Portable: no Arduino headers; waking
+// the owner and the statistics are the caller's.
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include "command.h"
+#include "registry.h"
+
+#define BUS_SIZE 64 // power of two
+static_assert((BUS_SIZE & (BUS_SIZE - 1)) == 0, "BUS_SIZE must be a power of two");
+struct BusMsg
+{
+    GatewayCommand cmd;
+    uint32_t token;    // != 0: caller waits in busCall() for the result
+    uint32_t postedUs; // µs clock at post, for queue latency
+    char text[NODE_LABEL_LEN];
+};
+struct BusCell
+{
+    std::atomic<uint32_t> seq; // == pos: free for producer, pos + 1: full
+    BusMsg msg;
+};
+struct BusRing
+{
+    BusCell cells[BUS_SIZE];
+    std::atomic<uint32_t> tail; // next cell to claim (producers)
+    uint32_t head;              // next cell to read (owner)
+};
+// ---------------- Reset (before any producer) -----
+inline void busRingInit(BusRing &r)
+{
+    for (uint32_t i = 0; i < BUS_SIZE; i++)
+        r.cells[i].seq.store(i, std::memory_order_relaxed);
+    r.tail.store(0, std::memory_order_relaxed);
+    r.head = 0;
+}
+// ---------------- Post (any thread) ---------------
+// False when the ring is full. postedUs is stamped with nowUs.
+inline bool busRingPost(BusRing &r, const BusMsg &m, uint32_t nowUs)
+{
+    uint32_t pos = r.tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        BusCell &c = r.cells[pos & (BUS_SIZE - 1)];
+        int32_t dif = (int32_t)(c.seq.load(std::memory_order_acquire) - pos);
+        if (dif == 0)
+        {
+            if (r.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                c.msg = m;
+                c.msg.postedUs = nowUs;
+                c.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+            // lost the race, pos now holds the current tail
+        }
+        else if (dif < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = r.tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+// ---------------- Take (owner only) ---------------
+inline bool busRingTake(BusRing &r, BusMsg &out)
+{
+    BusCell &c = r.cells[r.head & (BUS_SIZE - 1)];
+    if ((int32_t)(c.seq.load(std::memory_order_acquire) - (r.head + 1)) < 0)
+        return false; // empty, or the next producer has not finished
+    out = c.msg;
+    c.seq.store(r.head + BUS_SIZE, std::memory_order_release);
+    r.head++;
+    return true;
+}
+// Messages posted and not yet taken, counting the one just taken; owner.
+inline uint32_t busRingDepth(const BusRing &r)
+{
+    return r.tail.load(std::memory_order_relaxed) - r.head + 1;
+}
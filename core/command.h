@@ -0,0 +1,352 @@
+// ================ Commands =========================
+// The command model every producer (HTTP, MQTT, buttons, schedules,
+// rules) hands to the state owner, and the MQTT topic parser. Portable:
+// no Arduino headers.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "protocol.h"
+
+#define CMD_ID_ALL 0xFFFF
+enum CmdTarget : uint8_t
+{
+    CMD_LOCAL_RELAY,
+    CMD_NODE,
+    CMD_GROUP,
+    CMD_SCENE,       // id = scene id, action ignored
+    CMD_NODE_ADD,    // probe node <id> over LoRa, add it if it answers
+    CMD_NODE_REMOVE, // id
+    CMD_NODE_EDIT,   // id -> value (new id), label in BusMsg.text
+    CMD_CONFIG,      // id = CFG_* bits that changed
+    CMD_GROUP_SYNC,  // group membership edited: resend every node's mask
+    CMD_NODE_MODE    // id, value 1 = class-A (downlinks after uplinks)
+};
+enum CmdAction : uint8_t
+{
+    ACT_OFF,
+    ACT_ON,
+    ACT_TOGGLE,
+    ACT_DIM,
+    ACT_FADE // nodes only: value = level, fadeMs, curve
+};
+enum CmdSource : uint8_t
+{
+    CMD_SRC_MQTT,
+    CMD_SRC_HTTP,
+    CMD_SRC_BUTTON,
+    CMD_SRC_SYSTEM,
+    CMD_SRC_SCHEDULE,
+    CMD_SRC_RULE
+};
+enum CmdPriority : uint8_t
+{
+    PRIO_DEFAULT, // derived from the source, see cmdPriority()
+    PRIO_LOW,
+    PRIO_NORMAL,
+    PRIO_HIGH,
+    PRIO_MANUAL
+};
+struct GatewayCommand
+{
+    uint8_t target;   // CmdTarget
+    uint8_t action;   // CmdAction
+    uint8_t source;   // CmdSource
+    uint16_t id;      // relay channel, node id or group id
+    int16_t value;    // dimming level for ACT_DIM and ACT_FADE
+    uint8_t priority; // CmdPriority
+    uint8_t curve;    // FadeCurve, ACT_FADE
+    uint16_t fadeMs;  // ACT_FADE duration
+};
+// ---------------- Effective priority --------------
+// An explicit priority wins; otherwise a person at the device outranks
+// the portal, which outranks remote systems and automation.
+inline uint8_t cmdPriority(const GatewayCommand &cmd)
+{
+    if (cmd.priority != PRIO_DEFAULT)
+        return cmd.priority;
+    switch (cmd.source)
+    {
+    case CMD_SRC_BUTTON:
+        return PRIO_MANUAL;
+    case CMD_SRC_HTTP:
+        return PRIO_HIGH;
+    case CMD_SRC_MQTT:
+        return PRIO_NORMAL;
+    }
+    return PRIO_LOW;
+}
+// ---------------- Stored command check -----------
+// Schedules and rules keep target, id and action in flash and index name
+// tables with them; true if the owner can run the triple. Same id ranges
+// as the MQTT parser below.
+inline bool cmdStoredValid(uint8_t target, uint16_t id, uint8_t action)
+{
+    if (action > ACT_DIM)
+        return false;
+    switch (target)
+    {
+    case CMD_LOCAL_RELAY:
+        return id <= 3 || id == CMD_ID_ALL;
+    case CMD_NODE:
+        return id >= 1 && id <= NODE_SLOTS;
+    case CMD_GROUP:
+        return id <= 255; // 0 = every node
+    case CMD_SCENE:
+        return id >= 1 && id <= 255;
+    }
+    return false;
+}
+// Portal and JSON names of the stored targets and actions, by value.
+static const char *const cmdTargetNames[4] = {"relay", "node", "group", "scene"};
+static const char *const cmdActionNames[4] = {"off", "on", "toggle", "dim"};
+// ---------------- MQTT command parser ----------
+// Topics under gateway/<id>/cmd/ (payload in brackets):
+//   relay/<ch>              [on|off|toggle]  ch 0..3 or "all"
+//   node/<nid>/relay        [on|off|toggle]
+//   node/<nid>/dim          [0..255]
+//   node/<nid>/fade         [level[,ms[,linear|ease|square]]]  node-side ramp
+//   group/<gid>/relay|dim   as above, gid "all" (0) = every node
+//   scene/<sid>             [activate|on|1]
+//   batch                   [<path>=<value>;<path>=<value>...]
+// The legacy esp32/relay/cmd topic (all_on, all_off, <ch>) still works.
+// Parsing reads the PubSubClient buffer in place: no terminator is
+// written and nothing is allocated.
+struct Slice
+{
+    const char *p;
+    int n;
+};
+static inline bool sliceEq(Slice s, const char *lit)
+{
+    int i = 0;
+    for (; i < s.n; i++)
+        if (lit[i] == '\0' || lit[i] != s.p[i])
+            return false;
+    return lit[i] == '\0';
+}
+static inline bool isSpaceChar(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+static inline Slice sliceTrim(Slice s)
+{
+    while (s.n && isSpaceChar(s.p[0]))
+    {
+        s.p++;
+        s.n--;
+    }
+    while (s.n && isSpaceChar(s.p[s.n - 1]))
+        s.n--;
+    return s;
+}
+// ---------------- Split off next token ------------
+static inline Slice sliceNext(Slice &rest, const char *seps)
+{
+    Slice head = {rest.p, 0};
+    while (head.n < rest.n && !strchr(seps, rest.p[head.n]))
+        head.n++;
+    int used = head.n < rest.n ? head.n + 1 : head.n;
+    rest.p += used;
+    rest.n -= used;
+    return head;
+}
+// ---------------- Bounded decimal -----------------
+static inline bool sliceToInt(Slice s, long lo, long hi, long &out)
+{
+    if (s.n == 0 || s.n > 6)
+        return false;
+    long v = 0;
+    for (int i = 0; i < s.n; i++)
+    {
+        char c = s.p[i];
+        if (c < '0' || c > '9')
+            return false;
+        v = v * 10 + (c - '0');
+    }
+    if (v < lo || v > hi)
+        return false;
+    out = v;
+    return true;
+}
+// ---------------- Parse action value --------------
+static inline bool parseAction(Slice value, bool dim, GatewayCommand &cmd)
+{
+    value = sliceTrim(value);
+    if (dim)
+    {
+        long v;
+        if (!sliceToInt(value, 0, 255, v))
+            return false;
+        cmd.action = ACT_DIM;
+        cmd.value = (int16_t)v;
+        return true;
+    }
+    if (sliceEq(value, "on") || sliceEq(value, "1") || sliceEq(value, "true"))
+        cmd.action = ACT_ON;
+    else if (sliceEq(value, "off") || sliceEq(value, "0") || sliceEq(value, "false"))
+        cmd.action = ACT_OFF;
+    else if (sliceEq(value, "toggle"))
+        cmd.action = ACT_TOGGLE;
+    else
+        return false;
+    cmd.value = 0;
+    return true;
+}
+// ---------------- Parse fade value ----------------
+// "level[,ms[,curve]]", e.g. "200,1500,ease"
+static inline bool parseFade(Slice value, GatewayCommand &cmd)
+{
+    Slice rest = sliceTrim(value);
+    Slice level = sliceTrim(sliceNext(rest, ","));
+    Slice ms = sliceTrim(sliceNext(rest, ","));
+    Slice curve = sliceTrim(rest);
+    long v, d = FADE_DEFAULT_MS;
+    if (!sliceToInt(level, 0, 255, v) || (ms.n && !sliceToInt(ms, 0, FADE_MAX_MS, d)))
+        return false;
+    int c = curve.n ? -1 : FADE_LINEAR;
+    for (int i = 0; i < FADE_CURVES; i++)
+        if (sliceEq(curve, fadeCurveNames[i]))
+            c = i;
+    if (c < 0)
+        return false;
+    cmd.action = ACT_FADE;
+    cmd.value = (int16_t)v;
+    cmd.fadeMs = (uint16_t)d;
+    cmd.curve = (uint8_t)c;
+    return true;
+}
+// ---------------- Parse one command path ----------
+inline bool parseCommandPath(Slice path, Slice value, GatewayCommand &cmd)
+{
+    Slice rest = sliceTrim(path);
+    Slice kind = sliceNext(rest, "/");
+    Slice id = sliceNext(rest, "/");
+    long v;
+
+    if (sliceEq(kind, "relay"))
+    {
+        if (rest.n != 0)
+            return false;
+        cmd.target = CMD_LOCAL_RELAY;
+        if (sliceEq(id, "all"))
+            cmd.id = CMD_ID_ALL;
+        else if (sliceToInt(id, 0, 3, v))
+            cmd.id = (uint16_t)v;
+        else
+            return false;
+        return parseAction(value, false, cmd);
+    }
+
+    if (sliceEq(kind, "scene"))
+    {
+        Slice act = sliceTrim(value);
+        if (rest.n != 0 || !sliceToInt(id, 1, 255, v))
+            return false;
+        if (!sliceEq(act, "activate") && !sliceEq(act, "on") && !sliceEq(act, "1"))
+            return false;
+        cmd.target = CMD_SCENE;
+        cmd.action = ACT_ON;
+        cmd.id = (uint16_t)v;
+        cmd.value = 0;
+        return true;
+    }
+
+    if (sliceEq(kind, "node"))
+    {
+        if (!sliceToInt(id, 1, NODE_SLOTS, v))
+            return false;
+        cmd.target = CMD_NODE;
+    }
+    else if (sliceEq(kind, "group"))
+    {
+        if (sliceEq(id, "all"))
+            v = 0;
+        else if (!sliceToInt(id, 0, 255, v))
+            return false;
+        cmd.target = CMD_GROUP;
+    }
+    else
+    {
+        return false;
+    }
+    cmd.id = (uint16_t)v;
+
+    Slice leaf = sliceNext(rest, "/");
+    if (rest.n != 0)
+        return false;
+    if (sliceEq(leaf, "relay"))
+        return parseAction(value, false, cmd);
+    if (sliceEq(leaf, "dim"))
+        return parseAction(value, true, cmd);
+    if (sliceEq(leaf, "fade") && cmd.target == CMD_NODE)
+        return parseFade(value, cmd);
+    return false;
+}
+// ---------------- Parse one MQTT message ----------
+// Fills out[] and returns the command count, or -1 if anything in the
+// message is invalid (batches are all-or-nothing). prefix is the
+// "gateway/<id>/cmd/" the topic must start with. Every command is
+// zeroed before it is filled, so fields a path does not set (priority,
+// fade) read as defaults whatever the caller's buffer held.
+inline int parseCommandMessage(const char *prefix, const char *topic, const uint8_t *payload, unsigned int length,
+                               GatewayCommand *out, int max)
+{
+    Slice body = {(const char *)payload, (int)length};
+    size_t plen = strlen(prefix);
+
+    if (max < 1)
+        return -1;
+    if (strcmp(topic, "esp32/relay/cmd") == 0)
+    {
+        body = sliceTrim(body);
+        memset(&out[0], 0, sizeof(out[0]));
+        out[0].source = CMD_SRC_MQTT;
+        out[0].target = CMD_LOCAL_RELAY;
+        out[0].value = 0;
+        long ch;
+        if (sliceEq(body, "all_on") || sliceEq(body, "all_off"))
+        {
+            out[0].id = CMD_ID_ALL;
+            out[0].action = sliceEq(body, "all_on") ? ACT_ON : ACT_OFF;
+        }
+        else if (sliceToInt(body, 0, 3, ch))
+        {
+            out[0].id = (uint16_t)ch;
+            out[0].action = ACT_TOGGLE;
+        }
+        else
+        {
+            return -1;
+        }
+        return 1;
+    }
+
+    if (plen == 0 || strncmp(topic, prefix, plen) != 0)
+        return -1;
+    Slice sub = {topic + plen, (int)strlen(topic + plen)};
+
+    if (!sliceEq(sub, "batch"))
+    {
+        memset(&out[0], 0, sizeof(out[0]));
+        out[0].source = CMD_SRC_MQTT;
+        return parseCommandPath(sub, body, out[0]) ? 1 : -1;
+    }
+
+    int count = 0;
+    while (body.n > 0)
+    {
+        Slice item = sliceTrim(sliceNext(body, ";\n"));
+        if (item.n == 0)
+            continue;
+        if (count >= max)
+            return -1;
+        Slice value = item;
+        Slice path = sliceNext(value, "=");
+        memset(&out[count], 0, sizeof(out[count]));
+        out[count].source = CMD_SRC_MQTT;
+        if (!parseCommandPath(path, value, out[count]))
+            return -1;
+        count++;
+    }
+    return count;
+}
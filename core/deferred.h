@@ -0,0 +1,33 @@
+// ================ Deferred flash writes ============
+// A burst of edits is written once, after changes have stopped for a
+// quiet period, instead of wearing the flash on every slider step. The
+// caller marks each change and asks how long is left. Portable: no
+// Arduino headers, time is passed in.
+#pragma once
+#include <stdint.h>
+
+#define DEFER_NONE 0xFFFFFFFFUL // nothing pending
+struct Deferred
+{
+    bool pending;
+    uint32_t since; // ms of the last change
+};
+// ---------------- Mark a change -------------------
+inline void deferMark(Deferred &d, uint32_t now)
+{
+    d.pending = true;
+    d.since = now;
+}
+// ---------------- Time left -----------------------
+// 0: write now (then deferDone()); DEFER_NONE if nothing is pending.
+inline uint32_t deferWait(const Deferred &d, uint32_t now, uint32_t quietMs)
+{
+    if (!d.pending)
+        return DEFER_NONE;
+    uint32_t age = now - d.since;
+    return age >= quietMs ? 0 : quietMs - age;
+}
+inline void deferDone(Deferred &d)
+{
+    d.pending = false;
+}
@@ -0,0 +1,53 @@
+// ================ Display compositor ===============
+// Frames are drawn whole into the panel buffer (cheap, in RAM); only the
+// 8x8 tiles that differ from what the panel already shows are sent,
+// which keeps the shared I2C bus free. Portable: no Arduino headers.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "hal.h"
+
+#define OLED_TILES_X 16 // 128 px
+#define OLED_TILES_Y 8  // 64 px
+#define OLED_BUF_SIZE (OLED_TILES_X * OLED_TILES_Y * 8)
+// ---------------- Send changed tiles --------------
+// The buffer is one 128-byte page per tile row, 8 bytes per tile. Each
+// row sends the span from its first to its last changed tile in one
+// sendTiles() call (one addressing sequence per row). shadow holds what
+// the panel shows; !*valid sends the whole frame. Returns tiles sent.
+inline int displaySendChanged(DisplayHal &d, uint8_t *shadow, bool *valid)
+{
+    const uint8_t *buf = d.frame();
+    int tiles = 0;
+    if (!*valid)
+    {
+        d.sendAll();
+        tiles = OLED_TILES_X * OLED_TILES_Y;
+        *valid = true;
+    }
+    else
+    {
+        for (int ty = 0; ty < OLED_TILES_Y; ty++)
+        {
+            int first = -1, last = -1;
+            for (int tx = 0; tx < OLED_TILES_X; tx++)
+            {
+                int off = (ty * OLED_TILES_X + tx) * 8;
+                if (memcmp(buf + off, shadow + off, 8) != 0)
+                {
+                    if (first < 0)
+                        first = tx;
+                    last = tx;
+                }
+            }
+            if (first >= 0)
+            {
+                d.sendTiles(first, ty, last - first + 1, 1);
+                tiles += last - first + 1;
+            }
+        }
+    }
+    if (tiles)
+        memcpy(shadow, buf, OLED_BUF_SIZE);
+    return tiles;
+}
@@ -0,0 +1,121 @@
+// ================ Groups and scenes ================
+// A group is a named set of node ids, a scene a stored relay/dim preset
+// for a set of nodes. Both go out as one extended LoRa frame that every
+// member acts on (core/protocol.h), instead of a frame per node. Tables,
+// membership and their NVS blobs; locking and execution are the
+// caller's. Portable: no Arduino headers.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "hal.h"
+#include "protocol.h"
+
+#define GROUP_MAX 16 // group ids 1..GROUP_MAX; 0 = every node
+#define SCENE_MAX 16
+#define GROUP_NAME_LEN 16
+struct NodeGroup
+{
+    uint8_t id; // 0 = free
+    char name[GROUP_NAME_LEN];
+    uint8_t members[(NODE_SLOTS + 7) / 8]; // bit (node id - 1)
+};
+struct SceneEntry
+{
+    uint8_t node;
+    uint8_t relay;
+    uint8_t dim;
+};
+struct Scene
+{
+    uint8_t id; // 0 = free
+    char name[GROUP_NAME_LEN];
+    uint8_t count;
+    SceneEntry entries[NODE_SLOTS];
+};
+// ---------------- Membership ----------------------
+inline bool groupHas(const NodeGroup &g, int id)
+{
+    return id >= 1 && id <= NODE_SLOTS && (g.members[(id - 1) / 8] & (1u << ((id - 1) % 8)));
+}
+inline void groupAdd(NodeGroup &g, int id)
+{
+    if (id >= 1 && id <= NODE_SLOTS)
+        g.members[(id - 1) / 8] |= 1u << ((id - 1) % 8);
+}
+// The JOIN frame mask for node nid: bit (group id - 1).
+inline uint16_t groupJoinMask(const NodeGroup *groups, int nid)
+{
+    uint16_t mask = 0;
+    for (int i = 0; i < GROUP_MAX; i++)
+        if (groups[i].id && groupHas(groups[i], nid))
+            mask |= 1u << (groups[i].id - 1);
+    return mask;
+}
+// ---------------- Slot by id, or a free one -------
+template <typename T>
+inline T *groupSlot(T *table, int n, int id)
+{
+    T *freeSlot = NULL;
+    for (int i = 0; i < n; i++)
+    {
+        if (table[i].id == id)
+            return &table[i];
+        if (!table[i].id && !freeSlot)
+            freeSlot = &table[i];
+    }
+    return freeSlot;
+}
+// ---------------- Record checks -------------------
+// What a group or scene must look like to be executed; the NVS blobs
+// are trusted for nothing.
+inline bool groupValid(const NodeGroup &g)
+{
+    if (g.id > GROUP_MAX || memchr(g.name, 0, sizeof(g.name)) == NULL)
+        return false;
+    for (int id = NODE_SLOTS + 1; id <= (int)sizeof(g.members) * 8; id++)
+        if (g.members[(id - 1) / 8] & (1u << ((id - 1) % 8)))
+            return false;
+    return true;
+}
+inline bool sceneValid(const Scene &sc)
+{
+    if (memchr(sc.name, 0, sizeof(sc.name)) == NULL || sc.count > NODE_SLOTS)
+        return false;
+    for (int i = 0; i < sc.count; i++)
+        if (sc.entries[i].node < 1 || sc.entries[i].node > NODE_SLOTS || sc.entries[i].relay > 1)
+            return false;
+    return true;
+}
+// ---------------- Persist -------------------------
+// Both tables whole, namespace "groups". Returns the records dropped on
+// load; a missing or resized blob leaves that table empty.
+inline int groupsLoad(StorageHal &s, NodeGroup *groups, Scene *scenes)
+{
+    int dropped = 0;
+    if (!s.load("groups", "g", groups, sizeof(NodeGroup) * GROUP_MAX))
+        memset(groups, 0, sizeof(NodeGroup) * GROUP_MAX);
+    if (!s.load("groups", "s", scenes, sizeof(Scene) * SCENE_MAX))
+        memset(scenes, 0, sizeof(Scene) * SCENE_MAX);
+    for (int i = 0; i < GROUP_MAX; i++)
+    {
+        if (groups[i].id && !groupValid(groups[i]))
+        {
+            memset(&groups[i], 0, sizeof(groups[i]));
+            dropped++;
+        }
+    }
+    for (int i = 0; i < SCENE_MAX; i++)
+    {
+        if (scenes[i].id && !sceneValid(scenes[i]))
+        {
+            memset(&scenes[i], 0, sizeof(scenes[i]));
+            dropped++;
+        }
+    }
+    return dropped;
+}
+inline bool groupsSave(StorageHal &s, const NodeGroup *groups, const Scene *scenes)
+{
+    bool g = s.save("groups", "g", groups, sizeof(NodeGroup) * GROUP_MAX);
+    return s.save("groups", "s", scenes, sizeof(Scene) * SCENE_MAX) && g;
+}
@@ -0,0 +1,58 @@
+// ================ Hardware abstraction =============
+// The few board services the gateway logic needs. main.cpp implements
+// them on the ESP32 (HAL section); the host build (CMakeLists.txt) links
+// the fakes in host/ instead, so the core can run and be profiled off
+// target.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// ---------------- Radio --------------------------
+struct RadioHal
+{
+    // One frame, blocking until it is on air; back in receive afterwards.
+    virtual void send(const uint8_t *buf, int len) = 0;
+    // A frame has arrived (DIO0 high) and not been read yet.
+    virtual bool rxPending() = 0;
+    // Reads the waiting frame into buf (truncated to max) and returns its
+    // full length, 0 if none.
+    virtual int receive(uint8_t *buf, int max) = 0;
+};
+// ---------------- Storage ------------------------
+// Named blobs grouped by namespace; a blob of the wrong size reads as
+// missing (0). Tables too big for a blob (schedules, rules) are files,
+// read at any offset and written front to back.
+struct StorageHal
+{
+    virtual size_t load(const char *ns, const char *key, void *buf, size_t len) = 0;
+    virtual bool save(const char *ns, const char *key, const void *buf, size_t len) = 0;
+    // Up to len bytes from pos; short at the end, 0 if there is no file.
+    virtual size_t readFile(const char *path, uint32_t pos, void *buf, size_t len) = 0;
+    // pos 0 starts the file over; any other pos must be its current end.
+    virtual bool writeFile(const char *path, uint32_t pos, const void *buf, size_t len) = 0;
+};
+// ---------------- Clock --------------------------
+struct ClockHal
+{
+    virtual uint32_t ms() = 0;     // monotonic, wraps
+    virtual uint64_t unixMs() = 0; // wall clock, 0 = not set
+};
+// ---------------- GPIO ---------------------------
+struct GpioHal
+{
+    virtual void write(int pin, bool high) = 0;
+    virtual bool read(int pin) = 0;
+    virtual void pwm(int channel, uint32_t duty) = 0; // raw duty at the channel's resolution
+};
+// ---------------- Display ------------------------
+// A 1-bit panel addressed in 8x8 tiles. The frame is drawn by the
+// caller (u8g2 on the board); the HAL only owns the buffer and moves
+// tiles to the glass.
+struct DisplayHal
+{
+    // tilesX * tilesY * 8 bytes, one byte per tile column, row-major tiles
+    virtual uint8_t *frame() = 0;
+    virtual void sendAll() = 0;
+    virtual void sendTiles(int tx, int ty, int tw, int th) = 0;
+    virtual void rotate(bool flipped) = 0;
+};
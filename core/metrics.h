@@ -0,0 +1,110 @@
+// ================ Metrics text =====================
+// Prometheus text exposition into a caller's buffer: one "# TYPE" line
+// per family, "gw_"-prefixed names, integer or 3-decimal samples. Also
+// the event -> action latency per wake-up path, which one task writes
+// and the status and metrics readers copy under its seqlock. Portable:
+// no Arduino headers.
+#pragma once
+#include <atomic>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "seqlock.h"
+
+struct TextOut
+{
+    char *buf;
+    size_t cap;
+    size_t len;
+};
+// ---------------- Append --------------------------
+inline void textf(TextOut &t, const char *fmt, ...)
+{
+    if (t.len >= t.cap)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(t.buf + t.len, t.cap - t.len, fmt, ap);
+    va_end(ap);
+    t.len = n < 0 ? t.cap : t.len + n; // len >= cap marks overflow
+}
+// ---------------- Families and samples ------------
+inline void metricType(TextOut &t, const char *name, const char *type)
+{
+    textf(t, "# TYPE gw_%s %s\n", name, type);
+}
+inline void metricU(TextOut &t, const char *name, const char *labels, uint64_t v)
+{
+    textf(t, labels ? "gw_%s{%s} %llu\n" : "gw_%s%s %llu\n", name, labels ? labels : "", (unsigned long long)v);
+}
+inline void metricF(TextOut &t, const char *name, const char *labels, float v)
+{
+    textf(t, labels ? "gw_%s{%s} %.3f\n" : "gw_%s%s %.3f\n", name, labels ? labels : "", v);
+}
+// one-sample families
+inline void gauge(TextOut &t, const char *name, uint64_t v)
+{
+    metricType(t, name, "gauge");
+    metricU(t, name, NULL, v);
+}
+inline void counter(TextOut &t, const char *name, uint64_t v)
+{
+    metricType(t, name, "counter");
+    metricU(t, name, NULL, v);
+}
+// ================ Wake-up latency ==================
+struct WakeStats // written by the woken task only
+{
+    const char *name;
+    uint32_t events;
+    uint32_t latMaxUs;
+    uint64_t latTotalUs;
+};
+// ---------------- Record (the path's task) --------
+// Updated in place inside its own seqlock window.
+inline void wakeAdd(WakeStats &w, std::atomic<uint32_t> &seq, uint32_t latUs)
+{
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    w.events++;
+    w.latTotalUs += latUs;
+    if (latUs > w.latMaxUs)
+        w.latMaxUs = latUs;
+    seq.store(s + 2, std::memory_order_release);
+}
+// ---------------- Copy for a reader ---------------
+// Returns the seqlock retries, see seqCopy().
+inline uint32_t wakeSnapshot(WakeStats *out, const WakeStats *live, const std::atomic<uint32_t> *seq, int n,
+                             void (*yield)())
+{
+    uint32_t retries = 0;
+    for (int i = 0; i < n; i++)
+        retries += seqCopy(seq[i], &out[i], &live[i], sizeof(out[i]), yield);
+    return retries;
+}
+// ---------------- Render --------------------------
+// rate(wake_latency_us_total) / rate(wake_events_total) is the mean.
+inline void metricsWake(TextOut &t, const WakeStats *w, int n)
+{
+    char lbl[32];
+    metricType(t, "wake_events_total", "counter");
+    for (int i = 0; i < n; i++)
+    {
+        snprintf(lbl, sizeof(lbl), "path=\"%s\"", w[i].name);
+        metricU(t, "wake_events_total", lbl, w[i].events);
+    }
+    metricType(t, "wake_latency_us_total", "counter");
+    for (int i = 0; i < n; i++)
+    {
+        snprintf(lbl, sizeof(lbl), "path=\"%s\"", w[i].name);
+        metricU(t, "wake_latency_us_total", lbl, w[i].latTotalUs);
+    }
+    metricType(t, "wake_latency_max_us", "gauge");
+    for (int i = 0; i < n; i++)
+    {
+        snprintf(lbl, sizeof(lbl), "path=\"%s\"", w[i].name);
+        metricU(t, "wake_latency_max_us", lbl, w[i].latMaxUs);
+    }
+}
@@ -0,0 +1,252 @@
+// ================ MQTT outbox ======================
+// Telemetry produced while the broker is unreachable goes into a ring
+// file and is drained after reconnect. Record layout, all little-endian:
+//   [0] magic 0xB5   [1] flags   [2] topic len   [3] reserved
+//   [4..5] payload len   [6..7] CRC-16/CCITT of topic+payload
+//   [8..11] unix time queued   [12..] topic, payload
+// A record never straddles the end of the file; 0xB6 (or too little
+// room for a header) means "continue at offset 0". The ring pointers
+// (OutboxMeta) are saved apart from the file: a record is written after
+// the pointers that stop covering what it overwrites and before the ones
+// that cover it, so a power cut loses at most the record being written
+// and may resend what the last drain burst sent. Portable: no Arduino
+// headers, storage is reached through OutboxStore.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define OUTBOX_CAPACITY (64UL * 1024)
+#define OUTBOX_META_MAGIC 0x4F425831UL // "OBX1"
+#define OUTBOX_MAGIC 0xB5
+#define OUTBOX_WRAP 0xB6
+#define OUTBOX_HDR_SIZE 12
+#define OUTBOX_MAX_TOPIC 96
+#define OUTBOX_MAX_PAYLOAD 256
+#define OUTBOX_FLAG_RETAIN 0x01
+struct OutboxHeader
+{
+    uint8_t flags;
+    uint8_t topicLen;
+    uint16_t payloadLen;
+    uint16_t crc;
+    uint32_t ts;
+};
+struct OutboxMeta // ring pointers, see OutboxStore::saveMeta
+{
+    uint32_t magic;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t count;
+    uint32_t bytes;
+};
+struct OutboxStats
+{
+    uint32_t enqueued;
+    uint32_t drained;
+    uint32_t dropped;
+    uint32_t corrupt;
+    uint32_t drainRate; // msg/s over the last second
+};
+// The open ring file, OUTBOX_CAPACITY bytes addressed from 0, and where
+// its pointers are kept.
+struct OutboxStore
+{
+    virtual bool read(uint32_t pos, uint8_t *buf, uint32_t len) = 0;
+    virtual bool write(uint32_t pos, const uint8_t *buf, uint32_t len) = 0;
+    virtual void saveMeta(const OutboxMeta &m) = 0;
+};
+// ---------------- CRC-16/CCITT --------------------
+inline uint16_t crc16Ccitt(const uint8_t *data, size_t len, uint16_t crc)
+{
+    while (len--)
+    {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+// ---------------- Record header codec -------------
+inline void outboxEncodeHeader(uint8_t *dst, const OutboxHeader &h)
+{
+    dst[0] = OUTBOX_MAGIC;
+    dst[1] = h.flags;
+    dst[2] = h.topicLen;
+    dst[3] = 0;
+    dst[4] = h.payloadLen & 0xFF;
+    dst[5] = h.payloadLen >> 8;
+    dst[6] = h.crc & 0xFF;
+    dst[7] = h.crc >> 8;
+    for (int i = 0; i < 4; i++)
+        dst[8 + i] = (h.ts >> (8 * i)) & 0xFF;
+}
+inline bool outboxDecodeHeader(const uint8_t *src, OutboxHeader &h)
+{
+    if (src[0] != OUTBOX_MAGIC)
+        return false;
+    h.flags = src[1];
+    h.topicLen = src[2];
+    h.payloadLen = src[4] | (src[5] << 8);
+    h.crc = src[6] | (src[7] << 8);
+    h.ts = 0;
+    for (int i = 0; i < 4; i++)
+        h.ts |= (uint32_t)src[8 + i] << (8 * i);
+    return h.topicLen > 0 && h.topicLen <= OUTBOX_MAX_TOPIC && h.payloadLen <= OUTBOX_MAX_PAYLOAD;
+}
+// ---------------- Ring pointers -------------------
+inline void outboxReset(OutboxMeta &m)
+{
+    m.magic = OUTBOX_META_MAGIC;
+    m.head = 0;
+    m.tail = 0;
+    m.count = 0;
+    m.bytes = 0;
+}
+// Pointers read back at boot; anything else starts an empty ring.
+inline bool outboxMetaValid(const OutboxMeta &m)
+{
+    return m.magic == OUTBOX_META_MAGIC && m.head < OUTBOX_CAPACITY && m.tail <= OUTBOX_CAPACITY &&
+           m.bytes <= OUTBOX_CAPACITY && (m.count != 0 || m.bytes == 0);
+}
+// ---------------- Read header at head -------------
+// Skips a wrap marker and leaves m.head on the record it returns.
+inline bool outboxHeadHeader(OutboxStore &f, OutboxMeta &m, OutboxHeader &h)
+{
+    uint8_t hdr[OUTBOX_HDR_SIZE];
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (OUTBOX_CAPACITY - m.head < OUTBOX_HDR_SIZE)
+            m.head = 0;
+        if (!f.read(m.head, hdr, sizeof(hdr)))
+            return false;
+        if (hdr[0] == OUTBOX_WRAP && m.head != 0)
+        {
+            m.head = 0;
+            continue;
+        }
+        return outboxDecodeHeader(hdr, h);
+    }
+    return false;
+}
+// ---------------- Advance head --------------------
+inline void outboxAdvance(OutboxMeta &m, const OutboxHeader &h)
+{
+    uint32_t size = OUTBOX_HDR_SIZE + h.topicLen + h.payloadLen;
+    m.head += size;
+    m.bytes -= size;
+    if (--m.count == 0)
+    {
+        m.head = 0;
+        m.tail = 0;
+        m.bytes = 0;
+    }
+}
+// ---------------- Append (oldest-first drop) ------
+// Saves the pointers itself, see the top of the file.
+inline bool outboxAppend(OutboxStore &f, OutboxMeta &m, OutboxStats &s, const char *topic, const char *payload,
+                         int len, uint8_t flags, uint32_t ts)
+{
+    size_t tl = strlen(topic);
+    if (tl == 0 || tl > OUTBOX_MAX_TOPIC || len < 0 || len > OUTBOX_MAX_PAYLOAD)
+        return false;
+
+    uint32_t need = OUTBOX_HDR_SIZE + tl + len;
+    uint32_t pos = 0;
+    bool wrap = false, dropped = false;
+    for (;;)
+    {
+        wrap = false;
+        if (m.count == 0)
+        {
+            m.head = m.tail = 0;
+            pos = 0;
+            break;
+        }
+        if (m.tail > m.head)
+        {
+            // free space is [tail, end) and [0, head)
+            if (OUTBOX_CAPACITY - m.tail >= need)
+            {
+                pos = m.tail;
+                break;
+            }
+            if (m.head >= need)
+            {
+                pos = 0;
+                wrap = true;
+                break;
+            }
+        }
+        else if (m.head - m.tail >= need)
+        {
+            pos = m.tail;
+            break;
+        }
+        // full: drop the oldest record and try again
+        OutboxHeader old;
+        if (!outboxHeadHeader(f, m, old))
+        {
+            s.corrupt++;
+            outboxReset(m);
+            dropped = true;
+            continue;
+        }
+        outboxAdvance(m, old);
+        s.dropped++;
+        dropped = true;
+    }
+    if (dropped)
+        f.saveMeta(m); // the new record may overwrite what was dropped
+
+    if (wrap && OUTBOX_CAPACITY - m.tail >= OUTBOX_HDR_SIZE)
+    {
+        // a full header-sized block, so the reader never hits a short read
+        uint8_t marker[OUTBOX_HDR_SIZE] = {OUTBOX_WRAP};
+        f.write(m.tail, marker, sizeof(marker));
+    }
+
+    uint8_t rec[OUTBOX_HDR_SIZE + OUTBOX_MAX_TOPIC + OUTBOX_MAX_PAYLOAD];
+    OutboxHeader h;
+    h.flags = flags;
+    h.topicLen = tl;
+    h.payloadLen = len;
+    h.ts = ts;
+    memcpy(rec + OUTBOX_HDR_SIZE, topic, tl);
+    memcpy(rec + OUTBOX_HDR_SIZE + tl, payload, len);
+    h.crc = crc16Ccitt(rec + OUTBOX_HDR_SIZE, tl + len, 0xFFFF);
+    outboxEncodeHeader(rec, h);
+    if (!f.write(pos, rec, need))
+        return false;
+
+    m.tail = pos + need;
+    m.count++;
+    m.bytes += need;
+    s.enqueued++;
+    f.saveMeta(m);
+    return true;
+}
+// ---------------- Read the oldest record ----------
+// 1: topic (terminated) and payload filled, h describes them; the record
+// stays queued until outboxAdvance(). 0: its CRC failed, it has been
+// skipped. -1: the ring is unreadable and has been reset.
+inline int outboxPeek(OutboxStore &f, OutboxMeta &m, OutboxStats &s, OutboxHeader &h,
+                      char *topic, uint8_t *payload)
+{
+    if (!outboxHeadHeader(f, m, h))
+    {
+        s.corrupt++;
+        outboxReset(m);
+        return -1;
+    }
+    uint32_t at = m.head + OUTBOX_HDR_SIZE;
+    bool ok = f.read(at, (uint8_t *)topic, h.topicLen) && f.read(at + h.topicLen, payload, h.payloadLen);
+    topic[h.topicLen] = '\0';
+    uint16_t crc = crc16Ccitt((const uint8_t *)topic, h.topicLen, 0xFFFF);
+    crc = crc16Ccitt(payload, h.payloadLen, crc);
+    if (ok && crc == h.crc)
+        return 1;
+    s.corrupt++;
+    outboxAdvance(m, h);
+    return 0;
+}
@@ -0,0 +1,259 @@
+// ================ Payload encoders =================
+// One writer, two wire formats. Schema functions describe each message
+// once; the same calls produce JSON text or CBOR (RFC 8949,
+// indefinite-length containers) directly in the caller's buffer. The
+// status document, which reads gateway globals, stays in main.cpp.
+// Portable: no Arduino headers.
+#pragma once
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+struct PayloadWriter
+{
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    bool cbor;
+    bool overflow;
+    bool first;    // JSON: next value opens its container
+    bool afterKey; // JSON: next value follows a key
+    PayloadWriter(uint8_t *b, size_t c, bool asCbor);
+    void beginMap();
+    void endMap();
+    void beginArray();
+    void endArray();
+    void key(const char *k);
+    void num(int64_t v);
+    void real(float v, int decimals);
+    void boolean(bool v);
+    void str(const char *s);
+    int size() const { return overflow ? -1 : (int)len; }
+
+private:
+    void put(const void *data, size_t n);
+    void putByte(uint8_t b);
+    void head(uint8_t major, uint64_t v);
+    void jsonValue();
+};
+inline PayloadWriter::PayloadWriter(uint8_t *b, size_t c, bool asCbor)
+    : buf(b), cap(c), len(0), cbor(asCbor), overflow(false), first(true), afterKey(false)
+{
+    if (!cbor && cap)
+        buf[0] = '\0';
+}
+inline void PayloadWriter::put(const void *data, size_t n)
+{
+    // JSON output stays NUL-terminated, so keep one byte spare
+    if (overflow || len + n + (cbor ? 0 : 1) > cap)
+    {
+        overflow = true;
+        return;
+    }
+    memcpy(buf + len, data, n);
+    len += n;
+    if (!cbor)
+        buf[len] = '\0';
+}
+inline void PayloadWriter::putByte(uint8_t b)
+{
+    put(&b, 1);
+}
+// ---------------- CBOR head (major type + arg) ----
+inline void PayloadWriter::head(uint8_t major, uint64_t v)
+{
+    uint8_t h[9];
+    int n;
+    major <<= 5;
+    if (v < 24)
+    {
+        h[0] = major | v;
+        n = 1;
+    }
+    else if (v <= 0xFF)
+    {
+        h[0] = major | 24;
+        h[1] = v;
+        n = 2;
+    }
+    else if (v <= 0xFFFF)
+    {
+        h[0] = major | 25;
+        h[1] = v >> 8;
+        h[2] = v;
+        n = 3;
+    }
+    else if (v <= 0xFFFFFFFFULL)
+    {
+        h[0] = major | 26;
+        for (int i = 0; i < 4; i++)
+            h[1 + i] = v >> (24 - 8 * i);
+        n = 5;
+    }
+    else
+    {
+        h[0] = major | 27;
+        for (int i = 0; i < 8; i++)
+            h[1 + i] = v >> (56 - 8 * i);
+        n = 9;
+    }
+    put(h, n);
+}
+// ---------------- JSON separator ------------------
+inline void PayloadWriter::jsonValue()
+{
+    if (afterKey)
+        afterKey = false;
+    else if (!first)
+        putByte(',');
+    first = false;
+}
+// ---------------- Containers ----------------------
+inline void PayloadWriter::beginMap()
+{
+    if (cbor)
+        return putByte(0xBF);
+    jsonValue();
+    putByte('{');
+    first = true;
+}
+inline void PayloadWriter::endMap()
+{
+    putByte(cbor ? 0xFF : '}');
+    first = false;
+}
+inline void PayloadWriter::beginArray()
+{
+    if (cbor)
+        return putByte(0x9F);
+    jsonValue();
+    putByte('[');
+    first = true;
+}
+inline void PayloadWriter::endArray()
+{
+    putByte(cbor ? 0xFF : ']');
+    first = false;
+}
+// ---------------- Scalars -------------------------
+inline void PayloadWriter::key(const char *k)
+{
+    str(k);
+    if (!cbor)
+    {
+        putByte(':');
+        afterKey = true;
+    }
+}
+inline void PayloadWriter::num(int64_t v)
+{
+    if (cbor)
+        return v >= 0 ? head(0, v) : head(1, -1 - v);
+    char tmp[24];
+    jsonValue();
+    put(tmp, snprintf(tmp, sizeof(tmp), "%lld", (long long)v));
+}
+inline void PayloadWriter::real(float v, int decimals)
+{
+    if (cbor)
+    {
+        uint32_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        putByte(0xFA);
+        for (int i = 0; i < 4; i++)
+            putByte(bits >> (24 - 8 * i));
+        return;
+    }
+    char tmp[24];
+    jsonValue();
+    if (isnan(v) || isinf(v))
+        put("null", 4);
+    else
+        put(tmp, snprintf(tmp, sizeof(tmp), "%.*f", decimals, v));
+}
+inline void PayloadWriter::boolean(bool v)
+{
+    if (cbor)
+        return putByte(v ? 0xF5 : 0xF4);
+    jsonValue();
+    put(v ? "true" : "false", v ? 4 : 5);
+}
+inline void PayloadWriter::str(const char *s)
+{
+    size_t n = strlen(s);
+    if (cbor)
+    {
+        head(3, n);
+        return put(s, n);
+    }
+    jsonValue();
+    putByte('"');
+    for (size_t i = 0; i < n; i++)
+    {
+        char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            putByte('\\');
+            putByte(c);
+        }
+        else if ((uint8_t)c < 0x20)
+        {
+            char esc[8];
+            put(esc, snprintf(esc, sizeof(esc), "\\u%04x", c));
+        }
+        else
+        {
+            putByte(c);
+        }
+    }
+    putByte('"');
+}
+// ================ Message schemas =================
+inline void schemaGatewayState(PayloadWriter &w, float temp, bool fan, const bool *relays)
+{
+    w.beginMap();
+    w.key("temp");
+    w.real(temp, 1);
+    w.key("fan");
+    w.num(fan ? 1 : 0);
+    w.key("relays");
+    w.beginArray();
+    for (int i = 0; i < 4; i++)
+        w.num(relays[i] ? 1 : 0);
+    w.endArray();
+    w.endMap();
+}
+// ---------------- Node state ----------------------
+inline void schemaNodeState(PayloadWriter &w, int nid, bool relay, int dim, bool connected)
+{
+    w.beginMap();
+    w.key("id");
+    w.num(nid);
+    w.key("relay");
+    w.num(relay ? 1 : 0);
+    w.key("dimming");
+    w.num(dim);
+    w.key("connected");
+    w.num(connected ? 1 : 0);
+    w.endMap();
+}
+// ---------------- Node telemetry ------------------
+// ts is only set on backlog copies from the outbox.
+inline void schemaNodeTelemetry(PayloadWriter &w, int nid, float temperature, int uptime, uint32_t ts)
+{
+    w.beginMap();
+    w.key("id");
+    w.num(nid);
+    w.key("temperature");
+    w.real(temperature, 2);
+    w.key("uptime");
+    w.num(uptime);
+    if (ts)
+    {
+        w.key("ts");
+        w.num(ts);
+    }
+    w.endMap();
+}
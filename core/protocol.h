@@ -0,0 +1,127 @@
+// ================ Radio protocol ===================
+// Frame layouts and codecs shared by the gateway and the nodes. Plain C++,
+// no Arduino headers: builds on the target and on a workstation alike.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#define NODE_SLOTS 10 // radio node ids 1..NODE_SLOTS
+// ---------------- Unicast frames ---------------
+// The wire format is the ESP32 struct layout, 12 bytes each; fixed-width
+// fields keep it the same on a 64-bit host.
+struct LoRaPacket // gateway -> node: full state
+{
+    int32_t id;    // ID node
+    bool data1;    // relay state
+    int32_t data2; // PWM / Slider value
+};
+struct LoRaPacketRec // node -> gateway: telemetry
+{
+    int32_t id;
+    float data1;    // temperature
+    uint32_t data2; // timestamp or uptime
+};
+// ---------------- Extended frames --------------
+// Unicast frames are 12 bytes. Extended frames start with LORA_EXT_MAGIC
+// and are never 12 bytes long:
+//   GROUP  A7 01 seq gid  act dim        act 0 off, 1 on, 3 dim; gid 0 = all
+//   SCENE  A7 02 seq sid  n {node relay dim} x n
+//   JOIN   A7 03 seq nid  maskLo maskHi  the node's groups, bit (gid - 1)
+//   FADE   A7 04 seq nid  level curve msLo msHi   node ramps to level itself
+// seq is stamped when the frame goes out (frameStamp).
+#define LORA_EXT_MAGIC 0xA7
+#define LORA_EXT_GROUP 1
+#define LORA_EXT_SCENE 2
+#define LORA_EXT_JOIN 3
+#define LORA_EXT_FADE 4
+#define LORA_EXT_HDR 4
+#define LORA_SCENE_PER_FRAME 80 // 5 + 3 * 80 bytes
+#define LORA_FRAME_MAX (LORA_EXT_HDR + 1 + 3 * LORA_SCENE_PER_FRAME)
+#define CLASSA_WINDOW_MS 300 // how long a class-A node listens after its uplink
+// ---------------- Fade curves ------------------
+#define FADE_DEFAULT_MS 400
+#define FADE_MAX_MS 60000
+enum FadeCurve : uint8_t
+{
+    FADE_LINEAR,
+    FADE_EASE,   // smoothstep, slow at both ends
+    FADE_SQUARE, // perceptual: slow start on LEDs
+    FADE_CURVES
+};
+static const char *const fadeCurveNames[FADE_CURVES] = {"linear", "ease", "square"};
+// ---------------- Level during a fade ----------
+// Same curves as the node firmware; elapsed >= ms means done.
+inline int fadeLevel(int from, int to, uint32_t elapsed, uint32_t ms, uint8_t curve)
+{
+    if (ms == 0 || elapsed >= ms)
+        return to;
+    float x = (float)elapsed / ms;
+    if (curve == FADE_EASE)
+        x = x * x * (3 - 2 * x);
+    else if (curve == FADE_SQUARE)
+        x = x * x;
+    return from + (int)lroundf((to - from) * x);
+}
+// ---------------- Frame builders ---------------
+// Each writes into buf and returns the frame length.
+inline int frameState(uint8_t *buf, int id, bool on, int level)
+{
+    LoRaPacket p;
+    memset(&p, 0, sizeof(p));
+    p.id = id;
+    p.data1 = on;
+    p.data2 = level;
+    memcpy(buf, &p, sizeof(p));
+    return sizeof(p);
+}
+inline int frameProbe(uint8_t *buf, int id)
+{
+    LoRaPacketRec p;
+    memset(&p, 0, sizeof(p));
+    p.id = id;
+    memcpy(buf, &p, sizeof(p));
+    return sizeof(p);
+}
+inline int frameGroup(uint8_t *buf, uint8_t gid, uint8_t act, uint8_t dim)
+{
+    const uint8_t f[6] = {LORA_EXT_MAGIC, LORA_EXT_GROUP, 0, gid, act, dim};
+    memcpy(buf, f, sizeof(f));
+    return sizeof(f);
+}
+inline int frameJoin(uint8_t *buf, uint8_t nid, uint16_t mask)
+{
+    const uint8_t f[6] = {LORA_EXT_MAGIC, LORA_EXT_JOIN, 0, nid, (uint8_t)(mask & 0xFF), (uint8_t)(mask >> 8)};
+    memcpy(buf, f, sizeof(f));
+    return sizeof(f);
+}
+inline int frameFade(uint8_t *buf, uint8_t nid, uint8_t level, uint8_t curve, uint16_t ms)
+{
+    const uint8_t f[8] = {LORA_EXT_MAGIC, LORA_EXT_FADE, 0, nid, level, curve, (uint8_t)(ms & 0xFF), (uint8_t)(ms >> 8)};
+    memcpy(buf, f, sizeof(f));
+    return sizeof(f);
+}
+// entries: n x {node relay dim}, n <= LORA_SCENE_PER_FRAME
+inline int frameScene(uint8_t *buf, uint8_t sid, const uint8_t *entries, int n)
+{
+    buf[0] = LORA_EXT_MAGIC;
+    buf[1] = LORA_EXT_SCENE;
+    buf[2] = 0;
+    buf[3] = sid;
+    buf[4] = (uint8_t)n;
+    memcpy(buf + 5, entries, 3 * n);
+    return 5 + 3 * n;
+}
+// ---------------- Frame helpers ----------------
+inline void frameStamp(uint8_t *buf, uint8_t seq)
+{
+    buf[2] = seq;
+}
+// Uplink telemetry; false for anything that is not a 12-byte report.
+inline bool frameParseUplink(const uint8_t *buf, int len, LoRaPacketRec &out)
+{
+    if (len != (int)sizeof(LoRaPacketRec))
+        return false;
+    memcpy(&out, buf, sizeof(out));
+    return true;
+}
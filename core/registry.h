@@ -0,0 +1,130 @@
+// ================ Node registry ====================
+// The nodes the gateway knows by id and label, in insertion order.
+// Radio state per id lives with the owner (SlaveStation); this is only
+// the list the portal, the display and the groups walk. Portable: no
+// Arduino headers, NVS is behind StorageHal.
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+
+#define MAX_NODES 24
+#define NODE_LABEL_LEN 24
+struct Node
+{
+    int id;
+    char label[NODE_LABEL_LEN];
+    float voltage;
+    float current;
+    bool relay;
+    bool online;
+};
+struct NodeRegistry
+{
+    Node nodes[MAX_NODES];
+    int count;
+    int nextId; // auto-id for addNode(), always above every id in use
+};
+// ---------------- Reset ---------------------------
+inline void registryClear(NodeRegistry &r)
+{
+    memset(&r, 0, sizeof(r));
+    r.nextId = 1;
+}
+// ---------------- Find by id ----------------------
+inline int registryFind(const NodeRegistry &r, int id)
+{
+    for (int i = 0; i < r.count; i++)
+        if (r.nodes[i].id == id)
+            return i;
+    return -1;
+}
+// ---------------- Add -----------------------------
+// Appends id with label (truncated); index, or -1 when the id is taken
+// or the table is full.
+inline int registryAdd(NodeRegistry &r, int id, const char *label, bool relay)
+{
+    if (r.count >= MAX_NODES || registryFind(r, id) >= 0)
+        return -1;
+    Node &n = r.nodes[r.count];
+    memset(&n, 0, sizeof(n));
+    n.id = id;
+    snprintf(n.label, NODE_LABEL_LEN, "%s", label);
+    n.relay = relay;
+    n.online = true;
+    if (id >= r.nextId)
+        r.nextId = id + 1;
+    return r.count++;
+}
+// ---------------- Remove --------------------------
+// Later entries move up one; order is kept.
+inline bool registryRemove(NodeRegistry &r, int id)
+{
+    int idx = registryFind(r, id);
+    if (idx < 0)
+        return false;
+    for (int i = idx; i < r.count - 1; i++)
+        r.nodes[i] = r.nodes[i + 1];
+    r.count--;
+    return true;
+}
+// ---------------- Change id and label -------------
+// Empty label keeps the old one. False if id is unknown or newId is
+// another node's.
+inline bool registryEdit(NodeRegistry &r, int id, int newId, const char *label)
+{
+    int idx = registryFind(r, id);
+    if (idx < 0 || (newId != id && registryFind(r, newId) >= 0))
+        return false;
+    Node &n = r.nodes[idx];
+    if (label[0])
+        snprintf(n.label, NODE_LABEL_LEN, "%s", label);
+    n.id = newId;
+    if (newId >= r.nextId)
+        r.nextId = newId + 1;
+    return true;
+}
+// ---------------- Persist -------------------------
+// The whole registry as one NVS blob ("nodes"/"reg"), plus the class A
+// flags by slave slot ("nodes"/"classA"), saved from the caller's own
+// copy so no record is built on the stack.
+inline bool registrySave(StorageHal &s, const NodeRegistry &r, uint32_t classA)
+{
+    bool ok = s.save("nodes", "reg", &r, sizeof(r));
+    return s.save("nodes", "classA", &classA, sizeof(classA)) && ok;
+}
+// Loads in place and repairs: a node with id <= 0, an unterminated label
+// or an id already seen is dropped (and counted), nextId is raised above
+// every id kept. -1 if there is no blob or its count is out of range (r
+// is then cleared).
+inline int registryLoad(StorageHal &s, NodeRegistry &r, uint32_t &classA)
+{
+    if (!s.load("nodes", "reg", &r, sizeof(r)) || r.count < 0 || r.count > MAX_NODES)
+    {
+        registryClear(r);
+        classA = 0;
+        return -1;
+    }
+    if (!s.load("nodes", "classA", &classA, sizeof(classA)))
+        classA = 0;
+    int stored = r.count;
+    int dropped = 0;
+    r.count = 0;
+    if (r.nextId < 1)
+        r.nextId = 1;
+    for (int i = 0; i < stored; i++)
+    {
+        Node n = r.nodes[i];
+        if (n.id <= 0 || memchr(n.label, 0, sizeof(n.label)) == NULL || registryFind(r, n.id) >= 0)
+        {
+            dropped++;
+            continue;
+        }
+        n.online = true;
+        r.nodes[r.count++] = n;
+        if (n.id >= r.nextId)
+            r.nextId = n.id + 1;
+    }
+    return dropped;
+}
@@ -0,0 +1,265 @@
+// ================ Rules ============================
+// "When <source> <field> <op> <threshold> [and relay guard] [and inside
+// a time window] do <command>". Each rule hangs off the one source it
+// watches (a node, or a local relay), so a telemetry update walks only
+// that source's list. Rules are edge-triggered: a rule fires once when
+// its condition becomes true and re-arms after it clears by hyst.
+// Table, edits, file, index and evaluation; the caller supplies the
+// source's values, the clock, what firing means and the locking.
+// Portable: no Arduino headers.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "command.h"
+#include "tablefile.h"
+
+#ifndef RULE_MAX
+#define RULE_MAX 1024
+#endif
+#define RULE_NONE -1
+#define RULE_MAGIC 0x314C5552UL // "RUL1"
+#define RULE_RELAYS 4
+#define RULE_SRC_RELAY 100 // + local relay index; 1..NODE_SLOTS = node id
+#define RULE_BUCKETS (NODE_SLOTS + RULE_RELAYS)
+enum RuleField : uint8_t
+{
+    RULE_F_TEMP,  // node temperature
+    RULE_F_TIME,  // node time/uptime field
+    RULE_F_RELAY, // node or local relay, 0/1
+    RULE_F_DIM,   // node dimming level
+    RULE_FIELDS
+};
+enum RuleOp : uint8_t
+{
+    RULE_GT,
+    RULE_GE,
+    RULE_LT,
+    RULE_LE,
+    RULE_EQ,
+    RULE_NE
+};
+struct Rule // also the file record
+{
+    float threshold;
+    float hyst;         // re-arm margin, GT/GE/LT/LE only
+    uint16_t id;        // 0 = free slot
+    uint16_t targetId;
+    int16_t value;      // ACT_DIM level
+    uint16_t cooldownS; // minimum time between firings
+    uint16_t fromMin;   // window, minute of day; fromMin == toMin = always
+    uint16_t toMin;
+    uint8_t src;        // node id, or RULE_SRC_RELAY + relay
+    uint8_t field;      // RuleField
+    uint8_t op;         // RuleOp
+    int8_t guardRelay;  // local relay that must be in guardOn, -1 = none
+    uint8_t guardOn;
+    uint8_t target;     // CmdTarget
+    uint8_t action;     // CmdAction
+    uint8_t reserved;
+};
+struct RuleTable
+{
+    Rule rules[RULE_MAX];
+    int16_t head[RULE_BUCKETS]; // per source, first slot
+    int16_t next[RULE_MAX];
+    bool latched[RULE_MAX];     // fired, waiting for the condition to clear
+    uint32_t lastFire[RULE_MAX]; // ms, 0 = never
+    int count;
+    uint16_t lastId;
+};
+struct RuleStats
+{
+    uint32_t triggers;  // source updates that had rules
+    uint32_t evals;     // rules evaluated
+    uint32_t fired;
+    uint32_t blocked;   // condition true, guard, window or cooldown said no
+    uint32_t busFull;
+    uint32_t evalMaxUs; // one source update, all its rules
+    uint64_t evalUs;
+    uint32_t edits;
+};
+// What one run reads besides the rules.
+struct RuleInputs
+{
+    float fields[RULE_FIELDS]; // the source's values by RuleField
+    const bool *relays;        // RULE_RELAYS local relays, for guards
+    uint32_t nowMs;
+    uint16_t minute;           // of the day, for windows
+    bool (*fire)(const Rule &r); // false: not taken, the rule stays armed
+};
+// ---------------- Source to bucket ----------------
+inline int ruleBucket(uint8_t src)
+{
+    if (src >= 1 && src <= NODE_SLOTS)
+        return src - 1;
+    if (src >= RULE_SRC_RELAY && src < RULE_SRC_RELAY + RULE_RELAYS)
+        return NODE_SLOTS + src - RULE_SRC_RELAY;
+    return -1;
+}
+// ---------------- Record check --------------------
+// /rules.bin is trusted for nothing: the rules API indexes name tables
+// with field, op, target and action. A rule that fails this is skipped
+// on load.
+inline bool ruleValid(const Rule &r)
+{
+    if (ruleBucket(r.src) < 0 || r.field >= RULE_FIELDS || r.op > RULE_NE)
+        return false;
+    if (r.guardRelay < -1 || r.guardRelay >= RULE_RELAYS)
+        return false;
+    if (r.fromMin >= 1440 || r.toMin >= 1440)
+        return false;
+    return cmdStoredValid(r.target, r.targetId, r.action);
+}
+// ---------------- Rebuild the index ---------------
+// Slots are linked in table order, so rules on one source run in the
+// order they were created.
+inline void rulesIndex(RuleTable &t)
+{
+    for (int b = 0; b < RULE_BUCKETS; b++)
+        t.head[b] = RULE_NONE;
+    for (int i = RULE_MAX - 1; i >= 0; i--)
+    {
+        int b = t.rules[i].id ? ruleBucket(t.rules[i].src) : -1;
+        if (b < 0)
+            continue;
+        t.next[i] = t.head[b];
+        t.head[b] = i;
+    }
+}
+// ---------------- Edit ----------------------------
+inline int ruleFind(const RuleTable &t, uint16_t id)
+{
+    for (int i = 0; i < RULE_MAX; i++)
+        if (t.rules[i].id == id)
+            return i;
+    return -1;
+}
+// r.id 0 adds, otherwise replaces that rule (and re-arms it). Returns the
+// id, 0 when the table is full or the id unknown.
+inline uint16_t rulesPut(RuleTable &t, const Rule &in)
+{
+    int slot = ruleFind(t, in.id); // id 0 finds a free slot
+    if (slot < 0)
+        return 0;
+    uint16_t id = in.id;
+    if (!id)
+    {
+        // ids are never 0 and never reused while in the table
+        do
+            id = ++t.lastId;
+        while (!id || ruleFind(t, id) >= 0);
+        t.count++;
+    }
+    t.rules[slot] = in;
+    t.rules[slot].id = id;
+    t.latched[slot] = false;
+    t.lastFire[slot] = 0;
+    rulesIndex(t);
+    return id;
+}
+// id 0 deletes every rule.
+inline bool rulesDelete(RuleTable &t, uint16_t id)
+{
+    bool found = false;
+    for (int i = 0; i < RULE_MAX; i++)
+    {
+        if (t.rules[i].id && (!id || t.rules[i].id == id))
+        {
+            t.rules[i].id = 0;
+            t.count--;
+            found = true;
+        }
+    }
+    rulesIndex(t);
+    return found;
+}
+// ---------------- Persist -------------------------
+// File format: core/tablefile.h.
+inline bool rulesSave(StorageHal &s, const char *path, const RuleTable &t)
+{
+    return tableSave(s, path, RULE_MAGIC, t.rules, RULE_MAX, t.count);
+}
+// Resets the table first and indexes what it loaded. Returns the invalid
+// records dropped.
+inline int rulesLoad(StorageHal &s, const char *path, RuleTable &t)
+{
+    memset(&t, 0, sizeof(t));
+    int dropped;
+    t.count = tableLoad(s, path, RULE_MAGIC, t.rules, RULE_MAX, ruleValid, dropped);
+    for (int i = 0; i < t.count; i++)
+        if (t.rules[i].id > t.lastId)
+            t.lastId = t.rules[i].id;
+    rulesIndex(t);
+    return dropped;
+}
+// ---------------- Condition -----------------------
+// margin > 0 widens the "still true" band; used for re-arming.
+inline bool ruleTest(const Rule &r, float v, float margin)
+{
+    switch (r.op)
+    {
+    case RULE_GT:
+        return v > r.threshold - margin;
+    case RULE_GE:
+        return v >= r.threshold - margin;
+    case RULE_LT:
+        return v < r.threshold + margin;
+    case RULE_LE:
+        return v <= r.threshold + margin;
+    case RULE_EQ:
+        return v == r.threshold;
+    case RULE_NE:
+        return v != r.threshold;
+    }
+    return false;
+}
+// ---------------- Guards --------------------------
+inline bool ruleGuards(const RuleTable &t, int i, const RuleInputs &in)
+{
+    const Rule &r = t.rules[i];
+    if (r.guardRelay >= 0 && r.guardRelay < RULE_RELAYS && in.relays[r.guardRelay] != (bool)r.guardOn)
+        return false;
+    if (r.cooldownS && t.lastFire[i] && in.nowMs - t.lastFire[i] < r.cooldownS * 1000UL)
+        return false;
+    if (r.fromMin != r.toMin)
+    {
+        uint16_t m = in.minute;
+        bool on = r.fromMin < r.toMin ? m >= r.fromMin && m < r.toMin
+                                      : m >= r.fromMin || m < r.toMin; // past midnight
+        if (!on)
+            return false;
+    }
+    return true;
+}
+// ---------------- Run one source ------------------
+// Cost is that source's list, never the table.
+inline void rulesEval(RuleTable &t, int bucket, const RuleInputs &in, RuleStats &s)
+{
+    for (int i = t.head[bucket]; i != RULE_NONE; i = t.next[i])
+    {
+        const Rule &r = t.rules[i];
+        float v = r.field < RULE_FIELDS ? in.fields[r.field] : 0;
+        s.evals++;
+        if (t.latched[i])
+        {
+            if (!ruleTest(r, v, r.hyst))
+                t.latched[i] = false;
+            continue;
+        }
+        if (!ruleTest(r, v, 0))
+            continue;
+        if (!ruleGuards(t, i, in))
+        {
+            s.blocked++;
+            continue;
+        }
+        if (!in.fire(r))
+        {
+            s.busFull++; // stays armed; the next update retries
+            continue;
+        }
+        t.latched[i] = true;
+        t.lastFire[i] = in.nowMs | 1;
+        s.fired++;
+    }
+}
@@ -0,0 +1,331 @@
+// ================ Schedules ========================
+// One-shot and recurring entries that fire a GatewayCommand at RTC local
+// time: entry format (also the file record), next-fire arithmetic, and
+// the table with its min-heap on next fire time, so the scheduler sleeps
+// until the top entry is due and nothing scans the table per tick. Times
+// are unix seconds. Portable: no Arduino headers; locking, the clock and
+// what firing means are the caller's.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "command.h"
+#include "tablefile.h"
+
+#ifndef SCHED_MAX
+#define SCHED_MAX 2048
+#endif
+#define SCHED_NONE 0xFFFF
+#define SCHED_MAGIC 0x31484353UL     // "SCH1"
+#define SCHED_STEP_MS 2000           // clock moved against the tick: recompute
+#define SCHED_CLOCK_MIN 1577836800UL // 2020-01-01; earlier = RTC never set
+#define SCHED_LATE_MS 1000
+
+enum SchedKind : uint8_t
+{
+    SCHED_ONCE,   // at = unix time
+    SCHED_DAILY,  // at = second of the day, on the days in the mask
+    SCHED_HOURLY  // at = second of the hour, on the days in the mask
+};
+struct SchedEntry // also the file record, 16 bytes
+{
+    uint32_t at;
+    uint16_t id;       // 0 = free slot
+    uint16_t targetId; // relay channel, node, group or scene id
+    int16_t value;     // ACT_DIM level
+    uint8_t kind;      // SchedKind
+    uint8_t days;      // bit 0 = Sunday
+    uint8_t target;    // CMD_LOCAL_RELAY, CMD_NODE, CMD_GROUP or CMD_SCENE
+    uint8_t action;    // CmdAction
+    uint8_t reserved[2];
+};
+// ---------------- Next fire time ------------------
+// First time strictly after t at which e fires, 0 = never again.
+inline uint32_t schedNextFire(const SchedEntry &e, uint32_t t)
+{
+    if (e.kind == SCHED_ONCE)
+        return e.at > t ? e.at : 0;
+    uint32_t day0 = t / 86400;
+    for (uint32_t d = day0; d <= day0 + 7; d++)
+    {
+        if (!(e.days & (1u << ((d + 4) % 7)))) // 1970-01-01 was a Thursday
+            continue;
+        uint32_t start = d * 86400;
+        if (e.kind == SCHED_DAILY)
+        {
+            if (start + e.at > t)
+                return start + e.at;
+            continue;
+        }
+        for (uint32_t h = t > start ? (t - start) / 3600 : 0; h < 24; h++)
+        {
+            if (start + h * 3600 + e.at > t)
+                return start + h * 3600 + e.at;
+        }
+    }
+    return 0;
+}
+// ---------------- Record check --------------------
+// /sched.bin is trusted for nothing: a record that fails this is skipped
+// on load.
+inline bool schedEntryValid(const SchedEntry &e)
+{
+    if (e.kind == SCHED_DAILY && e.at >= 86400)
+        return false;
+    if (e.kind == SCHED_HOURLY && e.at >= 3600)
+        return false;
+    return e.kind <= SCHED_HOURLY && cmdStoredValid(e.target, e.targetId, e.action);
+}
+// ================ Table and heap ===================
+struct SchedStats
+{
+    uint32_t fired;
+    uint32_t late;     // more than SCHED_LATE_MS after their time
+    uint32_t missed;   // one-shots already past at boot or a clock step
+    uint32_t busFull;  // firing retried, fire() refused
+    uint32_t rebuilds; // every next time recomputed (clock set or stepped)
+    uint32_t saves;
+    uint32_t jitterMaxMs;
+    uint64_t jitterTotalMs;
+};
+struct SchedTable
+{
+    SchedEntry entries[SCHED_MAX];
+    uint32_t nextAt[SCHED_MAX];  // unix time, queued slots only
+    uint16_t heap[SCHED_MAX];    // slots, min-heap on nextAt
+    uint16_t heapPos[SCHED_MAX]; // slot -> heap index, SCHED_NONE = not queued
+    int heapLen;
+    int count;
+    uint16_t lastId;
+    bool clockOk;       // heap built against a valid clock
+    bool dirty;         // file behind the table
+    uint64_t clockMs;   // unix ms and tick at the last schedClock()
+    uint32_t clockTick;
+    SchedStats stats;
+};
+// ---------------- Reset ---------------------------
+inline void schedTableInit(SchedTable &t)
+{
+    memset(&t, 0, sizeof(t));
+    for (int i = 0; i < SCHED_MAX; i++)
+        t.heapPos[i] = SCHED_NONE;
+}
+// ---------------- Heap ----------------------------
+inline bool schedBefore(const SchedTable &t, int a, int b)
+{
+    return t.nextAt[t.heap[a]] < t.nextAt[t.heap[b]];
+}
+inline void schedSwap(SchedTable &t, int a, int b)
+{
+    uint16_t x = t.heap[a];
+    t.heap[a] = t.heap[b];
+    t.heap[b] = x;
+    t.heapPos[t.heap[a]] = a;
+    t.heapPos[t.heap[b]] = b;
+}
+inline int schedSiftUp(SchedTable &t, int i)
+{
+    while (i > 0 && schedBefore(t, i, (i - 1) / 2))
+    {
+        schedSwap(t, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    return i;
+}
+inline void schedSiftDown(SchedTable &t, int i)
+{
+    for (;;)
+    {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < t.heapLen && schedBefore(t, l, m))
+            m = l;
+        if (r < t.heapLen && schedBefore(t, r, m))
+            m = r;
+        if (m == i)
+            return;
+        schedSwap(t, i, m);
+        i = m;
+    }
+}
+inline void schedUnqueue(SchedTable &t, int slot)
+{
+    int i = t.heapPos[slot];
+    if (i == SCHED_NONE)
+        return;
+    t.heapPos[slot] = SCHED_NONE;
+    int last = --t.heapLen;
+    if (i == last)
+        return;
+    t.heap[i] = t.heap[last];
+    t.heapPos[t.heap[i]] = i;
+    schedSiftDown(t, schedSiftUp(t, i));
+}
+// ---------------- (Re)queue a slot ----------------
+// Next firing after now; an entry that never fires again stays out.
+inline void schedQueue(SchedTable &t, int slot, uint32_t now)
+{
+    schedUnqueue(t, slot);
+    uint32_t at = schedNextFire(t.entries[slot], now);
+    if (!at)
+        return;
+    t.nextAt[slot] = at;
+    int i = t.heapLen++;
+    t.heap[i] = slot;
+    t.heapPos[slot] = i;
+    schedSiftUp(t, i);
+}
+inline void schedFree(SchedTable &t, int slot)
+{
+    schedUnqueue(t, slot);
+    t.entries[slot].id = 0;
+    t.count--;
+    t.dirty = true;
+}
+// ---------------- Rebuild the heap ----------------
+// At the first valid clock and after the clock is set or steps. One-shots
+// already past are dropped rather than fired late.
+inline void schedRebuild(SchedTable &t, uint32_t now)
+{
+    t.heapLen = 0;
+    for (int i = 0; i < SCHED_MAX; i++)
+        t.heapPos[i] = SCHED_NONE;
+    for (int i = 0; i < SCHED_MAX; i++)
+    {
+        const SchedEntry &e = t.entries[i];
+        if (!e.id)
+            continue;
+        if (e.kind == SCHED_ONCE && e.at <= now)
+        {
+            schedFree(t, i);
+            t.stats.missed++;
+            continue;
+        }
+        schedQueue(t, i, now);
+    }
+    t.stats.rebuilds++;
+}
+// ---------------- Edit ----------------------------
+inline int schedFind(const SchedTable &t, uint16_t id)
+{
+    for (int i = 0; i < SCHED_MAX; i++)
+        if (t.entries[i].id == id)
+            return i;
+    return -1;
+}
+// e.id 0 adds, otherwise replaces that entry; now is the current unix
+// time. Returns the id, 0 when the table is full or the id unknown.
+inline uint16_t schedPut(SchedTable &t, const SchedEntry &in, uint32_t now)
+{
+    int slot = schedFind(t, in.id); // id 0 finds a free slot
+    if (slot < 0)
+        return 0;
+    uint16_t id = in.id;
+    if (!id)
+    {
+        // ids are never 0 and never reused while in the table
+        do
+            id = ++t.lastId;
+        while (!id || schedFind(t, id) >= 0);
+        t.count++;
+    }
+    t.entries[slot] = in;
+    t.entries[slot].id = id;
+    if (t.clockOk)
+        schedQueue(t, slot, now);
+    t.dirty = true;
+    return id;
+}
+// id 0 deletes every entry.
+inline bool schedDelete(SchedTable &t, uint16_t id)
+{
+    bool found = false;
+    for (int i = 0; i < SCHED_MAX; i++)
+    {
+        if (t.entries[i].id && (!id || t.entries[i].id == id))
+        {
+            schedFree(t, i);
+            found = true;
+        }
+    }
+    return found;
+}
+// ---------------- Clock check ---------------------
+// nowMs is the unix clock, tick a monotonic ms counter. Before
+// SCHED_CLOCK_MIN nothing is queued; the first valid time builds the
+// heap, and so does a step (the clock set or resynced) of more than
+// SCHED_STEP_MS against the tick, since it invalidates every queued
+// time. Returns that step, 0 when the heap was not rebuilt for one.
+inline int64_t schedClock(SchedTable &t, uint64_t nowMs, uint32_t tick)
+{
+    int64_t step = (int64_t)(nowMs - t.clockMs) - (int64_t)(uint32_t)(tick - t.clockTick);
+    int64_t stepped = 0;
+    uint32_t now = nowMs / 1000;
+    if (now < SCHED_CLOCK_MIN)
+    {
+        t.clockOk = false;
+    }
+    else if (!t.clockOk || step > SCHED_STEP_MS || step < -SCHED_STEP_MS)
+    {
+        if (t.clockOk)
+            stepped = step;
+        schedRebuild(t, now);
+        t.clockOk = true;
+    }
+    t.clockMs = nowMs;
+    t.clockTick = tick;
+    return stepped;
+}
+// ---------------- Fire what is due ----------------
+// Hands every entry due at nowMs to fire() in time order; one-shots are
+// freed, the others requeued. Returns ms until the next entry is due,
+// 0 when fire() refused one (it stays on top; retry shortly), or
+// 0xFFFFFFFF when nothing is queued (or the next is that far off).
+inline uint32_t schedRunDue(SchedTable &t, uint64_t nowMs, bool (*fire)(const SchedEntry &e))
+{
+    while (t.clockOk && t.heapLen)
+    {
+        int slot = t.heap[0];
+        uint64_t dueMs = (uint64_t)t.nextAt[slot] * 1000;
+        if (dueMs > nowMs)
+            return dueMs - nowMs < 0xFFFFFFFFULL ? (uint32_t)(dueMs - nowMs) : 0xFFFFFFFF;
+        const SchedEntry &e = t.entries[slot];
+        if (!fire(e))
+        {
+            t.stats.busFull++;
+            return 0;
+        }
+        uint32_t jitter = nowMs - dueMs;
+        t.stats.fired++;
+        t.stats.jitterTotalMs += jitter;
+        if (jitter > t.stats.jitterMaxMs)
+            t.stats.jitterMaxMs = jitter;
+        if (jitter > SCHED_LATE_MS)
+            t.stats.late++;
+        if (e.kind == SCHED_ONCE)
+            schedFree(t, slot);
+        else
+            schedQueue(t, slot, t.nextAt[slot]);
+    }
+    return 0xFFFFFFFF;
+}
+// ================ Persist ==========================
+// File format: core/tablefile.h.
+inline bool schedSave(StorageHal &s, const char *path, SchedTable &t)
+{
+    if (!tableSave(s, path, SCHED_MAGIC, t.entries, SCHED_MAX, t.count))
+        return false;
+    t.dirty = false;
+    t.stats.saves++;
+    return true;
+}
+// Resets the table first and leaves it with no heap (see schedClock()).
+// Returns the invalid records dropped.
+inline int schedLoad(StorageHal &s, const char *path, SchedTable &t)
+{
+    schedTableInit(t);
+    int dropped;
+    t.count = tableLoad(s, path, SCHED_MAGIC, t.entries, SCHED_MAX, schedEntryValid, dropped);
+    for (int i = 0; i < t.count; i++)
+        if (t.entries[i].id > t.lastId)
+            t.lastId = t.entries[i].id;
+    return dropped;
+}
@@ -0,0 +1,42 @@
+// ================ Seqlock ==========================
+// One writer publishes a plain struct to any number of readers without a
+// lock: the writer makes the sequence odd, copies, makes it even. A
+// reader that saw an odd value, or a different value after its copy,
+// raced a write and copies again. Portable: no Arduino headers; how a
+// reader backs off is the caller's.
+#pragma once
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// ---------------- Write (single writer) -----------
+inline void seqWrite(std::atomic<uint32_t> &seq, void *dst, const void *src, size_t n)
+{
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(dst, src, n);
+    seq.store(s + 2, std::memory_order_release);
+}
+// ---------------- Read ----------------------------
+// Copies src to dst until the copy is consistent; returns the retries.
+// After a few spins each retry calls yield (if given), so a writer
+// preempted on the reader's core gets the CPU.
+inline uint32_t seqCopy(const std::atomic<uint32_t> &seq, void *dst, const void *src, size_t n,
+                        void (*yield)())
+{
+    for (uint32_t tries = 0;; tries++)
+    {
+        uint32_t s1 = seq.load(std::memory_order_acquire);
+        if (!(s1 & 1))
+        {
+            memcpy(dst, src, n);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s1)
+                return tries;
+        }
+        if (tries >= 4 && yield)
+            yield();
+    }
+}
@@ -0,0 +1,73 @@
+// ================ Record table files ===============
+// Schedules and rules are kept as one file each: magic, record count,
+// then the used records (id != 0) packed, rewritten whole on save.
+// Records go through a small buffer, so a full table costs a few file
+// calls and no heap. Portable: no Arduino headers, the file system is
+// behind StorageHal.
+#pragma once
+#include <stdint.h>
+#include "hal.h"
+
+#define TABLE_IO_CHUNK 16 // records per file call
+// ---------------- Save ----------------------------
+template <typename T>
+inline bool tableSave(StorageHal &s, const char *path, uint32_t magic, const T *recs, int slots, int count)
+{
+    uint32_t hdr[2] = {magic, (uint32_t)count};
+    if (!s.writeFile(path, 0, hdr, sizeof(hdr)))
+        return false;
+    uint32_t pos = sizeof(hdr);
+    T buf[TABLE_IO_CHUNK];
+    int n = 0;
+    for (int i = 0; i <= slots; i++)
+    {
+        if (i < slots && recs[i].id)
+            buf[n++] = recs[i];
+        if (n == TABLE_IO_CHUNK || (i == slots && n))
+        {
+            if (!s.writeFile(path, pos, buf, n * sizeof(T)))
+                return false;
+            pos += n * sizeof(T);
+            n = 0;
+        }
+    }
+    return true;
+}
+// ---------------- Load ----------------------------
+// The file is trusted for nothing: a record that fails valid() is
+// dropped (and counted). Fills recs[] from slot 0 and returns how many;
+// the slots after them are left alone. A missing, foreign or short file
+// loads what it has.
+template <typename T>
+inline int tableLoad(StorageHal &s, const char *path, uint32_t magic, T *recs, int slots, bool (*valid)(const T &),
+                     int &dropped)
+{
+    dropped = 0;
+    uint32_t hdr[2] = {0, 0};
+    if (s.readFile(path, 0, hdr, sizeof(hdr)) != sizeof(hdr) || hdr[0] != magic)
+        return 0;
+    uint32_t pos = sizeof(hdr);
+    int count = 0;
+    T buf[TABLE_IO_CHUNK];
+    for (uint32_t left = hdr[1]; left && count < slots;)
+    {
+        uint32_t want = left < TABLE_IO_CHUNK ? left : TABLE_IO_CHUNK;
+        uint32_t n = s.readFile(path, pos, buf, want * sizeof(T)) / sizeof(T);
+        for (uint32_t k = 0; k < n && count < slots; k++)
+        {
+            if (!buf[k].id)
+                continue;
+            if (!valid(buf[k]))
+            {
+                dropped++;
+                continue;
+            }
+            recs[count++] = buf[k];
+        }
+        if (n < want)
+            break;
+        pos += n * sizeof(T);
+        left -= n;
+    }
+    return count;
+}
@@ -0,0 +1,194 @@
+// ================ TX queue =========================
+// Downlinks wait here by class; the radio owner takes one frame per pass,
+// so an interactive command waits for at most the frame already on air,
+// never for a whole refresh round.
+//   WINDOW       class-A receive windows   strict priority, highest
+//   INTERACTIVE  HTTP, MQTT, buttons       strict priority
+//   SCHEDULED    schedules, rules, system  the other three share what is
+//   REFRESH      periodic state resend     left by weight (txWeights)
+//   DISCOVERY    node-add probes
+// An entry older than its class deadline is dropped unsent. A unicast
+// frame carries the node's whole state, so it supersedes queued frames
+// for the same node; refresh entries carry no frame, the owner builds it
+// when it goes out. Portable: no Arduino headers, time is passed in.
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include "protocol.h"
+
+enum TxClass : uint8_t
+{
+    TX_WINDOW, // see Class-A hold-off
+    TX_INTERACTIVE,
+    TX_SCHEDULED,
+    TX_REFRESH,
+    TX_DISCOVERY,
+    TX_CLASSES
+};
+enum TxKind : uint8_t
+{
+    TXK_UNICAST, // 12-byte state frame for node
+    TXK_FADE,    // extended FADE frame for node
+    TXK_REFRESH, // unicast built at send time
+    TXK_PROBE,   // node-add probe
+    TXK_OTHER    // group, scene, join
+};
+// Per class. A refresh round queues one entry per node before anything
+// goes out, and so does a group or scene fanned out as unicast, so a
+// ring must hold every node plus room for frames already waiting.
+#define TX_DEPTH (NODE_SLOTS + 4)
+static_assert(TX_DEPTH >= NODE_SLOTS, "a refresh round must fit one ring");
+static const char *const txClassNames[TX_CLASSES] = {"window", "interactive", "scheduled", "refresh", "discovery"};
+static const uint8_t txWeights[TX_CLASSES] = {0, 0, 4, 2, 1}; // 0 = strict
+static const uint16_t txDeadlineMs[TX_CLASSES] = {CLASSA_WINDOW_MS, 3000, 10000, 5000, 1000}; // probe + answer < busCall wait
+struct TxEntry
+{
+    bool live; // false: superseded, skipped when it reaches the head
+    uint8_t kind;
+    uint8_t len;
+    uint16_t node;
+    uint32_t queuedAt; // ms
+    uint8_t buf[LORA_FRAME_MAX];
+};
+struct TxRing
+{
+    TxEntry e[TX_DEPTH];
+    uint8_t head;
+    uint8_t count;
+};
+struct TxClassStats
+{
+    uint32_t queued;
+    uint32_t sent;
+    uint32_t expired;    // deadline passed before the radio was free
+    uint32_t full;       // rejected, ring full
+    uint32_t superseded; // replaced by a newer frame for the same node
+    uint32_t waitMaxMs;
+    uint64_t waitTotalMs; // queue delay of sent frames
+};
+struct TxQueue
+{
+    TxRing rings[TX_CLASSES];
+    TxClassStats stats[TX_CLASSES];
+    uint8_t credit[TX_CLASSES];
+};
+enum TxNext
+{
+    TXQ_EMPTY,
+    TXQ_SEND,   // out is due on air
+    TXQ_EXPIRED // out passed its deadline; already counted
+};
+// ---------------- Drop superseded entries ---------
+// Dead entries otherwise hold their cell until they reach the head.
+inline void txqCompact(TxRing &r)
+{
+    int kept = 0;
+    for (int k = 0; k < r.count; k++)
+    {
+        TxEntry &e = r.e[(r.head + k) % TX_DEPTH];
+        if (!e.live)
+            continue;
+        TxEntry &dst = r.e[(r.head + kept) % TX_DEPTH];
+        if (&dst != &e)
+            dst = e;
+        kept++;
+    }
+    r.count = kept;
+}
+// ---------------- Queue a frame -------------------
+// False only when the ring is full of live entries. A refresh behind any
+// frame for the same node is absorbed (true, nothing queued).
+inline bool txqPush(TxQueue &q, uint8_t cls, uint8_t kind, uint16_t node, const uint8_t *buf, int len, uint32_t now)
+{
+    for (int c = 0; c < TX_CLASSES && node; c++)
+    {
+        TxRing &r = q.rings[c];
+        for (int k = 0; k < r.count; k++)
+        {
+            TxEntry &e = r.e[(r.head + k) % TX_DEPTH];
+            if (!e.live || e.node != node)
+                continue;
+            if (kind == TXK_REFRESH)
+                return true;
+            if ((kind == TXK_UNICAST && e.kind != TXK_PROBE && e.kind != TXK_OTHER) ||
+                (kind == TXK_FADE && e.kind == TXK_FADE))
+            {
+                e.live = false;
+                q.stats[c].superseded++;
+            }
+        }
+    }
+    TxRing &r = q.rings[cls];
+    if (r.count >= TX_DEPTH)
+        txqCompact(r);
+    if (r.count >= TX_DEPTH || len > LORA_FRAME_MAX)
+    {
+        q.stats[cls].full++;
+        return false;
+    }
+    TxEntry &e = r.e[(r.head + r.count) % TX_DEPTH];
+    e.live = true;
+    e.kind = kind;
+    e.node = node;
+    e.len = len;
+    e.queuedAt = now;
+    if (len)
+        memcpy(e.buf, buf, len);
+    r.count++;
+    q.stats[cls].queued++;
+    return true;
+}
+// ---------------- Take the next frame -------------
+// Strict classes first, then the weighted ones round robin. Superseded
+// entries are skipped; an expired one is handed back once so the caller
+// can clean up after it (a probe, say).
+inline int txqNext(TxQueue &q, uint32_t now, TxEntry &out, uint8_t &outCls)
+{
+    for (;;)
+    {
+        int cls = -1;
+        for (int c = 0; c < TX_CLASSES && !txWeights[c] && cls < 0; c++)
+            if (q.rings[c].count)
+                cls = c;
+        for (int pass = 0; pass < 2 && cls < 0; pass++)
+        {
+            for (int c = 0; c < TX_CLASSES && cls < 0; c++)
+                if (txWeights[c] && q.rings[c].count && q.credit[c])
+                    cls = c;
+            if (cls < 0)
+                memcpy(q.credit, txWeights, sizeof(q.credit)); // new round
+        }
+        if (cls < 0)
+            return TXQ_EMPTY;
+
+        TxRing &r = q.rings[cls];
+        TxEntry &e = r.e[r.head];
+        r.head = (r.head + 1) % TX_DEPTH;
+        r.count--;
+        if (!e.live)
+            continue;
+        out = e;
+        outCls = cls;
+        uint32_t waited = now - e.queuedAt;
+        TxClassStats &st = q.stats[cls];
+        if (waited > txDeadlineMs[cls])
+        {
+            st.expired++;
+            return TXQ_EXPIRED;
+        }
+        if (txWeights[cls])
+            q.credit[cls]--;
+        st.sent++;
+        st.waitTotalMs += waited;
+        if (waited > st.waitMaxMs)
+            st.waitMaxMs = waited;
+        return TXQ_SEND;
+    }
+}
+inline bool txqPending(const TxQueue &q)
+{
+    for (int c = 0; c < TX_CLASSES; c++)
+        if (q.rings[c].count)
+            return true;
+    return false;
+}
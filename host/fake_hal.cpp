@@ -0,0 +1,107 @@
+#include "fake_hal.h"
+#include <string.h>
+
+// ---------------- Radio --------------------------
+void FakeRadio::send(const uint8_t *buf, int len)
+{
+    sent.push_back(Frame(buf, buf + len));
+}
+bool FakeRadio::rxPending()
+{
+    return !rx.empty();
+}
+int FakeRadio::receive(uint8_t *buf, int max)
+{
+    if (rx.empty())
+        return 0;
+    Frame f = rx.front();
+    rx.pop_front();
+    int n = (int)f.size();
+    memcpy(buf, f.data(), n < max ? n : max);
+    return n;
+}
+void FakeRadio::inject(const uint8_t *buf, int len)
+{
+    rx.push_back(Frame(buf, buf + len));
+}
+// ---------------- Storage ------------------------
+size_t FakeStorage::load(const char *ns, const char *key, void *buf, size_t len)
+{
+    std::map<std::string, Frame>::const_iterator it = blobs.find(std::string(ns) + "/" + key);
+    if (it == blobs.end() || it->second.size() != len)
+        return 0;
+    memcpy(buf, it->second.data(), len);
+    return len;
+}
+bool FakeStorage::save(const char *ns, const char *key, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    blobs[std::string(ns) + "/" + key] = Frame(p, p + len);
+    writes++;
+    return true;
+}
+size_t FakeStorage::readFile(const char *path, uint32_t pos, void *buf, size_t len)
+{
+    std::map<std::string, Frame>::const_iterator it = files.find(path);
+    if (it == files.end() || pos >= it->second.size())
+        return 0;
+    size_t n = it->second.size() - pos < len ? it->second.size() - pos : len;
+    memcpy(buf, it->second.data() + pos, n);
+    return n;
+}
+bool FakeStorage::writeFile(const char *path, uint32_t pos, const void *buf, size_t len)
+{
+    Frame &f = files[path];
+    if (pos == 0)
+        f.clear();
+    else if (pos != f.size())
+        return false;
+    const uint8_t *p = (const uint8_t *)buf;
+    f.insert(f.end(), p, p + len);
+    fileWrites++;
+    return true;
+}
+// ---------------- Clock --------------------------
+uint32_t FakeClock::ms()
+{
+    return now;
+}
+uint64_t FakeClock::unixMs()
+{
+    return unix0 ? unix0 + now : 0;
+}
+// ---------------- GPIO ---------------------------
+void FakeGpio::write(int pin, bool high)
+{
+    pins[pin] = high;
+    writes++;
+}
+bool FakeGpio::read(int pin)
+{
+    return pins[pin];
+}
+void FakeGpio::pwm(int channel, uint32_t d)
+{
+    duty[channel] = d;
+}
+// ---------------- Display ------------------------
+uint8_t *FakeDisplay::frame()
+{
+    return buf;
+}
+void FakeDisplay::sendAll()
+{
+    fullSends++;
+    tilesSent += OLED_TILES_X * OLED_TILES_Y;
+}
+void FakeDisplay::sendTiles(int tx, int ty, int tw, int th)
+{
+    (void)tx;
+    (void)ty;
+    areas++;
+    tilesSent += tw * th;
+}
+void FakeDisplay::rotate(bool f)
+{
+    flipped = f;
+}
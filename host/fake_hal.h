@@ -0,0 +1,76 @@
+// ================ Fake HAL (host) ==================
+// In-memory stand-ins for the board services in core/hal.h. Tests and
+// benchmarks drive them directly: inject uplinks, step the clock, look
+// at what was sent or written.
+#pragma once
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "core/hal.h"
+#include "core/display.h"
+
+typedef std::vector<uint8_t> Frame;
+// ---------------- Radio --------------------------
+struct FakeRadio : RadioHal
+{
+    std::vector<Frame> sent; // downlinks in the order they went out
+    std::deque<Frame> rx;    // uplinks waiting to be read
+
+    void send(const uint8_t *buf, int len) override;
+    bool rxPending() override;
+    int receive(uint8_t *buf, int max) override;
+    void inject(const uint8_t *buf, int len);
+};
+// ---------------- Storage ------------------------
+struct FakeStorage : StorageHal
+{
+    std::map<std::string, Frame> blobs; // "ns/key"
+    std::map<std::string, Frame> files; // by path
+    uint32_t writes = 0;     // blobs
+    uint32_t fileWrites = 0;
+
+    size_t load(const char *ns, const char *key, void *buf, size_t len) override;
+    bool save(const char *ns, const char *key, const void *buf, size_t len) override;
+    size_t readFile(const char *path, uint32_t pos, void *buf, size_t len) override;
+    bool writeFile(const char *path, uint32_t pos, const void *buf, size_t len) override;
+};
+// ---------------- Clock --------------------------
+struct FakeClock : ClockHal
+{
+    uint32_t now = 0;
+    uint64_t unix0 = 0; // unixMs() at now == 0, 0 = clock not set
+
+    uint32_t ms() override;
+    uint64_t unixMs() override;
+    void advance(uint32_t d)
+    {
+        now += d;
+    }
+};
+// ---------------- GPIO ---------------------------
+struct FakeGpio : GpioHal
+{
+    std::map<int, bool> pins;
+    std::map<int, uint32_t> duty;
+    uint32_t writes = 0;
+
+    void write(int pin, bool high) override;
+    bool read(int pin) override;
+    void pwm(int channel, uint32_t d) override;
+};
+// ---------------- Display ------------------------
+struct FakeDisplay : DisplayHal
+{
+    uint8_t buf[OLED_BUF_SIZE] = {};
+    uint32_t fullSends = 0;
+    uint32_t tilesSent = 0;
+    uint32_t areas = 0; // sendTiles() calls
+    bool flipped = false;
+
+    uint8_t *frame() override;
+    void sendAll() override;
+    void sendTiles(int tx, int ty, int tw, int th) override;
+    void rotate(bool f) override;
+};
@@ -1,1532 +1,6010 @@
-/* Full ESP32 program - feature update per user:
-   - delete/edit/add node by ID via webportal
-   - add long-press 2s on 4 buttons to toggle 4 relays (SELECT keeps 5s menu)
-   - Implement long-press 2s BOOT button for menu.
-   - display node info (ID, dimming, relay) on data screen, rotate through nodes
-   - relayStatusTask prints node info to Serial
-   - persist node IDs to Preferences
-*/
-
-#include <Arduino.h>
-#include <U8g2lib.h>
-#include <LoRa.h>
-#include <Wire.h>
-#include <WiFi.h>
-#include <RTClib.h>
-#include <EEPROM.h>
-#include <WebServer.h>
-#include <webportal.h>
-#include <Preferences.h>
-#include <ArduinoJson.h>
-#include <PubSubClient.h>
-// ---------------- Hardware pins --------------------
-#define BT_BOOT 0
-#define BT_UP 35   // UP
-#define BT_SEL 32  // SELECT
-#define BT_DN 33   // DOWN
-#define BT_BACK 25 // BACK
-#define BUZ_PIN 13
-#define FAN_PIN 15
-// ---------------- Relay OUTPUT ---------------------
-#define RL1 12
-#define RL2 14
-#define RL3 27
-#define RL4 26
-#define total_Slave 10
-// ---------------- buzzer LEDC channel --------------
-#define BUZ_CHANNEL 0
-// ---------------- LoRa pins ------------------------
-#define LORA_SS 5
-#define LORA_RST 17
-#define LORA_DIO 2
-// ---------------- watchdog timmer-------------------
-#define WDT_TIMEOUT 10
-// ---------------- Globals --------------------------
-U8G2_SSD1306_128X64_NONAME_F_HW_I2C u8g2(U8G2_R0);
-RTC_DS3231 rtc;
-Preferences prefs;
-WiFiClient espClient;
-PubSubClient mqttClient(espClient);
-WebServer statusServer(8080);
-// ---------------- Init Task ---------------------
-TaskHandle_t displayTaskHandle;
-TaskHandle_t ioTaskHandle;
-TaskHandle_t loraTaskHandle;
-TaskHandle_t relaytaskhandle;
-// ----------- Always-on AP (status) --------------
-const char *AP_SSID = "ESP MASTER";
-const char *AP_PASS = "12345678";
-// ---------------- Struct-------------------------
-struct LoRaPacket
-{
-    int id;     // ID node
-    bool data1; // relay state
-    int data2;  // PWM / Slider value
-};
-LoRaPacket packetToSend;
-
-struct LoRaPacketRec
-{
-    int id;
-    float data1;         // temperature
-    unsigned long data2; // timestamp or uptime
-};
-LoRaPacketRec receivedPacket;
-
-struct MasterStation
-{
-    float sensorValues[6];
-    String onTime;
-    String offTime;
-};
-MasterStation master;
-
-struct SlaveStation
-{
-    int id;
-    float temperature;
-    int time;
-    int sliderValue;
-    bool isOn;
-    bool isConnected;
-    String timeString;
-};
-SlaveStation slaves[total_Slave];
-
-struct LoRaPacketSend {
-  int id;
-  float data1;
-  long data2;
-};
-// ---------------- mqtt Server define -------------
-const char *mqtt_server = "broker.hivemq.com";
-const int mqtt_port = 1883;
-bool Lora_status = true;
-// ---------------- menu state ---------------------
-const char *mainMenu[] = {"Time Setting", "Screen Setting", "Internet Setting", "Exits"};
-const int mainMenuCount = 4;
-volatile bool inMenu = false;
-int menuLevel = 0;
-int menuCursor = 0;
-int submenuSelected = -1;
-// --------------- time setting --------------------
-int setHour = 12, setMinute = 0, setSecond = 0;
-int cursorPos = 0;
-bool editingTime = false;
-bool screenFlip = false;
-// --------------- relays (local) ------------------
-bool relayState[4] = {false, false, false, false};
-const int relayPins[4] = {RL1, RL2, RL3, RL4};
-// --------------- fan control ---------------------
-int fanThreshold = 50;
-bool fanState = false;
-// --------------- UI timing -----------------------
-bool datascreenflag = true;
-unsigned long lastActivity = 0;
-const unsigned long standbyTimeout = 15000UL; // ms
-unsigned long timmerAllert = 0;
-// --------------- buzzer (non-blocking) -----------
-unsigned long buzzerStart = 0;
-unsigned long buzzerDuration = 0;
-bool buzzerActive = false;
-int buzzerFrequency = 1000;
-// --------------- icons ----------------------------
-static const unsigned char icon_connected[] = {0x7c, 0x00, 0x82, 0x00, 0x01, 0x01, 0x38, 0x00, 0x44, 0x00, 0x00, 0x00, 0x10, 0x00};
-static const unsigned char icon_disconnect[] = {0x00, 0x01, 0xfc, 0x00, 0xc2, 0x00, 0x21, 0x01, 0x38, 0x00, 0x4c, 0x00, 0x04, 0x00, 0x12, 0x00};
-static const unsigned char icon_Thermal[] = {0xc6, 0x01, 0x29, 0x02, 0x29, 0x00, 0x26, 0x00, 0x20, 0x00, 0x20, 0x00, 0x20, 0x02, 0xc0, 0x01};
-static const unsigned char image_weather_temperature_bits[] = {0x38, 0x00, 0x44, 0x40, 0xd4, 0xa0, 0x54, 0x40, 0xd4, 0x1c, 0x54, 0x06, 0xd4, 0x02, 0x54, 0x02, 0x54, 0x06, 0x92, 0x1c, 0x39, 0x01, 0x75, 0x01, 0x7d, 0x01, 0x39, 0x01, 0x82, 0x00, 0x7c, 0x00};
-// ---------------- Node model -------------------
-#define MAX_NODES 24
-struct Node
-{
-    int id;
-    String label;
-    float voltage;
-    float current;
-    bool relay;
-    bool online;
-};
-Node nodes[MAX_NODES];
-int nodeCount = 0;
-int nextNodeId = 1;
-// ------- forward declarations functions -----------
-void startStatusServer();
-void setRelayLocal(int idx, bool on);
-void initBuzzer();
-void buzzerBeep(int frequency, unsigned long duration);
-void buzzerUpdate();
-void saveToEEPROM(int slaveId, bool isOn, int sliderValue);
-void sendLora(int ID, int stateLed, int valvePwm);
-void handle_api_status();
-void handle_api_relay();
-void handle_api_node_add();
-void handle_api_node_remove();
-void handle_api_node_relay();
-void handle_api_node_dim();
-void handle_api_node_edit();
-void handle_api_config_save();
-void saveNodesPrefs();
-void loadNodesPrefs();
-void addNodeWithId(int id, const String &name, bool relay);
-void addNode(const String &name, float voltage = 0.0, float current = 0.0, bool relay = false);
-void updateNodeFromLoRa(int id, float voltage, float current, bool relay);
-int findNodeIndexById(int id);
-bool removeNodeById(int id);
-float readInternalTemp();
-// ---------------- Init buzzer ---------------------
-void initBuzzer()
-{
-    pinMode(BUZ_PIN, OUTPUT);
-    digitalWrite(BUZ_PIN, LOW);
-}
-// ---------------- Beep buzzer ---------------------
-void buzzerBeep(int frequency, unsigned long duration)
-{
-    // start buzzer non-blocking using ledc
-    buzzerFrequency = frequency;
-    buzzerDuration = duration;
-    buzzerStart = millis();
-    buzzerActive = true;
-    ledcAttachPin(BUZ_PIN, BUZ_CHANNEL);
-    ledcSetup(BUZ_CHANNEL, frequency, 8);
-    ledcWriteTone(BUZ_CHANNEL, frequency);
-}
-// ---------------- Update buzzer -------------------
-void buzzerUpdate()
-{
-    if (buzzerActive && millis() - buzzerStart >= buzzerDuration)
-    {
-        ledcWriteTone(BUZ_CHANNEL, 0); // stop
-        ledcDetachPin(BUZ_PIN);
-        buzzerActive = false;
-    }
-}
-// ---------------- Relay status task ---------------
-void relayStatusTask(void *pvParameters)
-{
-    (void)pvParameters;
-    for (;;)
-    {
-        Serial.println("=== Relay Status & Nodes ===");
-        for (int i = 0; i < 4; i++)
-        {
-            Serial.printf("Relay %d: %s |", i + 1, relayState[i] ? "ON" : "OFF");
-        }
-        Serial.print("\n");
-        Serial.println("--- Nodes ---");
-        for (int i = 0; i < nodeCount; i++)
-        {
-            int nid = nodes[i].id;
-            bool online = nodes[i].online;
-            int slider = 0;
-            bool s_on = false;
-            bool s_conn = false;
-            if (nid > 0 && nid <= total_Slave)
-            {
-                int si = nid - 1;
-                slider = slaves[si].sliderValue;
-                s_on = slaves[si].isOn;
-                s_conn = slaves[si].isConnected;
-            }
-            Serial.printf("Node[%d] id=%d label=\"%s\" relay=%s online=%s slider=%d s_on=%s s_conn=%s\n",
-                          i, nodes[i].id, nodes[i].label.c_str(),
-                          nodes[i].relay ? "ON" : "OFF",
-                          nodes[i].online ? "Y" : "N",
-                          slider,
-                          s_on ? "ON" : "OFF",
-                          s_conn ? "Y" : "N");
-        }
-        Serial.println("============================\n");
-        Serial.printf("inmenu:%d|menulevel:%d|menucursor:%d|submenu:%d\n", inMenu, menuLevel, menuCursor, submenuSelected);
-        Serial.print("============================\n");
-        vTaskDelay(500 / portTICK_PERIOD_MS);
-    }
-}
-// ---------------- Helper: RTC/time ----------------
-extern "C" uint8_t temprature_sens_read();
-// ---------------- Read internal temp --------------
-float readInternalTemp()
-{
-    return (temprature_sens_read() - 32) / 1.8;
-}
-// ---------------- Helper: relays ------------------
-void setRelayLocal(int idx, bool on)
-{
-    if (idx < 0 || idx > 3)
-        return;
-    relayState[idx] = on;
-    digitalWrite(relayPins[idx], on ? HIGH : LOW);
-    buzzerBeep(2000, 80);
-}
-// ---------------- Node helpers --------------------
-void initNodes()
-{
-    LoRa.setPins(LORA_SS, LORA_RST, LORA_DIO);
-    if (!LoRa.begin(433E6))
-    {
-        Serial.println("LoRa initialization failed!");
-        Lora_status = false;
-    }
-    LoRa.setSyncWord(0xF3);
-    nodeCount = 0;
-    nextNodeId = 1;
-    for (int i = 0; i < MAX_NODES; i++)
-    {
-        nodes[i].id = 0;
-        nodes[i].label = "";
-        nodes[i].voltage = 0;
-        nodes[i].current = 0;
-        nodes[i].relay = false;
-        nodes[i].online = false;
-    }
-    for (int i = 0; i < total_Slave; i++)
-    {
-        slaves[i].id = 0;
-        slaves[i].temperature = 0;
-        slaves[i].time = 0;
-        slaves[i].sliderValue = 0;
-        slaves[i].isOn = false;
-        slaves[i].isConnected = false;
-        slaves[i].timeString = "";
-    }
-}
-// ---------------- Find node by ID -----------------
-int findNodeIndexById(int id)
-{
-    for (int i = 0; i < nodeCount; i++)
-        if (nodes[i].id == id)
-            return i;
-    return -1;
-}
-// ---------------- Add node with ID ----------------
-void addNodeWithId(int id, const String &name, bool relay)
-{
-    if (nodeCount >= MAX_NODES)
-        return;
-    // ensure id not duplicate
-    if (findNodeIndexById(id) >= 0)
-        return;
-    nodes[nodeCount].id = id;
-    nodes[nodeCount].label = name;
-    nodes[nodeCount].voltage = 0;
-    nodes[nodeCount].current = 0;
-    nodes[nodeCount].relay = relay;
-    nodes[nodeCount].online = true;
-    nodeCount++;
-    if (id >= nextNodeId)
-        nextNodeId = id + 1;
-
-    // if maps to slave slot, init slave
-    if (id > 0 && id <= total_Slave)
-    {
-        int si = id - 1;
-        slaves[si].id = id;
-        // keep existing slider/isOn if previously stored in EEPROM
-        slaves[si].isConnected = false;
-    }
-    saveNodesPrefs();
-}
-// ---------------- Add node ------------------------
-void addNode(const String &name, float voltage, float current, bool relay)
-{
-    // fallback auto-id behavior: assign nextNodeId
-    addNodeWithId(nextNodeId++, name, relay);
-}
-// ---------------- remove node by ID ---------------
-bool removeNodeById(int id)
-{
-    int idx = findNodeIndexById(id);
-    if (idx < 0)
-        return false;
-    for (int i = idx; i < nodeCount - 1; i++)
-        nodes[i] = nodes[i + 1];
-    nodeCount--;
-    // if mapped to slave, clear slave mapping but keep EEPROM stored data
-    if (id > 0 && id <= total_Slave)
-    {
-        int s = id - 1;
-        slaves[s].id = 0;
-        slaves[s].isConnected = false;
-        // don't erase EEPROM: keep dim/relay state persisted if desired
-    }
-    saveNodesPrefs();
-    return true;
-}
-// ---------------- Update node from LoRa -----------
-void updateNodeFromLoRa(int id, float voltage, float current, bool relay)
-{
-    int idx = findNodeIndexById(id);
-    if (idx >= 0)
-    {
-        nodes[idx].voltage = voltage;
-        nodes[idx].current = current;
-        nodes[idx].relay = relay;
-        nodes[idx].online = true;
-    }
-    else
-    {
-        // if node not present, auto-add with that id and default label
-        if (nodeCount < MAX_NODES)
-        {
-            nodes[nodeCount].id = id;
-            nodes[nodeCount].label = "Node " + String(id);
-            nodes[nodeCount].voltage = voltage;
-            nodes[nodeCount].current = current;
-            nodes[nodeCount].relay = relay;
-            nodes[nodeCount].online = true;
-            nodeCount++;
-            if (id >= nextNodeId)
-                nextNodeId = id + 1;
-            saveNodesPrefs();
-        }
-    }
-}
-// ---------------- Save node into prefs ------------
-void saveNodesPrefs()
-{
-    prefs.begin("nodes", false);
-    prefs.putInt("count", nodeCount);
-    prefs.putInt("nextId", nextNodeId);
-    for (int i = 0; i < nodeCount; i++)
-    {
-        prefs.putInt(("nid" + String(i)).c_str(), nodes[i].id);
-        prefs.putString(("nname" + String(i)).c_str(), nodes[i].label);
-        prefs.putFloat(("nv" + String(i)).c_str(), nodes[i].voltage);
-        prefs.putFloat(("nc" + String(i)).c_str(), nodes[i].current);
-        prefs.putInt(("nr" + String(i)).c_str(), nodes[i].relay ? 1 : 0);
-    }
-    prefs.end();
-
-    // Also save per-slave slider & isOn into EEPROM for persistence
-    for (int i = 0; i < total_Slave; i++)
-    {
-        int addr = i * 8;
-        EEPROM.write(addr, slaves[i].isOn ? 1 : 0);
-        EEPROM.write(addr + 4, slaves[i].sliderValue & 0xFF);
-    }
-    EEPROM.commit();
-}
-// ---------------- Load node Prefs -----------------
-void loadNodesPrefs()
-{
-    prefs.begin("nodes", true);
-    int cnt = prefs.getInt("count", 0);
-    nextNodeId = prefs.getInt("nextId", 1);
-    if (cnt < 0)
-        cnt = 0;
-    nodeCount = 0;
-    for (int i = 0; i < cnt && i < MAX_NODES; i++)
-    {
-        int nid = prefs.getInt(("nid" + String(i)).c_str(), 0);
-        String name = prefs.getString(("nname" + String(i)).c_str(), "");
-        float v = prefs.getFloat(("nv" + String(i)).c_str(), 0.0f);
-        float c = prefs.getFloat(("nc" + String(i)).c_str(), 0.0f);
-        int r = prefs.getInt(("nr" + String(i)).c_str(), 0);
-        nodes[nodeCount].id = nid > 0 ? nid : nextNodeId++;
-        nodes[nodeCount].label = name.length() ? name : String("Node") + String(nodeCount + 1);
-        nodes[nodeCount].voltage = v;
-        nodes[nodeCount].current = c;
-        nodes[nodeCount].relay = (r != 0);
-        nodes[nodeCount].online = true;
-        nodeCount++;
-
-        // map into slaves array if within range
-        int idAssigned = nodes[nodeCount - 1].id;
-        if (idAssigned > 0 && idAssigned <= total_Slave)
-        {
-            int si = idAssigned - 1;
-            slaves[si].id = idAssigned;
-            slaves[si].isOn = nodes[nodeCount - 1].relay;
-            slaves[si].isConnected = false;
-        }
-    }
-    prefs.end();
-
-    // load saved slider & isOn from EEPROM
-    for (int i = 0; i < total_Slave; i++)
-    {
-        int addr = i * 8;
-        uint8_t on = EEPROM.read(addr);
-        uint8_t slider = EEPROM.read(addr + 4);
-        slaves[i].isOn = (on != 0);
-        slaves[i].sliderValue = slider;
-    }
-}
-// ---------------- Status server endpoints ---------
-void handle_api_status()
-{
-    DynamicJsonDocument doc(16384);
-    float t = readInternalTemp();
-    DateTime now = rtc.now();
-    doc["temp"] = t;
-    doc["fan"] = fanState ? 1 : 0;
-    char timestr[16];
-    sprintf(timestr, "%02d:%02d:%02d", now.hour(), now.minute(), now.second());
-    doc["time"] = timestr;
-
-    JsonArray r = doc.createNestedArray("relays");
-    for (int i = 0; i < 4; i++)
-        r.add(relayState[i] ? 1 : 0);
-
-    JsonArray arr = doc.createNestedArray("nodes");
-    for (int i = 0; i < nodeCount; i++)
-    {
-        JsonObject n = arr.createNestedObject();
-        n["id"] = nodes[i].id;
-        n["label"] = nodes[i].label;
-        n["voltage"] = nodes[i].voltage;
-        n["current"] = nodes[i].current;
-        n["relay"] = nodes[i].relay ? 1 : 0;
-        n["online"] = nodes[i].online ? 1 : 0;
-    }
-
-    // slaves array
-    JsonArray sarr = doc.createNestedArray("slaves");
-    for (int i = 0; i < total_Slave; i++)
-    {
-        if (slaves[i].id != 0)
-        {
-            JsonObject s = sarr.createNestedObject();
-            s["id"] = slaves[i].id;
-            s["temperature"] = slaves[i].temperature;
-            s["time"] = slaves[i].time;
-            s["slider"] = slaves[i].sliderValue;
-            s["isOn"] = slaves[i].isOn ? 1 : 0;
-            s["connected"] = slaves[i].isConnected ? 1 : 0;
-        }
-    }
-
-    prefs.begin("wifi", true);
-    String savedSsid = prefs.getString("ssid", "");
-    int savedFan = prefs.getInt("fanThreshold", fanThreshold);
-    prefs.end();
-
-    doc["ssid"] = savedSsid.c_str();
-    doc["fanThreshold"] = savedFan;
-
-    String out;
-    serializeJson(doc, out);
-    statusServer.send(200, "application/json", out);
-}
-// ---------------- Relay API -----------------------
-void handle_api_relay()
-{
-    if (!statusServer.hasArg("ch"))
-    {
-        statusServer.send(400, "text/plain", "missing ch");
-        return;
-    }
-
-    String arg = statusServer.arg("ch");
-
-    if (arg == "all")
-    {
-        // Toggle tất cả relay cùng lúc
-        bool anyOn = false;
-        for (int i = 0; i < 4; i++)
-        {
-            if (relayState[i])
-            {
-                anyOn = true;
-                break;
-            }
-        }
-        // Nếu có ít nhất 1 relay ON thì tắt hết, ngược lại bật hết
-        bool newState = !anyOn;
-        for (int i = 0; i < 4; i++)
-        {
-            setRelayLocal(i, newState);
-        }
-        statusServer.send(200, "application/json", "{\"ok\":1}");
-        return;
-    }
-
-    // Xử lý từng relay riêng lẻ
-    int ch = arg.toInt();
-    if (ch < 0 || ch > 3)
-    {
-        statusServer.send(400, "text/plain", "invalid ch");
-        return;
-    }
-
-    setRelayLocal(ch, !relayState[ch]);
-    statusServer.send(200, "application/json", "{\"ok\":1}");
-}
-// ---------------- Add node ------------------------
-void handle_api_node_add()
-{
-    if (!statusServer.hasArg("id"))
-    {
-        statusServer.send(400, "application/json", "{\"ok\":0,\"msg\":\"Missing id\"}");
-        return;
-    }
-    int id = statusServer.arg("id").toInt();
-    String label = "Node " + String(id);
-
-    // Gửi gói test đến node
-    LoRaPacketRec testCmd;
-    testCmd.id = id;
-    testCmd.data1 = false;
-    testCmd.data2 = 0;
-    LoRa.beginPacket();
-    LoRa.write((uint8_t *)&testCmd, sizeof(testCmd));
-    LoRa.endPacket();
-
-    unsigned long start = millis();
-    bool found = false;
-
-    // Chờ node trả lời trong 500ms
-    while (millis() - start < 500)
-    {
-        int packetSize = LoRa.parsePacket();
-        if (packetSize == sizeof(LoRaPacketSend))
-        {
-            LoRaPacketSend pkt;
-            LoRa.readBytes((uint8_t *)&pkt, sizeof(pkt));
-            if (pkt.id == id)
-            {
-                addNodeWithId(id, label, 0);
-                slaves[id - 1].id = id;
-                slaves[id - 1].temperature = pkt.data1;
-                slaves[id - 1].time = pkt.data2;
-                slaves[id - 1].isConnected = true;
-                found = true;
-                break;
-            }
-        }
-    }
-
-    DynamicJsonDocument doc(128);
-    if (found)
-    {
-        doc["ok"] = 1;
-        doc["msg"] = "Node added";
-    }
-    else
-    {
-        doc["ok"] = 0;
-        doc["msg"] = "No response from node";
-    }
-    String out;
-    serializeJson(doc, out);
-    statusServer.send(200, "application/json", out);
-}
-// ---------------- remove node ---------------------
-void handle_api_node_remove()
-{
-    if (!statusServer.hasArg("node"))
-    {
-        statusServer.send(400, "text/plain", "missing node");
-        return;
-    }
-    int id = statusServer.arg("node").toInt();
-    bool ok = removeNodeById(id);
-    if (!ok)
-        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"not found\"}");
-    else
-        statusServer.send(200, "application/json", "{\"ok\":1}");
-}
-// ---------------- edit node -----------------------
-void handle_api_node_edit()
-{
-    if (!statusServer.hasArg("node"))
-    {
-        statusServer.send(400, "text/plain", "missing node");
-        return;
-    }
-    int nodeId = statusServer.arg("node").toInt();
-    int idx = findNodeIndexById(nodeId);
-    if (idx < 0)
-    {
-        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"node not found\"}");
-        return;
-    }
-    String newLabel = statusServer.arg("name");
-    int newId = nodeId;
-    if (statusServer.hasArg("id"))
-        newId = statusServer.arg("id").toInt();
-
-    // if id changed, ensure not duplicate
-    if (newId != nodeId)
-    {
-        if (findNodeIndexById(newId) >= 0)
-        {
-            statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"id exists\"}");
-            return;
-        }
-    }
-
-    // apply changes
-    int oldId = nodes[idx].id;
-    nodes[idx].label = newLabel.length() ? newLabel : nodes[idx].label;
-    nodes[idx].id = newId;
-
-    // remap slave info if id changed and within range
-    if (oldId != newId)
-    {
-        // clear old slave mapping if existed
-        if (oldId > 0 && oldId <= total_Slave)
-        {
-            int oldsi = oldId - 1;
-            slaves[oldsi].id = 0;
-            slaves[oldsi].isConnected = false;
-        }
-        if (newId > 0 && newId <= total_Slave)
-        {
-            int newsi = newId - 1;
-            slaves[newsi].id = newId;
-            // slider and isOn persisted in EEPROM remain; we leave them.
-            slaves[newsi].isConnected = false;
-        }
-    }
-
-    // ensure nextNodeId updated
-    if (newId >= nextNodeId)
-        nextNodeId = newId + 1;
-
-    saveNodesPrefs();
-
-    statusServer.send(200, "application/json", "{\"ok\":1}");
-}
-// ---------------- Relay node ----------------------
-void handle_api_node_relay()
-{
-    if (!statusServer.hasArg("node"))
-    {
-        statusServer.send(400, "text/plain", "missing node");
-        return;
-    }
-    int id = statusServer.arg("node").toInt();
-    int idx = findNodeIndexById(id);
-    if (idx < 0)
-    {
-        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"node not found\"}");
-        return;
-    }
-    nodes[idx].relay = !nodes[idx].relay;
-    if (id > 0 && id <= total_Slave)
-    {
-        int s = id - 1;
-        slaves[s].isOn = nodes[idx].relay;
-        int addr = s * 8;
-        EEPROM.write(addr, slaves[s].isOn ? 1 : 0);
-        EEPROM.commit();
-        if (slaves[s].id != 0)
-            sendLora(slaves[s].id, slaves[s].isOn ? 1 : 0, slaves[s].sliderValue);
-    }
-    saveNodesPrefs();
-    statusServer.send(200, "application/json", "{\"ok\":1}");
-}
-// ---------------- dimming node --------------------
-void handle_api_node_dim()
-{
-    if (!statusServer.hasArg("node") || !statusServer.hasArg("value"))
-    {
-        statusServer.send(400, "text/plain", "missing params");
-        return;
-    }
-    int id = statusServer.arg("node").toInt();
-    int val = statusServer.arg("value").toInt();
-    if (id <= 0 || id > total_Slave)
-    {
-        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"invalid node id\"}");
-        return;
-    }
-    int sidx = id - 1;
-    slaves[sidx].sliderValue = constrain(val, 0, 255);
-    saveToEEPROM(sidx, slaves[sidx].isOn, slaves[sidx].sliderValue);
-    sendLora(id, slaves[sidx].isOn ? 1 : 0, slaves[sidx].sliderValue);
-
-    statusServer.send(200, "application/json", "{\"ok\":1}");
-}
-// ---------------- config save ---------------------
-void handle_api_config_save()
-{
-    String ssid = statusServer.arg("ssid");
-    String pass = statusServer.arg("pass");
-    int fan = fanThreshold;
-    if (statusServer.hasArg("fan"))
-        fan = statusServer.arg("fan").toInt();
-
-    prefs.begin("wifi", false);
-    if (ssid.length())
-        prefs.putString("ssid", ssid.c_str());
-    if (pass.length())
-        prefs.putString("pass", pass.c_str());
-    prefs.putInt("fanThreshold", fan);
-    prefs.end();
-
-    fanThreshold = fan;
-
-    if (ssid.length())
-    {
-        WiFi.mode(WIFI_AP_STA);
-        WiFi.softAP(AP_SSID, AP_PASS);
-        WiFi.begin(ssid.c_str(), pass.c_str());
-    }
-
-    statusServer.send(200, "application/json", "{\"ok\":1}");
-}
-// ---------------- Start server --------------------
-void startStatusServer()
-{
-    statusServer.on("/", HTTP_GET, []()
-                    { statusServer.send(200, "text/html", status_html); });
-    statusServer.on("/api/status", HTTP_GET, handle_api_status);
-    statusServer.on("/api/relay", HTTP_POST, handle_api_relay);
-    statusServer.on("/api/node/add", HTTP_POST, handle_api_node_add);
-    statusServer.on("/api/node/remove", HTTP_POST, handle_api_node_remove);
-    statusServer.on("/api/node/edit", HTTP_POST, handle_api_node_edit);
-    statusServer.on("/api/node/relay", HTTP_POST, handle_api_node_relay);
-    statusServer.on("/api/node/dim", HTTP_POST, handle_api_node_dim);
-    statusServer.on("/api/config/save", HTTP_POST, handle_api_config_save);
-    statusServer.begin();
-}
-// ---------------- save to EEPROM ------------------
-void saveToEEPROM(int slaveId, bool isOn, int sliderValue)
-{
-    if (slaveId < 0 || slaveId >= total_Slave)
-        return;
-
-    int addr = slaveId * 8;
-    EEPROM.write(addr, isOn ? 1 : 0);
-    EEPROM.write(addr + 4, sliderValue & 0xFF);
-    EEPROM.commit();
-}
-// ---------------- Send data to LoRa nodes ---------
-void sendLora(int ID, int stateLed, int valvePwm)
-{
-    if (ID <= 0 || ID > total_Slave)
-        return;
-    int idx = ID - 1;
-    if (idx < 0 || idx >= total_Slave)
-        return;
-
-    saveToEEPROM(idx, slaves[idx].isOn, slaves[idx].sliderValue);
-    slaves[idx].isConnected = false;
-
-    packetToSend.id = ID;
-    packetToSend.data1 = stateLed ? 1 : 0;
-    packetToSend.data2 = valvePwm;
-
-    LoRa.beginPacket();
-    LoRa.write((uint8_t *)&packetToSend, sizeof(packetToSend));
-    LoRa.endPacket();
-}
-// ================ Connect to WiFi =================
-void connectWiFiSTA()
-{
-    Preferences prefs;
-    prefs.begin("settings", false);
-    String ssid = prefs.getString("sta_ssid", "");
-    String pass = prefs.getString("sta_pass", "");
-    prefs.end();
-
-    if (ssid == "" || pass == "")
-    {
-        Serial.println("[MQTT] Chưa có SSID/PASS trong Preferences!");
-        return;
-    }
-
-    WiFi.mode(WIFI_AP_STA); // vừa AP cho WebPortal, vừa STA để lên internet
-    WiFi.begin(ssid.c_str(), pass.c_str());
-
-    Serial.printf("[MQTT] Connecting to SSID: %s\n", ssid.c_str());
-    unsigned long start = millis();
-    while (WiFi.status() != WL_CONNECTED && millis() - start < 15000)
-    {
-        delay(500);
-        Serial.print(".");
-    }
-
-    if (WiFi.status() == WL_CONNECTED)
-    {
-        Serial.println("\n[MQTT] WiFi STA connected: " + WiFi.localIP().toString());
-    }
-    else
-    {
-        Serial.println("\n[MQTT] WiFi STA connect failed!");
-    }
-}
-// ================ connect to MQTT =================
-void connectMQTT()
-{
-    while (!mqttClient.connected())
-    {
-        Serial.print("Connecting MQTT...");
-        if (mqttClient.connect("ESP32Master"))
-        {
-            Serial.println("connected!");
-            mqttClient.subscribe("esp32/relay/cmd"); // lệnh điều khiển relay
-        }
-        else
-        {
-            Serial.print("failed, rc=");
-            Serial.println(mqttClient.state());
-            delay(2000);
-        }
-    }
-}
-// ================ Publish Status ==================
-void publishStatus()
-{
-    StaticJsonDocument<512> doc;
-    doc["temp"] = readInternalTemp();
-    doc["fan"] = fanState;
-
-    JsonArray rel = doc.createNestedArray("relays");
-    for (int i = 0; i < 4; i++)
-        rel.add(relayState[i]);
-
-    JsonArray sl = doc.createNestedArray("slaves");
-    for (int i = 0; i < total_Slave; i++)
-    {
-        if (slaves[i].id != 0)
-        {
-            JsonObject s = sl.createNestedObject();
-            s["id"] = slaves[i].id;
-            s["relay"] = slaves[i].isOn;
-            s["dimming"] = slaves[i].sliderValue;
-            s["connected"] = slaves[i].isConnected;
-        }
-    }
-
-    char buffer[512];
-    size_t n = serializeJson(doc, buffer);
-    mqttClient.publish("esp32/status", buffer, n);
-}
-// ================ MQTT callback ===================
-void mqttCallback(char *topic, byte *payload, unsigned int length)
-{
-    payload[length] = '\0';
-    String msg = String((char *)payload);
-
-    if (String(topic) == "esp32/relay/cmd")
-    {
-        if (msg == "all_on")
-        {
-            for (int i = 0; i < 4; i++)
-                setRelayLocal(i, true);
-        }
-        else if (msg == "all_off")
-        {
-            for (int i = 0; i < 4; i++)
-                setRelayLocal(i, false);
-        }
-        else
-        {
-            int ch = msg.toInt(); // "0","1","2","3"
-            if (ch >= 0 && ch < 4)
-            {
-                setRelayLocal(ch, !relayState[ch]);
-            }
-        }
-        Serial.printf("[MQTT] Relay cmd: %s\n", msg.c_str());
-    }
-}
-// ---------------- Standby Screen ------------------
-void standby_screen()
-{
-    DateTime now = rtc.now();
-    char tbuf[16];
-    sprintf(tbuf, "%02d:%02d:%02d", now.hour(), now.minute(), now.second());
-    u8g2.setFont(u8g2_font_ncenB18_te);
-    u8g2.setCursor(18, 38);
-    u8g2.print(tbuf);
-}
-// ---------------- Data Screen ---------------------
-void data_screen()
-{
-    // basic data screen + rotating node info
-    u8g2.setCursor(52, 33);
-    u8g2.drawXBM(36, 17, 16, 16, image_weather_temperature_bits);
-    u8g2.setFont(u8g2_font_profont12_tr);
-    u8g2.printf("%.1f", readInternalTemp());
-    u8g2.drawXBM(80, 25, 10, 8, icon_Thermal);
-    DateTime now = rtc.now();
-    char tbuf[16];
-    sprintf(tbuf, "%02d:%02d:%02d", now.hour(), now.minute(), now.second());
-    u8g2.setFont(u8g2_font_12x6LED_mn);
-    u8g2.setCursor(33, 12);
-    u8g2.print(tbuf);
-    u8g2.drawLine(0, 15, 127, 15);
-    u8g2.drawLine(34, 15, 34, 63);
-    u8g2.drawLine(92, 15, 92, 63);
-    u8g2.drawLine(34, 40, 0, 40);
-    u8g2.drawLine(92, 40, 127, 40);
-
-    u8g2.setFont(u8g2_font_6x13_tr);
-    u8g2.setColorIndex(digitalRead(RL1) == HIGH ? 0 : 1);
-    u8g2.drawStr(5, 34, "RL1");
-    u8g2.setColorIndex(digitalRead(RL2) == HIGH ? 0 : 1);
-    u8g2.drawStr(5, 58, "RL2");
-    u8g2.setColorIndex(digitalRead(RL3) == HIGH ? 0 : 1);
-    u8g2.drawStr(99, 34, "RL3");
-    u8g2.setColorIndex(digitalRead(RL4) == HIGH ? 0 : 1);
-    u8g2.drawStr(99, 58, "RL4");
-    u8g2.setColorIndex(1);
-
-    if (WiFi.status())
-    {
-        u8g2.drawXBM(115, 4, 9, 7, icon_connected);
-    }
-    else
-    {
-        u8g2.drawXBM(115, 4, 9, 7, icon_disconnect);
-    }
-
-    // rotate through nodes if exist
-    static unsigned long lastSwitch = 0;
-    static int displayIndex = 0;
-    int validCount = 0;
-    for (int i = 0; i < nodeCount; i++)
-        if (nodes[i].id > 0)
-            validCount++;
-    if (validCount > 0)
-    {
-        if (millis() - lastSwitch >= 3000)
-        {
-            displayIndex = (displayIndex + 1) % validCount;
-            lastSwitch = millis();
-        }
-        // find displayIndex-th valid node
-        int found = -1;
-        int cnt = 0;
-        for (int i = 0; i < nodeCount; i++)
-        {
-            if (nodes[i].id <= 0)
-                continue;
-            if (cnt == displayIndex)
-            {
-                found = i;
-                break;
-            }
-            cnt++;
-        }
-        if (found >= 0)
-        {
-            int nid = nodes[found].id;
-            int slider = 0;
-            bool s_on = false;
-            bool s_conn = false;
-            if (nid > 0 && nid <= total_Slave)
-            {
-                int si = nid - 1;
-                slider = slaves[si].sliderValue;
-                s_on = slaves[si].isOn;
-                s_conn = slaves[si].isConnected;
-            }
-            char buf[32];
-            char buf1[32];
-            snprintf(buf, sizeof(buf), "ID:%d", nid);
-            snprintf(buf1, sizeof(buf1), "Tag: %s", nodes[found].label.c_str());
-            u8g2.setFont(u8g2_font_5x7_mf);
-            u8g2.setCursor(36, 43);
-            u8g2.printf(buf);
-            u8g2.setCursor(36, 51);
-            u8g2.printf(buf1);
-            char buf2[64];
-            snprintf(buf2, sizeof(buf2), "D:%d RL:%s", slider, nodes[found].relay ? "ON" : "OFF", s_conn ? "C" : "D");
-            u8g2.setCursor(36, 60);
-            u8g2.print(buf2);
-        }
-    }
-}
-// ---------------- Display Task --------------------
-void displayTask(void *pvParameters)
-{
-    // esp_task_wdt_init(WDT_TIMEOUT, true);
-    // esp_task_wdt_add(NULL);
-    (void)pvParameters;
-    u8g2.begin();
-    while (1)
-    {
-        u8g2.clearBuffer();
-        if (!inMenu)
-        {
-            if (millis() - lastActivity >= standbyTimeout)
-            {
-                datascreenflag = false;
-                standby_screen();
-            }
-            else
-            {
-                datascreenflag = true;
-                data_screen();
-            }
-        }
-        else
-        {
-            if (menuLevel == 1)
-            {
-                u8g2.setFont(u8g2_font_ncenB08_tr);
-                for (int i = 0; i < mainMenuCount; i++)
-                {
-                    if (i == menuCursor)
-                        u8g2.drawRFrame(0, i * 15, 128, 15, 3);
-                    u8g2.setCursor(6, (i + 1) * 15 - 3);
-                    u8g2.print(mainMenu[i]);
-                }
-            }
-            else if (menuLevel == 2)
-            {
-                if (submenuSelected == 0)
-                {
-                    u8g2.setFont(u8g2_font_ncenB12_te);
-                    u8g2.drawStr(6, 14, "Time Setup");
-                    char buf[20];
-                    sprintf(buf, "%02d:%02d:%02d", setHour, setMinute, setSecond);
-                    u8g2.setCursor(18, 32);
-                    u8g2.print(buf);
-                    if (editingTime)
-                    {
-                        int xPos[] = {18, 42, 66};
-                        u8g2.drawRFrame(xPos[cursorPos], 18, 20, 18, 3);
-                        u8g2.setFont(u8g2_font_6x10_tr);
-                    }
-                }
-                else if (submenuSelected == 1)
-                {
-                    u8g2.setFont(u8g2_font_ncenB08_tr);
-                    u8g2.drawStr(6, 14, "Flip Screen");
-                    u8g2.setCursor(6, 28);
-                    u8g2.print("Enable");
-                    u8g2.setCursor(6, 40);
-                    u8g2.print("Disable");
-                    if (screenFlip)
-                        u8g2.drawRFrame(0, 18, 128, 12, 3);
-                    else
-                        u8g2.drawRFrame(0, 30, 128, 12, 3);
-                }
-                else if (submenuSelected == 2)
-                {
-                    u8g2.setFont(u8g2_font_ncenB08_tr);
-                    u8g2.drawStr(6, 14, "Internet");
-                    prefs.begin("wifi", true);
-                    String ss = prefs.getString("ssid", "");
-                    prefs.end();
-                    u8g2.setCursor(2, 20 + 12);
-                    if (ss.length() == 0)
-                        u8g2.print("No SSID configured");
-                    else
-                    {
-                        u8g2.setFont(u8g2_font_6x10_tr);
-                        u8g2.setCursor(6, 24);
-                        u8g2.printf("SSID: %s", WiFi.SSID().c_str());
-                        u8g2.setCursor(6, 36);
-                        u8g2.printf("IP:%s", WiFi.localIP().toString().c_str());
-                    }
-                }
-                else if (submenuSelected == 3)
-                {
-                    inMenu = false;
-                    menuLevel = 0;
-                }
-            }
-        }
-        u8g2.sendBuffer();
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-    }
-    // esp_task_wdt_reset();
-}
-// ---------------- LoRa Task -----------------------
-void loraTask(void *pvParameters)
-{
-    // esp_task_wdt_init(WDT_TIMEOUT, true);
-    // esp_task_wdt_add(NULL);
-    (void)pvParameters;
-    unsigned long lastSend = 0;
-    while (1)
-    {
-        int packetSize = LoRa.parsePacket();
-        if (packetSize)
-        {
-            if (packetSize == sizeof(LoRaPacketRec))
-            {
-                LoRa.readBytes((uint8_t *)&receivedPacket, sizeof(receivedPacket));
-
-                int id = receivedPacket.id;
-                if (id > 0 && id <= total_Slave)
-                {
-                    int sidx = id - 1;
-                    slaves[sidx].id = id;
-                    slaves[sidx].temperature = receivedPacket.data1;
-                    slaves[sidx].time = (int)receivedPacket.data2;
-                    slaves[sidx].isConnected = true;
-                    slaves[sidx].timeString = String(millis() / 1000) + "s";
-
-                    updateNodeFromLoRa(id, slaves[sidx].temperature, (float)slaves[sidx].time, slaves[sidx].isOn);
-                }
-                Serial.printf("[LoRa RX] id=%d temp=%.2f time=%lu\n", receivedPacket.id, receivedPacket.data1, receivedPacket.data2);
-            }
-            else
-            {
-                uint8_t buf[256];
-                int toRead = min(packetSize, (int)sizeof(buf));
-                LoRa.readBytes(buf, toRead);
-                Serial.printf("[LoRa RX] unexpected size: %d\n", packetSize);
-            }
-        }
-
-        if (millis() - lastSend >= 5000)
-        {
-            for (int i = 0; i < total_Slave; i++)
-            {
-                if (slaves[i].id != 0)
-                {
-                    sendLora(slaves[i].id, slaves[i].isOn ? 1 : 0, slaves[i].sliderValue);
-                }
-            }
-            lastSend = millis();
-        }
-
-        vTaskDelay(50 / portTICK_PERIOD_MS);
-    }
-    // esp_task_wdt_reset();
-}
-// ---------------- IO task (core 1) ----------------
-void ioTask(void *pvParameters)
-{
-    // esp_task_wdt_init(WDT_TIMEOUT, true);
-    // esp_task_wdt_add(NULL);
-    (void)pvParameters;
-    pinMode(BT_UP, INPUT_PULLUP);
-    pinMode(BT_SEL, INPUT_PULLUP);
-    pinMode(BT_DN, INPUT_PULLUP);
-    pinMode(BT_BACK, INPUT_PULLUP);
-    pinMode(BT_BOOT, INPUT_PULLUP);
-    pinMode(BUZ_PIN, OUTPUT);
-    pinMode(FAN_PIN, OUTPUT);
-
-    for (int i = 0; i < 4; i++)
-    {
-        pinMode(relayPins[i], OUTPUT);
-        setRelayLocal(i, relayState[i]);
-    }
-
-    WiFi.mode(WIFI_AP);
-    WiFi.softAP(AP_SSID, AP_PASS);
-    startStatusServer();
-
-    lastActivity = millis();
-
-    unsigned long pressStart[5] = {0, 0, 0, 0, 0};
-    bool pressed[5] = {false, false, false, false, false};
-
-    while (1)
-    {
-        statusServer.handleClient();
-        buzzerUpdate();
-
-        int states[5] = {
-            digitalRead(BT_UP),
-            digitalRead(BT_SEL),
-            digitalRead(BT_DN),
-            digitalRead(BT_BACK),
-            digitalRead(BT_BOOT)};
-
-        if (!inMenu)
-        {
-            for (int b = 0; b < 5; b++)
-            {
-                if (states[b] == LOW)
-                {
-                    if (!pressed[b])
-                    {
-                        pressed[b] = true;
-                        lastActivity = millis();
-                        pressStart[b] = millis();
-                    }
-                    else
-                    {
-                        unsigned long held = millis() - pressStart[b];
-
-                        if (b == 4 && held >= 2000)
-                        {
-                            inMenu = true;
-                            menuLevel = 1;
-                            menuCursor = 0;
-                            submenuSelected = -1;
-                            buzzerBeep(1500, 120);
-                            pressed[b] = false;
-                        }
-                        else if (held >= 2000)
-                        {
-                            setRelayLocal(b, !relayState[b]);
-                            buzzerBeep(1500, 120);
-                            pressed[b] = false;
-                        }
-                    }
-                }
-                else
-                {
-                    pressed[b] = false;
-                }
-            }
-        }
-        if (inMenu)
-        {
-            if (menuLevel == 2 && submenuSelected == 0)
-            {
-                // Time Setting
-                if (digitalRead(BT_UP) == LOW)
-                {
-                    buzzerBeep(1200, 60);
-                    if (cursorPos == 0)
-                        setHour = (setHour + 1) % 24;
-                    else if (cursorPos == 1)
-                        setMinute = (setMinute + 1) % 60;
-                    else
-                        setSecond = (setSecond + 1) % 60;
-                    while (digitalRead(BT_UP) == LOW)
-                        vTaskDelay(10);
-                }
-                if (digitalRead(BT_DN) == LOW)
-                {
-                    buzzerBeep(1200, 60);
-                    if (cursorPos == 0)
-                        setHour = (setHour + 23) % 24;
-                    else if (cursorPos == 1)
-                        setMinute = (setMinute + 59) % 60;
-                    else
-                        setSecond = (setSecond + 59) % 60;
-                    while (digitalRead(BT_DN) == LOW)
-                        vTaskDelay(10);
-                }
-                if (digitalRead(BT_SEL) == LOW)
-                {
-                    buzzerBeep(1000, 60);
-                    cursorPos = (cursorPos + 1) % 3;
-                    editingTime = true;
-                    while (digitalRead(BT_SEL) == LOW)
-                        vTaskDelay(10);
-                }
-                if (digitalRead(BT_BACK) == LOW)
-                {
-                    buzzerBeep(900, 80);
-                    DateTime now = rtc.now();
-                    rtc.adjust(DateTime(now.year(), now.month(), now.day(), setHour, setMinute, setSecond));
-                    menuLevel = 1;
-                    submenuSelected = -1;
-                    editingTime = false;
-                    cursorPos = 0;
-                    while (digitalRead(BT_BACK) == LOW)
-                        vTaskDelay(10);
-                }
-            }
-            else if (menuLevel == 2 && submenuSelected == 1)
-            {
-                // Screen Flip
-                if (digitalRead(BT_UP) == LOW || digitalRead(BT_DN) == LOW)
-                {
-                    buzzerBeep(1000, 50);
-                    screenFlip = !screenFlip;
-                    while (digitalRead(BT_UP) == LOW || digitalRead(BT_DN) == LOW)
-                        vTaskDelay(10);
-                }
-                if (digitalRead(BT_SEL) == LOW)
-                {
-                    buzzerBeep(1000, 80);
-                    if (screenFlip)
-                        u8g2.setDisplayRotation(U8G2_R2);
-                    else
-                        u8g2.setDisplayRotation(U8G2_R0);
-                    while (digitalRead(BT_SEL) == LOW)
-                        vTaskDelay(10);
-                }
-                if (digitalRead(BT_BACK) == LOW)
-                {
-                    buzzerBeep(900, 80);
-                    menuLevel = 1;
-                    submenuSelected = -1;
-                    while (digitalRead(BT_BACK) == LOW)
-                        vTaskDelay(10);
-                }
-            }
-            else
-            {
-                // Menu navigation
-                if (digitalRead(BT_UP) == LOW)
-                {
-                    buzzerBeep(1000, 50);
-                    menuCursor = (menuCursor - 1 + mainMenuCount) % mainMenuCount;
-                    while (digitalRead(BT_UP) == LOW)
-                        vTaskDelay(10);
-                }
-                if (digitalRead(BT_DN) == LOW)
-                {
-                    buzzerBeep(1000, 50);
-                    menuCursor = (menuCursor + 1) % mainMenuCount;
-                    while (digitalRead(BT_DN) == LOW)
-                        vTaskDelay(10);
-                }
-                if (digitalRead(BT_SEL) == LOW)
-                {
-                    buzzerBeep(1000, 80);
-                    if (menuLevel == 1)
-                    {
-                        submenuSelected = menuCursor;
-                        menuLevel = 2;
-                        menuCursor = 0;
-                        if (submenuSelected == 0)
-                        {
-                            DateTime now = rtc.now();
-                            setHour = now.hour();
-                            setMinute = now.minute();
-                            setSecond = now.second();
-                            editingTime = true;
-                        }
-                    }
-                    while (digitalRead(BT_SEL) == LOW)
-                        vTaskDelay(10);
-                }
-
-                if (digitalRead(BT_BACK) == LOW)
-                {
-                    buzzerBeep(1000, 80);
-                    if (menuLevel == 2)
-                    {
-                        menuLevel = 1;
-                        submenuSelected = -1;
-                    }
-                    else
-                    {
-                        inMenu = false;
-                        menuLevel = 0;
-                        submenuSelected = -1;
-                    }
-                    while (digitalRead(BT_BACK) == LOW)
-                        vTaskDelay(10);
-                }
-            }
-        }
-
-        // ----------------------
-        // Fan theo nhiệt độ
-        // ----------------------
-        float t = readInternalTemp();
-        if (t >= fanThreshold)
-        {
-            digitalWrite(FAN_PIN, HIGH);
-            fanState = true;
-        }
-        else
-        {
-            digitalWrite(FAN_PIN, LOW);
-            fanState = false;
-        }
-
-        vTaskDelay(20 / portTICK_PERIOD_MS);
-    }
-    // esp_task_wdt_reset();
-}
-// ---------------- MQTT Task -----------------------
-void mqttTask(void *pvParameters)
-{
-    // esp_task_wdt_init(WDT_TIMEOUT, true);
-    // esp_task_wdt_add(NULL);
-    connectWiFiSTA();
-
-    mqttClient.setServer(mqtt_server, mqtt_port);
-    mqttClient.setCallback(mqttCallback);
-
-    unsigned long lastPub = 0;
-
-    for (;;)
-    {
-        if (WiFi.status() == WL_CONNECTED)
-        {
-            if (!mqttClient.connected())
-            {
-                connectMQTT();
-            }
-            mqttClient.loop();
-
-            if (millis() - lastPub > 5000)
-            {
-                publishStatus();
-                lastPub = millis();
-            }
-        }
-        else
-        {
-            connectWiFiSTA();
-        }
-
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-    }
-    // esp_task_wdt_reset();
-}
-// ---------------- Setup / Loop --------------------
-void setup()
-{
-    Serial.begin(115200);
-    EEPROM.begin(512);
-    if (!rtc.begin())
-    {
-        for (int i = 0; i < 3; i++)
-        {
-            buzzerBeep(2000, 100);
-            vTaskDelay(150 / portTICK_PERIOD_MS);
-        }
-    }
-
-    prefs.begin("wifi", true);
-    if (prefs.isKey("fanThreshold"))
-    {
-        fanThreshold = prefs.getInt("fanThreshold", fanThreshold);
-    }
-    String savedSsid = prefs.getString("ssid", "");
-    String savedPass = prefs.getString("pass", "");
-    prefs.end();
-
-    if (savedSsid.length())
-    {
-        WiFi.mode(WIFI_AP_STA);
-        WiFi.softAP(AP_SSID, AP_PASS);
-        WiFi.begin(savedSsid.c_str(), savedPass.c_str());
-    }
-    initNodes();
-    initBuzzer();
-    loadNodesPrefs();
-
-    prefs.begin("relay", true);
-    if (prefs.isKey("r0"))
-    {
-        relayState[0] = prefs.getInt("r0", 0);
-    }
-    if (prefs.isKey("r1"))
-    {
-        relayState[1] = prefs.getInt("r1", 0);
-    }
-    if (prefs.isKey("r2"))
-    {
-        relayState[2] = prefs.getInt("r2", 0);
-    }
-    if (prefs.isKey("r3"))
-    {
-        relayState[3] = prefs.getInt("r3", 0);
-    }
-    prefs.end();
-
-    pinMode(FAN_PIN, OUTPUT);
-    digitalWrite(FAN_PIN, LOW);
-
-    for (int i = 0; i < 4; i++)
-    {
-        pinMode(relayPins[i], OUTPUT);
-        digitalWrite(relayPins[i], relayState[i] ? HIGH : LOW);
-    }
-
-    xTaskCreatePinnedToCore(displayTask, "DisplayTask", 4096, NULL, 1, &displayTaskHandle, 0);
-    xTaskCreatePinnedToCore(ioTask, "IOTask", 8192, NULL, 1, &ioTaskHandle, 1);
-    xTaskCreatePinnedToCore(loraTask, "LoRaTask", 4096, NULL, 1, &loraTaskHandle, 1);
-    // xTaskCreatePinnedToCore(relayStatusTask, "RelayStatus", 4096, NULL, 1, &relaytaskhandle, 1);
-    xTaskCreatePinnedToCore(mqttTask, "MQTTTask", 4096, NULL, 1, NULL, 1); // chạy core1
-
-    WiFi.mode(WIFI_AP);
-    WiFi.softAP(AP_SSID, AP_PASS);
-    startStatusServer();
-}
-// ---------------- void loop -----------------------
+/* Full ESP32 program - feature update per user:
+   - delete/edit/add node by ID via webportal
+   - add long-press 2s on 4 buttons to toggle 4 relays (SELECT keeps 5s menu)
+   - Implement long-press 2s BOOT button for menu.
+   - display node info (ID, dimming, relay) on data screen, rotate through nodes
+   - relayStatusTask prints node info to Serial
+   - persist node IDs to Preferences
+*/
+
+#include <Arduino.h>
+#include <U8g2lib.h>
+#include <LoRa.h>
+#include <Wire.h>
+#include <WiFi.h>
+#include <RTClib.h>
+#include <EEPROM.h>
+#include <WebServer.h>
+#include <webportal.h>
+#include <Preferences.h>
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <LittleFS.h>
+#include <atomic>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#include <esp_heap_caps.h>
+#include <esp_freertos_hooks.h>
+#include <esp_timer.h>
+#include "core/hal.h"
+#include "core/protocol.h"
+#include "core/command.h"
+#include "core/schedule.h"
+#include "core/rules.h"
+#include "core/groups.h"
+#include "core/api.h"
+#include "core/outbox.h"
+#include "core/payload.h"
+#include "core/seqlock.h"
+#include "core/metrics.h"
+#include "core/deferred.h"
+#include "core/bus.h"
+#include "core/txqueue.h"
+#include "core/registry.h"
+#include "core/display.h"
+// ---------------- Hardware pins --------------------
+#define BT_BOOT 0
+#define BT_UP 35   // UP
+#define BT_SEL 32  // SELECT
+#define BT_DN 33   // DOWN
+#define BT_BACK 25 // BACK
+#define BUZ_PIN 13
+#define FAN_PIN 15
+// ---------------- Relay OUTPUT ---------------------
+#define RL1 12
+#define RL2 14
+#define RL3 27
+#define RL4 26
+#define total_Slave NODE_SLOTS // core/protocol.h
+// ---------------- buzzer LEDC channel --------------
+#define BUZ_CHANNEL 0
+// ---------------- fan LEDC channel -----------------
+#define FAN_CHANNEL 2 // 0/1 share a timer, and the buzzer retunes it
+#define FAN_PWM_HZ 25000
+#define FAN_PWM_BITS 8
+// ---------------- LoRa pins ------------------------
+#define LORA_SS 5
+#define LORA_RST 17
+#define LORA_DIO 2
+// ---------------- watchdog timmer-------------------
+#define WDT_TIMEOUT 10
+#define SUP_PERIOD_MS 1000
+// ---------------- Globals --------------------------
+U8G2_SSD1306_128X64_NONAME_F_HW_I2C u8g2(U8G2_R0);
+RTC_DS3231 rtc;
+Preferences prefs;
+WiFiClient espClient;
+PubSubClient mqttClient(espClient);
+WebServer statusServer(8080);
+// ---------------- Init Task ---------------------
+// Build defaults for the task table (see taskSpecs); any of them can be
+// overridden with -D, and priority/core/stack again per device from NVS.
+#ifndef DISPLAY_STACK
+#define DISPLAY_STACK 4096
+#endif
+#ifndef IO_STACK
+#define IO_STACK 8192
+#endif
+#ifndef LORA_STACK
+#define LORA_STACK 4096
+#endif
+#ifndef MQTT_STACK
+#define MQTT_STACK 6144 // renders the metrics mirror (vsnprintf with floats)
+#endif
+#ifndef SUP_STACK
+#define SUP_STACK 3072
+#endif
+#ifndef SAMPLER_STACK
+#define SAMPLER_STACK 3072
+#endif
+#ifndef UI_STACK
+#define UI_STACK 4096
+#endif
+#ifndef SCHED_STACK
+#define SCHED_STACK 4096
+#endif
+#ifndef DISPLAY_PRIO
+#define DISPLAY_PRIO 1
+#endif
+#ifndef IO_PRIO
+#define IO_PRIO 1
+#endif
+#ifndef LORA_PRIO
+#define LORA_PRIO 1
+#endif
+#ifndef MQTT_PRIO
+#define MQTT_PRIO 1
+#endif
+#ifndef SUP_PRIO
+#define SUP_PRIO 2
+#endif
+#ifndef SAMPLER_PRIO
+#define SAMPLER_PRIO 1
+#endif
+#ifndef UI_PRIO
+#define UI_PRIO 2 // preempts a slow HTTP handler on the same core
+#endif
+#ifndef SCHED_PRIO
+#define SCHED_PRIO 1
+#endif
+#ifndef DISPLAY_CORE
+#define DISPLAY_CORE 0 // shares core 0 with the WiFi stack
+#endif
+#ifndef IO_CORE
+#define IO_CORE 1
+#endif
+#ifndef LORA_CORE
+#define LORA_CORE 1
+#endif
+#ifndef MQTT_CORE
+#define MQTT_CORE 1
+#endif
+#ifndef SUP_CORE
+#define SUP_CORE 0
+#endif
+#ifndef SAMPLER_CORE
+#define SAMPLER_CORE 0
+#endif
+#ifndef UI_CORE
+#define UI_CORE 1 // button interrupts are serviced here too
+#endif
+#ifndef SCHED_CORE
+#define SCHED_CORE 0
+#endif
+#define TASK_PRIO_MAX 5 // well below the WiFi/lwIP tasks
+#define TASK_STACK_MIN 2048
+#define TASK_STACK_MAX 16384
+struct TaskSpec
+{
+    const char *key;  // short name: NVS keys "<key>.p/.c/.s", HTTP, metrics
+    const char *name; // FreeRTOS task name
+    TaskFunction_t fn;
+    uint32_t stack; // bytes
+    UBaseType_t prio;
+    BaseType_t core;
+    TaskHandle_t *handle;
+    int8_t sup;       // SupTask whose loop count gives the wake-ups, -1 = none
+    bool enabled;     // created by setup()
+    bool fromNvs;     // a stored override replaced the build default
+};
+TaskHandle_t displayTaskHandle;
+TaskHandle_t ioTaskHandle;
+TaskHandle_t loraTaskHandle;
+TaskHandle_t relaytaskhandle;
+TaskHandle_t mqttTaskHandle;
+TaskHandle_t supervisorTaskHandle;
+TaskHandle_t samplerTaskHandle;
+TaskHandle_t uiTaskHandle;
+TaskHandle_t schedTaskHandle;
+// ----------- Always-on AP (status) --------------
+const char *AP_SSID = "ESP MASTER";
+const char *AP_PASS = "12345678";
+// ---------------- Struct-------------------------
+// frame layouts: core/protocol.h
+LoRaPacketRec receivedPacket;
+
+struct MasterStation
+{
+    float sensorValues[6];
+    String onTime;
+    String offTime;
+};
+MasterStation master;
+
+struct SlaveStation
+{
+    int id;
+    float temperature;
+    int time;
+    int sliderValue; // dimming target; see slaveLevel() while a fade runs
+    bool isOn;
+    bool isConnected;
+    unsigned long lastSeen; // millis() of the last uplink, 0 = never
+    // node-side fade in progress, fadeMs 0 = none
+    uint8_t fadeFrom;
+    uint8_t fadeCurve; // FadeCurve
+    uint16_t fadeMs;
+    unsigned long fadeStart; // millis() the FADE frame went out
+    bool classA;             // downlinks wait for the node's uplink
+    bool held;               // class-A downlink waiting for that uplink
+};
+SlaveStation slaves[total_Slave];
+
+// ---------------- mqtt Server define -------------
+const char *mqtt_server = "broker.hivemq.com"; // default, overridable via config
+const int mqtt_port = 1883;
+bool Lora_status = true;
+// ---------------- menu state ---------------------
+// Written by uiTask only; displayTask draws from menuView (see menuPublish).
+// The screens themselves are rows of menuScreens[] (Menu engine).
+enum MenuScreenId : int8_t
+{
+    SCR_NONE = -1, // not in the menu
+    SCR_MAIN,
+    SCR_TIME,
+    SCR_FLIP,
+    SCR_NET,
+    SCR_NODES,
+    SCR_COUNT
+};
+int8_t menuScreen = SCR_NONE;
+int menuCursor = 0;
+int menuParentCursor = 0; // restored when BACK returns to the list
+// ---------------- Buttons ------------------------
+// Debounced edges become events: PRESS and RELEASE, LONG once after
+// BTN_LONG_MS held, REPEAT every BTN_REPEAT_MS after BTN_REPEAT_DELAY_MS.
+// Produced by the button driver (ISR + esp_timer), consumed by uiTask.
+#define BTN_DEBOUNCE_MS 30
+#define BTN_LONG_MS 2000
+#define BTN_REPEAT_DELAY_MS 500
+#define BTN_REPEAT_MS 150
+enum ButtonId : uint8_t
+{
+    BTN_UP, // index doubles as the relay a long press toggles
+    BTN_SEL,
+    BTN_DN,
+    BTN_BACK,
+    BTN_BOOT,
+    BTN_COUNT
+};
+enum ButtonEventType : uint8_t
+{
+    BTN_PRESS,
+    BTN_RELEASE,
+    BTN_LONG,
+    BTN_REPEAT
+};
+struct ButtonEvent
+{
+    uint8_t button; // ButtonId
+    uint8_t type;   // ButtonEventType
+};
+const uint8_t buttonPins[BTN_COUNT] = {BT_UP, BT_SEL, BT_DN, BT_BACK, BT_BOOT};
+struct ButtonHw // driver state; ISR and timer callback under buttonMux
+{
+    esp_timer_handle_t timer; // settle check, then LONG/REPEAT while held
+    bool down;                // debounced level
+    bool longSent;
+    uint32_t edgeUs; // last accepted edge
+    uint32_t pressedUs;
+    uint32_t nextRepeatUs;
+};
+struct ButtonStats
+{
+    uint32_t edges;   // interrupts
+    uint32_t bounces; // inside the lockout, or no level change
+    uint32_t settled; // edges first seen by the settle check
+    uint32_t events;  // taken by uiTask
+    uint32_t dropped; // uiQueue full
+};
+ButtonHw buttonHw[BTN_COUNT];
+ButtonStats buttonStats;
+portMUX_TYPE buttonMux = portMUX_INITIALIZER_UNLOCKED;
+// ---------------- UI queue -----------------------
+// uiTask's only wake-up source: button events, and beep requests so a
+// beep starts at once.
+#define UI_QUEUE_LEN 16
+#define UI_IDLE_MS 1000 // heartbeat while nothing happens
+enum UiEventKind : uint8_t
+{
+    UI_EV_BUTTON,
+    UI_EV_BEEP
+};
+struct UiEvent
+{
+    uint8_t kind; // UiEventKind
+    ButtonEvent button;
+    uint32_t atUs; // edge or timer time, for the latency stats
+};
+QueueHandle_t uiQueue = NULL;
+// --------------- time setting --------------------
+int setHour = 12, setMinute = 0, setSecond = 0;
+int cursorPos = 0;
+bool editingTime = false;
+bool screenFlip = false;    // selection in the flip submenu
+bool screenRotated = false; // applied by displayTask, which owns u8g2
+// --------------- relays (local) ------------------
+// relayState, fanState, registry and slaves[] belong to loraTask (the state
+// owner). Other tasks post commands to the bus and read stateView.
+bool relayState[4] = {false, false, false, false};
+const int relayPins[4] = {RL1, RL2, RL3, RL4};
+// --------------- fan control ---------------------
+// On at fanThreshold, off below fanThreshold - hyst, each state held at
+// least its minimum time. Running, the duty is maxDuty, or with the PI
+// curve minDuty + kp * error + integral (error = temp - threshold).
+struct FanTuning
+{
+    float hyst;       // degC
+    bool pi;
+    float kp;         // % per degC
+    float ki;         // % per degC per second
+    uint8_t minDuty;  // %
+    uint8_t maxDuty;  // %
+    uint16_t minOnS;
+    uint16_t minOffS;
+};
+struct FanStats
+{
+    uint32_t switches;  // on/off transitions
+    uint32_t held;      // transitions put off by the minimum on/off time
+    uint64_t onMs;      // runtime
+    uint64_t dutyMs;    // runtime weighted by duty, in full-speed ms
+};
+int fanThreshold = 50; // owner copy, refreshed on CMD_CONFIG
+FanTuning fanTuning = {3.0f, false, 10.0f, 0.5f, 30, 100, 30, 30}; // owner copy
+bool fanState = false;
+uint8_t fanDuty = 0; // % applied to FAN_CHANNEL
+FanStats fanStats;
+// --------------- UI timing -----------------------
+bool datascreenflag = true;
+unsigned long lastActivity = 0; // uiTask
+const unsigned long standbyTimeout = 15000UL; // ms
+unsigned long timmerAllert = 0;
+// --------------- buzzer (non-blocking) -----------
+// Any task may request a beep; uiTask owns LEDC and plays it.
+std::atomic<uint32_t> buzzerRequest(0); // frequency << 16 | duration ms
+unsigned long buzzerStart = 0;
+unsigned long buzzerDuration = 0;
+bool buzzerActive = false;
+int buzzerFrequency = 1000;
+// --------------- icons ----------------------------
+static const unsigned char icon_connected[] = {0x7c, 0x00, 0x82, 0x00, 0x01, 0x01, 0x38, 0x00, 0x44, 0x00, 0x00, 0x00, 0x10, 0x00};
+static const unsigned char icon_disconnect[] = {0x00, 0x01, 0xfc, 0x00, 0xc2, 0x00, 0x21, 0x01, 0x38, 0x00, 0x4c, 0x00, 0x04, 0x00, 0x12, 0x00};
+static const unsigned char icon_Thermal[] = {0xc6, 0x01, 0x29, 0x02, 0x29, 0x00, 0x26, 0x00, 0x20, 0x00, 0x20, 0x00, 0x20, 0x02, 0xc0, 0x01};
+static const unsigned char image_weather_temperature_bits[] = {0x38, 0x00, 0x44, 0x40, 0xd4, 0xa0, 0x54, 0x40, 0xd4, 0x1c, 0x54, 0x06, 0xd4, 0x02, 0x54, 0x02, 0x54, 0x06, 0x92, 0x1c, 0x39, 0x01, 0x75, 0x01, 0x7d, 0x01, 0x39, 0x01, 0x82, 0x00, 0x7c, 0x00};
+// ---------------- Node model -------------------
+// Node, NodeRegistry: core/registry.h. Owner (loraTask) state.
+NodeRegistry registry;
+// ---------------- Groups and scenes ------------
+// NodeGroup, Scene, membership and their NVS blobs: core/groups.h.
+// Edited by ioTask under groupMutex, executed by the state owner.
+#ifndef LORA_MULTICAST
+#define LORA_MULTICAST 1 // 0: nodes without extended frames, fan out unicast
+#endif
+struct GroupStats // owner
+{
+    uint32_t groupCmds;
+    uint32_t sceneCmds;
+    uint32_t frames;     // extended frames sent
+    uint32_t unicast;    // per-node frames (LORA_MULTICAST 0)
+    uint32_t joins;      // membership frames
+    uint32_t nodesSet;   // node states changed by groups and scenes
+};
+NodeGroup groups[GROUP_MAX];
+Scene scenes[SCENE_MAX];
+SemaphoreHandle_t groupMutex = NULL;
+GroupStats groupStats;
+// ---------------- Node fades -------------------
+// Frames and curves: core/protocol.h. The gateway only records where a
+// fade started; the level it expects the node to be at is recomputed
+// from the clock with the node's own curve.
+uint32_t fadeFrames = 0; // owner
+// ---------------- Dim coalescing ---------------
+// Dim and fade commands park in one slot per node; a newer command
+// overwrites the older one (last writer wins) and the slot goes on air
+// DIM_COALESCE_MS after it was first filled. EEPROM commits trail the
+// last change by EEPROM_COMMIT_MS. All owner (loraTask) state.
+#define DIM_COALESCE_MS 150
+#define EEPROM_COMMIT_MS 3000
+struct DimSlot
+{
+    bool pending;
+    uint8_t action; // ACT_DIM or ACT_FADE
+    uint8_t curve;
+    uint8_t value;
+    uint16_t fadeMs;
+    uint8_t txClass;   // TxClass of the command that filled it last
+    unsigned long due; // millis()
+};
+struct DimStats
+{
+    uint32_t posted;     // dim/fade commands executed
+    uint32_t superseded; // overwritten before they reached the radio
+    uint32_t sent;       // frames that left
+    uint32_t commits;    // EEPROM flash writes
+};
+DimSlot dimSlots[total_Slave];
+DimStats dimStats;
+Deferred eepromPending; // core/deferred.h
+// ---------------- TX queue ---------------------
+// Classes, deadlines and weights: core/txqueue.h. Owner (loraTask) state.
+TxQueue txq;
+uint8_t txClassNow = TX_SCHEDULED; // class of frames the owner queues now
+// ---------------- Class-A hold-off -------------
+// A node in class-A mode (SlaveStation.classA) keeps its receiver off
+// except for CLASSA_WINDOW_MS after each of its own uplinks. Nothing is
+// queued for it in between: its downlinks are held here, newest state
+// only, and go out in TX_WINDOW right after the uplink is read. The
+// protocol has no ack, so a state frame is repeated on the following
+// uplinks until CLASSA_SENDS copies have gone out.
+#define CLASSA_SENDS 2
+struct DownlinkHold
+{
+    uint8_t sends;        // state frames still to send, 0 = none held
+    bool fade;            // fadeFrame held
+    uint8_t fadeFrame[8]; // LORA_EXT_FADE
+};
+struct ClassAStats
+{
+    uint32_t held;    // downlinks parked for an uplink
+    uint32_t windows; // uplinks that carried a held downlink back
+};
+DownlinkHold holds[total_Slave];
+ClassAStats classAStats;
+// ---------------- Config model -----------------
+// Settings persisted in the "wifi" NVS namespace. Loaded once at boot by
+// configLoad(); everything else reads the RAM copy.
+#define CFG_WIFI (1u << 0)
+#define CFG_FAN (1u << 1)
+#define CFG_MQTT (1u << 2)
+#define MAX_CONFIG_LISTENERS 6
+struct GatewayConfig
+{
+    String ssid;
+    String pass;
+    int fanThreshold;
+    FanTuning fan;
+    String mqttHost;
+    int mqttPort;
+    bool mqttCbor; // publish CBOR on ".../cbor" topics instead of JSON
+};
+typedef void (*ConfigListener)(uint32_t changed);
+GatewayConfig config;
+SemaphoreHandle_t configMutex = NULL;
+ConfigListener configListeners[MAX_CONFIG_LISTENERS];
+int configListenerCount = 0;
+volatile bool configSsidSet = false;
+// ---------------- Link manager state -----------
+#define LINK_EV_WIFI_UP (1u << 0)
+#define LINK_EV_WIFI_DOWN (1u << 1)
+#define LINK_EV_WIFI_RECONFIG (1u << 2)
+#define LINK_EV_MQTT_RECONFIG (1u << 3)
+#define LINK_EV_STATE (1u << 4) // statePublish(): something to send
+#define LINK_EV_ALL (LINK_EV_WIFI_UP | LINK_EV_WIFI_DOWN | LINK_EV_WIFI_RECONFIG | LINK_EV_MQTT_RECONFIG | LINK_EV_STATE)
+#define WIFI_JOIN_TIMEOUT 15000UL
+#define LINK_BACKOFF_MIN 1000UL
+#define LINK_BACKOFF_MAX 60000UL
+enum LinkState
+{
+    LINK_NO_CONFIG,    // no SSID saved yet
+    LINK_WIFI_WAIT,    // backoff before the next join
+    LINK_WIFI_JOINING, // WiFi.begin() issued, waiting for GOT_IP
+    LINK_MQTT_WAIT,    // WiFi up, backoff before the next broker attempt
+    LINK_ONLINE
+};
+struct LinkStats
+{
+    uint32_t wifiAttempts;
+    uint32_t wifiConnects;
+    uint32_t wifiDrops;
+    uint32_t mqttAttempts;
+    uint32_t mqttConnects;
+    uint32_t mqttDrops;
+    int mqttLastRc;
+    unsigned long wifiUpSince; // millis() of the current session, 0 while down
+    unsigned long mqttUpSince;
+    unsigned long wifiUpTotal; // ms accumulated over closed sessions
+    unsigned long mqttUpTotal;
+};
+EventGroupHandle_t linkEvents = NULL;
+volatile LinkState linkState = LINK_NO_CONFIG;
+LinkStats linkStats;
+// ---------------- MQTT publish cache -----------
+// Last values published per topic; a topic is re-sent only on change.
+#define TELEMETRY_DEADBAND_C 0.5f
+#define NODE_ONLINE_TIMEOUT 15000UL // three refresh periods without uplink
+struct NodePubCache
+{
+    bool stateValid;
+    bool relay;
+    int dim;
+    bool connected;
+    bool telemetryValid;
+    float temperature;
+};
+struct GatewayPubCache
+{
+    bool valid;
+    bool relays[4];
+    bool fan;
+    float temp;
+};
+char gatewayId[16] = "gw-000000";
+char cmdTopicPrefix[32] = ""; // "gateway/<id>/cmd/"
+bool mqttCbor = false;        // payload format in use, owned by mqttTask
+NodePubCache nodePubCache[total_Slave];
+GatewayPubCache gwPubCache;
+// ---------------- Command bus ------------------
+// Every change to relays, nodes and slaves is a message to loraTask, the
+// single owner of that state (and of the radio). Producers (ioTask for
+// HTTP, uiTask for buttons, mqttTask for MQTT) never take a lock: the bus is a bounded
+// multi-producer/single-consumer ring with a sequence number per cell
+// (core/bus.h).
+#define CMD_BATCH_MAX 16
+#define BUS_REPLY_WAIT_MS 2000
+struct CmdStats // MQTT command path, mqttTask
+{
+    uint32_t messages;
+    uint32_t rejected;
+    uint32_t queued;
+    uint32_t dropped;
+    uint32_t parseMaxUs;
+    uint64_t parseTotalUs;
+};
+struct BusStats
+{
+    std::atomic<uint32_t> posted;
+    std::atomic<uint32_t> full; // rejected because the ring was full
+    uint32_t taken;             // owner-side from here on
+    uint32_t depthMax;
+    uint32_t latMaxUs;
+    uint64_t latTotalUs;
+    uint32_t rate; // msg/s over the last second
+};
+// ---------------- Actuator service -------------
+// Local relay intents are collected for ACT_COALESCE_MS and applied in one
+// GPIO pass with one beep. A relay never switches again within
+// RELAY_MIN_SWITCH_MS; a newer intent just replaces the pending one.
+#define ACT_COALESCE_MS 30
+#define RELAY_MIN_SWITCH_MS 500
+#define ACT_LAT_BUCKETS 12
+const uint16_t actLatBoundsMs[ACT_LAT_BUCKETS - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000};
+struct RelayIntent
+{
+    bool pending;
+    bool on;
+    uint8_t priority;
+    uint8_t source;
+    uint32_t postedUs; // oldest intent folded into this one
+};
+struct ActuatorStats
+{
+    uint32_t intents;
+    uint32_t applied;    // GPIO transitions
+    uint32_t coalesced;  // merged into a pending intent, or already in effect
+    uint32_t superseded; // ignored: a higher-priority intent was pending
+    uint32_t limited;    // applies delayed by the switch-rate limit
+    uint32_t batches;
+    uint32_t latMaxMs;
+    uint64_t latTotalMs;
+    uint32_t latHist[ACT_LAT_BUCKETS]; // intent post -> GPIO write
+};
+RelayIntent relayIntent[4];
+unsigned long relayLastSwitch[4];
+bool actPending = false;
+unsigned long actDueAt = 0; // next actuatorService() pass while pending
+ActuatorStats actStats;
+BusRing bus;
+BusStats busStats;
+CmdStats cmdStats;
+uint32_t cmdExecuted = 0; // owner
+// busCall() rendezvous; only ioTask waits, only the owner answers
+SemaphoreHandle_t busReplySem = NULL;
+std::atomic<uint32_t> busReplyToken(0);
+volatile int busReplyResult = 0;
+#define BUS_OK 0
+#define BUS_NOT_FOUND -1
+#define BUS_EXISTS -2
+#define BUS_NO_ANSWER -3
+#define BUS_BUSY -4
+#define BUS_PENDING 1 // owner replies later (node-add probe)
+// ---------------- Node-add probe ---------------
+// The probe is a DISCOVERY frame; the answer arrives through the normal RX
+// path, so loraTask keeps serving commands while it waits.
+#define PROBE_WAIT_MS 500
+struct ProbeState
+{
+    bool active;
+    bool sent;
+    uint32_t sentAt; // sysClock->ms()
+    BusMsg msg; // answered with busReply() when the probe completes
+};
+ProbeState probe;
+// ---------------- Published state --------------
+// The owner copies its state into stateView after each pass that changed
+// something; readers copy it out under a seqlock (odd sequence = write in
+// progress, retry). Writers never wait and readers never block the owner.
+struct GatewayState
+{
+    uint32_t version;
+    bool relays[4];
+    bool fan;
+    uint8_t fanDuty; // %
+    int nodeCount;
+    Node nodes[MAX_NODES];
+    SlaveStation slaves[total_Slave];
+};
+struct MenuView // uiTask -> displayTask
+{
+    int8_t screen; // MenuScreenId, SCR_NONE outside the menu
+    int8_t cursor;
+    int8_t hour, minute, second;
+    int8_t cursorPos;
+    bool editingTime;
+    bool screenFlip;
+    bool screenRotated;
+    unsigned long lastActivity;
+};
+struct SeqStats
+{
+    uint32_t publishes;
+    std::atomic<uint32_t> retries;
+};
+std::atomic<uint32_t> stateSeq(0);
+GatewayState stateView;
+std::atomic<uint32_t> menuSeq(0);
+MenuView menuView;
+SeqStats stateStats;
+// ---------------- Supervisor -------------------
+// Each task loop reports its busy time; the supervisor feeds the task
+// watchdog only while every task has reported within its stall limit.
+#define LOOP_HIST_BUCKETS 16 // bucket b: loop time < 64 us << b, last open
+#define STALL_MAGIC 0x53544C31UL // "STL1"
+enum SupTask
+{
+    SUP_DISPLAY,
+    SUP_IO,
+    SUP_LORA,
+    SUP_MQTT,
+    SUP_SAMPLER,
+    SUP_UI,
+    SUP_SCHED,
+    SUP_COUNT
+};
+struct TaskHealth
+{
+    const char *name;
+    uint32_t stallMs;           // no heartbeat for this long = stalled
+    volatile uint32_t lastBeat; // millis()
+    uint32_t loops;
+    uint32_t maxUs;
+    uint32_t hist[LOOP_HIST_BUCKETS];
+};
+struct StallRecord // survives the watchdog reset in RTC slow memory
+{
+    uint32_t magic;
+    uint32_t resets; // stall resets since power-on
+    int8_t task;     // SupTask
+    uint32_t silentMs;
+    uint32_t uptimeS;
+    uint32_t check; // magic ^ fields, rejects garbage after power-on
+};
+TaskHealth taskHealth[SUP_COUNT] = {
+    {"display", 3000},
+    {"io", 5000},    // busCall() waits up to 2 s
+    {"lora", 3000},  // longest step: one frame on air, ~0.4 s for a full scene at SF7
+    {"mqtt", 15000}, // broker connect, bounded by the socket timeout
+    {"sampler", 3000}, // RTC edge search, up to 1.1 s
+    {"ui", 3000},      // idles on uiQueue for UI_IDLE_MS
+    {"sched", 5000},   // a deferred save writes up to SCHED_MAX records
+};
+RTC_NOINIT_ATTR StallRecord stallRecord;
+StallRecord lastStall; // copy taken at boot, valid if magic matches
+esp_reset_reason_t bootResetReason = ESP_RST_UNKNOWN;
+volatile int supStalled = -1; // SupTask currently stalled, -1 = healthy
+// ---------------- Runtime metrics --------------
+// CPU load is estimated from idle-hook calls: an idle core wakes its idle
+// task about once per tick, a busy one less often. Each second the count
+// is compared with the highest count seen so far (the idle baseline).
+#define METRICS_BUF_SIZE 8192
+#define METRICS_PERIOD_MS 60000UL // MQTT mirror
+volatile uint32_t idleCalls[2];
+// one render buffer for HTTP and the MQTT mirror; both are rare
+SemaphoreHandle_t metricsMutex = NULL;
+char metricsBuf[METRICS_BUF_SIZE];
+GatewayState metricsState;
+struct CpuLoad
+{
+    uint32_t lastCalls[2];
+    uint32_t idleMax[2]; // calls/s baseline
+    uint8_t loadPct[2];
+};
+CpuLoad cpuLoad;
+// ---------------- Wake-up sources --------------
+// Tasks block on a notification or event group rather than a fixed delay.
+// DIO0 wakes loraTask from its ISR, the buttons queue events for uiTask;
+// state and menu
+// publishes wake the display and mqttTask. Timeouts are left only where a
+// deadline exists or a library can only be polled.
+#define OWNER_EV_BUS (1u << 0)   // loraTask: command posted
+#define OWNER_EV_RADIO (1u << 1) // loraTask: DIO0 rose (RxDone)
+#define REFRESH_MS 5000UL        // node state resend
+#define FAN_CHECK_MS 1000UL
+#define IO_POLL_MS 20       // WebServer exposes no socket to wait on
+#define MQTT_POLL_MS 100    // PubSubClient reads its socket only in loop()
+#define MQTT_IDLE_MS 1000   // offline, or nothing changed: link timers, deadbands
+enum WakePath
+{
+    WAKE_RADIO,   // DIO0 edge -> packet read
+    WAKE_BUTTON,  // button edge -> menu action done
+    WAKE_DISPLAY, // publish -> frame sent
+    WAKE_MQTT,    // state publish -> publishChanges() done
+    WAKE_COUNT
+};
+WakeStats wakeStats[WAKE_COUNT] = {{"radio"}, {"button"}, {"display"}, {"mqtt"}};
+std::atomic<uint32_t> wakeSeq[WAKE_COUNT]; // seqlock per path, see wakeRecord()
+volatile uint32_t radioIrqUs = 0;
+std::atomic<uint32_t> displayKickUs(0); // first publish not yet drawn
+std::atomic<uint32_t> mqttKickUs(0);
+// ---------------- Scheduling profiler ----------
+// Every PROF_PERIOD_MS the supervisor reads uxTaskGetSystemState() and
+// keeps per-task CPU share over that window. FreeRTOS keeps no switch
+// counts, so wake-ups (one blocking wait per loop) are given for the
+// tasks in taskSpecs; preemptions are not visible.
+#define PROF_PERIOD_MS 5000UL
+#define PROF_MAX_TASKS 32
+#define PROFILE_BUF_SIZE 6144
+struct ProfEntry
+{
+    TaskHandle_t h;
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t prio;    // current (inherited while holding a mutex)
+    uint8_t basePrio;
+    int8_t core;     // -1 = either core
+    uint16_t cpuPermille; // of one core, over the window
+    uint32_t stackFree;   // bytes, least ever
+    uint32_t runTime;     // counter at the sample, for the next delta
+    int32_t wakes;        // over the window, -1 = not a table task
+};
+struct Profile
+{
+    uint32_t windowMs;
+    uint32_t samples;
+    uint32_t totalRunTime;
+    int count;
+    ProfEntry tasks[PROF_MAX_TASKS];
+};
+std::atomic<uint32_t> profSeq(0);
+Profile profView; // seqlock-published, read by /api/profile
+Profile metricsProfile; // metricsRender()'s copy, under metricsMutex
+// ---------------- Display compositor -----------
+// Tile diff: core/display.h. Screens draw with u8g2 into its buffer,
+// which the display HAL hands to the compositor.
+struct DisplayStats // displayTask only
+{
+    uint32_t frames;     // rendered
+    uint32_t sent;       // frames that changed at least one tile
+    uint32_t fullFrames; // whole-panel sends (first frame)
+    uint32_t tilesSent;
+    uint32_t i2cMaxUs;
+    uint64_t i2cUs;    // diff and send, frames with changes only
+    uint64_t renderUs; // drawing into the buffer (incl. the RTC read)
+};
+uint8_t oledShadow[OLED_BUF_SIZE]; // panel contents
+bool oledShadowValid = false;      // false: next flush sends the whole frame
+DisplayStats dispStats;
+// ---------------- Sensor cache -----------------
+// samplerTask owns the DS3231 and the internal temperature sensor. The RTC
+// is read at boot, after a set, and once a minute to confirm the cached
+// time; in between the time is a second-aligned base plus millis().
+#define SENS_TEMP_PERIOD_MS 500
+#define SENS_TEMP_ALPHA 0.1f // EMA weight of a new sample, ~5 s time constant
+#define SENS_RTC_CHECK_MS 60000UL
+struct SensorView
+{
+    uint32_t rtcBase;   // unix time
+    uint32_t rtcBaseMs; // millis() when the RTC ticked to rtcBase
+    float temp;         // filtered, degC
+    float tempRaw;      // last sample
+};
+struct SensorStats // samplerTask only
+{
+    uint32_t rtcReads;
+    uint32_t rtcSyncs; // edge searches: boot and drift
+    uint32_t rtcSets;
+    uint32_t tempSamples;
+};
+std::atomic<uint32_t> sensSeq(0);
+SensorView sensView;
+SensorStats sensStats;
+std::atomic<uint32_t> sensSetRequest(0); // unix time to write, 0 = none
+bool rtcPresent = false;
+// ---------------- Schedules --------------------
+// Entries, min-heap, clock handling and file format: core/schedule.h.
+// schedTask sleeps until the top entry is due; HTTP edits go through
+// schedMutex and wake it.
+#define SCHED_FILE "/sched.bin"
+#define SCHED_SAVE_DELAY_MS 2000UL     // a burst of edits is written once
+#define SCHED_IDLE_MS 1000UL           // heartbeat and clock-step check
+#define SCHED_RETRY_MS 10              // command bus full
+#define SCHED_PAGE_MAX 100             // entries per GET /api/schedules
+#define SCHED_BUF_SIZE 12288
+SchedTable schedTable; // under schedMutex
+Deferred schedPending; // schedTask: file behind the table
+SemaphoreHandle_t schedMutex = NULL;
+// ---------------- Rules ------------------------
+// Rule model, index and evaluation: core/rules.h. Evaluated by loraTask;
+// fired commands go to the bus.
+#define RULE_FILE "/rules.bin"
+#define RULE_PAGE_MAX 100
+#define RULE_BUF_SIZE 16384
+RuleTable ruleTable; // rules[] written by ioTask (HTTP) only, under ruleMutex
+SemaphoreHandle_t ruleMutex = NULL;
+RuleStats ruleStats; // loraTask, except edits
+// ---------------- MQTT outbox ------------------
+// Record format and ring logic: core/outbox.h.
+#define OUTBOX_FILE "/outbox.bin"
+#define OUTBOX_META "/outbox.meta"
+#define OUTBOX_DRAIN_BURST 4 // per mqttTask pass, ~40 msg/s
+bool outboxReady = false;
+OutboxMeta outbox;
+OutboxStats outboxStats;
+// ---------------- Stats views ------------------
+// Counters stay with the task that updates them. That task copies them
+// out under a seqlock (see State snapshots) at the end of each pass, and
+// /api/status, /api/metrics and the MQTT mirror render from the copies
+// only, so a 64-bit total is never read half-written from another core.
+struct OwnerStatsView // loraTask
+{
+    ActuatorStats act;
+    uint32_t busTaken;
+    uint32_t busDepthMax;
+    uint32_t busLatMaxUs;
+    uint32_t busRate;
+    uint64_t busLatTotalUs;
+    uint32_t cmdExecuted;
+    TxClassStats tx[TX_CLASSES];
+    uint8_t txDepth[TX_CLASSES];
+    FanStats fan;
+    DimStats dim;
+    RuleStats rule;
+    GroupStats group;
+    ClassAStats classA;
+    uint32_t fadeFrames;
+};
+struct MqttStatsView // mqttTask
+{
+    LinkStats link;
+    CmdStats cmd;
+    uint32_t outboxCount;
+    uint32_t outboxBytes;
+    OutboxStats outbox;
+};
+std::atomic<uint32_t> ownerStatsSeq(0);
+OwnerStatsView ownerStatsView;
+std::atomic<uint32_t> mqttStatsSeq(0);
+MqttStatsView mqttStatsView;
+std::atomic<uint32_t> dispStatsSeq(0);
+DisplayStats dispStatsView; // displayTask
+// ---------------- Payload writer ---------------
+// JSON or CBOR into a caller buffer: core/payload.h.
+#define STATUS_BUF_SIZE 8192
+// ------- forward declarations functions -----------
+void startStatusServer();
+void actuatorRequest(int idx, uint8_t action, uint8_t source, uint8_t priority, uint32_t postedUs);
+void initBuzzer();
+void buzzerBeep(int frequency, unsigned long duration);
+void buzzerUpdate();
+void saveToEEPROM(int slaveId, bool isOn, int sliderValue);
+void eepromDefer();
+uint32_t eepromFlush(bool force);
+void sendLora(int ID, int stateLed, int valvePwm);
+void handle_api_status();
+void handle_api_relay();
+void handle_api_node_add();
+void handle_api_node_remove();
+void handle_api_node_relay();
+void handle_api_node_dim();
+void handle_api_node_fade();
+void handle_api_node_mode();
+void handle_api_node_edit();
+void handle_api_config_save();
+void saveNodesPrefs();
+void loadNodesPrefs();
+void addNodeWithId(int id, const String &name, bool relay);
+void addNode(const String &name, float voltage = 0.0, float current = 0.0, bool relay = false);
+void updateNodeFromLoRa(int id, float voltage, float current, bool relay);
+int findNodeIndexById(int id);
+bool removeNodeById(int id);
+float readInternalTemp();
+void configLoad();
+void configSnapshot(GatewayConfig &out);
+void configSubscribe(ConfigListener fn);
+void configSetWifi(const String &ssid, const String &pass);
+void configSetFanThreshold(int threshold);
+void configSetFanTuning(const FanTuning &t);
+void configSetMqtt(const String &host, int port);
+void configSetMqttFormat(bool cbor);
+void mqttApplyBroker();
+const char *linkStateName(LinkState s);
+void mqttTopic(char *out, size_t n, int nid, const char *leaf);
+void mqttOnConnected();
+bool nodeSetRelay(int id, bool on);
+bool nodeSetDim(int id, int value);
+bool nodeFade(int id, int level, int ms, int curve);
+static void groupSendJoins(int id);
+int slaveLevel(const SlaveStation &sl, unsigned long now);
+bool cmdPost(const GatewayCommand &cmd);
+bool busPost(const BusMsg &m);
+int busCall(BusMsg &m);
+void executeCommand(const BusMsg &m);
+void statePublish();
+void stateRead(GatewayState &out);
+void ownerStatsPublish();
+void mqttStatsPublish();
+void menuPublish();
+void menuRead(MenuView &out);
+void supBeat(int task, uint32_t busyUs);
+void supAlive(int task);
+bool idleHookCpu0();
+bool idleHookCpu1();
+void cpuLoadSample();
+int metricsRender(char *buf, size_t cap, const GatewayState &st);
+void handle_api_metrics();
+uint32_t supP99Us(const TaskHealth &h);
+void wakeRecord(int path, uint32_t sinceUs);
+void displayTask(void *pvParameters);
+void ioTask(void *pvParameters);
+void uiTask(void *pvParameters);
+void schedTask(void *pvParameters);
+void loraTask(void *pvParameters);
+void relayStatusTask(void *pvParameters);
+void mqttTask(void *pvParameters);
+void supervisorTask(void *pvParameters);
+void samplerTask(void *pvParameters);
+void sensInit(bool rtcOk);
+uint32_t sensUnixTime();
+DateTime sensNow();
+float sensTemp();
+void sensSetTime(const DateTime &t);
+uint32_t sensMsToNextSecond();
+uint64_t sensUnixMs();
+void schedBegin();
+uint16_t schedPut(const SchedEntry &e);
+bool schedDelete(uint16_t id);
+void rulesBegin();
+void groupsBegin();
+void groupsSave();
+uint16_t rulePut(const Rule &r);
+bool ruleDelete(uint16_t id);
+void rulesOnNode(int id);
+void rulesOnRelay(int idx);
+void taskLayoutLoad();
+void taskLayoutStart();
+void profSample();
+void handle_api_profile();
+void handle_api_tasks();
+void onRadioDio0();
+void onButtonEdge(void *arg);
+void buttonsBegin();
+const char *resetReasonName(esp_reset_reason_t r);
+// ================ HAL (ESP32) ======================
+// Board side of core/hal.h. Everything in core/ reaches the hardware only
+// through these five objects.
+// ---------------- Radio: SX127x over sandeep LoRa -
+struct Esp32Radio : RadioHal
+{
+    void send(const uint8_t *buf, int len) override
+    {
+        LoRa.beginPacket();
+        LoRa.write(buf, len);
+        LoRa.endPacket();
+        LoRa.receive(); // TX leaves the radio in standby
+    }
+    bool rxPending() override
+    {
+        return digitalRead(LORA_DIO) == HIGH;
+    }
+    int receive(uint8_t *buf, int cap) override
+    {
+        int n = LoRa.parsePacket();
+        if (n > 0)
+            LoRa.readBytes(buf, min(n, cap));
+        LoRa.receive(); // parsePacket() left it in standby
+        return n > 0 ? n : 0;
+    }
+};
+// ---------------- Storage: NVS blobs, LittleFS files
+// Files need LittleFS mounted (outboxBegin()).
+struct Esp32Storage : StorageHal
+{
+    size_t load(const char *ns, const char *key, void *buf, size_t len) override
+    {
+        Preferences p;
+        p.begin(ns, true);
+        size_t n = p.getBytesLength(key) == len ? p.getBytes(key, buf, len) : 0;
+        p.end();
+        return n;
+    }
+    bool save(const char *ns, const char *key, const void *buf, size_t len) override
+    {
+        Preferences p;
+        p.begin(ns, false);
+        size_t n = p.putBytes(key, buf, len);
+        p.end();
+        return n == len;
+    }
+    size_t readFile(const char *path, uint32_t pos, void *buf, size_t len) override
+    {
+        File f = LittleFS.open(path, "r");
+        if (!f)
+            return 0;
+        size_t n = f.seek(pos) ? f.read((uint8_t *)buf, len) : 0;
+        f.close();
+        return n;
+    }
+    bool writeFile(const char *path, uint32_t pos, const void *buf, size_t len) override
+    {
+        File f = LittleFS.open(path, pos ? "a" : "w");
+        if (!f)
+            return false;
+        bool ok = f.size() == pos && f.write((const uint8_t *)buf, len) == len;
+        f.close();
+        return ok;
+    }
+};
+// ---------------- Clock: millis() and the RTC cache
+struct Esp32Clock : ClockHal
+{
+    uint32_t ms() override
+    {
+        return millis();
+    }
+    uint64_t unixMs() override
+    {
+        return sensUnixMs();
+    }
+};
+// ---------------- GPIO: pins and LEDC -------------
+struct Esp32Gpio : GpioHal
+{
+    void write(int pin, bool high) override
+    {
+        digitalWrite(pin, high ? HIGH : LOW);
+    }
+    bool read(int pin) override
+    {
+        return digitalRead(pin) == HIGH;
+    }
+    void pwm(int channel, uint32_t duty) override
+    {
+        ledcWrite(channel, duty);
+    }
+};
+// ---------------- Display: SSD1306 through u8g2 --
+// Screens still draw with u8g2 calls; the panel side goes through here.
+struct U8g2Display : DisplayHal
+{
+    uint8_t *frame() override
+    {
+        return u8g2.getBufferPtr();
+    }
+    void sendAll() override
+    {
+        u8g2.sendBuffer();
+    }
+    void sendTiles(int tx, int ty, int tw, int th) override
+    {
+        u8g2.updateDisplayArea(tx, ty, tw, th);
+    }
+    void rotate(bool flipped) override
+    {
+        u8g2.setDisplayRotation(flipped ? U8G2_R2 : U8G2_R0);
+    }
+};
+Esp32Radio esp32Radio;
+Esp32Storage esp32Storage;
+Esp32Clock esp32Clock;
+Esp32Gpio esp32Gpio;
+U8g2Display u8g2Display;
+RadioHal *radio = &esp32Radio;
+StorageHal *storage = &esp32Storage;
+ClockHal *sysClock = &esp32Clock;
+GpioHal *gpio = &esp32Gpio;
+DisplayHal *display = &u8g2Display;
+// ---------------- Task table ----------------------
+TaskSpec taskSpecs[] = {
+    {"display", "DisplayTask", displayTask, DISPLAY_STACK, DISPLAY_PRIO, DISPLAY_CORE, &displayTaskHandle, SUP_DISPLAY, true},
+    {"io", "IOTask", ioTask, IO_STACK, IO_PRIO, IO_CORE, &ioTaskHandle, SUP_IO, true},
+    {"lora", "LoRaTask", loraTask, LORA_STACK, LORA_PRIO, LORA_CORE, &loraTaskHandle, SUP_LORA, true},
+    {"relay", "RelayStatus", relayStatusTask, 4096, 1, 1, &relaytaskhandle, -1, false},
+    {"mqtt", "MQTTTask", mqttTask, MQTT_STACK, MQTT_PRIO, MQTT_CORE, &mqttTaskHandle, SUP_MQTT, true},
+    {"sampler", "Sampler", samplerTask, SAMPLER_STACK, SAMPLER_PRIO, SAMPLER_CORE, &samplerTaskHandle, SUP_SAMPLER, true},
+    {"ui", "UITask", uiTask, UI_STACK, UI_PRIO, UI_CORE, &uiTaskHandle, SUP_UI, true},
+    {"sched", "Scheduler", schedTask, SCHED_STACK, SCHED_PRIO, SCHED_CORE, &schedTaskHandle, SUP_SCHED, true},
+    {"supervisor", "Supervisor", supervisorTask, SUP_STACK, SUP_PRIO, SUP_CORE, &supervisorTaskHandle, -1, true},
+};
+const int taskSpecCount = sizeof(taskSpecs) / sizeof(taskSpecs[0]);
+// ---------------- Init buzzer ---------------------
+void initBuzzer()
+{
+    pinMode(BUZ_PIN, OUTPUT);
+    digitalWrite(BUZ_PIN, LOW);
+}
+// ---------------- Beep buzzer ---------------------
+// Safe from any task: a newer request replaces one not yet played.
+void buzzerBeep(int frequency, unsigned long duration)
+{
+    buzzerRequest.store(((uint32_t)frequency << 16) | (duration & 0xFFFF));
+    if (uiQueue)
+    {
+        UiEvent e = {UI_EV_BEEP};
+        xQueueSend(uiQueue, &e, 0); // full: played on the next wake anyway
+    }
+}
+// ---------------- Update buzzer -------------------
+void buzzerUpdate()
+{
+    uint32_t req = buzzerRequest.exchange(0);
+    if (req)
+    {
+        // start buzzer non-blocking using ledc
+        buzzerFrequency = req >> 16;
+        buzzerDuration = req & 0xFFFF;
+        buzzerStart = millis();
+        buzzerActive = true;
+        ledcAttachPin(BUZ_PIN, BUZ_CHANNEL);
+        ledcSetup(BUZ_CHANNEL, buzzerFrequency, 8);
+        ledcWriteTone(BUZ_CHANNEL, buzzerFrequency);
+    }
+    if (buzzerActive && millis() - buzzerStart >= buzzerDuration)
+    {
+        ledcWriteTone(BUZ_CHANNEL, 0); // stop
+        ledcDetachPin(BUZ_PIN);
+        buzzerActive = false;
+    }
+}
+// ---------------- Relay status task ---------------
+void relayStatusTask(void *pvParameters)
+{
+    (void)pvParameters;
+    static GatewayState st;
+    for (;;)
+    {
+        stateRead(st);
+        Serial.println("=== Relay Status & Nodes ===");
+        for (int i = 0; i < 4; i++)
+        {
+            Serial.printf("Relay %d: %s |", i + 1, st.relays[i] ? "ON" : "OFF");
+        }
+        Serial.print("\n");
+        Serial.println("--- Nodes ---");
+        for (int i = 0; i < st.nodeCount; i++)
+        {
+            int nid = st.nodes[i].id;
+            int slider = 0;
+            bool s_on = false;
+            bool s_conn = false;
+            if (nid > 0 && nid <= total_Slave)
+            {
+                int si = nid - 1;
+                slider = st.slaves[si].sliderValue;
+                s_on = st.slaves[si].isOn;
+                s_conn = st.slaves[si].isConnected;
+            }
+            Serial.printf("Node[%d] id=%d label=\"%s\" relay=%s online=%s slider=%d s_on=%s s_conn=%s\n",
+                          i, st.nodes[i].id, st.nodes[i].label,
+                          st.nodes[i].relay ? "ON" : "OFF",
+                          st.nodes[i].online ? "Y" : "N",
+                          slider,
+                          s_on ? "ON" : "OFF",
+                          s_conn ? "Y" : "N");
+        }
+        Serial.println("============================\n");
+        MenuView mv;
+        menuRead(mv);
+        Serial.printf("menuscreen:%d|menucursor:%d\n", mv.screen, mv.cursor);
+        Serial.print("============================\n");
+        vTaskDelay(500 / portTICK_PERIOD_MS);
+    }
+}
+// ---------------- Helper: RTC/time ----------------
+extern "C" uint8_t temprature_sens_read();
+// ---------------- Read internal temp --------------
+float readInternalTemp()
+{
+    return (temprature_sens_read() - 32) / 1.8;
+}
+// ================ Actuator service ================
+// Runs in the state owner. Buttons, HTTP, MQTT and later schedules all
+// reach the relays through actuatorRequest(); actuatorService() applies
+// the batch. Intent priority: cmdPriority() in core/command.h.
+// ---------------- Queue an intent -----------------
+void actuatorRequest(int idx, uint8_t action, uint8_t source, uint8_t priority, uint32_t postedUs)
+{
+    if (idx < 0 || idx > 3)
+        return;
+    RelayIntent &in = relayIntent[idx];
+    actStats.intents++;
+    if (in.pending && priority < in.priority)
+    {
+        actStats.superseded++;
+        return;
+    }
+    // toggles stack on what is already pending, so two cancel out
+    bool base = in.pending ? in.on : relayState[idx];
+    bool on = action == ACT_TOGGLE ? !base : action == ACT_ON;
+    if (in.pending)
+        actStats.coalesced++; // folded into the pending intent
+    else
+        in.postedUs = postedUs;
+    in.pending = true;
+    in.on = on;
+    in.priority = priority;
+    in.source = source;
+    // the first intent opens the window; later ones ride along with it
+    unsigned long due = millis() + ACT_COALESCE_MS;
+    if (!actPending || (long)(actDueAt - due) > 0)
+        actDueAt = due;
+    actPending = true;
+}
+// ---------------- Latency histogram ---------------
+static void actuatorRecordLatency(uint32_t ms)
+{
+    int b = 0;
+    while (b < ACT_LAT_BUCKETS - 1 && ms > actLatBoundsMs[b])
+        b++;
+    actStats.latHist[b]++;
+    actStats.latTotalMs += ms;
+    if (ms > actStats.latMaxMs)
+        actStats.latMaxMs = ms;
+}
+// ---------------- Apply due intents ---------------
+// Returns ms until it needs to run again, or portMAX_DELAY when idle.
+// Sets *changed when a relay switched.
+uint32_t actuatorService(bool *changed)
+{
+    if (!actPending)
+        return portMAX_DELAY;
+    unsigned long now = millis();
+    long left = (long)(actDueAt - now);
+    if (left > 0)
+        return left;
+
+    uint32_t nowUs = micros();
+    uint32_t wait = portMAX_DELAY;
+    int switched = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        RelayIntent &in = relayIntent[i];
+        if (!in.pending)
+            continue;
+        if (in.on == relayState[i])
+        {
+            in.pending = false; // the burst cancelled itself out
+            actStats.coalesced++;
+            continue;
+        }
+        unsigned long since = now - relayLastSwitch[i];
+        if (relayLastSwitch[i] && since < RELAY_MIN_SWITCH_MS)
+        {
+            uint32_t left = RELAY_MIN_SWITCH_MS - since;
+            if (left < wait)
+                wait = left;
+            actStats.limited++;
+            continue;
+        }
+        gpio->write(relayPins[i], in.on);
+        relayState[i] = in.on;
+        relayLastSwitch[i] = now | 1;
+        rulesOnRelay(i);
+        in.pending = false;
+        actuatorRecordLatency((nowUs - in.postedUs) / 1000);
+        actStats.applied++;
+        switched++;
+    }
+    if (switched)
+    {
+        actStats.batches++;
+        buzzerBeep(2000, 80); // one beep per batch, not per relay
+        *changed = true;
+    }
+    // rate-limited relays keep their intent until their hold-off ends
+    actPending = wait != portMAX_DELAY;
+    actDueAt = now + wait;
+    return wait;
+}
+// ---------------- Node helpers --------------------
+void initNodes()
+{
+    LoRa.setPins(LORA_SS, LORA_RST, LORA_DIO);
+    if (!LoRa.begin(433E6))
+    {
+        Serial.println("LoRa initialization failed!");
+        Lora_status = false;
+    }
+    LoRa.setSyncWord(0xF3);
+    if (Lora_status)
+    {
+        // continuous receive; DIO0 signals RxDone to loraTask
+        pinMode(LORA_DIO, INPUT);
+        attachInterrupt(digitalPinToInterrupt(LORA_DIO), onRadioDio0, RISING);
+        LoRa.receive();
+    }
+    registryClear(registry);
+    for (int i = 0; i < total_Slave; i++)
+    {
+        slaves[i].id = 0;
+        slaves[i].temperature = 0;
+        slaves[i].time = 0;
+        slaves[i].sliderValue = 0;
+        slaves[i].isOn = false;
+        slaves[i].isConnected = false;
+        slaves[i].lastSeen = 0;
+    }
+}
+// ---------------- Find node by ID -----------------
+int findNodeIndexById(int id)
+{
+    return registryFind(registry, id);
+}
+// ---------------- Add node with ID ----------------
+void addNodeWithId(int id, const String &name, bool relay)
+{
+    // full, or the id is taken
+    if (registryAdd(registry, id, name.c_str(), relay) < 0)
+        return;
+
+    // if maps to slave slot, init slave
+    if (id > 0 && id <= total_Slave)
+    {
+        int si = id - 1;
+        slaves[si].id = id;
+        // keep existing slider/isOn if previously stored in EEPROM
+        slaves[si].isConnected = false;
+    }
+    saveNodesPrefs();
+}
+// ---------------- Add node ------------------------
+void addNode(const String &name, float voltage, float current, bool relay)
+{
+    // fallback auto-id behavior: assign registry.nextId
+    addNodeWithId(registry.nextId, name, relay);
+}
+// ---------------- remove node by ID ---------------
+bool removeNodeById(int id)
+{
+    if (!registryRemove(registry, id))
+        return false;
+    // if mapped to slave, clear slave mapping but keep EEPROM stored data
+    if (id > 0 && id <= total_Slave)
+    {
+        int s = id - 1;
+        slaves[s].id = 0;
+        slaves[s].isConnected = false;
+        dimSlots[s].pending = false; // nobody left to send it to
+        memset(&holds[s], 0, sizeof(holds[s]));
+        slaves[s].held = false;
+        // don't erase EEPROM: keep dim/relay state persisted if desired
+    }
+    saveNodesPrefs();
+    return true;
+}
+// ---------------- Update node from LoRa -----------
+void updateNodeFromLoRa(int id, float voltage, float current, bool relay)
+{
+    int idx = findNodeIndexById(id);
+    if (idx >= 0)
+    {
+        registry.nodes[idx].voltage = voltage;
+        registry.nodes[idx].current = current;
+        registry.nodes[idx].relay = relay;
+        registry.nodes[idx].online = true;
+    }
+    else
+    {
+        // if node not present, auto-add with that id and default label
+        char label[NODE_LABEL_LEN];
+        snprintf(label, sizeof(label), "Node %d", id);
+        idx = registryAdd(registry, id, label, relay);
+        if (idx >= 0)
+        {
+            registry.nodes[idx].voltage = voltage;
+            registry.nodes[idx].current = current;
+            saveNodesPrefs();
+        }
+    }
+}
+// ---------------- Save node into prefs ------------
+// Registry blob: core/registry.h. Relay and dim by slot stay in EEPROM.
+void saveNodesPrefs()
+{
+    uint32_t classA = 0; // by slave slot, like the EEPROM state
+    for (int i = 0; i < total_Slave; i++)
+        if (slaves[i].classA)
+            classA |= 1u << i;
+    registrySave(*storage, registry, classA);
+
+    // Also save per-slave slider & isOn into EEPROM for persistence
+    for (int i = 0; i < total_Slave; i++)
+    {
+        int addr = i * 8;
+        EEPROM.write(addr, slaves[i].isOn ? 1 : 0);
+        EEPROM.write(addr + 4, slaves[i].sliderValue & 0xFF);
+    }
+    eepromDefer();
+}
+// ---------------- Legacy node keys ----------------
+// Firmware before the registry blob kept one typed key per field
+// ("nid0", "nname0", ...). Read once, then saved as the blob.
+static uint32_t loadNodesLegacy()
+{
+    prefs.begin("nodes", true);
+    int cnt = prefs.getInt("count", 0);
+    registryClear(registry);
+    registry.nextId = prefs.getInt("nextId", 1);
+    for (int i = 0; i < cnt && i < MAX_NODES; i++)
+    {
+        int nid = prefs.getInt(("nid" + String(i)).c_str(), 0);
+        String name = prefs.getString(("nname" + String(i)).c_str(), "");
+        float v = prefs.getFloat(("nv" + String(i)).c_str(), 0.0f);
+        float c = prefs.getFloat(("nc" + String(i)).c_str(), 0.0f);
+        int r = prefs.getInt(("nr" + String(i)).c_str(), 0);
+        if (!name.length())
+            name = "Node" + String(registry.count + 1);
+        int idx = registryAdd(registry, nid > 0 ? nid : registry.nextId, name.c_str(), r != 0);
+        if (idx < 0)
+            continue; // duplicate id in a damaged record
+        registry.nodes[idx].voltage = v;
+        registry.nodes[idx].current = c;
+    }
+    uint32_t classA = prefs.getUInt("classA", 0);
+    prefs.end();
+    if (cnt)
+        registrySave(*storage, registry, classA);
+    return classA;
+}
+// ---------------- Load node Prefs -----------------
+void loadNodesPrefs()
+{
+    uint32_t classA;
+    int dropped = registryLoad(*storage, registry, classA);
+    if (dropped < 0)
+        classA = loadNodesLegacy();
+    else if (dropped)
+        Serial.printf("[NODE] %d invalid nodes dropped\n", dropped);
+    for (int i = 0; i < registry.count; i++)
+    {
+        // map into slaves array if within range
+        int idAssigned = registry.nodes[i].id;
+        if (idAssigned > 0 && idAssigned <= total_Slave)
+        {
+            int si = idAssigned - 1;
+            slaves[si].id = idAssigned;
+            slaves[si].isOn = registry.nodes[i].relay;
+            slaves[si].isConnected = false;
+        }
+    }
+    for (int i = 0; i < total_Slave; i++)
+        slaves[i].classA = (classA >> i) & 1;
+
+    // load saved slider & isOn from EEPROM
+    for (int i = 0; i < total_Slave; i++)
+    {
+        int addr = i * 8;
+        uint8_t on = EEPROM.read(addr);
+        uint8_t slider = EEPROM.read(addr + 4);
+        slaves[i].isOn = (on != 0);
+        slaves[i].sliderValue = slider;
+    }
+}
+// ---------------- Config service ------------------
+static void configLock()
+{
+    if (configMutex)
+        xSemaphoreTake(configMutex, portMAX_DELAY);
+}
+static void configUnlock()
+{
+    if (configMutex)
+        xSemaphoreGive(configMutex);
+}
+// Listeners run on the caller's task, after the lock is released.
+static void configNotify(uint32_t changed)
+{
+    if (!changed)
+        return;
+    for (int i = 0; i < configListenerCount; i++)
+        configListeners[i](changed);
+}
+// ---------------- Load config once ----------------
+void configLoad()
+{
+    if (!configMutex)
+        configMutex = xSemaphoreCreateMutex();
+
+    Preferences p;
+    p.begin("wifi", false);
+    String ssid = p.getString("ssid", "");
+    String pass = p.getString("pass", "");
+    int fan = p.getInt("fanThreshold", fanThreshold);
+    String host = p.getString("mqttHost", mqtt_server);
+    int port = p.getInt("mqttPort", mqtt_port);
+    bool cbor = p.getInt("mqttFmt", 0) == 1;
+    FanTuning ft;
+    ft.hyst = p.getFloat("fanHyst", fanTuning.hyst);
+    ft.pi = p.getInt("fanPi", fanTuning.pi) == 1;
+    ft.kp = p.getFloat("fanKp", fanTuning.kp);
+    ft.ki = p.getFloat("fanKi", fanTuning.ki);
+    ft.minDuty = p.getInt("fanDmin", fanTuning.minDuty);
+    ft.maxDuty = p.getInt("fanDmax", fanTuning.maxDuty);
+    ft.minOnS = p.getInt("fanMinOn", fanTuning.minOnS);
+    ft.minOffS = p.getInt("fanMinOff", fanTuning.minOffS);
+
+    // older firmware kept STA credentials in "settings"; fold them in once
+    if (ssid.length() == 0)
+    {
+        Preferences legacy;
+        legacy.begin("settings", false);
+        String oldSsid = legacy.getString("sta_ssid", "");
+        String oldPass = legacy.getString("sta_pass", "");
+        if (oldSsid.length())
+        {
+            ssid = oldSsid;
+            pass = oldPass;
+            p.putString("ssid", ssid.c_str());
+            p.putString("pass", pass.c_str());
+            legacy.remove("sta_ssid");
+            legacy.remove("sta_pass");
+            Serial.println("[CFG] migrated STA credentials from \"settings\"");
+        }
+        legacy.end();
+    }
+    p.end();
+
+    configLock();
+    config.ssid = ssid;
+    config.pass = pass;
+    config.fanThreshold = fan;
+    config.fan = ft;
+    config.mqttHost = host.length() ? host : String(mqtt_server);
+    config.mqttPort = port > 0 ? port : mqtt_port;
+    config.mqttCbor = cbor;
+    configSsidSet = ssid.length() > 0;
+    configUnlock();
+
+    fanThreshold = fan;
+    fanTuning = ft;
+}
+// ---------------- Copy config ---------------------
+void configSnapshot(GatewayConfig &out)
+{
+    configLock();
+    out = config;
+    configUnlock();
+}
+// ---------------- Subscribe -----------------------
+void configSubscribe(ConfigListener fn)
+{
+    if (configListenerCount < MAX_CONFIG_LISTENERS)
+        configListeners[configListenerCount++] = fn;
+}
+// ---------------- Set WiFi ------------------------
+void configSetWifi(const String &ssid, const String &pass)
+{
+    configLock();
+    bool changed = !(config.ssid == ssid) || !(config.pass == pass);
+    if (changed)
+    {
+        Preferences p;
+        p.begin("wifi", false);
+        p.putString("ssid", ssid.c_str());
+        p.putString("pass", pass.c_str());
+        p.end();
+        config.ssid = ssid;
+        config.pass = pass;
+        configSsidSet = ssid.length() > 0;
+    }
+    configUnlock();
+    configNotify(changed ? CFG_WIFI : 0);
+}
+// ---------------- Set fan threshold ---------------
+void configSetFanThreshold(int threshold)
+{
+    configLock();
+    bool changed = config.fanThreshold != threshold;
+    if (changed)
+    {
+        Preferences p;
+        p.begin("wifi", false);
+        p.putInt("fanThreshold", threshold);
+        p.end();
+        config.fanThreshold = threshold;
+    }
+    configUnlock();
+    configNotify(changed ? CFG_FAN : 0);
+}
+// ---------------- Set fan tuning ------------------
+// Out-of-range values are clamped, not rejected.
+void configSetFanTuning(const FanTuning &in)
+{
+    FanTuning t = in;
+    t.hyst = constrain(t.hyst, 0.5f, 20.0f);
+    t.kp = constrain(t.kp, 0.0f, 100.0f);
+    t.ki = constrain(t.ki, 0.0f, 10.0f);
+    t.maxDuty = constrain(t.maxDuty, 10, 100);
+    t.minDuty = constrain(t.minDuty, 0, t.maxDuty);
+    t.minOnS = min(t.minOnS, (uint16_t)3600);
+    t.minOffS = min(t.minOffS, (uint16_t)3600);
+    configLock();
+    const FanTuning &c = config.fan;
+    bool changed = c.hyst != t.hyst || c.pi != t.pi || c.kp != t.kp || c.ki != t.ki ||
+                   c.minDuty != t.minDuty || c.maxDuty != t.maxDuty ||
+                   c.minOnS != t.minOnS || c.minOffS != t.minOffS;
+    if (changed)
+    {
+        Preferences p;
+        p.begin("wifi", false);
+        p.putFloat("fanHyst", t.hyst);
+        p.putInt("fanPi", t.pi ? 1 : 0);
+        p.putFloat("fanKp", t.kp);
+        p.putFloat("fanKi", t.ki);
+        p.putInt("fanDmin", t.minDuty);
+        p.putInt("fanDmax", t.maxDuty);
+        p.putInt("fanMinOn", t.minOnS);
+        p.putInt("fanMinOff", t.minOffS);
+        p.end();
+        config.fan = t;
+    }
+    configUnlock();
+    configNotify(changed ? CFG_FAN : 0);
+}
+// ---------------- Set MQTT broker -----------------
+void configSetMqtt(const String &host, int port)
+{
+    if (host.length() == 0 || port <= 0 || port > 65535)
+        return;
+    configLock();
+    bool changed = !(config.mqttHost == host) || config.mqttPort != port;
+    if (changed)
+    {
+        Preferences p;
+        p.begin("wifi", false);
+        p.putString("mqttHost", host.c_str());
+        p.putInt("mqttPort", port);
+        p.end();
+        config.mqttHost = host;
+        config.mqttPort = port;
+    }
+    configUnlock();
+    configNotify(changed ? CFG_MQTT : 0);
+}
+// ---------------- Set MQTT payload format ---------
+void configSetMqttFormat(bool cbor)
+{
+    configLock();
+    bool changed = config.mqttCbor != cbor;
+    if (changed)
+    {
+        Preferences p;
+        p.begin("wifi", false);
+        p.putInt("mqttFmt", cbor ? 1 : 0);
+        p.end();
+        config.mqttCbor = cbor;
+    }
+    configUnlock();
+    configNotify(changed ? CFG_MQTT : 0);
+}
+// ---------------- Config subscribers --------------
+void onConfigChanged(uint32_t changed)
+{
+    // the fan settings are read by the state owner; let it pick them up
+    if (changed & CFG_FAN)
+    {
+        BusMsg m = {};
+        m.cmd.target = CMD_CONFIG;
+        m.cmd.source = CMD_SRC_SYSTEM;
+        m.cmd.id = (uint16_t)changed;
+        busPost(m);
+    }
+
+    // WiFi and mqttClient belong to the link manager in mqttTask
+    if (linkEvents && (changed & CFG_WIFI))
+        xEventGroupSetBits(linkEvents, LINK_EV_WIFI_RECONFIG);
+    if (linkEvents && (changed & CFG_MQTT))
+        xEventGroupSetBits(linkEvents, LINK_EV_MQTT_RECONFIG);
+}
+// ================ Wake-ups ========================
+// ISRs only stamp the time and notify; the task does the work.
+void IRAM_ATTR onRadioDio0()
+{
+    BaseType_t woken = pdFALSE;
+    radioIrqUs = micros();
+    if (loraTaskHandle)
+        xTaskNotifyFromISR(loraTaskHandle, OWNER_EV_RADIO, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+// ---------------- Event -> action latency ---------
+// Each path has one writer, the woken task; it brackets the update with
+// its own seqlock for the status readers.
+void wakeRecord(int path, uint32_t sinceUs)
+{
+    wakeAdd(wakeStats[path], wakeSeq[path], micros() - sinceUs);
+}
+// ---------------- Mark a reader kick --------------
+// Keeps the oldest unserved stamp, so the latency covers the whole wait.
+static void wakeStamp(std::atomic<uint32_t> &kick)
+{
+    uint32_t none = 0;
+    kick.compare_exchange_strong(none, micros() | 1, std::memory_order_relaxed);
+}
+// ================ Command bus =====================
+// The ring of core/bus.h plus the owner wake-up and the statistics.
+void busInit()
+{
+    busRingInit(bus);
+    busReplySem = xSemaphoreCreateBinary();
+}
+// ---------------- Post (any task) -----------------
+bool busPost(const BusMsg &m)
+{
+    if (!busRingPost(bus, m, micros()))
+    {
+        busStats.full.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    busStats.posted.fetch_add(1, std::memory_order_relaxed);
+    if (loraTaskHandle)
+        xTaskNotify(loraTaskHandle, OWNER_EV_BUS, eSetBits);
+    return true;
+}
+// ---------------- Take (owner only) ---------------
+bool busTake(BusMsg &out)
+{
+    if (!busRingTake(bus, out))
+        return false;
+
+    uint32_t lat = micros() - out.postedUs;
+    uint32_t depth = busRingDepth(bus);
+    busStats.taken++;
+    busStats.latTotalUs += lat;
+    if (lat > busStats.latMaxUs)
+        busStats.latMaxUs = lat;
+    if (depth > busStats.depthMax)
+        busStats.depthMax = depth;
+    return true;
+}
+// ---------------- Owner answers a busCall ---------
+void busReply(const BusMsg &m, int result)
+{
+    if (!m.token)
+        return;
+    busReplyResult = result;
+    busReplyToken.store(m.token, std::memory_order_release);
+    xSemaphoreGive(busReplySem);
+}
+// ---------------- Post and wait (ioTask) ----------
+// For HTTP handlers that must report the outcome. A reply that arrives
+// after its caller gave up carries an old token and is skipped.
+int busCall(BusMsg &m)
+{
+    static uint32_t token = 0;
+    if (++token == 0)
+        token = 1;
+    m.token = token;
+    if (!busPost(m))
+        return BUS_BUSY;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t wait = BUS_REPLY_WAIT_MS / portTICK_PERIOD_MS;
+    for (;;)
+    {
+        TickType_t spent = xTaskGetTickCount() - start;
+        if (spent >= wait || xSemaphoreTake(busReplySem, wait - spent) != pdTRUE)
+            return BUS_BUSY;
+        if (busReplyToken.load(std::memory_order_acquire) == token)
+            return busReplyResult;
+    }
+}
+// ---------------- Bus throughput (msg/s) ----------
+void busUpdateRate()
+{
+    static unsigned long windowStart = 0;
+    static uint32_t takenAtStart = 0;
+    unsigned long now = millis();
+    if (now - windowStart >= 1000)
+    {
+        busStats.rate = busStats.taken - takenAtStart;
+        takenAtStart = busStats.taken;
+        windowStart = now;
+    }
+}
+// ================ State snapshots =================
+// Seqlocks (core/seqlock.h); a reader that keeps racing the writer
+// sleeps a tick between tries.
+static void seqYield()
+{
+    vTaskDelay(1);
+}
+static void seqRead(std::atomic<uint32_t> &seq, void *dst, const void *src, size_t n)
+{
+    stateStats.retries.fetch_add(seqCopy(seq, dst, src, n, seqYield), std::memory_order_relaxed);
+}
+// ---------------- Owner: publish ------------------
+void statePublish()
+{
+    static GatewayState next; // staging copy, keeps the seqlock window short
+    next.version = stateStats.publishes + 1;
+    for (int i = 0; i < 4; i++)
+        next.relays[i] = relayState[i];
+    next.fan = fanState;
+    next.fanDuty = fanDuty;
+    next.nodeCount = registry.count;
+    memcpy(next.nodes, registry.nodes, sizeof(registry.nodes));
+    memcpy(next.slaves, slaves, sizeof(slaves));
+    seqWrite(stateSeq, &stateView, &next, sizeof(next));
+    stateStats.publishes++;
+
+    wakeStamp(displayKickUs);
+    if (displayTaskHandle)
+        xTaskNotifyGive(displayTaskHandle);
+    wakeStamp(mqttKickUs);
+    if (linkEvents)
+        xEventGroupSetBits(linkEvents, LINK_EV_STATE);
+}
+// ---------------- Readers -------------------------
+void stateRead(GatewayState &out)
+{
+    seqRead(stateSeq, &out, &stateView, sizeof(out));
+}
+// ---------------- Owner: publish counters ---------
+// End of every loraTask pass; a few hundred bytes, no wake-ups.
+void ownerStatsPublish()
+{
+    static OwnerStatsView v;
+    v.act = actStats;
+    v.busTaken = busStats.taken;
+    v.busDepthMax = busStats.depthMax;
+    v.busLatMaxUs = busStats.latMaxUs;
+    v.busRate = busStats.rate;
+    v.busLatTotalUs = busStats.latTotalUs;
+    v.cmdExecuted = cmdExecuted;
+    for (int c = 0; c < TX_CLASSES; c++)
+    {
+        v.tx[c] = txq.stats[c];
+        v.txDepth[c] = txq.rings[c].count;
+    }
+    v.fan = fanStats;
+    v.dim = dimStats;
+    v.rule = ruleStats;
+    v.group = groupStats;
+    v.classA = classAStats;
+    v.fadeFrames = fadeFrames;
+    seqWrite(ownerStatsSeq, &ownerStatsView, &v, sizeof(v));
+}
+// ---------------- mqttTask: publish counters ------
+void mqttStatsPublish()
+{
+    static MqttStatsView v;
+    v.link = linkStats;
+    v.cmd = cmdStats;
+    v.outboxCount = outbox.count;
+    v.outboxBytes = outbox.bytes;
+    v.outbox = outboxStats;
+    seqWrite(mqttStatsSeq, &mqttStatsView, &v, sizeof(v));
+}
+// ---------------- uiTask: publish menu ------------
+void menuPublish()
+{
+    static MenuView last;
+    MenuView v;
+    memset(&v, 0, sizeof(v)); // padding too, for the compare below
+    v.screen = menuScreen;
+    v.cursor = menuCursor;
+    v.hour = setHour;
+    v.minute = setMinute;
+    v.second = setSecond;
+    v.cursorPos = cursorPos;
+    v.editingTime = editingTime;
+    v.screenFlip = screenFlip;
+    v.screenRotated = screenRotated;
+    v.lastActivity = lastActivity;
+    // called every uiTask pass; only a real change costs a frame
+    if (memcmp(&v, &last, sizeof(v)) == 0)
+        return;
+    last = v;
+    seqWrite(menuSeq, &menuView, &v, sizeof(v));
+    wakeStamp(displayKickUs);
+    if (displayTaskHandle)
+        xTaskNotifyGive(displayTaskHandle);
+}
+void menuRead(MenuView &out)
+{
+    seqRead(menuSeq, &out, &menuView, sizeof(out));
+}
+// ================ Sensor cache ====================
+// Readers copy SensorView under the seqlock and extrapolate; no I2C, no
+// ADC, constant time from any task.
+static uint32_t rtcRead()
+{
+    sensStats.rtcReads++;
+    return rtc.now().unixtime();
+}
+// ---------------- Find the RTC second edge --------
+// The DS3231 reports whole seconds only. Polling until it ticks puts the
+// base on the edge, so the extrapolated time is right to within ~10 ms.
+static void rtcSync(SensorView &v)
+{
+    uint32_t first = rtcRead();
+    uint32_t t = first;
+    unsigned long start = millis();
+    while (t == first && millis() - start < 1100)
+    {
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+        t = rtcRead();
+    }
+    v.rtcBase = t;
+    v.rtcBaseMs = millis();
+    sensStats.rtcSyncs++;
+}
+// ---------------- Boot (setup) --------------------
+// One plain read so readers have a time before samplerTask runs; the
+// task then moves the base onto the second edge.
+void sensInit(bool rtcOk)
+{
+    rtcPresent = rtcOk;
+    SensorView v;
+    v.rtcBase = rtcPresent ? rtcRead() : 0;
+    v.rtcBaseMs = millis();
+    v.tempRaw = readInternalTemp();
+    v.temp = v.tempRaw;
+    sensStats.tempSamples = 1;
+    seqWrite(sensSeq, &sensView, &v, sizeof(v));
+}
+// ---------------- Readers -------------------------
+uint32_t sensUnixTime()
+{
+    SensorView v;
+    seqRead(sensSeq, &v, &sensView, sizeof(v));
+    return v.rtcBase + (millis() - v.rtcBaseMs) / 1000;
+}
+DateTime sensNow()
+{
+    return DateTime(sensUnixTime());
+}
+float sensTemp()
+{
+    SensorView v;
+    seqRead(sensSeq, &v, &sensView, sizeof(v));
+    return v.temp;
+}
+uint64_t sensUnixMs()
+{
+    SensorView v;
+    seqRead(sensSeq, &v, &sensView, sizeof(v));
+    return (uint64_t)v.rtcBase * 1000 + (millis() - v.rtcBaseMs);
+}
+uint32_t sensMsToNextSecond()
+{
+    SensorView v;
+    seqRead(sensSeq, &v, &sensView, sizeof(v));
+    return 1000 - (millis() - v.rtcBaseMs) % 1000;
+}
+// ---------------- Set the clock (any task) --------
+void sensSetTime(const DateTime &t)
+{
+    sensSetRequest.store(t.unixtime());
+    if (samplerTaskHandle)
+        xTaskNotifyGive(samplerTaskHandle);
+}
+// ================ Message schemas =================
+// Gateway and node payloads: core/payload.h.
+// ---------------- Status document ----------------
+void schemaStatus(PayloadWriter &w, const GatewayState &st)
+{
+    static OwnerStatsView own; // ioTask only
+    static MqttStatsView mq;
+    seqRead(ownerStatsSeq, &own, &ownerStatsView, sizeof(own));
+    seqRead(mqttStatsSeq, &mq, &mqttStatsView, sizeof(mq));
+    float t = sensTemp();
+    DateTime now = sensNow();
+    char timestr[16];
+    sprintf(timestr, "%02d:%02d:%02d", now.hour(), now.minute(), now.second());
+
+    w.beginMap();
+    w.key("temp");
+    w.real(t, 2);
+    w.key("fan");
+    w.num(st.fan ? 1 : 0);
+    w.key("fanDuty");
+    w.num(st.fanDuty);
+    w.key("gatewayId");
+    w.str(gatewayId);
+    w.key("time");
+    w.str(timestr);
+
+    w.key("relays");
+    w.beginArray();
+    for (int i = 0; i < 4; i++)
+        w.num(st.relays[i] ? 1 : 0);
+    w.endArray();
+
+    w.key("nodes");
+    w.beginArray();
+    for (int i = 0; i < st.nodeCount; i++)
+    {
+        const Node &n = st.nodes[i];
+        w.beginMap();
+        w.key("id");
+        w.num(n.id);
+        w.key("label");
+        w.str(n.label);
+        w.key("voltage");
+        w.real(n.voltage, 2);
+        w.key("current");
+        w.real(n.current, 2);
+        w.key("relay");
+        w.num(n.relay ? 1 : 0);
+        w.key("online");
+        w.num(n.online ? 1 : 0);
+        w.endMap();
+    }
+    w.endArray();
+
+    w.key("slaves");
+    w.beginArray();
+    for (int i = 0; i < total_Slave; i++)
+    {
+        const SlaveStation &sl = st.slaves[i];
+        if (sl.id == 0)
+            continue;
+        w.beginMap();
+        w.key("id");
+        w.num(sl.id);
+        w.key("temperature");
+        w.real(sl.temperature, 2);
+        w.key("time");
+        w.num(sl.time);
+        w.key("slider");
+        w.num(sl.sliderValue);
+        unsigned long now = millis();
+        w.key("level"); // expected, differs from slider while fading
+        w.num(slaveLevel(sl, now));
+        w.key("fadeLeft");
+        w.num(sl.fadeMs && now - sl.fadeStart < sl.fadeMs ? sl.fadeMs - (now - sl.fadeStart) : 0);
+        w.key("classA");
+        w.num(sl.classA ? 1 : 0);
+        w.key("held"); // class-A downlink waiting for the next uplink
+        w.num(sl.held ? 1 : 0);
+        w.key("isOn");
+        w.num(sl.isOn ? 1 : 0);
+        w.key("connected");
+        w.num(sl.isConnected ? 1 : 0);
+        w.endMap();
+    }
+    w.endArray();
+
+    GatewayConfig c;
+    configSnapshot(c);
+    w.key("ssid");
+    w.str(c.ssid.c_str());
+    w.key("fanThreshold");
+    w.num(c.fanThreshold);
+    w.key("fanTuning");
+    w.beginMap();
+    w.key("hyst");
+    w.real(c.fan.hyst, 1);
+    w.key("pi");
+    w.boolean(c.fan.pi);
+    w.key("kp");
+    w.real(c.fan.kp, 2);
+    w.key("ki");
+    w.real(c.fan.ki, 3);
+    w.key("minDuty");
+    w.num(c.fan.minDuty);
+    w.key("maxDuty");
+    w.num(c.fan.maxDuty);
+    w.key("minOnS");
+    w.num(c.fan.minOnS);
+    w.key("minOffS");
+    w.num(c.fan.minOffS);
+    w.endMap();
+    w.key("mqttHost");
+    w.str(c.mqttHost.c_str());
+    w.key("mqttPort");
+    w.num(c.mqttPort);
+    w.key("mqttFormat");
+    w.str(c.mqttCbor ? "cbor" : "json");
+
+    // link manager: attempts, drops and session uptime (s)
+    unsigned long ms = millis();
+    w.key("link");
+    w.beginMap();
+    w.key("state");
+    w.str(linkStateName(linkState));
+    w.key("wifiAttempts");
+    w.num(mq.link.wifiAttempts);
+    w.key("wifiConnects");
+    w.num(mq.link.wifiConnects);
+    w.key("wifiDrops");
+    w.num(mq.link.wifiDrops);
+    w.key("wifiUp");
+    w.num(mq.link.wifiUpSince ? (ms - mq.link.wifiUpSince) / 1000 : 0);
+    w.key("wifiUpTotal");
+    w.num((mq.link.wifiUpTotal + (mq.link.wifiUpSince ? ms - mq.link.wifiUpSince : 0)) / 1000);
+    w.key("mqttAttempts");
+    w.num(mq.link.mqttAttempts);
+    w.key("mqttConnects");
+    w.num(mq.link.mqttConnects);
+    w.key("mqttDrops");
+    w.num(mq.link.mqttDrops);
+    w.key("mqttLastRc");
+    w.num(mq.link.mqttLastRc);
+    w.key("mqttUp");
+    w.num(mq.link.mqttUpSince ? (ms - mq.link.mqttUpSince) / 1000 : 0);
+    w.key("mqttUpTotal");
+    w.num((mq.link.mqttUpTotal + (mq.link.mqttUpSince ? ms - mq.link.mqttUpSince : 0)) / 1000);
+    w.key("uptime");
+    w.num(ms / 1000);
+    w.endMap();
+
+    w.key("cmd");
+    w.beginMap();
+    w.key("messages");
+    w.num(mq.cmd.messages);
+    w.key("rejected");
+    w.num(mq.cmd.rejected);
+    w.key("queued");
+    w.num(mq.cmd.queued);
+    w.key("dropped");
+    w.num(mq.cmd.dropped);
+    w.key("executed");
+    w.num(own.cmdExecuted);
+    w.key("parseAvgUs");
+    w.num(mq.cmd.messages ? mq.cmd.parseTotalUs / mq.cmd.messages : 0);
+    w.key("parseMaxUs");
+    w.num(mq.cmd.parseMaxUs);
+    w.endMap();
+
+    w.key("actuator");
+    w.beginMap();
+    w.key("intents");
+    w.num(own.act.intents);
+    w.key("applied");
+    w.num(own.act.applied);
+    w.key("coalesced");
+    w.num(own.act.coalesced);
+    w.key("superseded");
+    w.num(own.act.superseded);
+    w.key("limited");
+    w.num(own.act.limited);
+    w.key("batches");
+    w.num(own.act.batches);
+    w.key("latMaxMs");
+    w.num(own.act.latMaxMs);
+    w.key("latBoundsMs"); // upper bounds; the last bucket is open-ended
+    w.beginArray();
+    for (int i = 0; i < ACT_LAT_BUCKETS - 1; i++)
+        w.num(actLatBoundsMs[i]);
+    w.endArray();
+    w.key("latHist");
+    w.beginArray();
+    for (int i = 0; i < ACT_LAT_BUCKETS; i++)
+        w.num(own.act.latHist[i]);
+    w.endArray();
+    w.endMap();
+
+    // command bus into the state owner, and snapshot readers
+    w.key("bus");
+    w.beginMap();
+    w.key("posted");
+    w.num(busStats.posted.load(std::memory_order_relaxed));
+    w.key("full");
+    w.num(busStats.full.load(std::memory_order_relaxed));
+    w.key("taken");
+    w.num(own.busTaken);
+    w.key("depthMax");
+    w.num(own.busDepthMax);
+    w.key("latAvgUs");
+    w.num(own.busTaken ? own.busLatTotalUs / own.busTaken : 0);
+    w.key("latMaxUs");
+    w.num(own.busLatMaxUs);
+    w.key("rate");
+    w.num(own.busRate);
+    w.key("stateVersion");
+    w.num(st.version);
+    w.key("readRetries");
+    w.num(stateStats.retries.load(std::memory_order_relaxed));
+    w.endMap();
+
+    // task loop health and the stall that caused the last reset, if any
+    w.key("supervisor");
+    w.beginMap();
+    w.key("resetReason");
+    w.str(resetReasonName(bootResetReason));
+    w.key("stallResets");
+    w.num(lastStall.resets);
+    if (lastStall.task >= 0 && lastStall.task < SUP_COUNT)
+    {
+        w.key("lastStall");
+        w.beginMap();
+        w.key("task");
+        w.str(taskHealth[lastStall.task].name);
+        w.key("silentMs");
+        w.num(lastStall.silentMs);
+        w.key("uptime");
+        w.num(lastStall.uptimeS);
+        w.endMap();
+    }
+    w.key("stalled");
+    w.str(supStalled >= 0 ? taskHealth[supStalled].name : "");
+    w.key("tasks");
+    w.beginArray();
+    for (int i = 0; i < SUP_COUNT; i++)
+    {
+        const TaskHealth &h = taskHealth[i];
+        w.beginMap();
+        w.key("name");
+        w.str(h.name);
+        w.key("loops");
+        w.num(h.loops);
+        w.key("maxUs");
+        w.num(h.maxUs);
+        w.key("p99Us");
+        w.num(supP99Us(h));
+        w.key("silentMs");
+        w.num(ms - h.lastBeat);
+        w.key("stallMs");
+        w.num(h.stallMs);
+        w.endMap();
+    }
+    w.endArray();
+    w.key("wake");
+    w.beginArray();
+    WakeStats wake[WAKE_COUNT];
+    stateStats.retries.fetch_add(wakeSnapshot(wake, wakeStats, wakeSeq, WAKE_COUNT, seqYield),
+                                 std::memory_order_relaxed);
+    for (int i = 0; i < WAKE_COUNT; i++)
+    {
+        const WakeStats &k = wake[i];
+        w.beginMap();
+        w.key("path");
+        w.str(k.name);
+        w.key("events");
+        w.num(k.events);
+        w.key("latAvgUs");
+        w.num(k.events ? k.latTotalUs / k.events : 0);
+        w.key("latMaxUs");
+        w.num(k.latMaxUs);
+        w.endMap();
+    }
+    w.endArray();
+    w.endMap();
+
+    w.key("outbox");
+    w.beginMap();
+    w.key("depth");
+    w.num(mq.outboxCount);
+    w.key("bytes");
+    w.num(mq.outboxBytes);
+    w.key("capacity");
+    w.num(OUTBOX_CAPACITY);
+    w.key("enqueued");
+    w.num(mq.outbox.enqueued);
+    w.key("drained");
+    w.num(mq.outbox.drained);
+    w.key("dropped");
+    w.num(mq.outbox.dropped);
+    w.key("corrupt");
+    w.num(mq.outbox.corrupt);
+    w.key("drainRate");
+    w.num(mq.outbox.drainRate);
+    w.endMap();
+
+    w.endMap();
+}
+// ---------------- Status server endpoints ---------
+// Accept: application/cbor selects the binary encoding of the same schema.
+bool clientWantsCbor()
+{
+    return statusServer.header("Accept").indexOf("application/cbor") >= 0;
+}
+void handle_api_status()
+{
+    // only ioTask serves HTTP, so static buffers are enough
+    static uint8_t out[STATUS_BUF_SIZE];
+    static GatewayState st;
+    stateRead(st);
+    bool cbor = clientWantsCbor();
+    PayloadWriter w(out, sizeof(out), cbor);
+    schemaStatus(w, st);
+    if (w.size() < 0)
+    {
+        statusServer.send(500, "application/json", "{\"ok\":0, \"err\":\"status too large\"}");
+        return;
+    }
+    statusServer.send_P(200, cbor ? "application/cbor" : "application/json", (const char *)out, w.size());
+}
+// ================ Metrics =========================
+// Prometheus text exposition (version 0.0.4, helpers in core/metrics.h),
+// rendered into the caller's buffer. Served on /api/metrics and mirrored
+// to gateway/<id>/metrics.
+bool idleHookCpu0()
+{
+    idleCalls[0]++;
+    return true; // once per wake-up, not in a tight loop
+}
+bool idleHookCpu1()
+{
+    idleCalls[1]++;
+    return true;
+}
+// ---------------- CPU load (supervisor, 1 Hz) -----
+void cpuLoadSample()
+{
+    for (int c = 0; c < 2; c++)
+    {
+        uint32_t calls = idleCalls[c];
+        uint32_t d = calls - cpuLoad.lastCalls[c];
+        cpuLoad.lastCalls[c] = calls;
+        if (d > cpuLoad.idleMax[c])
+            cpuLoad.idleMax[c] = d;
+        cpuLoad.loadPct[c] = cpuLoad.idleMax[c] ? 100 - (uint32_t)d * 100 / cpuLoad.idleMax[c] : 0;
+    }
+}
+// ---------------- Render --------------------------
+// Returns the text length, or -1 if it did not fit.
+int metricsRender(char *buf, size_t cap, const GatewayState &st)
+{
+    TextOut t = {buf, cap, 0};
+    char lbl[32];
+    unsigned long ms = millis();
+    // counter copies; metricsMutex makes the statics safe
+    static OwnerStatsView own;
+    static MqttStatsView mq;
+    static DisplayStats disp;
+    static WakeStats wake[WAKE_COUNT];
+    seqRead(ownerStatsSeq, &own, &ownerStatsView, sizeof(own));
+    seqRead(mqttStatsSeq, &mq, &mqttStatsView, sizeof(mq));
+    seqRead(dispStatsSeq, &disp, &dispStatsView, sizeof(disp));
+    stateStats.retries.fetch_add(wakeSnapshot(wake, wakeStats, wakeSeq, WAKE_COUNT, seqYield),
+                                 std::memory_order_relaxed);
+    SchedStats sched;
+    int schedN, schedQueued;
+    xSemaphoreTake(schedMutex, portMAX_DELAY);
+    sched = schedTable.stats;
+    schedN = schedTable.count;
+    schedQueued = schedTable.heapLen;
+    xSemaphoreGive(schedMutex);
+
+    gauge(t, "uptime_seconds", ms / 1000);
+
+    // heap: free, low-water mark, largest block; fragmentation = 1 - largest/free
+    size_t freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    gauge(t, "heap_free_bytes", freeHeap);
+    gauge(t, "heap_min_free_bytes", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    gauge(t, "heap_largest_block_bytes", largest);
+    metricType(t, "heap_fragmentation_ratio", "gauge");
+    metricF(t, "heap_fragmentation_ratio", NULL, freeHeap ? 1.0f - (float)largest / freeHeap : 0.0f);
+
+    // stacks: configured size and the least free ever (high-water mark)
+    seqRead(profSeq, &metricsProfile, &profView, sizeof(metricsProfile));
+    metricType(t, "task_stack_size_bytes", "gauge");
+    for (int i = 0; i < taskSpecCount; i++)
+    {
+        if (!taskSpecs[i].enabled)
+            continue;
+        snprintf(lbl, sizeof(lbl), "task=\"%s\"", taskSpecs[i].key);
+        metricU(t, "task_stack_size_bytes", lbl, taskSpecs[i].stack);
+    }
+    metricType(t, "task_stack_free_min_bytes", "gauge");
+    for (int i = 0; i < taskSpecCount; i++)
+    {
+        TaskHandle_t h = *taskSpecs[i].handle;
+        if (!taskSpecs[i].enabled || !h)
+            continue;
+        snprintf(lbl, sizeof(lbl), "task=\"%s\"", taskSpecs[i].key);
+        metricU(t, "task_stack_free_min_bytes", lbl, uxTaskGetStackHighWaterMark(h));
+    }
+    // per FreeRTOS task over the last profiler window, system tasks included
+    metricType(t, "task_cpu_ratio", "gauge");
+    for (int i = 0; i < metricsProfile.count; i++)
+    {
+        snprintf(lbl, sizeof(lbl), "name=\"%s\"", metricsProfile.tasks[i].name);
+        metricF(t, "task_cpu_ratio", lbl, metricsProfile.tasks[i].cpuPermille / 1000.0f);
+    }
+
+    metricType(t, "cpu_load_ratio", "gauge");
+    for (int c = 0; c < 2; c++)
+    {
+        snprintf(lbl, sizeof(lbl), "core=\"%d\"", c);
+        metricF(t, "cpu_load_ratio", lbl, cpuLoad.loadPct[c] / 100.0f);
+    }
+
+    // task loops (supervisor)
+    metricType(t, "task_loops_total", "counter");
+    for (int i = 0; i < SUP_COUNT; i++)
+    {
+        snprintf(lbl, sizeof(lbl), "task=\"%s\"", taskHealth[i].name);
+        metricU(t, "task_loops_total", lbl, taskHealth[i].loops);
+    }
+    metricType(t, "task_loop_max_us", "gauge");
+    for (int i = 0; i < SUP_COUNT; i++)
+    {
+        snprintf(lbl, sizeof(lbl), "task=\"%s\"", taskHealth[i].name);
+        metricU(t, "task_loop_max_us", lbl, taskHealth[i].maxUs);
+    }
+    metricType(t, "task_loop_p99_us", "gauge");
+    for (int i = 0; i < SUP_COUNT; i++)
+    {
+        snprintf(lbl, sizeof(lbl), "task=\"%s\"", taskHealth[i].name);
+        metricU(t, "task_loop_p99_us", lbl, supP99Us(taskHealth[i]));
+    }
+    counter(t, "stall_resets_total", lastStall.resets);
+
+    // event -> task action, per wake-up path
+    metricsWake(t, wake, WAKE_COUNT);
+
+    // buttons: bounces / edges is the contact quality
+    counter(t, "button_edges_total", buttonStats.edges);
+    counter(t, "button_bounces_total", buttonStats.bounces);
+    counter(t, "button_settled_total", buttonStats.settled);
+    counter(t, "button_events_total", buttonStats.events);
+    counter(t, "button_dropped_total", buttonStats.dropped);
+
+    // display: rate(i2c_us_total) / 1e6 is the share of the I2C bus it holds
+    counter(t, "display_frames_total", disp.frames);
+    counter(t, "display_frames_sent_total", disp.sent);
+    counter(t, "display_tiles_sent_total", disp.tilesSent);
+    counter(t, "display_render_us_total", disp.renderUs);
+    counter(t, "display_i2c_us_total", disp.i2cUs);
+    gauge(t, "display_i2c_max_us", disp.i2cMaxUs);
+
+    // fan: rate(on_seconds_total) is the duty cycle over time
+    gauge(t, "fan_on", st.fan ? 1 : 0);
+    gauge(t, "fan_duty_percent", st.fanDuty);
+    counter(t, "fan_switches_total", own.fan.switches);
+    counter(t, "fan_switches_held_total", own.fan.held);
+    metricType(t, "fan_on_seconds_total", "counter");
+    metricF(t, "fan_on_seconds_total", NULL, own.fan.onMs / 1000.0f);
+    metricType(t, "fan_full_speed_seconds_total", "counter");
+    metricF(t, "fan_full_speed_seconds_total", NULL, own.fan.dutyMs / 1000.0f);
+
+    // schedules: jitter_ms_total / fired_total is the mean firing delay
+    gauge(t, "sched_entries", schedN);
+    gauge(t, "sched_queued", schedQueued);
+    counter(t, "sched_fired_total", sched.fired);
+    counter(t, "sched_late_total", sched.late);
+    counter(t, "sched_missed_total", sched.missed);
+    counter(t, "sched_bus_full_total", sched.busFull);
+    counter(t, "sched_rebuilds_total", sched.rebuilds);
+    counter(t, "sched_saves_total", sched.saves);
+    counter(t, "sched_jitter_ms_total", sched.jitterTotalMs);
+    gauge(t, "sched_jitter_max_ms", sched.jitterMaxMs);
+
+    // rules: eval_us_total / triggers_total is the cost per telemetry update
+    gauge(t, "rules", ruleTable.count);
+    counter(t, "rule_triggers_total", own.rule.triggers);
+    counter(t, "rule_evals_total", own.rule.evals);
+    counter(t, "rule_fired_total", own.rule.fired);
+    counter(t, "rule_blocked_total", own.rule.blocked);
+    counter(t, "rule_bus_full_total", own.rule.busFull);
+    counter(t, "rule_eval_us_total", own.rule.evalUs);
+    gauge(t, "rule_eval_max_us", own.rule.evalMaxUs);
+
+    // groups and scenes: frames vs nodes_set is the fan-out saved
+    counter(t, "group_cmds_total", own.group.groupCmds);
+    counter(t, "scene_cmds_total", own.group.sceneCmds);
+    counter(t, "group_frames_total", own.group.frames);
+    counter(t, "group_unicast_frames_total", own.group.unicast);
+    counter(t, "group_join_frames_total", own.group.joins);
+    counter(t, "group_nodes_set_total", own.group.nodesSet);
+    counter(t, "node_fade_frames_total", own.fadeFrames);
+
+    // dim coalescing: posted vs sent is the airtime saved per drag
+    counter(t, "dim_posted_total", own.dim.posted);
+    counter(t, "dim_superseded_total", own.dim.superseded);
+    counter(t, "dim_sent_total", own.dim.sent);
+    counter(t, "eeprom_commits_total", own.dim.commits);
+
+    // TX queue per class: wait_ms_total / sent_total is the mean queue delay
+    static const char *const txMetric[] = {"tx_queued_total", "tx_sent_total", "tx_expired_total",
+                                           "tx_full_total", "tx_superseded_total", "tx_wait_ms_total"};
+    for (int m = 0; m < 6; m++)
+    {
+        metricType(t, txMetric[m], "counter");
+        for (int c = 0; c < TX_CLASSES; c++)
+        {
+            const TxClassStats &ts = own.tx[c];
+            uint64_t v[] = {ts.queued, ts.sent, ts.expired, ts.full, ts.superseded, ts.waitTotalMs};
+            snprintf(lbl, sizeof(lbl), "class=\"%s\"", txClassNames[c]);
+            metricU(t, txMetric[m], lbl, v[m]);
+        }
+    }
+    metricType(t, "tx_wait_max_ms", "gauge");
+    for (int c = 0; c < TX_CLASSES; c++)
+    {
+        snprintf(lbl, sizeof(lbl), "class=\"%s\"", txClassNames[c]);
+        metricU(t, "tx_wait_max_ms", lbl, own.tx[c].waitMaxMs);
+    }
+    metricType(t, "tx_depth", "gauge");
+    for (int c = 0; c < TX_CLASSES; c++)
+    {
+        snprintf(lbl, sizeof(lbl), "class=\"%s\"", txClassNames[c]);
+        metricU(t, "tx_depth", lbl, own.txDepth[c]);
+    }
+    // class-A: held vs windows shows how long downlinks wait for uplinks
+    counter(t, "classa_held_total", own.classA.held);
+    counter(t, "classa_windows_total", own.classA.windows);
+
+    // sensor cache
+    SensorView sv;
+    seqRead(sensSeq, &sv, &sensView, sizeof(sv));
+    metricType(t, "temp_celsius", "gauge");
+    metricF(t, "temp_celsius", NULL, sv.temp);
+    metricType(t, "temp_raw_celsius", "gauge");
+    metricF(t, "temp_raw_celsius", NULL, sv.tempRaw);
+    counter(t, "temp_samples_total", sensStats.tempSamples);
+    counter(t, "rtc_reads_total", sensStats.rtcReads);
+    counter(t, "rtc_syncs_total", sensStats.rtcSyncs);
+    counter(t, "rtc_sets_total", sensStats.rtcSets);
+
+    // link
+    gauge(t, "link_online", linkState == LINK_ONLINE ? 1 : 0);
+    counter(t, "wifi_attempts_total", mq.link.wifiAttempts);
+    counter(t, "wifi_connects_total", mq.link.wifiConnects);
+    counter(t, "wifi_drops_total", mq.link.wifiDrops);
+    counter(t, "mqtt_attempts_total", mq.link.mqttAttempts);
+    counter(t, "mqtt_connects_total", mq.link.mqttConnects);
+    counter(t, "mqtt_drops_total", mq.link.mqttDrops);
+
+    // nodes
+    int online = 0;
+    for (int i = 0; i < total_Slave; i++)
+        if (st.slaves[i].id && st.slaves[i].lastSeen && ms - st.slaves[i].lastSeen < NODE_ONLINE_TIMEOUT)
+            online++;
+    gauge(t, "nodes", st.nodeCount);
+    gauge(t, "nodes_online", online);
+
+    // command path
+    counter(t, "cmd_messages_total", mq.cmd.messages);
+    counter(t, "cmd_rejected_total", mq.cmd.rejected);
+    counter(t, "cmd_executed_total", own.cmdExecuted);
+    counter(t, "bus_posted_total", busStats.posted.load(std::memory_order_relaxed));
+    counter(t, "bus_full_total", busStats.full.load(std::memory_order_relaxed));
+    gauge(t, "bus_depth_max", own.busDepthMax);
+    gauge(t, "bus_latency_max_us", own.busLatMaxUs);
+    counter(t, "bus_latency_us_total", own.busLatTotalUs);
+    counter(t, "state_read_retries_total", stateStats.retries.load(std::memory_order_relaxed));
+
+    // actuator
+    counter(t, "relay_intents_total", own.act.intents);
+    counter(t, "relay_switches_total", own.act.applied);
+    counter(t, "relay_coalesced_total", own.act.coalesced);
+    counter(t, "relay_superseded_total", own.act.superseded);
+    counter(t, "relay_rate_limited_total", own.act.limited);
+    metricType(t, "relay_latency_ms", "histogram");
+    uint64_t cum = 0;
+    for (int b = 0; b < ACT_LAT_BUCKETS; b++)
+    {
+        cum += own.act.latHist[b];
+        if (b < ACT_LAT_BUCKETS - 1)
+            snprintf(lbl, sizeof(lbl), "le=\"%u\"", actLatBoundsMs[b]);
+        else
+            snprintf(lbl, sizeof(lbl), "le=\"+Inf\"");
+        metricU(t, "relay_latency_ms_bucket", lbl, cum);
+    }
+    metricU(t, "relay_latency_ms_sum", NULL, own.act.latTotalMs);
+    metricU(t, "relay_latency_ms_count", NULL, cum);
+
+    // outbox
+    gauge(t, "outbox_depth", mq.outboxCount);
+    gauge(t, "outbox_bytes", mq.outboxBytes);
+    counter(t, "outbox_enqueued_total", mq.outbox.enqueued);
+    counter(t, "outbox_drained_total", mq.outbox.drained);
+    counter(t, "outbox_dropped_total", mq.outbox.dropped);
+    counter(t, "outbox_corrupt_total", mq.outbox.corrupt);
+
+    return t.len < t.cap ? (int)t.len : -1;
+}
+// ---------------- HTTP ----------------------------
+void handle_api_metrics()
+{
+    xSemaphoreTake(metricsMutex, portMAX_DELAY);
+    stateRead(metricsState);
+    int n = metricsRender(metricsBuf, sizeof(metricsBuf), metricsState);
+    if (n < 0)
+        statusServer.send(500, "text/plain", "metrics too large");
+    else
+        statusServer.send_P(200, "text/plain; version=0.0.4", metricsBuf, n);
+    xSemaphoreGive(metricsMutex);
+}
+// ---------------- Relay API -----------------------
+// Handlers validate and post to the owner; they never touch state directly.
+static void sendPosted(bool ok)
+{
+    if (ok)
+        statusServer.send(200, "application/json", "{\"ok\":1}");
+    else
+        statusServer.send(503, "application/json", "{\"ok\":0, \"err\":\"busy\"}");
+}
+// ---------------- Request args --------------------
+// Parsers: core/api.h. This hands them the current request's args.
+struct WebArgs : ApiArgs
+{
+    String last;
+    bool has(const char *name) override
+    {
+        return statusServer.hasArg(name);
+    }
+    const char *get(const char *name) override
+    {
+        last = statusServer.arg(name);
+        return last.c_str();
+    }
+};
+void handle_api_relay()
+{
+    if (!statusServer.hasArg("ch"))
+    {
+        statusServer.send(400, "text/plain", "missing ch");
+        return;
+    }
+
+    String arg = statusServer.arg("ch");
+
+    if (arg == "all")
+    {
+        // Toggle tất cả relay cùng lúc
+        static GatewayState st;
+        stateRead(st);
+        bool anyOn = false;
+        for (int i = 0; i < 4; i++)
+        {
+            if (st.relays[i])
+            {
+                anyOn = true;
+                break;
+            }
+        }
+        // Nếu có ít nhất 1 relay ON thì tắt hết, ngược lại bật hết
+        GatewayCommand cmd = {CMD_LOCAL_RELAY, (uint8_t)(anyOn ? ACT_OFF : ACT_ON), CMD_SRC_HTTP, CMD_ID_ALL, 0};
+        sendPosted(cmdPost(cmd));
+        return;
+    }
+
+    // Xử lý từng relay riêng lẻ
+    int ch = arg.toInt();
+    if (ch < 0 || ch > 3)
+    {
+        statusServer.send(400, "text/plain", "invalid ch");
+        return;
+    }
+
+    GatewayCommand cmd = {CMD_LOCAL_RELAY, ACT_TOGGLE, CMD_SRC_HTTP, (uint16_t)ch, 0};
+    sendPosted(cmdPost(cmd));
+}
+// ---------------- Add node ------------------------
+void handle_api_node_add()
+{
+    if (!statusServer.hasArg("id"))
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0,\"msg\":\"Missing id\"}");
+        return;
+    }
+    int id = statusServer.arg("id").toInt();
+    if (id <= 0 || id > total_Slave)
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0,\"msg\":\"invalid node id\"}");
+        return;
+    }
+
+    // the owner queues the probe and replies once the node answers or times out
+    BusMsg m = {};
+    m.cmd.target = CMD_NODE_ADD;
+    m.cmd.source = CMD_SRC_HTTP;
+    m.cmd.id = (uint16_t)id;
+    int rc = busCall(m);
+
+    if (rc == BUS_OK)
+        statusServer.send(200, "application/json", "{\"ok\":1,\"msg\":\"Node added\"}");
+    else if (rc == BUS_BUSY)
+        statusServer.send(503, "application/json", "{\"ok\":0,\"msg\":\"busy\"}");
+    else
+        statusServer.send(200, "application/json", "{\"ok\":0,\"msg\":\"No response from node\"}");
+}
+// ---------------- remove node ---------------------
+void handle_api_node_remove()
+{
+    if (!statusServer.hasArg("node"))
+    {
+        statusServer.send(400, "text/plain", "missing node");
+        return;
+    }
+    BusMsg m = {};
+    m.cmd.target = CMD_NODE_REMOVE;
+    m.cmd.source = CMD_SRC_HTTP;
+    m.cmd.id = (uint16_t)statusServer.arg("node").toInt();
+    int rc = busCall(m);
+    if (rc == BUS_NOT_FOUND)
+        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"not found\"}");
+    else
+        sendPosted(rc == BUS_OK);
+}
+// ---------------- edit node -----------------------
+void handle_api_node_edit()
+{
+    if (!statusServer.hasArg("node"))
+    {
+        statusServer.send(400, "text/plain", "missing node");
+        return;
+    }
+    int nodeId = statusServer.arg("node").toInt();
+    int newId = nodeId;
+    if (statusServer.hasArg("id"))
+        newId = statusServer.arg("id").toInt();
+    if (newId <= 0 || newId > 0x7FFF)
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"invalid id\"}");
+        return;
+    }
+
+    BusMsg m = {};
+    m.cmd.target = CMD_NODE_EDIT;
+    m.cmd.source = CMD_SRC_HTTP;
+    m.cmd.id = (uint16_t)nodeId;
+    m.cmd.value = (int16_t)newId;
+    snprintf(m.text, sizeof(m.text), "%s", statusServer.arg("name").c_str());
+    int rc = busCall(m);
+
+    if (rc == BUS_NOT_FOUND)
+        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"node not found\"}");
+    else if (rc == BUS_EXISTS)
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"id exists\"}");
+    else
+        sendPosted(rc == BUS_OK);
+}
+// ---------------- Relay node ----------------------
+void handle_api_node_relay()
+{
+    if (!statusServer.hasArg("node"))
+    {
+        statusServer.send(400, "text/plain", "missing node");
+        return;
+    }
+    int id = statusServer.arg("node").toInt();
+    static GatewayState st;
+    stateRead(st);
+    bool known = false;
+    for (int i = 0; i < st.nodeCount && !known; i++)
+        known = st.nodes[i].id == id;
+    if (!known || id > 0x7FFF)
+    {
+        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"node not found\"}");
+        return;
+    }
+    GatewayCommand cmd = {CMD_NODE, ACT_TOGGLE, CMD_SRC_HTTP, (uint16_t)id, 0};
+    sendPosted(cmdPost(cmd));
+}
+// ---------------- dimming node --------------------
+void handle_api_node_dim()
+{
+    if (!statusServer.hasArg("node") || !statusServer.hasArg("value"))
+    {
+        statusServer.send(400, "text/plain", "missing params");
+        return;
+    }
+    int id = statusServer.arg("node").toInt();
+    int val = statusServer.arg("value").toInt();
+    if (id <= 0 || id > total_Slave)
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"invalid node id\"}");
+        return;
+    }
+    GatewayCommand cmd = {CMD_NODE, ACT_DIM, CMD_SRC_HTTP, (uint16_t)id, (int16_t)constrain(val, 0, 255)};
+    sendPosted(cmdPost(cmd));
+}
+// ---------------- fading node --------------------
+// Args: apiNodeFade() (core/api.h).
+void handle_api_node_fade()
+{
+    WebArgs args;
+    GatewayCommand cmd;
+    ApiResult rc = apiNodeFade(args, cmd);
+    if (rc == API_MISSING)
+        statusServer.send(400, "text/plain", "missing params");
+    else if (rc == API_BAD_ID)
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"invalid node id\"}");
+    else if (rc != API_OK)
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"invalid fade\"}");
+    if (rc != API_OK)
+        return;
+    cmd.source = CMD_SRC_HTTP;
+    sendPosted(cmdPost(cmd));
+}
+// ---------------- node radio mode -----------------
+// node=<id> classA=1: downlinks wait for the node's uplink (sleepy,
+// battery nodes); classA=0: the node always listens
+void handle_api_node_mode()
+{
+    if (!statusServer.hasArg("node") || !statusServer.hasArg("classA"))
+    {
+        statusServer.send(400, "text/plain", "missing params");
+        return;
+    }
+    BusMsg m = {};
+    m.cmd.target = CMD_NODE_MODE;
+    m.cmd.source = CMD_SRC_HTTP;
+    m.cmd.id = (uint16_t)statusServer.arg("node").toInt();
+    m.cmd.value = statusServer.arg("classA").toInt() == 1;
+    int rc = busCall(m);
+    if (rc == BUS_NOT_FOUND)
+        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"node not found\"}");
+    else
+        sendPosted(rc == BUS_OK);
+}
+// ---------------- config save ---------------------
+void handle_api_config_save()
+{
+    String ssid = statusServer.arg("ssid");
+    String pass = statusServer.arg("pass");
+
+    if (ssid.length())
+    {
+        // an empty password field keeps the stored one
+        GatewayConfig c;
+        configSnapshot(c);
+        configSetWifi(ssid, pass.length() ? pass : c.pass);
+    }
+    if (statusServer.hasArg("fan"))
+        configSetFanThreshold(statusServer.arg("fan").toInt());
+    {
+        // fan tuning: any subset of fanHyst, fanPi, fanKp, fanKi,
+        // fanMinDuty, fanMaxDuty, fanMinOn, fanMinOff
+        GatewayConfig c;
+        configSnapshot(c);
+        FanTuning t = c.fan;
+        bool any = false;
+        if (statusServer.hasArg("fanHyst"))
+            t.hyst = statusServer.arg("fanHyst").toFloat(), any = true;
+        if (statusServer.hasArg("fanPi"))
+            t.pi = statusServer.arg("fanPi").toInt() == 1, any = true;
+        if (statusServer.hasArg("fanKp"))
+            t.kp = statusServer.arg("fanKp").toFloat(), any = true;
+        if (statusServer.hasArg("fanKi"))
+            t.ki = statusServer.arg("fanKi").toFloat(), any = true;
+        if (statusServer.hasArg("fanMinDuty"))
+            t.minDuty = constrain(statusServer.arg("fanMinDuty").toInt(), 0, 100), any = true;
+        if (statusServer.hasArg("fanMaxDuty"))
+            t.maxDuty = constrain(statusServer.arg("fanMaxDuty").toInt(), 0, 100), any = true;
+        if (statusServer.hasArg("fanMinOn"))
+            t.minOnS = constrain(statusServer.arg("fanMinOn").toInt(), 0, 3600), any = true;
+        if (statusServer.hasArg("fanMinOff"))
+            t.minOffS = constrain(statusServer.arg("fanMinOff").toInt(), 0, 3600), any = true;
+        if (any)
+            configSetFanTuning(t);
+    }
+    if (statusServer.hasArg("mqttHost") && statusServer.arg("mqttHost").length())
+    {
+        int port = statusServer.hasArg("mqttPort") ? statusServer.arg("mqttPort").toInt() : mqtt_port;
+        configSetMqtt(statusServer.arg("mqttHost"), port);
+    }
+    if (statusServer.hasArg("mqttFormat"))
+        configSetMqttFormat(statusServer.arg("mqttFormat") == "cbor");
+
+    statusServer.send(200, "application/json", "{\"ok\":1}");
+}
+// ---------------- GET /api/schedules --------------
+// [offset=] [limit=]; entries in table order, at most SCHED_PAGE_MAX.
+void handle_api_schedules()
+{
+    static uint8_t out[SCHED_BUF_SIZE];
+    static const char *kinds[] = {"once", "daily", "hourly"};
+    int offset = max(0, (int)statusServer.arg("offset").toInt());
+    int limit = statusServer.hasArg("limit") ? statusServer.arg("limit").toInt() : SCHED_PAGE_MAX;
+    limit = constrain(limit, 1, SCHED_PAGE_MAX);
+    bool cbor = clientWantsCbor();
+    PayloadWriter w(out, sizeof(out), cbor);
+
+    xSemaphoreTake(schedMutex, portMAX_DELAY);
+    w.beginMap();
+    w.key("count");
+    w.num(schedTable.count);
+    w.key("max");
+    w.num(SCHED_MAX);
+    w.key("clockOk");
+    w.boolean(schedTable.clockOk);
+    w.key("entries");
+    w.beginArray();
+    int seen = 0, listed = 0;
+    for (int i = 0; i < SCHED_MAX && listed < limit; i++)
+    {
+        const SchedEntry &e = schedTable.entries[i];
+        if (!e.id || seen++ < offset)
+            continue;
+        listed++;
+        w.beginMap();
+        w.key("id");
+        w.num(e.id);
+        w.key("kind");
+        w.str(kinds[e.kind]);
+        w.key("at");
+        w.num(e.at);
+        if (e.kind != SCHED_ONCE)
+        {
+            w.key("days");
+            w.num(e.days);
+        }
+        w.key("target");
+        w.str(cmdTargetNames[e.target]);
+        w.key("tid");
+        w.num(e.targetId);
+        w.key("action");
+        w.str(cmdActionNames[e.action]);
+        if (e.action == ACT_DIM)
+        {
+            w.key("value");
+            w.num(e.value);
+        }
+        if (schedTable.heapPos[i] != SCHED_NONE)
+        {
+            w.key("next");
+            w.num(schedTable.nextAt[i]);
+        }
+        w.endMap();
+    }
+    w.endArray();
+    w.endMap();
+    xSemaphoreGive(schedMutex);
+
+    if (w.size() < 0)
+    {
+        statusServer.send(500, "application/json", "{\"ok\":0, \"err\":\"page too large\"}");
+        return;
+    }
+    statusServer.send_P(200, cbor ? "application/cbor" : "application/json", (const char *)out, w.size());
+}
+// ---------------- POST /api/schedules -------------
+// Args: apiSchedEntry() (core/api.h). No id adds.
+void handle_api_schedules_put()
+{
+    WebArgs args;
+    SchedEntry e;
+    if (!apiSchedEntry(args, e))
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"invalid schedule\"}");
+        return;
+    }
+
+    uint16_t id = schedPut(e);
+    if (!id)
+    {
+        statusServer.send(e.id ? 404 : 507, "application/json", e.id ? "{\"ok\":0, \"err\":\"unknown id\"}" : "{\"ok\":0, \"err\":\"schedule table full\"}");
+        return;
+    }
+    char body[32];
+    snprintf(body, sizeof(body), "{\"ok\":1, \"id\":%u}", id);
+    statusServer.send(200, "application/json", body);
+}
+// ---------------- POST /api/schedules/delete ------
+// id=<id> | all=1
+void handle_api_schedules_delete()
+{
+    bool all = statusServer.arg("all") == "1";
+    int id = statusServer.arg("id").toInt();
+    if (!all && id <= 0)
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"id required\"}");
+        return;
+    }
+    if (!schedDelete(all ? 0 : id) && !all)
+    {
+        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"unknown id\"}");
+        return;
+    }
+    statusServer.send(200, "application/json", "{\"ok\":1}");
+}
+// ---------------- GET /api/groups -----------------
+void handle_api_groups()
+{
+    static uint8_t out[4096];
+    bool cbor = clientWantsCbor();
+    PayloadWriter w(out, sizeof(out), cbor);
+    // groups[] and scenes[] have no other writer than this task
+    w.beginMap();
+    w.key("multicast");
+    w.boolean(LORA_MULTICAST);
+    w.key("groups");
+    w.beginArray();
+    for (int i = 0; i < GROUP_MAX; i++)
+    {
+        const NodeGroup &g = groups[i];
+        if (!g.id)
+            continue;
+        w.beginMap();
+        w.key("id");
+        w.num(g.id);
+        w.key("name");
+        w.str(g.name);
+        w.key("members");
+        w.beginArray();
+        for (int nid = 1; nid <= total_Slave; nid++)
+            if (groupHas(g, nid))
+                w.num(nid);
+        w.endArray();
+        w.endMap();
+    }
+    w.endArray();
+    w.key("scenes");
+    w.beginArray();
+    for (int i = 0; i < SCENE_MAX; i++)
+    {
+        const Scene &sc = scenes[i];
+        if (!sc.id)
+            continue;
+        w.beginMap();
+        w.key("id");
+        w.num(sc.id);
+        w.key("name");
+        w.str(sc.name);
+        w.key("entries");
+        w.beginArray();
+        for (int k = 0; k < sc.count; k++)
+        {
+            w.beginMap();
+            w.key("node");
+            w.num(sc.entries[k].node);
+            w.key("relay");
+            w.num(sc.entries[k].relay);
+            w.key("dim");
+            w.num(sc.entries[k].dim);
+            w.endMap();
+        }
+        w.endArray();
+        w.endMap();
+    }
+    w.endArray();
+    w.endMap();
+    if (w.size() < 0)
+    {
+        statusServer.send(500, "application/json", "{\"ok\":0, \"err\":\"too large\"}");
+        return;
+    }
+    statusServer.send_P(200, cbor ? "application/cbor" : "application/json", (const char *)out, w.size());
+}
+// ---------------- POST /api/group -----------------
+// Args: apiGroup() (core/api.h).
+void handle_api_group()
+{
+    WebArgs args;
+    NodeGroup g;
+    ApiResult rc = apiGroup(args, g);
+    if (rc != API_OK)
+    {
+        statusServer.send(400, "application/json", rc == API_BAD_ID ? "{\"ok\":0, \"err\":\"id 1..16\"}" : "{\"ok\":0, \"err\":\"bad members\"}");
+        return;
+    }
+    NodeGroup *slot = groupSlot(groups, GROUP_MAX, g.id);
+    xSemaphoreTake(groupMutex, portMAX_DELAY);
+    *slot = g; // ids are 1..GROUP_MAX, so there is always a slot
+    xSemaphoreGive(groupMutex);
+    groupsSave();
+    GatewayCommand sync = {CMD_GROUP_SYNC, ACT_ON, CMD_SRC_HTTP, 0, 0};
+    sendPosted(cmdPost(sync));
+}
+// ---------------- POST /api/group/delete ----------
+void handle_api_group_delete()
+{
+    int id = statusServer.arg("id").toInt();
+    NodeGroup *g = groupSlot(groups, GROUP_MAX, id);
+    if (id < 1 || !g || g->id != id)
+    {
+        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"unknown group\"}");
+        return;
+    }
+    xSemaphoreTake(groupMutex, portMAX_DELAY);
+    g->id = 0;
+    xSemaphoreGive(groupMutex);
+    groupsSave();
+    GatewayCommand sync = {CMD_GROUP_SYNC, ACT_ON, CMD_SRC_HTTP, 0, 0};
+    sendPosted(cmdPost(sync));
+}
+// ---------------- POST /api/group/set -------------
+// Args: apiGroupSet() (core/api.h).
+void handle_api_group_set()
+{
+    WebArgs args;
+    GatewayCommand cmd;
+    if (!apiGroupSet(args, cmd))
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"bad id or action\"}");
+        return;
+    }
+    cmd.source = CMD_SRC_HTTP;
+    sendPosted(cmdPost(cmd));
+}
+// ---------------- POST /api/scene -----------------
+// Args: apiScene() (core/api.h); capture stores the nodes' current
+// relay and dim.
+void handle_api_scene()
+{
+    WebArgs args;
+    Scene sc;
+    bool capture;
+    ApiResult rc = apiScene(args, sc, capture);
+    Scene *slot = rc == API_BAD_ID ? NULL : groupSlot(scenes, SCENE_MAX, sc.id);
+    if (!slot)
+    {
+        statusServer.send(rc == API_BAD_ID ? 400 : 507, "application/json", "{\"ok\":0, \"err\":\"bad id or no free scene\"}");
+        return;
+    }
+    if (rc != API_OK)
+    {
+        statusServer.send(400, "application/json", rc == API_TOO_MANY ? "{\"ok\":0, \"err\":\"too many entries\"}" : "{\"ok\":0, \"err\":\"bad entries\"}");
+        return;
+    }
+    if (capture)
+    {
+        static GatewayState st;
+        stateRead(st);
+        for (int i = 0; i < sc.count; i++)
+        {
+            sc.entries[i].relay = st.slaves[sc.entries[i].node - 1].isOn;
+            sc.entries[i].dim = st.slaves[sc.entries[i].node - 1].sliderValue;
+        }
+    }
+    xSemaphoreTake(groupMutex, portMAX_DELAY);
+    *slot = sc;
+    xSemaphoreGive(groupMutex);
+    groupsSave();
+    statusServer.send(200, "application/json", "{\"ok\":1}");
+}
+// ---------------- POST /api/scene/delete ----------
+void handle_api_scene_delete()
+{
+    int id = statusServer.arg("id").toInt();
+    Scene *sc = groupSlot(scenes, SCENE_MAX, id);
+    if (id < 1 || !sc || sc->id != id)
+    {
+        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"unknown scene\"}");
+        return;
+    }
+    xSemaphoreTake(groupMutex, portMAX_DELAY);
+    sc->id = 0;
+    xSemaphoreGive(groupMutex);
+    groupsSave();
+    statusServer.send(200, "application/json", "{\"ok\":1}");
+}
+// ---------------- POST /api/scene/activate --------
+void handle_api_scene_activate()
+{
+    GatewayCommand cmd = {CMD_SCENE, ACT_ON, CMD_SRC_HTTP, (uint16_t)statusServer.arg("id").toInt(), 0};
+    sendPosted(cmdPost(cmd));
+}
+// ---------------- GET /api/rules ------------------
+// [offset=] [limit=]; rules in table order, at most RULE_PAGE_MAX.
+void handle_api_rules()
+{
+    static uint8_t out[RULE_BUF_SIZE];
+    static const char *fields[] = {"temp", "time", "relay", "dim"};
+    static const char *ops[] = {"gt", "ge", "lt", "le", "eq", "ne"};
+    int offset = max(0, (int)statusServer.arg("offset").toInt());
+    int limit = statusServer.hasArg("limit") ? statusServer.arg("limit").toInt() : RULE_PAGE_MAX;
+    limit = constrain(limit, 1, RULE_PAGE_MAX);
+    bool cbor = clientWantsCbor();
+    PayloadWriter w(out, sizeof(out), cbor);
+    // rules[] has no other writer than this task
+    w.beginMap();
+    w.key("count");
+    w.num(ruleTable.count);
+    w.key("max");
+    w.num(RULE_MAX);
+    w.key("rules");
+    w.beginArray();
+    int seen = 0, listed = 0;
+    for (int i = 0; i < RULE_MAX && listed < limit; i++)
+    {
+        const Rule &r = ruleTable.rules[i];
+        if (!r.id || seen++ < offset)
+            continue;
+        listed++;
+        w.beginMap();
+        w.key("id");
+        w.num(r.id);
+        if (r.src >= RULE_SRC_RELAY)
+        {
+            w.key("relay");
+            w.num(r.src - RULE_SRC_RELAY);
+        }
+        else
+        {
+            w.key("node");
+            w.num(r.src);
+            w.key("field");
+            w.str(fields[r.field]);
+        }
+        w.key("op");
+        w.str(ops[r.op]);
+        w.key("thr");
+        w.real(r.threshold, 2);
+        w.key("hyst");
+        w.real(r.hyst, 2);
+        if (r.guardRelay >= 0)
+        {
+            w.key("guardRelay");
+            w.num(r.guardRelay);
+            w.key("guardOn");
+            w.num(r.guardOn);
+        }
+        if (r.fromMin != r.toMin)
+        {
+            w.key("from");
+            w.num(r.fromMin);
+            w.key("to");
+            w.num(r.toMin);
+        }
+        w.key("cooldown");
+        w.num(r.cooldownS);
+        w.key("target");
+        w.str(cmdTargetNames[r.target]);
+        w.key("tid");
+        w.num(r.targetId);
+        w.key("action");
+        w.str(cmdActionNames[r.action]);
+        if (r.action == ACT_DIM)
+        {
+            w.key("value");
+            w.num(r.value);
+        }
+        w.key("latched");
+        w.boolean(ruleTable.latched[i]);
+        w.endMap();
+    }
+    w.endArray();
+    w.endMap();
+    if (w.size() < 0)
+    {
+        statusServer.send(500, "application/json", "{\"ok\":0, \"err\":\"page too large\"}");
+        return;
+    }
+    statusServer.send_P(200, cbor ? "application/cbor" : "application/json", (const char *)out, w.size());
+}
+// ---------------- POST /api/rules -----------------
+// Args: apiRule() (core/api.h). No id adds.
+void handle_api_rules_put()
+{
+    WebArgs args;
+    Rule r;
+    if (!apiRule(args, r))
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"invalid rule\"}");
+        return;
+    }
+
+    uint16_t id = rulePut(r);
+    if (!id)
+    {
+        statusServer.send(r.id ? 404 : 507, "application/json", r.id ? "{\"ok\":0, \"err\":\"unknown id\"}" : "{\"ok\":0, \"err\":\"rule table full\"}");
+        return;
+    }
+    char body[32];
+    snprintf(body, sizeof(body), "{\"ok\":1, \"id\":%u}", id);
+    statusServer.send(200, "application/json", body);
+}
+// ---------------- POST /api/rules/delete ----------
+// id=<id> | all=1
+void handle_api_rules_delete()
+{
+    bool all = statusServer.arg("all") == "1";
+    int id = statusServer.arg("id").toInt();
+    if (!all && id <= 0)
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"id required\"}");
+        return;
+    }
+    if (!ruleDelete(all ? 0 : id) && !all)
+    {
+        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"unknown id\"}");
+        return;
+    }
+    statusServer.send(200, "application/json", "{\"ok\":1}");
+}
+// ---------------- Start server --------------------
+void startStatusServer()
+{
+    const char *headerKeys[] = {"Accept"};
+    statusServer.collectHeaders(headerKeys, 1);
+    statusServer.on("/", HTTP_GET, []()
+                    { statusServer.send(200, "text/html", status_html); });
+    statusServer.on("/api/status", HTTP_GET, handle_api_status);
+    statusServer.on("/api/metrics", HTTP_GET, handle_api_metrics);
+    statusServer.on("/api/profile", HTTP_GET, handle_api_profile);
+    statusServer.on("/api/tasks", HTTP_POST, handle_api_tasks);
+    statusServer.on("/api/schedules", HTTP_GET, handle_api_schedules);
+    statusServer.on("/api/schedules", HTTP_POST, handle_api_schedules_put);
+    statusServer.on("/api/schedules/delete", HTTP_POST, handle_api_schedules_delete);
+    statusServer.on("/api/groups", HTTP_GET, handle_api_groups);
+    statusServer.on("/api/group", HTTP_POST, handle_api_group);
+    statusServer.on("/api/group/delete", HTTP_POST, handle_api_group_delete);
+    statusServer.on("/api/group/set", HTTP_POST, handle_api_group_set);
+    statusServer.on("/api/scene", HTTP_POST, handle_api_scene);
+    statusServer.on("/api/scene/delete", HTTP_POST, handle_api_scene_delete);
+    statusServer.on("/api/scene/activate", HTTP_POST, handle_api_scene_activate);
+    statusServer.on("/api/rules", HTTP_GET, handle_api_rules);
+    statusServer.on("/api/rules", HTTP_POST, handle_api_rules_put);
+    statusServer.on("/api/rules/delete", HTTP_POST, handle_api_rules_delete);
+    statusServer.on("/api/relay", HTTP_POST, handle_api_relay);
+    statusServer.on("/api/node/add", HTTP_POST, handle_api_node_add);
+    statusServer.on("/api/node/remove", HTTP_POST, handle_api_node_remove);
+    statusServer.on("/api/node/edit", HTTP_POST, handle_api_node_edit);
+    statusServer.on("/api/node/relay", HTTP_POST, handle_api_node_relay);
+    statusServer.on("/api/node/dim", HTTP_POST, handle_api_node_dim);
+    statusServer.on("/api/node/fade", HTTP_POST, handle_api_node_fade);
+    statusServer.on("/api/node/mode", HTTP_POST, handle_api_node_mode);
+    statusServer.on("/api/config/save", HTTP_POST, handle_api_config_save);
+    statusServer.begin();
+}
+// ---------------- save to EEPROM ------------------
+void saveToEEPROM(int slaveId, bool isOn, int sliderValue)
+{
+    if (slaveId < 0 || slaveId >= total_Slave)
+        return;
+
+    int addr = slaveId * 8;
+    EEPROM.write(addr, isOn ? 1 : 0);
+    EEPROM.write(addr + 4, sliderValue & 0xFF);
+    eepromDefer();
+}
+// ---------------- Deferred EEPROM commit ----------
+// EEPROM.write() only touches the RAM copy; the flash write happens in
+// eepromFlush() once changes have stopped for EEPROM_COMMIT_MS.
+void eepromDefer()
+{
+    deferMark(eepromPending, millis());
+}
+// Returns ms until the pending commit is due, DEFER_NONE if none.
+uint32_t eepromFlush(bool force)
+{
+    uint32_t wait = deferWait(eepromPending, millis(), EEPROM_COMMIT_MS);
+    if (wait == DEFER_NONE || (wait && !force))
+        return wait;
+    EEPROM.commit();
+    deferDone(eepromPending);
+    dimStats.commits++;
+    return DEFER_NONE;
+}
+// ---------------- TX class of a command -----------
+static uint8_t txClassFor(uint8_t source)
+{
+    switch (source)
+    {
+    case CMD_SRC_MQTT:
+    case CMD_SRC_HTTP:
+    case CMD_SRC_BUTTON:
+        return TX_INTERACTIVE;
+    default:
+        return TX_SCHEDULED;
+    }
+}
+// ---------------- Hold a class-A downlink ---------
+// A state frame is rebuilt from slaves[] when the window opens, so only
+// the fact that one is due is kept; it also replaces a held fade.
+static void classAHold(int id, uint8_t kind, const uint8_t *buf)
+{
+    DownlinkHold &h = holds[id - 1];
+    if (kind == TXK_REFRESH)
+        return; // the repeats below stand in for the periodic refresh
+    if (kind == TXK_FADE)
+    {
+        memcpy(h.fadeFrame, buf, sizeof(h.fadeFrame));
+        h.fade = true;
+    }
+    else
+    {
+        h.sends = CLASSA_SENDS;
+        h.fade = false;
+    }
+    slaves[id - 1].held = true;
+    classAStats.held++;
+}
+// ---------------- Queue a frame (owner) -----------
+static bool txEnqueue(uint8_t cls, uint8_t kind, uint16_t node, const uint8_t *buf, int len)
+{
+    if (node && cls != TX_WINDOW && slaves[node - 1].classA)
+    {
+        classAHold(node, kind, buf);
+        return true;
+    }
+    if (txqPush(txq, cls, kind, node, buf, len, millis()))
+        return true;
+    Serial.printf("[TX] %s queue full, frame dropped\n", txClassNames[cls]);
+    return false;
+}
+// ---------------- Send data to LoRa nodes ---------
+void sendLora(int ID, int stateLed, int valvePwm)
+{
+    if (ID <= 0 || ID > total_Slave)
+        return;
+    int idx = ID - 1;
+    if (idx < 0 || idx >= total_Slave)
+        return;
+
+    saveToEEPROM(idx, slaves[idx].isOn, slaves[idx].sliderValue);
+    slaves[idx].fadeMs = 0; // an absolute level ends any fade on the node
+
+    uint8_t f[sizeof(LoRaPacket)];
+    txEnqueue(txClassNow, TXK_UNICAST, ID, f, frameState(f, ID, stateLed, valvePwm));
+}
+// ---------------- Queue a state refresh -----------
+static void txRefresh(int id)
+{
+    txEnqueue(TX_REFRESH, TXK_REFRESH, id, NULL, 0);
+}
+// ---------------- Extended frame ------------------
+// seq is stamped when the frame goes out, so it follows air order.
+#if LORA_MULTICAST
+static void loraSendExt(const uint8_t *buf, int len)
+{
+    bool fade = buf[1] == LORA_EXT_FADE;
+    txEnqueue(txClassNow, fade ? TXK_FADE : TXK_OTHER, fade ? buf[3] : 0, buf, len);
+}
+#endif
+// ---------------- Class-A uplink (owner) ----------
+// The node is listening now: send what was held for it, ahead of all
+// other traffic. A held fade goes first; state repeats wait until the
+// fade has run so they cannot cut it short.
+static void classAOnUplink(int id)
+{
+    SlaveStation &sl = slaves[id - 1];
+    DownlinkHold &h = holds[id - 1];
+    if (!sl.classA || !sl.held)
+        return;
+    unsigned long now = millis();
+    if (h.fade)
+    {
+        txEnqueue(TX_WINDOW, TXK_FADE, id, h.fadeFrame, sizeof(h.fadeFrame));
+        h.fade = false;
+        sl.fadeStart = now; // the node starts when it hears it
+        classAStats.windows++;
+    }
+    else if (h.sends && slaveLevel(sl, now) == sl.sliderValue)
+    {
+        uint8_t f[sizeof(LoRaPacket)];
+        txEnqueue(TX_WINDOW, TXK_UNICAST, id, f, frameState(f, sl.id, sl.isOn, sl.sliderValue));
+        h.sends--;
+        classAStats.windows++;
+    }
+    sl.held = h.sends || h.fade;
+}
+// ---------------- Class-A mode (owner) ------------
+static int nodeSetClassA(int id, bool on)
+{
+    if (id <= 0 || id > total_Slave || findNodeIndexById(id) < 0)
+        return BUS_NOT_FOUND;
+    SlaveStation &sl = slaves[id - 1];
+    if (sl.classA == on)
+        return BUS_OK;
+    sl.classA = on;
+    if (!on && sl.held)
+    {
+        // always listening again: deliver what was waiting right away
+        sl.held = false;
+        holds[id - 1].sends = 0;
+        holds[id - 1].fade = false;
+        txClassNow = TX_SCHEDULED;
+        sendLora(id, sl.isOn ? 1 : 0, sl.sliderValue);
+    }
+    saveNodesPrefs();
+    return BUS_OK;
+}
+// ---------------- Probe done (owner) --------------
+static void probeFinish(int rc)
+{
+    if (!probe.active)
+        return;
+    probe.active = false;
+    if (rc == BUS_OK)
+    {
+        int id = probe.msg.cmd.id;
+        addNodeWithId(id, "Node " + String(id), 0); // no-op if RX already added it
+        txClassNow = TX_DISCOVERY;
+        groupSendJoins(id);
+    }
+    busReply(probe.msg, rc);
+}
+// ---------------- Start a probe (owner) -----------
+// Sends the test frame; the node's uplink completes it (probeOnUplink).
+static int probeStart(const BusMsg &m)
+{
+    if (probe.active)
+        return BUS_BUSY;
+    uint8_t f[sizeof(LoRaPacketRec)];
+    if (!txEnqueue(TX_DISCOVERY, TXK_PROBE, 0, f, frameProbe(f, m.cmd.id)))
+        return BUS_BUSY;
+    probe.active = true;
+    probe.sent = false;
+    probe.msg = m;
+    return BUS_PENDING;
+}
+// ---------------- Uplink seen (owner) -------------
+static void probeOnUplink(int id)
+{
+    if (probe.active && probe.sent && probe.msg.cmd.id == id)
+        probeFinish(BUS_OK);
+}
+// ---------------- Send one frame (owner) ----------
+// Returns ms until the next call has work: 0 while frames are queued,
+// else the probe timeout or 0xFFFFFFFF.
+static uint32_t txService(bool *dirty)
+{
+    uint32_t now = sysClock->ms();
+    if (probe.active && probe.sent && now - probe.sentAt >= PROBE_WAIT_MS)
+        probeFinish(BUS_NO_ANSWER);
+
+    TxEntry e;
+    uint8_t cls;
+    int rc;
+    while ((rc = txqNext(txq, now, e, cls)) != TXQ_EMPTY)
+    {
+        if (rc == TXQ_EXPIRED)
+        {
+            if (e.kind == TXK_PROBE)
+                probeFinish(BUS_NO_ANSWER);
+            continue;
+        }
+        if (e.kind == TXK_REFRESH)
+        {
+            const SlaveStation &sl = slaves[e.node - 1];
+            if (sl.id == 0)
+                continue; // removed while queued
+            e.len = frameState(e.buf, sl.id, sl.isOn, sl.sliderValue);
+        }
+        if (e.kind == TXK_FADE || e.kind == TXK_OTHER)
+        {
+            static uint8_t seq = 0;
+            frameStamp(e.buf, seq++);
+        }
+        radio->send(e.buf, e.len);
+
+        if (e.kind == TXK_UNICAST || e.kind == TXK_REFRESH)
+        {
+            slaves[e.node - 1].isConnected = false; // until the node answers
+            *dirty = true;
+        }
+        if (e.kind == TXK_PROBE)
+        {
+            probe.sent = true;
+            probe.sentAt = sysClock->ms();
+        }
+        break;
+    }
+
+    if (txqPending(txq))
+        return 0;
+    if (probe.active && probe.sent)
+        return PROBE_WAIT_MS - min(sysClock->ms() - probe.sentAt, (uint32_t)PROBE_WAIT_MS);
+    return 0xFFFFFFFF;
+}
+// ---------------- Node actuation ------------------
+bool nodeSetRelay(int id, bool on)
+{
+    int idx = findNodeIndexById(id);
+    if (idx < 0)
+        return false;
+    registry.nodes[idx].relay = on;
+    if (id > 0 && id <= total_Slave)
+    {
+        int s = id - 1;
+        slaves[s].isOn = on;
+        if (dimSlots[s].pending && dimSlots[s].action == ACT_DIM)
+        {
+            // the relay frame carries the level too
+            slaves[s].sliderValue = dimSlots[s].value;
+            dimSlots[s].pending = false;
+            dimStats.sent++;
+        }
+        if (slaves[s].id != 0)
+            sendLora(slaves[s].id, on ? 1 : 0, slaves[s].sliderValue); // also persists to EEPROM
+    }
+    saveNodesPrefs();
+    rulesOnNode(id);
+    return true;
+}
+// ---------------- Node dimming --------------------
+bool nodeSetDim(int id, int value)
+{
+    if (id <= 0 || id > total_Slave)
+        return false;
+    int s = id - 1;
+    slaves[s].sliderValue = constrain(value, 0, 255);
+    sendLora(id, slaves[s].isOn ? 1 : 0, slaves[s].sliderValue); // also persists to EEPROM
+    rulesOnNode(id);
+    return true;
+}
+// ---------------- Expected node level -------------
+// Where the node should be right now; same curves as the node firmware.
+int slaveLevel(const SlaveStation &sl, unsigned long now)
+{
+    return fadeLevel(sl.fadeFrom, sl.sliderValue, now - sl.fadeStart, sl.fadeMs, sl.fadeCurve);
+}
+// ---------------- Node fade -----------------------
+// One FADE frame replaces the stream of dim frames a slider drag used to
+// send. The EEPROM keeps the target, which is where the node ends up.
+bool nodeFade(int id, int level, int ms, int curve)
+{
+    if (id <= 0 || id > total_Slave)
+        return false;
+    SlaveStation &sl = slaves[id - 1];
+    unsigned long now = millis();
+    int from = slaveLevel(sl, now); // a fade may start mid-fade
+    level = constrain(level, 0, 255);
+    ms = constrain(ms, 0, FADE_MAX_MS);
+    if (curve < 0 || curve >= FADE_CURVES)
+        curve = FADE_LINEAR;
+#if LORA_MULTICAST
+    if (ms > 0)
+    {
+        sl.sliderValue = level;
+        saveToEEPROM(id - 1, sl.isOn, level);
+        uint8_t f[8];
+        loraSendExt(f, frameFade(f, id, level, curve, ms));
+        sl.fadeFrom = from;
+        sl.fadeCurve = curve;
+        sl.fadeMs = ms;
+        sl.fadeStart = now;
+        fadeFrames++;
+        rulesOnNode(id);
+        return true;
+    }
+#else
+    (void)from;
+#endif
+    return nodeSetDim(id, level); // no extended frames: jump to the target
+}
+// ---------------- Edit node (owner) ---------------
+static int nodeEdit(int nodeId, int newId, const char *label)
+{
+    int idx = findNodeIndexById(nodeId);
+    if (idx < 0)
+        return BUS_NOT_FOUND;
+    // if id changed, ensure not duplicate
+    if (newId != nodeId && findNodeIndexById(newId) >= 0)
+        return BUS_EXISTS;
+
+    // apply changes
+    int oldId = nodeId;
+    registryEdit(registry, nodeId, newId, label);
+
+    // remap slave info if id changed and within range
+    if (oldId != newId)
+    {
+        DimSlot parked = {}; // a dim or class-A hold still parked follows the node
+        DownlinkHold held = {};
+        // clear old slave mapping if existed
+        if (oldId > 0 && oldId <= total_Slave)
+        {
+            int oldsi = oldId - 1;
+            slaves[oldsi].id = 0;
+            slaves[oldsi].isConnected = false;
+            parked = dimSlots[oldsi];
+            dimSlots[oldsi].pending = false;
+            held = holds[oldsi];
+            memset(&holds[oldsi], 0, sizeof(holds[oldsi]));
+            slaves[oldsi].held = false;
+        }
+        if (newId > 0 && newId <= total_Slave)
+        {
+            int newsi = newId - 1;
+            slaves[newsi].id = newId;
+            dimSlots[newsi] = parked;
+            held.fadeFrame[3] = (uint8_t)newId; // the held frame carries the id
+            holds[newsi] = held;
+            slaves[newsi].held = held.sends || held.fade;
+            if (oldId > 0 && oldId <= total_Slave)
+            {
+                slaves[newsi].classA = slaves[oldId - 1].classA; // the radio did not change
+                slaves[oldId - 1].classA = false;
+            }
+            // slider and isOn persisted in EEPROM remain; we leave them.
+            slaves[newsi].isConnected = false;
+        }
+    }
+
+    saveNodesPrefs();
+    return BUS_OK;
+}
+// ================ Groups and scenes (owner) =======
+// ---------------- Set one node, no frame ----------
+// relay < 0 or dim < 0 leaves that part alone. A dim still parked for the
+// node is older than this command and must not land after it.
+static void nodeApplyLocal(int id, int relay, int dim)
+{
+    int idx = findNodeIndexById(id);
+    if (idx >= 0 && relay >= 0)
+        registry.nodes[idx].relay = relay;
+    if (id >= 1 && id <= total_Slave)
+    {
+        SlaveStation &sl = slaves[id - 1];
+        if (dimSlots[id - 1].pending)
+        {
+            dimSlots[id - 1].pending = false;
+            dimStats.superseded++;
+        }
+        if (relay >= 0)
+            sl.isOn = relay;
+        if (dim >= 0)
+            sl.sliderValue = dim;
+        saveToEEPROM(id - 1, sl.isOn, sl.sliderValue);
+        if (sl.classA)
+            classAHold(id, TXK_UNICAST, NULL); // asleep when the multicast goes out
+    }
+    groupStats.nodesSet++;
+    rulesOnNode(id);
+}
+// ---------------- Group command -------------------
+// Toggle resolves to "on unless every member is on", so the gateway's
+// record and the nodes cannot drift apart.
+static int groupExecute(const GatewayCommand &cmd)
+{
+    int ids[MAX_NODES];
+    int n = 0;
+    xSemaphoreTake(groupMutex, portMAX_DELAY);
+    const NodeGroup *g = NULL;
+    for (int i = 0; i < GROUP_MAX && cmd.id; i++)
+        if (groups[i].id == cmd.id)
+            g = &groups[i];
+    if (cmd.id == 0 || g)
+        for (int i = 0; i < registry.count; i++)
+            if (!g || groupHas(*g, registry.nodes[i].id))
+                ids[n++] = registry.nodes[i].id;
+    xSemaphoreGive(groupMutex);
+    if (cmd.id && !g)
+        return BUS_NOT_FOUND;
+    if (!n)
+        return BUS_OK;
+
+    uint8_t act = cmd.action;
+    if (act == ACT_TOGGLE)
+    {
+        act = ACT_OFF;
+        for (int i = 0; i < n; i++)
+            if (!registry.nodes[findNodeIndexById(ids[i])].relay)
+                act = ACT_ON;
+    }
+    int dim = act == ACT_DIM ? constrain(cmd.value, 0, 255) : -1;
+    for (int i = 0; i < n; i++)
+        nodeApplyLocal(ids[i], act == ACT_DIM ? -1 : act == ACT_ON, dim);
+#if LORA_MULTICAST
+    uint8_t f[6];
+    loraSendExt(f, frameGroup(f, cmd.id, act, max(dim, 0)));
+    groupStats.frames++;
+#else
+    for (int i = 0; i < n; i++)
+    {
+        if (ids[i] > total_Slave)
+            continue;
+        const SlaveStation &sl = slaves[ids[i] - 1];
+        sendLora(ids[i], sl.isOn ? 1 : 0, sl.sliderValue);
+        groupStats.unicast++;
+    }
+#endif
+    saveNodesPrefs();
+    groupStats.groupCmds++;
+    return BUS_OK;
+}
+// ---------------- Scene command -------------------
+static int sceneExecute(uint16_t sid)
+{
+    Scene sc;
+    sc.id = 0;
+    xSemaphoreTake(groupMutex, portMAX_DELAY);
+    for (int i = 0; i < SCENE_MAX; i++)
+        if (scenes[i].id && scenes[i].id == sid)
+            sc = scenes[i];
+    xSemaphoreGive(groupMutex);
+    if (!sc.id)
+        return BUS_NOT_FOUND;
+
+    for (int i = 0; i < sc.count; i++)
+        nodeApplyLocal(sc.entries[i].node, sc.entries[i].relay, sc.entries[i].dim);
+#if LORA_MULTICAST
+    uint8_t f[LORA_FRAME_MAX];
+    for (int first = 0; first < sc.count; first += LORA_SCENE_PER_FRAME)
+    {
+        int k = min(sc.count - first, LORA_SCENE_PER_FRAME);
+        loraSendExt(f, frameScene(f, sc.id, (const uint8_t *)&sc.entries[first], k));
+        groupStats.frames++;
+    }
+#else
+    for (int i = 0; i < sc.count; i++)
+    {
+        sendLora(sc.entries[i].node, sc.entries[i].relay, sc.entries[i].dim);
+        groupStats.unicast++;
+    }
+#endif
+    saveNodesPrefs();
+    groupStats.sceneCmds++;
+    return BUS_OK;
+}
+// ---------------- Membership frames ---------------
+// id 0: every node with a radio id.
+static void groupSendJoins(int id)
+{
+    for (int nid = 1; nid <= total_Slave; nid++)
+    {
+        if ((id && nid != id) || findNodeIndexById(nid) < 0)
+            continue;
+        xSemaphoreTake(groupMutex, portMAX_DELAY);
+        uint16_t mask = groupJoinMask(groups, nid);
+        xSemaphoreGive(groupMutex);
+#if LORA_MULTICAST
+        uint8_t f[6];
+        loraSendExt(f, frameJoin(f, nid, mask));
+        groupStats.frames++;
+        groupStats.joins++;
+#endif
+    }
+}
+// ---------------- Load (setup) --------------------
+void groupsBegin()
+{
+    groupMutex = xSemaphoreCreateMutex();
+    int dropped = groupsLoad(*storage, groups, scenes);
+    if (dropped)
+        Serial.printf("[GROUP] %d invalid groups/scenes dropped\n", dropped);
+}
+// ---------------- Save (ioTask) -------------------
+// ioTask is the only writer, so no lock is needed to read here.
+void groupsSave()
+{
+    groupsSave(*storage, groups, scenes);
+}
+// ---------------- Dim slot (owner) ----------------
+// Parks a dim or fade; whatever is still parked when the window closes is
+// the only frame sent, so a slider drag costs a handful of frames.
+static void dimPost(int id, const GatewayCommand &cmd)
+{
+    if (id <= 0 || id > total_Slave)
+        return;
+    DimSlot &d = dimSlots[id - 1];
+    dimStats.posted++;
+    if (d.pending)
+        dimStats.superseded++;
+    else
+        d.due = millis() + DIM_COALESCE_MS;
+    d.pending = true;
+    d.action = cmd.action;
+    d.value = (uint8_t)constrain(cmd.value, 0, 255);
+    d.fadeMs = cmd.fadeMs;
+    d.curve = cmd.curve;
+    d.txClass = txClassNow;
+}
+// ---------------- Send due dim slots --------------
+// Returns ms until the next slot is due, 0xFFFFFFFF if none is parked.
+static uint32_t dimFlush(bool *dirty)
+{
+    unsigned long now = millis();
+    uint32_t wait = 0xFFFFFFFF;
+    for (int i = 0; i < total_Slave; i++)
+    {
+        DimSlot &d = dimSlots[i];
+        if (!d.pending)
+            continue;
+        long left = (long)(d.due - now);
+        if (left > 0)
+        {
+            wait = min(wait, (uint32_t)left);
+            continue;
+        }
+        d.pending = false;
+        txClassNow = d.txClass;
+        if (d.action == ACT_FADE)
+            nodeFade(i + 1, d.value, d.fadeMs, d.curve);
+        else
+            nodeSetDim(i + 1, d.value);
+        dimStats.sent++;
+        *dirty = true;
+    }
+    return wait;
+}
+// ---------------- Execute queued command ----------
+static void executeNodeCommand(int id, const GatewayCommand &cmd)
+{
+    if (cmd.action == ACT_DIM || cmd.action == ACT_FADE)
+    {
+        dimPost(id, cmd);
+        return;
+    }
+    int idx = findNodeIndexById(id);
+    if (idx < 0)
+        return;
+    bool on = cmd.action == ACT_TOGGLE ? !registry.nodes[idx].relay : cmd.action == ACT_ON;
+    nodeSetRelay(id, on);
+}
+void executeCommand(const BusMsg &m)
+{
+    const GatewayCommand &cmd = m.cmd;
+    int rc = BUS_OK;
+    txClassNow = txClassFor(cmd.source);
+    switch (cmd.target)
+    {
+    case CMD_LOCAL_RELAY:
+        for (int i = 0; i < 4; i++)
+        {
+            if (cmd.id != CMD_ID_ALL && cmd.id != i)
+                continue;
+            actuatorRequest(i, cmd.action, cmd.source, cmdPriority(cmd), m.postedUs);
+        }
+        break;
+    case CMD_NODE:
+        executeNodeCommand(cmd.id, cmd);
+        break;
+    case CMD_GROUP:
+        rc = groupExecute(cmd);
+        break;
+    case CMD_SCENE:
+        rc = sceneExecute(cmd.id);
+        break;
+    case CMD_NODE_ADD:
+        rc = probeStart(m);
+        break;
+    case CMD_NODE_REMOVE:
+        rc = removeNodeById(cmd.id) ? BUS_OK : BUS_NOT_FOUND;
+        break;
+    case CMD_NODE_EDIT:
+        rc = nodeEdit(cmd.id, cmd.value, m.text);
+        break;
+    case CMD_CONFIG:
+    {
+        GatewayConfig c;
+        configSnapshot(c);
+        fanThreshold = c.fanThreshold;
+        fanTuning = c.fan;
+        break;
+    }
+    case CMD_GROUP_SYNC:
+        groupSendJoins(0);
+        break;
+    case CMD_NODE_MODE:
+        rc = nodeSetClassA(cmd.id, cmd.value == 1);
+        break;
+    }
+    cmdExecuted++;
+    if (rc != BUS_PENDING)
+        busReply(m, rc);
+}
+// ================ Link manager =====================
+// Drives WiFi STA and the MQTT session from WiFi events and timers. Every
+// step returns immediately; failed attempts are retried after a capped
+// exponential backoff with jitter so a dead uplink costs almost nothing.
+void onWiFiEvent(arduino_event_id_t event)
+{
+    if (!linkEvents)
+        return;
+    if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP)
+        xEventGroupSetBits(linkEvents, LINK_EV_WIFI_UP);
+    else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED || event == ARDUINO_EVENT_WIFI_STA_LOST_IP)
+        xEventGroupSetBits(linkEvents, LINK_EV_WIFI_DOWN);
+}
+// ---------------- Backoff with jitter -------------
+unsigned long linkBackoff(uint8_t attempt)
+{
+    unsigned long d = LINK_BACKOFF_MIN << min((int)attempt, 6);
+    if (d > LINK_BACKOFF_MAX)
+        d = LINK_BACKOFF_MAX;
+    // equal jitter: half fixed, half random
+    return d / 2 + esp_random() % (d / 2 + 1);
+}
+// ---------------- Link state names ----------------
+const char *linkStateName(LinkState s)
+{
+    switch (s)
+    {
+    case LINK_NO_CONFIG:
+        return "no_config";
+    case LINK_WIFI_WAIT:
+        return "wifi_backoff";
+    case LINK_WIFI_JOINING:
+        return "wifi_joining";
+    case LINK_MQTT_WAIT:
+        return "mqtt_backoff";
+    case LINK_ONLINE:
+        return "online";
+    }
+    return "?";
+}
+// ---------------- Session bookkeeping -------------
+static void linkMqttDown(unsigned long now)
+{
+    if (linkStats.mqttUpSince)
+    {
+        linkStats.mqttUpTotal += now - linkStats.mqttUpSince;
+        linkStats.mqttUpSince = 0;
+        linkStats.mqttDrops++;
+    }
+}
+static void linkWifiDown(unsigned long now)
+{
+    linkMqttDown(now);
+    if (linkStats.wifiUpSince)
+    {
+        linkStats.wifiUpTotal += now - linkStats.wifiUpSince;
+        linkStats.wifiUpSince = 0;
+        linkStats.wifiDrops++;
+    }
+}
+// ---------------- One link step -------------------
+void linkStep(EventBits_t ev)
+{
+    static unsigned long nextTry = 0;
+    static unsigned long joinStart = 0;
+    static uint8_t wifiAttempt = 0;
+    static uint8_t mqttAttempt = 0;
+    unsigned long now = millis();
+
+    if (ev & LINK_EV_MQTT_RECONFIG)
+    {
+        if (mqttClient.connected())
+            mqttClient.disconnect();
+        mqttApplyBroker();
+        mqttAttempt = 0;
+        if (linkState == LINK_ONLINE || linkState == LINK_MQTT_WAIT)
+        {
+            linkMqttDown(now);
+            linkState = LINK_MQTT_WAIT;
+            nextTry = now;
+        }
+    }
+    if (ev & LINK_EV_WIFI_RECONFIG)
+    {
+        WiFi.disconnect();
+        linkWifiDown(now);
+        wifiAttempt = 0;
+        linkState = LINK_WIFI_WAIT;
+        nextTry = now;
+    }
+    if ((ev & LINK_EV_WIFI_DOWN) && linkState != LINK_WIFI_WAIT && linkState != LINK_NO_CONFIG)
+    {
+        linkWifiDown(now);
+        linkState = LINK_WIFI_WAIT;
+        nextTry = now + linkBackoff(wifiAttempt++);
+    }
+    if ((ev & LINK_EV_WIFI_UP) && !linkStats.wifiUpSince)
+    {
+        Serial.println("[LINK] WiFi STA connected: " + WiFi.localIP().toString());
+        linkStats.wifiConnects++;
+        linkStats.wifiUpSince = now;
+        wifiAttempt = 0;
+        linkState = LINK_MQTT_WAIT;
+        nextTry = now;
+    }
+
+    switch (linkState)
+    {
+    case LINK_NO_CONFIG:
+        if (configSsidSet)
+        {
+            linkState = LINK_WIFI_WAIT;
+            nextTry = now;
+        }
+        break;
+    case LINK_WIFI_WAIT:
+        if (!configSsidSet)
+        {
+            linkState = LINK_NO_CONFIG;
+        }
+        else if ((long)(now - nextTry) >= 0)
+        {
+            GatewayConfig c;
+            configSnapshot(c);
+            WiFi.mode(WIFI_AP_STA); // vừa AP cho WebPortal, vừa STA để lên internet
+            WiFi.begin(c.ssid.c_str(), c.pass.c_str());
+            Serial.printf("[LINK] Joining SSID: %s (attempt %u)\n", c.ssid.c_str(), wifiAttempt + 1);
+            linkStats.wifiAttempts++;
+            joinStart = now;
+            linkState = LINK_WIFI_JOINING;
+        }
+        break;
+    case LINK_WIFI_JOINING:
+        if (now - joinStart >= WIFI_JOIN_TIMEOUT)
+        {
+            WiFi.disconnect();
+            linkState = LINK_WIFI_WAIT;
+            nextTry = now + linkBackoff(wifiAttempt++);
+            Serial.printf("[LINK] WiFi join timed out, retry in %lu ms\n", nextTry - now);
+        }
+        break;
+    case LINK_MQTT_WAIT:
+        if ((long)(now - nextTry) >= 0)
+        {
+            // bounded by the WiFiClient connect timeout, not a retry loop
+            linkStats.mqttAttempts++;
+            char willTopic[64];
+            mqttTopic(willTopic, sizeof(willTopic), 0, "status");
+            if (mqttClient.connect(gatewayId, willTopic, 0, true, "offline"))
+            {
+                Serial.println("[LINK] MQTT connected!");
+                mqttOnConnected();
+                linkStats.mqttConnects++;
+                linkStats.mqttUpSince = millis();
+                mqttAttempt = 0;
+                linkState = LINK_ONLINE;
+            }
+            else
+            {
+                linkStats.mqttLastRc = mqttClient.state();
+                nextTry = millis() + linkBackoff(mqttAttempt++);
+                Serial.printf("[LINK] MQTT failed, rc=%d, retry in %lu ms\n", linkStats.mqttLastRc, nextTry - millis());
+            }
+        }
+        break;
+    case LINK_ONLINE:
+        if (!mqttClient.connected())
+        {
+            linkStats.mqttLastRc = mqttClient.state();
+            linkMqttDown(now);
+            linkState = LINK_MQTT_WAIT;
+            nextTry = now + linkBackoff(mqttAttempt++);
+        }
+        break;
+    }
+}
+// ================ MQTT topic helpers ==============
+// gateway/<id>/...          gateway level (status, state)
+// gateway/<id>/node/<nid>/. per node (state, telemetry)
+void initGatewayId()
+{
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    snprintf(gatewayId, sizeof(gatewayId), "gw-%02x%02x%02x", mac[3], mac[4], mac[5]);
+    snprintf(cmdTopicPrefix, sizeof(cmdTopicPrefix), "gateway/%s/cmd/", gatewayId);
+}
+// ---------------- Build topic ---------------------
+void mqttTopic(char *out, size_t n, int nid, const char *leaf)
+{
+    if (nid > 0)
+        snprintf(out, n, "gateway/%s/node/%d/%s", gatewayId, nid, leaf);
+    else
+        snprintf(out, n, "gateway/%s/%s", gatewayId, leaf);
+}
+// ---------------- Publish retained ----------------
+bool mqttPublishRetained(const char *topic, const uint8_t *payload, int len)
+{
+    if (len < 0)
+        return false;
+    return mqttClient.publish(topic, payload, len, true);
+}
+// ---------------- Data topic (format suffix) ------
+// CBOR payloads go to ".../<leaf>/cbor" so subscribers can tell them apart.
+void mqttDataTopic(char *out, size_t n, int nid, const char *leaf)
+{
+    char full[24];
+    snprintf(full, sizeof(full), mqttCbor ? "%s/cbor" : "%s", leaf);
+    mqttTopic(out, n, nid, full);
+}
+// ---------------- Clear a data topic --------------
+// The format is a setting, so a retained copy may sit under either
+// suffix; both are cleared.
+void mqttClearData(int nid, const char *leaf)
+{
+    static const uint8_t none = 0;
+    char topic[64], full[24];
+    mqttTopic(topic, sizeof(topic), nid, leaf);
+    mqttPublishRetained(topic, &none, 0);
+    snprintf(full, sizeof(full), "%s/cbor", leaf);
+    mqttTopic(topic, sizeof(topic), nid, full);
+    mqttPublishRetained(topic, &none, 0);
+}
+// ---------------- Session start -------------------
+void mqttOnConnected()
+{
+    char topic[64];
+    mqttTopic(topic, sizeof(topic), 0, "status");
+    mqttPublishRetained(topic, (const uint8_t *)"online", 6);
+    mqttClient.subscribe("esp32/relay/cmd"); // lệnh điều khiển relay
+    mqttTopic(topic, sizeof(topic), 0, "cmd/#");
+    mqttClient.subscribe(topic);
+
+    // the broker may have lost retained state; send everything once
+    gwPubCache.valid = false;
+    for (int i = 0; i < total_Slave; i++)
+    {
+        nodePubCache[i].stateValid = false;
+        nodePubCache[i].telemetryValid = false;
+    }
+}
+// ================ MQTT outbox (flash) =============
+// The ring of core/outbox.h in a LittleFS file, its pointers in a second
+// file rewritten after every change.
+void outboxSaveMeta();
+struct LfsOutboxStore : OutboxStore
+{
+    File &f;
+    explicit LfsOutboxStore(File &file) : f(file) {}
+    bool read(uint32_t pos, uint8_t *buf, uint32_t len) override
+    {
+        return f.seek(pos) && f.read(buf, len) == len;
+    }
+    bool write(uint32_t pos, const uint8_t *buf, uint32_t len) override
+    {
+        return f.seek(pos) && f.write(buf, len) == len;
+    }
+    void saveMeta(const OutboxMeta &) override
+    {
+        outboxSaveMeta(); // the global ring, the only one
+    }
+};
+// ---------------- Persist ring pointers -----------
+void outboxSaveMeta()
+{
+    File f = LittleFS.open(OUTBOX_META, "w");
+    if (!f)
+        return;
+    f.write((const uint8_t *)&outbox, sizeof(outbox));
+    f.close();
+}
+// ---------------- Mount & recover -----------------
+void outboxBegin()
+{
+    if (!LittleFS.begin(true))
+    {
+        Serial.println("[OUTBOX] LittleFS mount failed, store-and-forward disabled");
+        return;
+    }
+    outboxReady = true;
+    File m = LittleFS.open(OUTBOX_META, "r");
+    bool ok = m && m.read((uint8_t *)&outbox, sizeof(outbox)) == sizeof(outbox);
+    if (m)
+        m.close();
+    ok = ok && outboxMetaValid(outbox) && LittleFS.exists(OUTBOX_FILE);
+    if (!ok)
+    {
+        File f = LittleFS.open(OUTBOX_FILE, "w");
+        if (f)
+            f.close();
+        outboxReset(outbox);
+        outboxSaveMeta();
+    }
+    Serial.printf("[OUTBOX] %u queued (%u bytes)\n", outbox.count, outbox.bytes);
+}
+// ---------------- Append (oldest-first drop) ------
+bool outboxPush(const char *topic, const char *payload, int len, uint8_t flags, uint32_t ts)
+{
+    if (!outboxReady)
+        return false;
+    File f = LittleFS.open(OUTBOX_FILE, "r+");
+    if (!f)
+        return false;
+    LfsOutboxStore io(f);
+    bool ok = outboxAppend(io, outbox, outboxStats, topic, payload, len, flags, ts);
+    f.close();
+    return ok;
+}
+// ---------------- Drain after reconnect -----------
+// At most OUTBOX_DRAIN_BURST records per mqttTask pass, after the live
+// publishes, so a long backlog never crowds out current traffic.
+void outboxDrain()
+{
+    if (!outboxReady || outbox.count == 0)
+        return;
+    File f = LittleFS.open(OUTBOX_FILE, "r");
+    if (!f)
+        return;
+    LfsOutboxStore io(f);
+
+    char topic[OUTBOX_MAX_TOPIC + 1];
+    uint8_t payload[OUTBOX_MAX_PAYLOAD];
+    int sent = 0;
+    bool skipped = false;
+    while (outbox.count > 0 && sent < OUTBOX_DRAIN_BURST)
+    {
+        OutboxHeader h;
+        int rc = outboxPeek(io, outbox, outboxStats, h, topic, payload);
+        skipped |= rc <= 0;
+        if (rc < 0)
+            break;
+        if (rc == 0)
+            continue; // corrupt record, skipped
+        if (!mqttClient.publish(topic, payload, h.payloadLen, h.flags & OUTBOX_FLAG_RETAIN))
+            break; // keep it for the next pass
+        outboxStats.drained++;
+        sent++;
+        outboxAdvance(outbox, h);
+    }
+    f.close();
+    if (sent || skipped)
+        outboxSaveMeta();
+}
+// ---------------- Drain rate (msg/s) --------------
+void outboxUpdateRate()
+{
+    static unsigned long windowStart = 0;
+    static uint32_t drainedAtStart = 0;
+    if (millis() - windowStart >= 1000)
+    {
+        outboxStats.drainRate = outboxStats.drained - drainedAtStart;
+        drainedAtStart = outboxStats.drained;
+        windowStart = millis();
+    }
+}
+// ================ Publish changes =================
+// Called every mqttTask pass. Each node publishes only when its own state
+// changes or its temperature moves beyond the deadband, so broker traffic
+// follows the rate of change, not the node count. While offline, state is
+// left to the full resend on reconnect and telemetry goes to the outbox.
+void publishChanges(bool connected)
+{
+    static GatewayState st;
+    char topic[64];
+    uint8_t buf[128];
+    int n;
+
+    stateRead(st);
+    float t = sensTemp();
+    bool relaysChanged = !gwPubCache.valid || gwPubCache.fan != st.fan;
+    for (int i = 0; i < 4 && !relaysChanged; i++)
+        relaysChanged = gwPubCache.relays[i] != st.relays[i];
+    if (connected && (relaysChanged || fabsf(t - gwPubCache.temp) >= TELEMETRY_DEADBAND_C))
+    {
+        PayloadWriter w(buf, sizeof(buf), mqttCbor);
+        schemaGatewayState(w, t, st.fan, st.relays);
+        mqttDataTopic(topic, sizeof(topic), 0, "state");
+        if (mqttPublishRetained(topic, buf, w.size()))
+        {
+            gwPubCache.valid = true;
+            gwPubCache.temp = t;
+            gwPubCache.fan = st.fan;
+            for (int i = 0; i < 4; i++)
+                gwPubCache.relays[i] = st.relays[i];
+        }
+    }
+
+    for (int i = 0; i < total_Slave; i++)
+    {
+        const SlaveStation &s = st.slaves[i];
+        NodePubCache &c = nodePubCache[i];
+        int nid = i + 1;
+
+        if (s.id == 0)
+        {
+            // node removed: clear its retained topics once
+            if (connected && (c.stateValid || c.telemetryValid))
+            {
+                mqttClearData(nid, "state");
+                mqttClearData(nid, "telemetry");
+                c.stateValid = false;
+                c.telemetryValid = false;
+            }
+            continue;
+        }
+
+        // isConnected drops on every downlink until the reply; judge
+        // reachability by the last uplink so the topic does not flap
+        bool online = s.lastSeen && millis() - s.lastSeen < NODE_ONLINE_TIMEOUT;
+        if (connected && (!c.stateValid || c.relay != s.isOn || c.dim != s.sliderValue || c.connected != online))
+        {
+            PayloadWriter w(buf, sizeof(buf), mqttCbor);
+            schemaNodeState(w, nid, s.isOn, s.sliderValue, online);
+            mqttDataTopic(topic, sizeof(topic), nid, "state");
+            if (mqttPublishRetained(topic, buf, w.size()))
+            {
+                c.stateValid = true;
+                c.relay = s.isOn;
+                c.dim = s.sliderValue;
+                c.connected = online;
+            }
+        }
+
+        if (online && (!c.telemetryValid || fabsf(s.temperature - c.temperature) >= TELEMETRY_DEADBAND_C))
+        {
+            mqttDataTopic(topic, sizeof(topic), nid, "telemetry");
+            if (connected)
+            {
+                PayloadWriter w(buf, sizeof(buf), mqttCbor);
+                schemaNodeTelemetry(w, nid, s.temperature, s.time, 0);
+                if (!mqttPublishRetained(topic, buf, w.size()))
+                    connected = false; // fall through to the outbox
+            }
+            if (!connected)
+            {
+                // backlog copies carry their capture time and are not retained
+                uint32_t ts = sensUnixTime();
+                PayloadWriter w(buf, sizeof(buf), mqttCbor);
+                schemaNodeTelemetry(w, nid, s.temperature, s.time, ts);
+                n = w.size();
+                if (n >= 0)
+                    outboxPush(topic, (const char *)buf, n, 0, ts);
+            }
+            c.telemetryValid = true;
+            c.temperature = s.temperature;
+        }
+    }
+}
+// ================ Metrics mirror ==================
+// Same text as /api/metrics on gateway/<id>/metrics, streamed so it does
+// not need a PubSubClient buffer of its size.
+void metricsPublish()
+{
+    static unsigned long last = 0;
+    if (last && millis() - last < METRICS_PERIOD_MS)
+        return;
+    last = millis() | 1;
+
+    char topic[64];
+    mqttTopic(topic, sizeof(topic), 0, "metrics");
+    xSemaphoreTake(metricsMutex, portMAX_DELAY);
+    stateRead(metricsState);
+    int n = metricsRender(metricsBuf, sizeof(metricsBuf), metricsState);
+    if (n > 0 && mqttClient.beginPublish(topic, n, false))
+    {
+        mqttClient.write((const uint8_t *)metricsBuf, n);
+        mqttClient.endPublish();
+    }
+    xSemaphoreGive(metricsMutex);
+}
+// ================ Apply broker from config ========
+void mqttApplyBroker()
+{
+    // PubSubClient keeps the host pointer, so it needs storage of its own
+    static char host[64];
+    GatewayConfig c;
+    configSnapshot(c);
+    snprintf(host, sizeof(host), "%s", c.mqttHost.c_str());
+    mqttClient.setServer(host, c.mqttPort);
+    mqttCbor = c.mqttCbor;
+}
+// ---------------- Queue a command -----------------
+bool cmdPost(const GatewayCommand &cmd)
+{
+    BusMsg m = {};
+    m.cmd = cmd;
+    return busPost(m);
+}
+// ================ MQTT callback ===================
+void mqttCallback(char *topic, byte *payload, unsigned int length)
+{
+    GatewayCommand cmds[CMD_BATCH_MAX] = {};
+    unsigned long t0 = micros();
+    int n = parseCommandMessage(cmdTopicPrefix, topic, payload, length, cmds, CMD_BATCH_MAX);
+    unsigned long dt = micros() - t0;
+
+    cmdStats.messages++;
+    cmdStats.parseTotalUs += dt;
+    if (dt > cmdStats.parseMaxUs)
+        cmdStats.parseMaxUs = dt;
+    if (n < 0)
+    {
+        cmdStats.rejected++;
+        Serial.printf("[MQTT] rejected cmd on %s (%u bytes)\n", topic, length);
+        return;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (cmdPost(cmds[i]))
+            cmdStats.queued++;
+        else
+            cmdStats.dropped++;
+    }
+}
+// ================ Schedules =======================
+// ---------------- Load (setup) --------------------
+// After outboxBegin(), which mounts LittleFS.
+void schedBegin()
+{
+    schedMutex = xSemaphoreCreateMutex();
+    int dropped = schedLoad(*storage, SCHED_FILE, schedTable);
+    if (dropped)
+        Serial.printf("[SCHED] %d invalid entries dropped\n", dropped);
+    Serial.printf("[SCHED] %d entries\n", schedTable.count);
+}
+// ---------------- Edit (any task) -----------------
+// e.id 0 adds, otherwise replaces that entry. Returns the id, 0 when the
+// table is full or the id unknown.
+uint16_t schedPut(const SchedEntry &in)
+{
+    xSemaphoreTake(schedMutex, portMAX_DELAY);
+    uint16_t id = schedPut(schedTable, in, sensUnixTime());
+    xSemaphoreGive(schedMutex);
+    if (id && schedTaskHandle)
+        xTaskNotifyGive(schedTaskHandle); // may be the new earliest
+    return id;
+}
+// id 0 deletes every entry.
+bool schedDelete(uint16_t id)
+{
+    xSemaphoreTake(schedMutex, portMAX_DELAY);
+    bool found = schedDelete(schedTable, id);
+    xSemaphoreGive(schedMutex);
+    if (found && schedTaskHandle)
+        xTaskNotifyGive(schedTaskHandle);
+    return found;
+}
+// ---------------- Scheduler task ------------------
+// Sleeps until the earliest entry is due, a pending save, or
+// SCHED_IDLE_MS; an edit wakes it early. Fired commands go to the bus
+// like any other source.
+static bool schedFire(const SchedEntry &e)
+{
+    GatewayCommand cmd = {e.target, e.action, CMD_SRC_SCHEDULE, e.targetId, e.value};
+    return cmdPost(cmd);
+}
+void schedTask(void *pvParameters)
+{
+    (void)pvParameters;
+    for (;;)
+    {
+        unsigned long t0 = micros();
+        uint32_t waitMs = SCHED_IDLE_MS;
+
+        xSemaphoreTake(schedMutex, portMAX_DELAY);
+        // the sampler rebases the clock on a set or an RTC resync
+        int64_t step = schedClock(schedTable, sensUnixMs(), millis());
+        if (step)
+            Serial.printf("[SCHED] clock stepped %lld ms, rebuilding\n", (long long)step);
+        uint32_t due = schedRunDue(schedTable, sensUnixMs(), schedFire);
+        waitMs = min(waitMs, due ? due : (uint32_t)SCHED_RETRY_MS);
+
+        if (schedTable.dirty)
+        {
+            deferMark(schedPending, millis());
+            schedTable.dirty = false;
+        }
+        uint32_t saveWait = deferWait(schedPending, millis(), SCHED_SAVE_DELAY_MS);
+        if (!saveWait)
+        {
+            schedSave(*storage, SCHED_FILE, schedTable);
+            deferDone(schedPending);
+        }
+        else
+        {
+            waitMs = min(waitMs, saveWait);
+        }
+        xSemaphoreGive(schedMutex);
+
+        supBeat(SUP_SCHED, micros() - t0);
+        ulTaskNotifyTake(pdTRUE, (waitMs ? waitMs : 1) / portTICK_PERIOD_MS);
+    }
+}
+// ================ Rules ===========================
+// ---------------- Load (setup) --------------------
+void rulesBegin()
+{
+    ruleMutex = xSemaphoreCreateMutex();
+    int dropped = rulesLoad(*storage, RULE_FILE, ruleTable);
+    if (dropped)
+        Serial.printf("[RULE] %d invalid rules dropped\n", dropped);
+    Serial.printf("[RULE] %d rules\n", ruleTable.count);
+}
+// ---------------- Edit (ioTask) -------------------
+// Only ioTask writes rules[], so it can save them without the lock.
+// r.id 0 adds, otherwise replaces that rule (and re-arms it). Returns the
+// id, 0 when the table is full or the id unknown.
+uint16_t rulePut(const Rule &in)
+{
+    xSemaphoreTake(ruleMutex, portMAX_DELAY);
+    uint16_t id = rulesPut(ruleTable, in);
+    xSemaphoreGive(ruleMutex);
+    if (!id)
+        return 0;
+    ruleStats.edits++;
+    rulesSave(*storage, RULE_FILE, ruleTable);
+    return id;
+}
+// id 0 deletes every rule.
+bool ruleDelete(uint16_t id)
+{
+    xSemaphoreTake(ruleMutex, portMAX_DELAY);
+    bool found = rulesDelete(ruleTable, id);
+    xSemaphoreGive(ruleMutex);
+    if (found)
+    {
+        ruleStats.edits++;
+        rulesSave(*storage, RULE_FILE, ruleTable);
+    }
+    return found;
+}
+// ---------------- Evaluate ------------------------
+static bool ruleFire(const Rule &r)
+{
+    GatewayCommand cmd = {r.target, r.action, CMD_SRC_RULE, r.targetId, r.value};
+    return cmdPost(cmd);
+}
+static void rulesRun(int bucket)
+{
+    if (!ruleMutex || ruleTable.head[bucket] == RULE_NONE)
+        return;
+    unsigned long t0 = micros();
+    RuleInputs in;
+    if (bucket < total_Slave)
+    {
+        const SlaveStation &sl = slaves[bucket];
+        in.fields[RULE_F_TEMP] = sl.temperature;
+        in.fields[RULE_F_TIME] = sl.time;
+        in.fields[RULE_F_RELAY] = sl.isOn ? 1 : 0;
+        in.fields[RULE_F_DIM] = sl.sliderValue;
+    }
+    else
+    {
+        for (int f = 0; f < RULE_FIELDS; f++) // a relay has one value
+            in.fields[f] = relayState[bucket - total_Slave] ? 1 : 0;
+    }
+    in.relays = relayState;
+    in.nowMs = millis();
+    in.minute = sensUnixTime() / 60 % 1440;
+    in.fire = ruleFire;
+    xSemaphoreTake(ruleMutex, portMAX_DELAY);
+    rulesEval(ruleTable, bucket, in, ruleStats);
+    xSemaphoreGive(ruleMutex);
+    uint32_t dt = micros() - t0;
+    ruleStats.triggers++;
+    ruleStats.evalUs += dt;
+    if (dt > ruleStats.evalMaxUs)
+        ruleStats.evalMaxUs = dt;
+}
+// ---------------- Source hooks (loraTask) ---------
+void rulesOnNode(int id)
+{
+    if (id >= 1 && id <= total_Slave)
+        rulesRun(id - 1);
+}
+void rulesOnRelay(int idx)
+{
+    if (idx >= 0 && idx < 4)
+        rulesRun(total_Slave + idx);
+}
+// ================ Supervisor ======================
+// Tasks call supBeat() once per loop with their busy time (the wait is
+// excluded) and supAlive() inside waits that may legitimately run long.
+// Only the supervisor is subscribed to the task watchdog: if any task stays
+// silent past its stall limit the feeding stops, the stall is written to
+// RTC memory and the watchdog resets the chip WDT_TIMEOUT s later.
+static uint32_t stallCheck(const StallRecord &r)
+{
+    return r.magic ^ r.resets ^ (uint32_t)r.task ^ r.silentMs ^ r.uptimeS ^ 0xA5A5A5A5UL;
+}
+void supBeat(int task, uint32_t busyUs)
+{
+    TaskHealth &h = taskHealth[task];
+    int b = 0;
+    while (b < LOOP_HIST_BUCKETS - 1 && busyUs >= (64UL << b))
+        b++;
+    h.hist[b]++;
+    if (busyUs > h.maxUs)
+        h.maxUs = busyUs;
+    h.loops++;
+    h.lastBeat = millis();
+}
+void supAlive(int task)
+{
+    taskHealth[task].lastBeat = millis();
+}
+// ---------------- p99 from the histogram ----------
+// Upper bound of the bucket holding the 99th percentile (0 = no data).
+uint32_t supP99Us(const TaskHealth &h)
+{
+    uint32_t total = 0;
+    for (int b = 0; b < LOOP_HIST_BUCKETS; b++)
+        total += h.hist[b];
+    if (!total)
+        return 0;
+    uint32_t need = total - total / 100, seen = 0;
+    for (int b = 0; b < LOOP_HIST_BUCKETS - 1; b++)
+    {
+        seen += h.hist[b];
+        if (seen >= need)
+            return 64UL << b;
+    }
+    return h.maxUs;
+}
+// ---------------- Reset reason names --------------
+const char *resetReasonName(esp_reset_reason_t r)
+{
+    switch (r)
+    {
+    case ESP_RST_POWERON:
+        return "poweron";
+    case ESP_RST_EXT:
+        return "external";
+    case ESP_RST_SW:
+        return "software";
+    case ESP_RST_PANIC:
+        return "panic";
+    case ESP_RST_INT_WDT:
+        return "int_wdt";
+    case ESP_RST_TASK_WDT:
+        return "task_wdt";
+    case ESP_RST_WDT:
+        return "wdt";
+    case ESP_RST_BROWNOUT:
+        return "brownout";
+    default:
+        return "other";
+    }
+}
+// ---------------- Boot: pick up stall record ------
+void supInit()
+{
+    bootResetReason = esp_reset_reason();
+    bool valid = stallRecord.magic == STALL_MAGIC && stallRecord.check == stallCheck(stallRecord);
+    if (!valid || bootResetReason == ESP_RST_POWERON || bootResetReason == ESP_RST_BROWNOUT)
+    {
+        memset(&stallRecord, 0, sizeof(stallRecord));
+        stallRecord.task = -1;
+    }
+    else if (stallRecord.task >= 0)
+    {
+        stallRecord.resets++;
+    }
+    lastStall = stallRecord;
+    if (lastStall.task >= 0 && lastStall.task < SUP_COUNT)
+        Serial.printf("[SUP] reset: %s, stalled task: %s (silent %lu ms, up %lu s)\n",
+                      resetReasonName(bootResetReason), taskHealth[lastStall.task].name,
+                      (unsigned long)lastStall.silentMs, (unsigned long)lastStall.uptimeS);
+    else
+        Serial.printf("[SUP] reset: %s\n", resetReasonName(bootResetReason));
+    // keep the counter, clear the pending stall
+    stallRecord.magic = STALL_MAGIC;
+    stallRecord.task = -1;
+    stallRecord.check = stallCheck(stallRecord);
+
+    unsigned long now = millis();
+    for (int i = 0; i < SUP_COUNT; i++)
+        taskHealth[i].lastBeat = now; // each task gets its full limit to start
+}
+// ================ Task layout =====================
+// taskSpecs holds the build defaults; NVS namespace "tasks" may override
+// priority (<key>.p), core (<key>.c) and stack (<key>.s) per device.
+void taskLayoutLoad()
+{
+    Preferences p;
+    if (!p.begin("tasks", true))
+        return; // nothing stored yet
+    char k[16];
+    for (int i = 0; i < taskSpecCount; i++)
+    {
+        TaskSpec &t = taskSpecs[i];
+        snprintf(k, sizeof(k), "%s.p", t.key);
+        if (p.isKey(k))
+        {
+            t.prio = constrain(p.getUInt(k, t.prio), 1u, (unsigned)TASK_PRIO_MAX);
+            t.fromNvs = true;
+        }
+        snprintf(k, sizeof(k), "%s.c", t.key);
+        if (p.isKey(k) && p.getUInt(k, 0) < portNUM_PROCESSORS)
+        {
+            t.core = p.getUInt(k, 0);
+            t.fromNvs = true;
+        }
+        snprintf(k, sizeof(k), "%s.s", t.key);
+        if (p.isKey(k))
+        {
+            t.stack = constrain(p.getUInt(k, t.stack), (uint32_t)TASK_STACK_MIN, (uint32_t)TASK_STACK_MAX);
+            t.fromNvs = true;
+        }
+    }
+    p.end();
+}
+// ---------------- Create the tasks ----------------
+void taskLayoutStart()
+{
+    for (int i = 0; i < taskSpecCount; i++)
+    {
+        const TaskSpec &t = taskSpecs[i];
+        if (!t.enabled)
+            continue;
+        if (xTaskCreatePinnedToCore(t.fn, t.name, t.stack, NULL, t.prio, t.handle, t.core) != pdPASS)
+            Serial.printf("[TASK] %s: create failed (stack %lu)\n", t.name, (unsigned long)t.stack);
+        else
+            Serial.printf("[TASK] %s prio %u core %d stack %lu%s\n", t.name, (unsigned)t.prio, (int)t.core,
+                          (unsigned long)t.stack, t.fromNvs ? " (nvs)" : "");
+    }
+}
+// ---------------- Profiler sample (supervisor) ----
+void profSample()
+{
+    static TaskStatus_t raw[PROF_MAX_TASKS];
+    static ProfEntry cur[PROF_MAX_TASKS];
+    static Profile next; // also the previous sample, for the deltas
+    static uint32_t lastLoops[SUP_COUNT];
+    static unsigned long lastAt = 0;
+
+    uint32_t total = 0;
+    UBaseType_t n = uxTaskGetSystemState(raw, PROF_MAX_TASKS, &total);
+    if (n == 0)
+        return; // more tasks than PROF_MAX_TASKS
+    uint32_t dTotal = total - next.totalRunTime;
+    for (UBaseType_t i = 0; i < n; i++)
+    {
+        const TaskStatus_t &r = raw[i];
+        ProfEntry &e = cur[i];
+        e.h = r.xHandle;
+        snprintf(e.name, sizeof(e.name), "%s", r.pcTaskName);
+        e.prio = r.uxCurrentPriority;
+        e.basePrio = r.uxBasePriority;
+#if configTASKLIST_INCLUDE_COREID
+        e.core = r.xCoreID == tskNO_AFFINITY ? -1 : r.xCoreID;
+#else
+        e.core = -1;
+#endif
+        e.stackFree = r.usStackHighWaterMark;
+        e.runTime = r.ulRunTimeCounter;
+        e.cpuPermille = 0;
+        for (int j = 0; j < next.count; j++)
+        {
+            if (next.tasks[j].h == e.h)
+            {
+                // first sample of a task has no delta: left at 0
+                uint64_t d = (uint32_t)(r.ulRunTimeCounter - next.tasks[j].runTime);
+                e.cpuPermille = dTotal ? (uint16_t)min(d * 1000 / dTotal, (uint64_t)1000) : 0;
+                break;
+            }
+        }
+        e.wakes = -1;
+        for (int k = 0; k < taskSpecCount; k++)
+        {
+            const TaskSpec &t = taskSpecs[k];
+            if (t.sup >= 0 && *t.handle == e.h)
+            {
+                e.wakes = taskHealth[t.sup].loops - lastLoops[t.sup];
+#if !configTASKLIST_INCLUDE_COREID
+                e.core = t.core;
+#endif
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < SUP_COUNT; i++)
+        lastLoops[i] = taskHealth[i].loops;
+
+    unsigned long now = millis();
+    next.windowMs = now - lastAt;
+    lastAt = now;
+    next.samples++;
+    next.totalRunTime = total;
+    next.count = n;
+    memcpy(next.tasks, cur, n * sizeof(ProfEntry));
+    seqWrite(profSeq, &profView, &next, sizeof(next));
+}
+// ---------------- GET /api/profile ----------------
+void handle_api_profile()
+{
+    static Profile pv;
+    static uint8_t out[PROFILE_BUF_SIZE];
+    seqRead(profSeq, &pv, &profView, sizeof(pv));
+    bool cbor = clientWantsCbor();
+    PayloadWriter w(out, sizeof(out), cbor);
+    w.beginMap();
+    w.key("windowMs");
+    w.num(pv.windowMs);
+    w.key("samples");
+    w.num(pv.samples);
+    w.key("runTimeStats");
+    w.boolean(configGENERATE_RUN_TIME_STATS != 0);
+    w.key("tasks");
+    w.beginArray();
+    for (int i = 0; i < pv.count; i++)
+    {
+        const ProfEntry &e = pv.tasks[i];
+        w.beginMap();
+        w.key("name");
+        w.str(e.name);
+        w.key("prio");
+        w.num(e.prio);
+        w.key("basePrio");
+        w.num(e.basePrio);
+        w.key("core");
+        w.num(e.core);
+        w.key("cpuPct");
+        w.real(e.cpuPermille / 10.0f, 1);
+        w.key("stackFree");
+        w.num(e.stackFree);
+        if (e.wakes >= 0)
+        {
+            w.key("wakesPerS");
+            w.real(pv.windowMs ? e.wakes * 1000.0f / pv.windowMs : 0.0f, 1);
+        }
+        w.endMap();
+    }
+    w.endArray();
+    w.key("layout");
+    w.beginArray();
+    for (int i = 0; i < taskSpecCount; i++)
+    {
+        const TaskSpec &t = taskSpecs[i];
+        w.beginMap();
+        w.key("task");
+        w.str(t.key);
+        w.key("name");
+        w.str(t.name);
+        w.key("enabled");
+        w.boolean(t.enabled);
+        w.key("prio");
+        w.num(t.prio);
+        w.key("core");
+        w.num(t.core);
+        w.key("stack");
+        w.num(t.stack);
+        w.key("source");
+        w.str(t.fromNvs ? "nvs" : "build");
+        w.endMap();
+    }
+    w.endArray();
+    w.endMap();
+    if (w.size() < 0)
+    {
+        statusServer.send(500, "application/json", "{\"ok\":0, \"err\":\"profile too large\"}");
+        return;
+    }
+    statusServer.send_P(200, cbor ? "application/cbor" : "application/json", (const char *)out, w.size());
+}
+// ---------------- POST /api/tasks -----------------
+// task=<key> [prio=] [core=] [stack=] | reset=1. Priority applies at once;
+// core and stack at the next boot.
+void handle_api_tasks()
+{
+    TaskSpec *t = NULL;
+    for (int i = 0; i < taskSpecCount && !t; i++)
+        if (statusServer.arg("task") == taskSpecs[i].key)
+            t = &taskSpecs[i];
+    if (!t)
+    {
+        statusServer.send(404, "application/json", "{\"ok\":0, \"err\":\"unknown task\"}");
+        return;
+    }
+    bool hasPrio = statusServer.hasArg("prio");
+    bool hasCore = statusServer.hasArg("core");
+    bool hasStack = statusServer.hasArg("stack");
+    bool reset = statusServer.arg("reset") == "1";
+    int prio = statusServer.arg("prio").toInt();
+    int core = statusServer.arg("core").toInt();
+    int stack = statusServer.arg("stack").toInt();
+    if ((hasPrio && (prio < 1 || prio > TASK_PRIO_MAX)) ||
+        (hasCore && (core < 0 || core >= portNUM_PROCESSORS)) ||
+        (hasStack && (stack < TASK_STACK_MIN || stack > TASK_STACK_MAX)))
+    {
+        statusServer.send(400, "application/json", "{\"ok\":0, \"err\":\"invalid value\"}");
+        return;
+    }
+
+    Preferences p;
+    p.begin("tasks", false);
+    char k[16];
+    if (reset)
+    {
+        snprintf(k, sizeof(k), "%s.p", t->key);
+        p.remove(k);
+        snprintf(k, sizeof(k), "%s.c", t->key);
+        p.remove(k);
+        snprintf(k, sizeof(k), "%s.s", t->key);
+        p.remove(k);
+    }
+    else
+    {
+        if (hasPrio)
+        {
+            snprintf(k, sizeof(k), "%s.p", t->key);
+            p.putUInt(k, prio);
+        }
+        if (hasCore)
+        {
+            snprintf(k, sizeof(k), "%s.c", t->key);
+            p.putUInt(k, core);
+        }
+        if (hasStack)
+        {
+            snprintf(k, sizeof(k), "%s.s", t->key);
+            p.putUInt(k, stack);
+        }
+    }
+    p.end();
+
+    if (hasPrio && !reset)
+    {
+        t->prio = prio;
+        t->fromNvs = true;
+        if (*t->handle)
+            vTaskPrioritySet(*t->handle, prio);
+    }
+    bool reboot = reset || hasCore || hasStack;
+    statusServer.send(200, "application/json", reboot ? "{\"ok\":1,\"reboot\":1}" : "{\"ok\":1,\"reboot\":0}");
+}
+// ---------------- Supervisor Task -----------------
+void supervisorTask(void *pvParameters)
+{
+    (void)pvParameters;
+    esp_task_wdt_init(WDT_TIMEOUT, true);
+    esp_task_wdt_add(NULL);
+    unsigned long lastProf = 0;
+    for (;;)
+    {
+        unsigned long now = millis();
+        int stalled = -1;
+        uint32_t worst = 0;
+        for (int i = 0; i < SUP_COUNT; i++)
+        {
+            uint32_t silent = now - taskHealth[i].lastBeat;
+            if (silent > taskHealth[i].stallMs && silent > worst)
+            {
+                stalled = i;
+                worst = silent;
+            }
+        }
+
+        if (stalled < 0)
+        {
+            esp_task_wdt_reset();
+            if (supStalled >= 0)
+            {
+                // recovered before the watchdog ran out: nothing to report
+                Serial.printf("[SUP] %s recovered\n", taskHealth[supStalled].name);
+                stallRecord.task = -1;
+                stallRecord.check = stallCheck(stallRecord);
+            }
+        }
+        else if (supStalled != stalled)
+        {
+            // no I2C/flash here: the stalled task may be holding the bus
+            stallRecord.magic = STALL_MAGIC;
+            stallRecord.task = stalled;
+            stallRecord.silentMs = worst;
+            stallRecord.uptimeS = now / 1000;
+            stallRecord.check = stallCheck(stallRecord);
+            Serial.printf("[SUP] %s silent for %lu ms, watchdog no longer fed\n",
+                          taskHealth[stalled].name, (unsigned long)worst);
+        }
+        supStalled = stalled;
+        cpuLoadSample();
+        if (now - lastProf >= PROF_PERIOD_MS)
+        {
+            profSample();
+            lastProf = now;
+        }
+        vTaskDelay(SUP_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+}
+// ---------------- Standby Screen ------------------
+void standby_screen()
+{
+    DateTime now = sensNow();
+    char tbuf[16];
+    sprintf(tbuf, "%02d:%02d:%02d", now.hour(), now.minute(), now.second());
+    u8g2.setFont(u8g2_font_ncenB18_te);
+    u8g2.setCursor(18, 38);
+    u8g2.print(tbuf);
+}
+// ---------------- Data Screen ---------------------
+void data_screen(const GatewayState &st)
+{
+    // basic data screen + rotating node info
+    u8g2.setCursor(52, 33);
+    u8g2.drawXBM(36, 17, 16, 16, image_weather_temperature_bits);
+    u8g2.setFont(u8g2_font_profont12_tr);
+    u8g2.printf("%.1f", sensTemp());
+    u8g2.drawXBM(80, 25, 10, 8, icon_Thermal);
+    DateTime now = sensNow();
+    char tbuf[16];
+    sprintf(tbuf, "%02d:%02d:%02d", now.hour(), now.minute(), now.second());
+    u8g2.setFont(u8g2_font_12x6LED_mn);
+    u8g2.setCursor(33, 12);
+    u8g2.print(tbuf);
+    u8g2.drawLine(0, 15, 127, 15);
+    u8g2.drawLine(34, 15, 34, 63);
+    u8g2.drawLine(92, 15, 92, 63);
+    u8g2.drawLine(34, 40, 0, 40);
+    u8g2.drawLine(92, 40, 127, 40);
+
+    u8g2.setFont(u8g2_font_6x13_tr);
+    u8g2.setColorIndex(st.relays[0] ? 0 : 1);
+    u8g2.drawStr(5, 34, "RL1");
+    u8g2.setColorIndex(st.relays[1] ? 0 : 1);
+    u8g2.drawStr(5, 58, "RL2");
+    u8g2.setColorIndex(st.relays[2] ? 0 : 1);
+    u8g2.drawStr(99, 34, "RL3");
+    u8g2.setColorIndex(st.relays[3] ? 0 : 1);
+    u8g2.drawStr(99, 58, "RL4");
+    u8g2.setColorIndex(1);
+
+    if (WiFi.status())
+    {
+        u8g2.drawXBM(115, 4, 9, 7, icon_connected);
+    }
+    else
+    {
+        u8g2.drawXBM(115, 4, 9, 7, icon_disconnect);
+    }
+
+    // rotate through nodes if exist
+    static unsigned long lastSwitch = 0;
+    static int displayIndex = 0;
+    int validCount = 0;
+    for (int i = 0; i < st.nodeCount; i++)
+        if (st.nodes[i].id > 0)
+            validCount++;
+    if (validCount > 0)
+    {
+        if (millis() - lastSwitch >= 3000)
+        {
+            displayIndex = (displayIndex + 1) % validCount;
+            lastSwitch = millis();
+        }
+        // find displayIndex-th valid node
+        int found = -1;
+        int cnt = 0;
+        if (displayIndex >= validCount)
+            displayIndex = 0; // a node was removed since the last frame
+        for (int i = 0; i < st.nodeCount; i++)
+        {
+            if (st.nodes[i].id <= 0)
+                continue;
+            if (cnt == displayIndex)
+            {
+                found = i;
+                break;
+            }
+            cnt++;
+        }
+        if (found >= 0)
+        {
+            int nid = st.nodes[found].id;
+            int slider = 0;
+            bool s_on = false;
+            bool s_conn = false;
+            if (nid > 0 && nid <= total_Slave)
+            {
+                int si = nid - 1;
+                slider = slaveLevel(st.slaves[si], millis()); // follows a running fade
+                s_on = st.slaves[si].isOn;
+                s_conn = st.slaves[si].isConnected;
+            }
+            char buf[32];
+            char buf1[32];
+            snprintf(buf, sizeof(buf), "ID:%d", nid);
+            snprintf(buf1, sizeof(buf1), "Tag: %s", st.nodes[found].label);
+            u8g2.setFont(u8g2_font_5x7_mf);
+            u8g2.setCursor(36, 43);
+            u8g2.printf(buf);
+            u8g2.setCursor(36, 51);
+            u8g2.printf(buf1);
+            char buf2[64];
+            snprintf(buf2, sizeof(buf2), "D:%d RL:%s", slider, st.nodes[found].relay ? "ON" : "OFF", s_conn ? "C" : "D");
+            u8g2.setCursor(36, 60);
+            u8g2.print(buf2);
+        }
+    }
+}
+// ---------------- Button driver ------------------
+// Both edges interrupt. The ISR takes an edge at once and ignores the
+// pin for BTN_DEBOUNCE_MS, so bounce costs no latency; the button's
+// esp_timer then re-reads the pin (an edge lost in the lockout is still
+// seen) and, while the button is held, times LONG and REPEAT. Nothing
+// polls the pins.
+static void IRAM_ATTR buttonTake(ButtonHw &k, bool down, uint32_t now)
+{
+    k.down = down;
+    k.edgeUs = now;
+    if (down)
+    {
+        k.pressedUs = now;
+        k.nextRepeatUs = now + BTN_REPEAT_DELAY_MS * 1000UL;
+        k.longSent = false;
+    }
+}
+void IRAM_ATTR onButtonEdge(void *arg)
+{
+    uint8_t b = (uint8_t)(uintptr_t)arg;
+    ButtonHw &k = buttonHw[b];
+    uint32_t now = micros();
+    bool down = digitalRead(buttonPins[b]) == LOW;
+    portENTER_CRITICAL_ISR(&buttonMux);
+    buttonStats.edges++;
+    bool take = down != k.down && now - k.edgeUs >= BTN_DEBOUNCE_MS * 1000UL;
+    if (take)
+        buttonTake(k, down, now);
+    else
+        buttonStats.bounces++;
+    portEXIT_CRITICAL_ISR(&buttonMux);
+    if (!take)
+        return;
+
+    esp_timer_stop(k.timer);
+    esp_timer_start_once(k.timer, BTN_DEBOUNCE_MS * 1000ULL);
+    UiEvent e = {UI_EV_BUTTON, {b, (uint8_t)(down ? BTN_PRESS : BTN_RELEASE)}, now};
+    BaseType_t woken = pdFALSE;
+    if (xQueueSendFromISR(uiQueue, &e, &woken) != pdTRUE)
+    {
+        portENTER_CRITICAL_ISR(&buttonMux);
+        buttonStats.dropped++;
+        portEXIT_CRITICAL_ISR(&buttonMux);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+// ---------------- Settle / hold timer -------------
+// Runs in the esp_timer task. Re-armed for the next due event while the
+// button is held; idle once it is released and settled.
+static void buttonTimer(void *arg)
+{
+    uint8_t b = (uint8_t)(uintptr_t)arg;
+    ButtonHw &k = buttonHw[b];
+    uint32_t now = micros();
+    bool down = digitalRead(buttonPins[b]) == LOW;
+    UiEvent ev[2];
+    int n = 0;
+    uint32_t nextUs = 0; // 0 = leave the timer idle
+    portENTER_CRITICAL(&buttonMux);
+    if (down != k.down)
+    {
+        // the edge that got the pin here fell inside the lockout
+        buttonTake(k, down, now);
+        buttonStats.settled++;
+        ev[n++] = {UI_EV_BUTTON, {b, (uint8_t)(down ? BTN_PRESS : BTN_RELEASE)}, now};
+        nextUs = BTN_DEBOUNCE_MS * 1000UL;
+    }
+    else if (k.down)
+    {
+        uint32_t longAt = k.pressedUs + BTN_LONG_MS * 1000UL;
+        if (!k.longSent && (int32_t)(now - longAt) >= 0)
+        {
+            k.longSent = true;
+            ev[n++] = {UI_EV_BUTTON, {b, BTN_LONG}, now};
+        }
+        if ((int32_t)(now - k.nextRepeatUs) >= 0)
+        {
+            // late timer: no burst of missed repeats
+            k.nextRepeatUs = now + BTN_REPEAT_MS * 1000UL;
+            ev[n++] = {UI_EV_BUTTON, {b, BTN_REPEAT}, now};
+        }
+        nextUs = k.nextRepeatUs - now;
+        if (!k.longSent && longAt - now < nextUs)
+            nextUs = longAt - now;
+    }
+    portEXIT_CRITICAL(&buttonMux);
+    // an edge since the unlock re-armed the timer already; that start wins
+    if (nextUs)
+        esp_timer_start_once(k.timer, nextUs);
+    for (int i = 0; i < n; i++)
+    {
+        if (xQueueSend(uiQueue, &ev[i], 0) != pdTRUE)
+        {
+            portENTER_CRITICAL(&buttonMux);
+            buttonStats.dropped++;
+            portEXIT_CRITICAL(&buttonMux);
+        }
+    }
+}
+// ---------------- Start the driver (uiTask) -------
+// Interrupts are serviced on the core that attaches them.
+void buttonsBegin()
+{
+    for (int b = 0; b < BTN_COUNT; b++)
+    {
+        pinMode(buttonPins[b], INPUT_PULLUP);
+        buttonHw[b].down = digitalRead(buttonPins[b]) == LOW; // held at boot: no PRESS
+        esp_timer_create_args_t args = {};
+        args.callback = buttonTimer;
+        args.arg = (void *)(uintptr_t)b;
+        args.dispatch_method = ESP_TIMER_TASK;
+        args.name = "button";
+        esp_timer_create(&args, &buttonHw[b].timer);
+        attachInterruptArg(digitalPinToInterrupt(buttonPins[b]), onButtonEdge, (void *)(uintptr_t)b, CHANGE);
+    }
+}
+// ================ Menu engine =====================
+// Each screen is a row of menuScreens[]. A list screen (items set) moves
+// its cursor on UP/DN and opens items[cursor] on SEL; other screens take
+// keys in their handler. BACK goes to the parent unless the handler
+// takes it. Handlers run in uiTask on button events and never wait;
+// renderers run in displayTask from the MenuView/GatewayState copies.
+#define MENU_ROWS 4
+struct MenuItem
+{
+    const char *label;
+    int8_t screen; // SCR_NONE leaves the menu
+};
+struct MenuScreen
+{
+    int8_t parent; // BACK; SCR_NONE leaves the menu
+    const MenuItem *items;
+    uint8_t itemCount;
+    void (*enter)();
+    bool (*key)(uint8_t button, bool repeat); // true = handled
+    void (*render)(const MenuView &mv, const GatewayState &st);
+};
+extern const MenuScreen menuScreens[SCR_COUNT];
+// ---------------- Navigation (uiTask) -------------
+void menuGo(int8_t screen)
+{
+    int8_t from = menuScreen;
+    if (screen != SCR_NONE && from != SCR_NONE && menuScreens[screen].parent == from)
+    {
+        menuParentCursor = menuCursor;
+        menuCursor = 0;
+    }
+    else if (screen != SCR_NONE && from != SCR_NONE && menuScreens[from].parent == screen)
+    {
+        menuCursor = menuParentCursor;
+    }
+    else
+    {
+        menuCursor = 0;
+    }
+    menuScreen = screen;
+    if (screen != SCR_NONE && menuScreens[screen].enter)
+        menuScreens[screen].enter();
+}
+// ---------------- Dispatch a button event ---------
+void menuOnButton(const ButtonEvent &e)
+{
+    if (e.type == BTN_PRESS)
+        lastActivity = millis();
+
+    if (menuScreen == SCR_NONE)
+    {
+        // outside the menu only long presses act
+        if (e.type != BTN_LONG)
+            return;
+        if (e.button == BTN_BOOT)
+        {
+            buzzerBeep(1500, 120);
+            menuGo(SCR_MAIN);
+        }
+        else
+        {
+            // the actuator beeps once the relay has switched
+            GatewayCommand cmd = {CMD_LOCAL_RELAY, ACT_TOGGLE, CMD_SRC_BUTTON, e.button, 0};
+            cmdPost(cmd);
+        }
+        return;
+    }
+
+    if (e.type != BTN_PRESS && e.type != BTN_REPEAT)
+        return;
+    bool repeat = e.type == BTN_REPEAT;
+    const MenuScreen &s = menuScreens[menuScreen];
+    if (s.key && s.key(e.button, repeat))
+        return;
+    if (s.items && (e.button == BTN_UP || e.button == BTN_DN))
+    {
+        if (!repeat)
+            buzzerBeep(1000, 50);
+        int step = e.button == BTN_UP ? s.itemCount - 1 : 1;
+        menuCursor = (menuCursor + step) % s.itemCount;
+    }
+    else if (s.items && e.button == BTN_SEL && !repeat)
+    {
+        buzzerBeep(1000, 80);
+        menuGo(s.items[menuCursor].screen);
+    }
+    else if (e.button == BTN_BACK && !repeat)
+    {
+        buzzerBeep(1000, 80);
+        menuGo(s.parent);
+    }
+}
+// ---------------- List screens --------------------
+static void menuRenderList(const MenuView &mv, const GatewayState &st)
+{
+    (void)st;
+    const MenuScreen &s = menuScreens[mv.screen];
+    u8g2.setFont(u8g2_font_ncenB08_tr);
+    // 15 px rows; scroll to keep the cursor on screen
+    int top = mv.cursor < MENU_ROWS ? 0 : mv.cursor - MENU_ROWS + 1;
+    for (int r = 0; r < MENU_ROWS && top + r < s.itemCount; r++)
+    {
+        if (top + r == mv.cursor)
+            u8g2.drawRFrame(0, r * 15, 128, 15, 3);
+        u8g2.setCursor(6, (r + 1) * 15 - 3);
+        u8g2.print(s.items[top + r].label);
+    }
+}
+// ---------------- Time setup ----------------------
+static void menuEnterTime()
+{
+    DateTime now = sensNow();
+    setHour = now.hour();
+    setMinute = now.minute();
+    setSecond = now.second();
+    cursorPos = 0;
+    editingTime = true;
+}
+static bool menuKeyTime(uint8_t button, bool repeat)
+{
+    int *field = cursorPos == 0 ? &setHour : cursorPos == 1 ? &setMinute : &setSecond;
+    int mod = cursorPos == 0 ? 24 : 60;
+    switch (button)
+    {
+    case BTN_UP:
+    case BTN_DN:
+        // holding the button steps the field, beeping once
+        if (!repeat)
+            buzzerBeep(1200, 60);
+        *field = (*field + (button == BTN_UP ? 1 : mod - 1)) % mod;
+        return true;
+    case BTN_SEL:
+        if (!repeat)
+        {
+            buzzerBeep(1000, 60);
+            cursorPos = (cursorPos + 1) % 3;
+            editingTime = true;
+        }
+        return true;
+    case BTN_BACK:
+        if (!repeat)
+        {
+            buzzerBeep(900, 80);
+            DateTime now = sensNow();
+            sensSetTime(DateTime(now.year(), now.month(), now.day(), setHour, setMinute, setSecond));
+            editingTime = false;
+            cursorPos = 0;
+            menuGo(SCR_MAIN);
+        }
+        return true;
+    }
+    return false;
+}
+static void menuRenderTime(const MenuView &mv, const GatewayState &st)
+{
+    (void)st;
+    u8g2.setFont(u8g2_font_ncenB12_te);
+    u8g2.drawStr(6, 14, "Time Setup");
+    char buf[20];
+    sprintf(buf, "%02d:%02d:%02d", mv.hour, mv.minute, mv.second);
+    u8g2.setCursor(18, 32);
+    u8g2.print(buf);
+    if (mv.editingTime)
+    {
+        int xPos[] = {18, 42, 66};
+        u8g2.drawRFrame(xPos[mv.cursorPos], 18, 20, 18, 3);
+    }
+}
+// ---------------- Screen flip ---------------------
+static bool menuKeyFlip(uint8_t button, bool repeat)
+{
+    if (repeat)
+        return true;
+    switch (button)
+    {
+    case BTN_UP:
+    case BTN_DN:
+        buzzerBeep(1000, 50);
+        screenFlip = !screenFlip;
+        return true;
+    case BTN_SEL:
+        buzzerBeep(1000, 80);
+        screenRotated = screenFlip; // displayTask applies it
+        return true;
+    case BTN_BACK:
+        buzzerBeep(900, 80);
+        menuGo(SCR_MAIN);
+        return true;
+    }
+    return false;
+}
+static void menuRenderFlip(const MenuView &mv, const GatewayState &st)
+{
+    (void)st;
+    u8g2.setFont(u8g2_font_ncenB08_tr);
+    u8g2.drawStr(6, 14, "Flip Screen");
+    u8g2.setCursor(6, 28);
+    u8g2.print("Enable");
+    u8g2.setCursor(6, 40);
+    u8g2.print("Disable");
+    if (mv.screenFlip)
+        u8g2.drawRFrame(0, 18, 128, 12, 3);
+    else
+        u8g2.drawRFrame(0, 30, 128, 12, 3);
+}
+// ---------------- Internet (read-only) ------------
+static void menuRenderNet(const MenuView &mv, const GatewayState &st)
+{
+    (void)mv;
+    (void)st;
+    u8g2.setFont(u8g2_font_ncenB08_tr);
+    u8g2.drawStr(6, 14, "Internet");
+    u8g2.setCursor(2, 20 + 12);
+    if (!configSsidSet)
+        u8g2.print("No SSID configured");
+    else
+    {
+        u8g2.setFont(u8g2_font_6x10_tr);
+        u8g2.setCursor(6, 24);
+        u8g2.printf("SSID: %s", WiFi.SSID().c_str());
+        u8g2.setCursor(6, 36);
+        u8g2.printf("IP:%s", WiFi.localIP().toString().c_str());
+    }
+}
+// ---------------- Nodes ---------------------------
+// UP/DN pick a node, SEL toggles its relay through the bus.
+static bool menuKeyNodes(uint8_t button, bool repeat)
+{
+    static GatewayState st;
+    if (button != BTN_UP && button != BTN_DN && button != BTN_SEL)
+        return false;
+    stateRead(st);
+    if (st.nodeCount == 0)
+        return true;
+    if (menuCursor >= st.nodeCount)
+        menuCursor = st.nodeCount - 1; // a node was removed meanwhile
+    if (button == BTN_SEL)
+    {
+        if (!repeat)
+        {
+            buzzerBeep(1000, 80);
+            GatewayCommand cmd = {CMD_NODE, ACT_TOGGLE, CMD_SRC_BUTTON, (uint16_t)st.nodes[menuCursor].id, 0};
+            cmdPost(cmd);
+        }
+        return true;
+    }
+    if (!repeat)
+        buzzerBeep(1000, 50);
+    int step = button == BTN_UP ? st.nodeCount - 1 : 1;
+    menuCursor = (menuCursor + step) % st.nodeCount;
+    return true;
+}
+static void menuRenderNodes(const MenuView &mv, const GatewayState &st)
+{
+    u8g2.setFont(u8g2_font_ncenB08_tr);
+    u8g2.drawStr(6, 10, "Nodes");
+    u8g2.setFont(u8g2_font_6x10_tr);
+    if (st.nodeCount == 0)
+    {
+        u8g2.drawStr(6, 30, "No nodes");
+        return;
+    }
+    int cursor = mv.cursor < st.nodeCount ? mv.cursor : st.nodeCount - 1;
+    int top = cursor < MENU_ROWS ? 0 : cursor - MENU_ROWS + 1;
+    for (int r = 0; r < MENU_ROWS && top + r < st.nodeCount; r++)
+    {
+        const Node &n = st.nodes[top + r];
+        int y = 14 + r * 12;
+        if (top + r == cursor)
+            u8g2.drawRFrame(0, y, 128, 12, 3);
+        u8g2.setCursor(4, y + 10);
+        u8g2.printf("%-3d %-12.12s %s", n.id, n.label, n.relay ? "ON" : "OFF");
+    }
+}
+// ---------------- Menu definition -----------------
+const MenuItem mainItems[] = {
+    {"Time Setting", SCR_TIME},
+    {"Screen Setting", SCR_FLIP},
+    {"Internet Setting", SCR_NET},
+    {"Nodes", SCR_NODES},
+    {"Exits", SCR_NONE},
+};
+// rows in MenuScreenId order: parent, items, count, enter, key, render
+const MenuScreen menuScreens[SCR_COUNT] = {
+    {SCR_NONE, mainItems, sizeof(mainItems) / sizeof(mainItems[0]), NULL, NULL, menuRenderList},
+    {SCR_MAIN, NULL, 0, menuEnterTime, menuKeyTime, menuRenderTime},
+    {SCR_MAIN, NULL, 0, NULL, menuKeyFlip, menuRenderFlip},
+    {SCR_MAIN, NULL, 0, NULL, NULL, menuRenderNet},
+    {SCR_MAIN, NULL, 0, NULL, menuKeyNodes, menuRenderNodes},
+};
+// ---------------- Send changed tiles --------------
+static void displayFlush()
+{
+    unsigned long t0 = micros();
+    bool full = !oledShadowValid;
+    int tiles = displaySendChanged(*display, oledShadow, &oledShadowValid);
+    if (!tiles)
+        return;
+    uint32_t us = micros() - t0;
+    if (full)
+        dispStats.fullFrames++;
+    dispStats.sent++;
+    dispStats.tilesSent += tiles;
+    dispStats.i2cUs += us;
+    if (us > dispStats.i2cMaxUs)
+        dispStats.i2cMaxUs = us;
+}
+// ---------------- Display Task --------------------
+void displayTask(void *pvParameters)
+{
+    (void)pvParameters;
+    static GatewayState st;
+    MenuView mv;
+    bool rotated = false;
+    u8g2.begin();
+    while (1)
+    {
+        unsigned long t0 = micros();
+        uint32_t kick = displayKickUs.exchange(0);
+        menuRead(mv);
+        if (mv.screenRotated != rotated)
+        {
+            rotated = mv.screenRotated;
+            display->rotate(rotated);
+        }
+        u8g2.clearBuffer();
+        if (mv.screen == SCR_NONE)
+        {
+            if (millis() - mv.lastActivity >= standbyTimeout)
+            {
+                datascreenflag = false;
+                standby_screen();
+            }
+            else
+            {
+                datascreenflag = true;
+                stateRead(st);
+                data_screen(st);
+            }
+        }
+        else
+        {
+            stateRead(st);
+            menuScreens[mv.screen].render(mv, st);
+        }
+        dispStats.frames++;
+        dispStats.renderUs += micros() - t0;
+        displayFlush();
+        seqWrite(dispStatsSeq, &dispStatsView, &dispStats, sizeof(dispStats));
+        if (kick)
+            wakeRecord(WAKE_DISPLAY, kick);
+        supBeat(SUP_DISPLAY, micros() - t0);
+        // a state or menu publish wakes us at once; otherwise the next
+        // clock second (which also paces node rotation and standby)
+        ulTaskNotifyTake(pdTRUE, (sensMsToNextSecond() + 2) / portTICK_PERIOD_MS);
+    }
+}
+// ---------------- Fan controller (loraTask) --------
+// One step per FAN_CHECK_MS on the filtered sensTemp(). Returns true when
+// on/off or the duty changed, i.e. the published state is stale.
+bool fanStep()
+{
+    static unsigned long lastStep = 0;
+    static unsigned long changedAt = 0; // last on/off switch
+    static float integral = 0;          // PI, in % duty
+    unsigned long now = millis();
+    unsigned long dt = lastStep ? now - lastStep : 0;
+    lastStep = now;
+    if (fanState)
+    {
+        fanStats.onMs += dt;
+        fanStats.dutyMs += (uint64_t)dt * fanDuty / 100;
+    }
+
+    const FanTuning &ft = fanTuning;
+    float temp = sensTemp();
+    float err = temp - fanThreshold;
+    bool on = fanState ? temp > fanThreshold - ft.hyst : err >= 0;
+    if (on != fanState && changedAt)
+    {
+        unsigned long holdMs = (fanState ? ft.minOnS : ft.minOffS) * 1000UL;
+        if (now - changedAt < holdMs)
+        {
+            on = fanState;
+            fanStats.held++;
+        }
+    }
+
+    uint8_t duty = 0;
+    if (on && ft.pi)
+    {
+        // anti-windup: the integral alone never exceeds the duty span
+        integral = constrain(integral + ft.ki * err * dt / 1000.0f, 0.0f, (float)(ft.maxDuty - ft.minDuty));
+        float d = ft.minDuty + ft.kp * err + integral;
+        duty = (uint8_t)constrain(d, (float)ft.minDuty, (float)ft.maxDuty);
+    }
+    else if (on)
+    {
+        duty = ft.maxDuty;
+    }
+    else
+    {
+        integral = 0;
+    }
+
+    bool changed = on != fanState || duty != fanDuty;
+    if (on != fanState)
+    {
+        fanStats.switches++;
+        changedAt = now;
+        Serial.printf("[FAN] %s at %.1f C, duty %u%%\n", on ? "on" : "off", temp, duty);
+    }
+    if (changed)
+        gpio->pwm(FAN_CHANNEL, duty * ((1u << FAN_PWM_BITS) - 1) / 100);
+    fanState = on;
+    fanDuty = duty;
+    return changed;
+}
+// ---------------- LoRa Task -----------------------
+void loraTask(void *pvParameters)
+{
+    (void)pvParameters;
+    unsigned long lastSend = 0;
+    unsigned long lastFan = 0;
+    uint32_t ev = 0;
+    while (1)
+    {
+        unsigned long t0 = micros();
+        // sole writer of relays, nodes, slaves and fan; see statePublish()
+        bool dirty = false;
+        BusMsg m;
+        while (busTake(m))
+        {
+            executeCommand(m);
+            dirty = true;
+        }
+
+        // DIO0 still high means an RxDone whose edge we did not see
+        // (it rose while a probe or TX had the radio)
+        if (Lora_status && ((ev & OWNER_EV_RADIO) || radio->rxPending()))
+        {
+            if (ev & OWNER_EV_RADIO)
+                wakeRecord(WAKE_RADIO, radioIrqUs);
+            uint8_t buf[LORA_FRAME_MAX];
+            int packetSize = radio->receive(buf, sizeof(buf));
+            if (frameParseUplink(buf, packetSize, receivedPacket))
+            {
+                int id = receivedPacket.id;
+                if (id > 0 && id <= total_Slave)
+                {
+                    int sidx = id - 1;
+                    slaves[sidx].id = id;
+                    slaves[sidx].temperature = receivedPacket.data1;
+                    slaves[sidx].time = (int)receivedPacket.data2;
+                    slaves[sidx].isConnected = true;
+                    slaves[sidx].lastSeen = millis();
+
+                    updateNodeFromLoRa(id, slaves[sidx].temperature, (float)slaves[sidx].time, slaves[sidx].isOn);
+                    rulesOnNode(id);
+                    probeOnUplink(id);
+                    classAOnUplink(id);
+                    dirty = true;
+                }
+                Serial.printf("[LoRa RX] id=%d temp=%.2f time=%lu\n", (int)receivedPacket.id, receivedPacket.data1,
+                              (unsigned long)receivedPacket.data2);
+            }
+            else if (packetSize)
+            {
+                Serial.printf("[LoRa RX] unexpected size: %d\n", packetSize);
+            }
+        }
+
+        if (millis() - lastSend >= REFRESH_MS)
+        {
+            for (int i = 0; i < total_Slave; i++)
+            {
+                // a refresh mid-fade would make the node jump to the target
+                if (slaves[i].id != 0 && slaveLevel(slaves[i], millis()) == slaves[i].sliderValue)
+                    txRefresh(slaves[i].id);
+            }
+            lastSend = millis();
+        }
+
+        // ----------------------
+        // Fan theo nhiệt độ
+        // ----------------------
+        if (millis() - lastFan >= FAN_CHECK_MS)
+        {
+            if (fanStep())
+                dirty = true;
+            lastFan = millis();
+        }
+
+        uint32_t actWait = actuatorService(&dirty);
+        uint32_t dimWait = dimFlush(&dirty);
+        uint32_t flashWait = eepromFlush(false);
+        uint32_t txWait = txService(&dirty); // one frame, then back to the bus
+
+        if (dirty)
+            statePublish();
+        busUpdateRate();
+        ownerStatsPublish();
+
+        // bus posts and DIO0 wake us; otherwise sleep to the next deadline
+        unsigned long now = millis();
+        uint32_t waitMs = actWait;
+        uint32_t due = REFRESH_MS - min(now - lastSend, REFRESH_MS);
+        if (due < waitMs)
+            waitMs = due;
+        due = FAN_CHECK_MS - min(now - lastFan, FAN_CHECK_MS);
+        if (due < waitMs)
+            waitMs = due;
+        waitMs = min(waitMs, min(dimWait, min(flashWait, txWait)));
+        supBeat(SUP_LORA, micros() - t0);
+        ev = 0;
+        xTaskNotifyWait(0, 0xFFFFFFFF, &ev, (waitMs ? waitMs : 1) / portTICK_PERIOD_MS);
+    }
+}
+// ---------------- IO task (core 1) ----------------
+// HTTP only. WebServer exposes no socket to block on, so it is polled.
+void ioTask(void *pvParameters)
+{
+    (void)pvParameters;
+    for (;;)
+    {
+        unsigned long t0 = micros();
+        statusServer.handleClient();
+        supBeat(SUP_IO, micros() - t0);
+        vTaskDelay(IO_POLL_MS / portTICK_PERIOD_MS);
+    }
+}
+// ---------------- UI task (core 1) ----------------
+// Buttons, menu and buzzer. Sleeps on uiQueue; the timeout only ends a
+// beep on time and keeps the heartbeat while idle. HTTP load no longer
+// sits between a button and its action.
+void uiTask(void *pvParameters)
+{
+    (void)pvParameters;
+    pinMode(BUZ_PIN, OUTPUT);
+    // relay and fan pins were set up in setup() and belong to loraTask
+    lastActivity = millis();
+    buttonsBegin();
+
+    for (;;)
+    {
+        unsigned long waitMs = UI_IDLE_MS;
+        if (buzzerActive)
+            waitMs = buzzerDuration - min(millis() - buzzerStart, buzzerDuration);
+        UiEvent e;
+        bool got = xQueueReceive(uiQueue, &e, (waitMs ? waitMs : 1) / portTICK_PERIOD_MS) == pdTRUE;
+        unsigned long t0 = micros();
+        while (got)
+        {
+            if (e.kind == UI_EV_BUTTON)
+            {
+                buttonStats.events++;
+                menuOnButton(e.button);
+                wakeRecord(WAKE_BUTTON, e.atUs);
+            }
+            got = xQueueReceive(uiQueue, &e, 0) == pdTRUE;
+        }
+        buzzerUpdate();
+        menuPublish();
+        supBeat(SUP_UI, micros() - t0);
+    }
+}
+// ---------------- MQTT Task -----------------------
+void mqttTask(void *pvParameters)
+{
+    (void)pvParameters;
+    mqttApplyBroker();
+    mqttClient.setCallback(mqttCallback);
+    mqttClient.setSocketTimeout(5); // bounds connect() well inside the stall limit
+
+    unsigned long lastPublish = 0;
+    for (;;)
+    {
+        // link and state events wake us; online, the broker socket is
+        // polled every MQTT_POLL_MS
+        TickType_t wait = (linkState == LINK_ONLINE ? MQTT_POLL_MS : MQTT_IDLE_MS) / portTICK_PERIOD_MS;
+        EventBits_t ev = xEventGroupWaitBits(linkEvents, LINK_EV_ALL, pdTRUE, pdFALSE, wait);
+        unsigned long t0 = micros();
+        LinkState before = linkState;
+        linkStep(ev);
+
+        bool online = linkState == LINK_ONLINE;
+        if (online)
+            mqttClient.loop();
+        // a full pass copies the state snapshot; do it on change, on a
+        // link transition, or once per MQTT_IDLE_MS for deadbands/timeouts
+        uint32_t kick = mqttKickUs.exchange(0);
+        if (kick || linkState != before || millis() - lastPublish >= MQTT_IDLE_MS)
+        {
+            publishChanges(online);
+            lastPublish = millis();
+            if (kick)
+                wakeRecord(WAKE_MQTT, kick);
+        }
+        if (online)
+        {
+            outboxDrain();
+            metricsPublish();
+        }
+        outboxUpdateRate();
+        mqttStatsPublish();
+        supBeat(SUP_MQTT, micros() - t0);
+    }
+}
+// ---------------- Sampler Task --------------------
+void samplerTask(void *pvParameters)
+{
+    (void)pvParameters;
+    SensorView v = sensView; // sole writer from here on
+    if (rtcPresent)
+        rtcSync(v);
+    unsigned long lastCheck = millis();
+    unsigned long lastTemp = millis();
+    for (;;)
+    {
+        unsigned long t0 = micros();
+        uint32_t set = sensSetRequest.exchange(0);
+        if (set && rtcPresent)
+        {
+            // writing the seconds register restarts the DS3231 countdown,
+            // so this instant is the second edge
+            rtc.adjust(DateTime(set));
+            v.rtcBase = set;
+            v.rtcBaseMs = millis();
+            sensStats.rtcSets++;
+            lastCheck = millis();
+        }
+        else if (rtcPresent && millis() - lastCheck >= SENS_RTC_CHECK_MS)
+        {
+            // rebase to keep the millis() span short, then confirm with
+            // one read; only a mismatch (drift, or a read right on the
+            // edge) costs another edge search
+            uint32_t whole = (millis() - v.rtcBaseMs) / 1000;
+            v.rtcBase += whole;
+            v.rtcBaseMs += whole * 1000;
+            if (rtcRead() != v.rtcBase + (millis() - v.rtcBaseMs) / 1000)
+                rtcSync(v);
+            lastCheck = millis();
+        }
+
+        if (millis() - lastTemp >= SENS_TEMP_PERIOD_MS)
+        {
+            v.tempRaw = readInternalTemp();
+            v.temp += SENS_TEMP_ALPHA * (v.tempRaw - v.temp);
+            sensStats.tempSamples++;
+            lastTemp = millis();
+        }
+        seqWrite(sensSeq, &sensView, &v, sizeof(v));
+        supBeat(SUP_SAMPLER, micros() - t0);
+        // sensSetTime() wakes us early
+        ulTaskNotifyTake(pdTRUE, SENS_TEMP_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+}
+// ---------------- Setup / Loop --------------------
+void setup()
+{
+    Serial.begin(115200);
+    supInit();
+    EEPROM.begin(512);
+    bool rtcOk = rtc.begin();
+    sensInit(rtcOk);
+    if (!rtcOk)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            buzzerBeep(2000, 100);
+            buzzerUpdate();
+            vTaskDelay(150 / portTICK_PERIOD_MS);
+            buzzerUpdate();
+        }
+    }
+
+    configLoad();
+    configSubscribe(onConfigChanged);
+
+    // STA joins are left to the link manager in mqttTask
+    linkEvents = xEventGroupCreate();
+    uiQueue = xQueueCreate(UI_QUEUE_LEN, sizeof(UiEvent));
+    metricsMutex = xSemaphoreCreateMutex();
+    busInit();
+    WiFi.setAutoReconnect(false);
+    WiFi.onEvent(onWiFiEvent);
+    WiFi.mode(WIFI_AP_STA);
+    WiFi.softAP(AP_SSID, AP_PASS);
+    initGatewayId();
+    startStatusServer();
+    initNodes();
+    initBuzzer();
+    loadNodesPrefs();
+    outboxBegin();
+    schedBegin();
+    rulesBegin();
+    groupsBegin();
+
+    prefs.begin("relay", true);
+    if (prefs.isKey("r0"))
+    {
+        relayState[0] = prefs.getInt("r0", 0);
+    }
+    if (prefs.isKey("r1"))
+    {
+        relayState[1] = prefs.getInt("r1", 0);
+    }
+    if (prefs.isKey("r2"))
+    {
+        relayState[2] = prefs.getInt("r2", 0);
+    }
+    if (prefs.isKey("r3"))
+    {
+        relayState[3] = prefs.getInt("r3", 0);
+    }
+    prefs.end();
+
+    // fan PWM; loraTask's controller owns the duty from here on
+    ledcSetup(FAN_CHANNEL, FAN_PWM_HZ, FAN_PWM_BITS);
+    ledcAttachPin(FAN_PIN, FAN_CHANNEL);
+    ledcWrite(FAN_CHANNEL, 0);
+
+    for (int i = 0; i < 4; i++)
+    {
+        pinMode(relayPins[i], OUTPUT);
+        digitalWrite(relayPins[i], relayState[i] ? HIGH : LOW);
+    }
+
+    // readers start from a complete picture, before any task runs
+    statePublish();
+    menuPublish();
+
+    esp_register_freertos_idle_hook_for_cpu(idleHookCpu0, 0);
+    esp_register_freertos_idle_hook_for_cpu(idleHookCpu1, 1);
+
+    taskLayoutLoad();
+    taskLayoutStart();
+}
+// ---------------- void loop -----------------------
 void loop() {}
\ No newline at end of file
@@ -0,0 +1,43 @@
+// ================ Minimal test runner ==============
+// No framework: each test file is one executable, ctest runs them all.
+// CHECK keeps going after a failure so one run reports every mismatch.
+#pragma once
+#include <stdio.h>
+
+static int checkFailed = 0;
+static int checkRun = 0;
+
+#define CHECK(cond)                                                        \
+    do                                                                     \
+    {                                                                      \
+        checkRun++;                                                        \
+        if (!(cond))                                                       \
+        {                                                                  \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            checkFailed++;                                                 \
+        }                                                                  \
+    } while (0)
+#define CHECK_EQ(a, b)                                                                      \
+    do                                                                                      \
+    {                                                                                       \
+        checkRun++;                                                                         \
+        long long va_ = (long long)(a), vb_ = (long long)(b);                               \
+        if (va_ != vb_)                                                                     \
+        {                                                                                   \
+            printf("%s:%d: %s == %s failed (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, va_, \
+                   vb_);                                                                    \
+            checkFailed++;                                                                  \
+        }                                                                                   \
+    } while (0)
+#define RUN(test)                    \
+    do                               \
+    {                                \
+        printf("[ RUN ] %s\n", #test); \
+        test();                      \
+    } while (0)
+
+inline int checkReport()
+{
+    printf("%d checks, %d failed\n", checkRun, checkFailed);
+    return checkFailed ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+// Portal request parsing (core/api.h).
+#include <map>
+#include <string>
+#include <string.h>
+#include "core/api.h"
+#include "check.h"
+
+// A request's form args; get() hands out a copy, like the WebServer glue.
+struct FakeArgs : ApiArgs
+{
+    std::map<std::string, std::string> args;
+    std::string last;
+
+    FakeArgs &set(const char *name, const char *value)
+    {
+        args[name] = value;
+        return *this;
+    }
+    bool has(const char *name) override
+    {
+        return args.count(name) != 0;
+    }
+    const char *get(const char *name) override
+    {
+        std::map<std::string, std::string>::const_iterator it = args.find(name);
+        last = it == args.end() ? "" : it->second;
+        return last.c_str();
+    }
+};
+
+static void testCommandArgs()
+{
+    uint8_t t = 0, a = 0;
+    uint16_t id = 0;
+    int16_t v = 0;
+    FakeArgs q;
+    q.set("target", "node").set("tid", "3").set("action", "dim").set("value", "300");
+    CHECK(apiCommandArgs(q, t, a, id, v));
+    CHECK_EQ(t, CMD_NODE);
+    CHECK_EQ(a, ACT_DIM);
+    CHECK_EQ(id, 3);
+    CHECK_EQ(v, 255);
+    q.set("target", "group").set("tid", "all");
+    CHECK(apiCommandArgs(q, t, a, id, v));
+    CHECK_EQ(id, 0); // every node
+    q.set("target", "relay");
+    CHECK(apiCommandArgs(q, t, a, id, v));
+    CHECK_EQ(id, CMD_ID_ALL);
+    q.set("target", "scene").set("tid", "7").args.erase("action");
+    CHECK(apiCommandArgs(q, t, a, id, v));
+    CHECK_EQ(a, ACT_ON);
+    q.set("target", "node").set("tid", "11").set("action", "on");
+    CHECK(!apiCommandArgs(q, t, a, id, v)); // past NODE_SLOTS
+    q.set("tid", "2").set("action", "fade");
+    CHECK(!apiCommandArgs(q, t, a, id, v));
+    q.set("target", "config").set("action", "on");
+    CHECK(!apiCommandArgs(q, t, a, id, v));
+}
+static void testSchedule()
+{
+    SchedEntry e;
+    FakeArgs q;
+    q.set("target", "node").set("tid", "2").set("action", "on");
+    q.set("kind", "daily").set("at", "07:30");
+    CHECK(apiSchedEntry(q, e));
+    CHECK_EQ(e.kind, SCHED_DAILY);
+    CHECK_EQ(e.at, 7 * 3600 + 30 * 60);
+    CHECK_EQ(e.days, 0x7F);
+    CHECK_EQ(e.id, 0);
+    q.set("days", "15").set("id", "12");
+    CHECK(apiSchedEntry(q, e));
+    CHECK_EQ(e.days, 0x22);
+    CHECK_EQ(e.id, 12);
+    q.set("days", "7");
+    CHECK(!apiSchedEntry(q, e));
+    q.set("days", "");
+    CHECK(!apiSchedEntry(q, e)); // no day at all
+    q.args.erase("days");
+    q.set("at", "24:00");
+    CHECK(!apiSchedEntry(q, e));
+    q.set("kind", "hourly").set("at", "15");
+    CHECK(apiSchedEntry(q, e));
+    CHECK_EQ(e.at, 15 * 60);
+    q.set("kind", "once").set("at", "1700000000");
+    CHECK(apiSchedEntry(q, e));
+    CHECK_EQ(e.at, 1700000000UL);
+    q.set("at", "1000");
+    CHECK(!apiSchedEntry(q, e)); // before the clock can be valid
+    q.set("kind", "weekly");
+    CHECK(!apiSchedEntry(q, e));
+}
+static void testRule()
+{
+    Rule r;
+    FakeArgs q;
+    q.set("target", "relay").set("tid", "1").set("action", "on");
+    q.set("node", "4").set("field", "temp").set("op", "ge").set("thr", "28.5").set("hyst", "-2");
+    CHECK(apiRule(q, r));
+    CHECK_EQ(r.src, 4);
+    CHECK_EQ(r.field, RULE_F_TEMP);
+    CHECK_EQ(r.op, RULE_GE);
+    CHECK(r.threshold == 28.5f);
+    CHECK(r.hyst == 0.0f);
+    CHECK_EQ(r.guardRelay, -1);
+    CHECK(ruleValid(r));
+    q.set("relay", "2").set("guardRelay", "0").set("guardOn", "0").set("from", "22:00").set("to", "06:30");
+    CHECK(apiRule(q, r));
+    CHECK_EQ(r.src, RULE_SRC_RELAY + 2);
+    CHECK_EQ(r.field, RULE_F_RELAY);
+    CHECK_EQ(r.guardOn, 0);
+    CHECK_EQ(r.fromMin, 22 * 60);
+    CHECK_EQ(r.toMin, 6 * 60 + 30);
+    CHECK(ruleValid(r));
+    q.set("to", "6");
+    CHECK(!apiRule(q, r));
+    q.set("to", "06:30").set("relay", "4");
+    CHECK(!apiRule(q, r));
+    q.args.erase("relay");
+    q.set("field", "humidity");
+    CHECK(!apiRule(q, r));
+    q.set("field", "dim").args.erase("thr");
+    CHECK(!apiRule(q, r));
+}
+static void testGroup()
+{
+    NodeGroup g;
+    FakeArgs q;
+    q.set("id", "3").set("members", "1,2,10");
+    CHECK_EQ(apiGroup(q, g), API_OK);
+    CHECK_EQ(g.id, 3);
+    CHECK(strcmp(g.name, "Group 3") == 0);
+    CHECK(groupHas(g, 1) && groupHas(g, 2) && groupHas(g, 10) && !groupHas(g, 3));
+    q.set("members", "");
+    CHECK_EQ(apiGroup(q, g), API_OK); // an empty group is allowed
+    q.set("members", "1,11");
+    CHECK_EQ(apiGroup(q, g), API_BAD_VALUE);
+    q.set("members", "1,x");
+    CHECK_EQ(apiGroup(q, g), API_BAD_VALUE);
+    q.set("id", "17");
+    CHECK_EQ(apiGroup(q, g), API_BAD_ID);
+
+    GatewayCommand cmd;
+    FakeArgs s;
+    s.set("id", "all").set("action", "dim").set("value", "-5");
+    CHECK(apiGroupSet(s, cmd));
+    CHECK_EQ(cmd.target, CMD_GROUP);
+    CHECK_EQ(cmd.id, 0);
+    CHECK_EQ(cmd.value, 0);
+    s.set("id", "17");
+    CHECK(!apiGroupSet(s, cmd));
+    s.set("id", "2").set("action", "up");
+    CHECK(!apiGroupSet(s, cmd));
+}
+static void testScene()
+{
+    Scene sc;
+    bool capture = true;
+    FakeArgs q;
+    q.set("id", "40").set("name", "Evening").set("entries", "1:1:128,3:0:0");
+    CHECK_EQ(apiScene(q, sc, capture), API_OK);
+    CHECK(!capture);
+    CHECK(strcmp(sc.name, "Evening") == 0);
+    CHECK_EQ(sc.count, 2);
+    CHECK_EQ(sc.entries[0].dim, 128);
+    CHECK_EQ(sc.entries[1].node, 3);
+    CHECK(sceneValid(sc));
+    // a short entry must not be stored half-parsed or read past the end
+    q.set("entries", "3");
+    CHECK_EQ(apiScene(q, sc, capture), API_BAD_VALUE);
+    q.set("entries", "3:1");
+    CHECK_EQ(apiScene(q, sc, capture), API_BAD_VALUE);
+    q.set("entries", "3:1:");
+    CHECK_EQ(apiScene(q, sc, capture), API_BAD_VALUE);
+    q.set("entries", "3:2:10");
+    CHECK_EQ(apiScene(q, sc, capture), API_BAD_VALUE);
+    q.set("entries", "3:1:256");
+    CHECK_EQ(apiScene(q, sc, capture), API_BAD_VALUE);
+    q.set("entries", "1:1:1,");
+    CHECK_EQ(apiScene(q, sc, capture), API_OK);
+    q.set("entries", "");
+    CHECK_EQ(apiScene(q, sc, capture), API_BAD_VALUE);
+    std::string many;
+    for (int i = 0; i <= NODE_SLOTS; i++)
+        many += "1:0:0,";
+    q.set("entries", many.c_str());
+    CHECK_EQ(apiScene(q, sc, capture), API_TOO_MANY);
+    q.set("id", "0");
+    CHECK_EQ(apiScene(q, sc, capture), API_BAD_ID);
+
+    FakeArgs c;
+    c.set("id", "5").set("capture", "2,4");
+    CHECK_EQ(apiScene(c, sc, capture), API_OK);
+    CHECK(capture);
+    CHECK(strcmp(sc.name, "Scene 5") == 0);
+    CHECK_EQ(sc.count, 2);
+    CHECK_EQ(sc.entries[1].node, 4);
+    c.set("capture", "2:1:1");
+    CHECK_EQ(apiScene(c, sc, capture), API_BAD_VALUE);
+}
+static void testNodeFade()
+{
+    GatewayCommand cmd;
+    FakeArgs q;
+    q.set("node", "2");
+    CHECK_EQ(apiNodeFade(q, cmd), API_MISSING);
+    q.set("value", "200");
+    CHECK_EQ(apiNodeFade(q, cmd), API_OK);
+    CHECK_EQ(cmd.action, ACT_FADE);
+    CHECK_EQ(cmd.fadeMs, FADE_DEFAULT_MS);
+    CHECK_EQ(cmd.curve, FADE_LINEAR);
+    q.set("ms", "1500").set("curve", "square");
+    CHECK_EQ(apiNodeFade(q, cmd), API_OK);
+    CHECK_EQ(cmd.fadeMs, 1500);
+    CHECK_EQ(cmd.curve, FADE_SQUARE);
+    q.set("curve", "cubic");
+    CHECK_EQ(apiNodeFade(q, cmd), API_BAD_VALUE);
+    q.set("curve", "ease").set("ms", "60001");
+    CHECK_EQ(apiNodeFade(q, cmd), API_BAD_VALUE);
+    q.set("node", "11");
+    CHECK_EQ(apiNodeFade(q, cmd), API_BAD_ID);
+}
+
+int main()
+{
+    RUN(testCommandArgs);
+    RUN(testSchedule);
+    RUN(testRule);
+    RUN(testGroup);
+    RUN(testScene);
+    RUN(testNodeFade);
+    return checkReport();
+}
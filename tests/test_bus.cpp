@@ -0,0 +1,104 @@
+// Command bus ring (core/bus.h): order, full ring, laps, and several
+// producer threads against one consumer.
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "core/bus.h"
+#include "check.h"
+
+static BusRing ring;
+
+static BusMsg msg(uint16_t producer, int16_t seq)
+{
+    BusMsg m;
+    memset(&m, 0, sizeof(m));
+    m.cmd.id = producer;
+    m.cmd.value = seq;
+    return m;
+}
+static void testFifoAndStamp()
+{
+    busRingInit(ring);
+    BusMsg out = msg(0, 0);
+    CHECK(!busRingTake(ring, out));
+    for (int i = 0; i < 10; i++)
+        CHECK(busRingPost(ring, msg(0, i), 1000 + i));
+    for (int i = 0; i < 10; i++)
+    {
+        CHECK(busRingTake(ring, out));
+        CHECK_EQ(out.cmd.value, i);
+        CHECK_EQ(out.postedUs, 1000 + i);
+        CHECK_EQ(busRingDepth(ring), 10 - i);
+    }
+    CHECK(!busRingTake(ring, out));
+}
+static void testFullRejects()
+{
+    busRingInit(ring);
+    for (int i = 0; i < BUS_SIZE; i++)
+        CHECK(busRingPost(ring, msg(0, i), 0));
+    CHECK(!busRingPost(ring, msg(0, BUS_SIZE), 0));
+    BusMsg out = msg(0, 0);
+    CHECK(busRingTake(ring, out));
+    CHECK_EQ(out.cmd.value, 0);
+    CHECK(busRingPost(ring, msg(0, BUS_SIZE), 0)); // one cell back
+}
+static void testManyLaps()
+{
+    busRingInit(ring);
+    BusMsg out = msg(0, 0);
+    int16_t next = 0, want = 0;
+    for (int lap = 0; lap < 1000; lap++)
+    {
+        for (int i = 0; i < 37; i++)
+            CHECK(busRingPost(ring, msg(0, next++), 0));
+        for (int i = 0; i < 37; i++)
+        {
+            CHECK(busRingTake(ring, out));
+            CHECK_EQ(out.cmd.value, want++);
+        }
+    }
+}
+// Every message arrives once and each producer's messages in its order.
+static void testProducersKeepOrder()
+{
+    const int producers = 3, each = 20000;
+    busRingInit(ring);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.push_back(std::thread([p, each]() {
+            for (int i = 0; i < each; i++)
+                while (!busRingPost(ring, msg(p, (int16_t)i), 0))
+                    std::this_thread::yield();
+        }));
+    }
+    int16_t next[producers] = {0, 0, 0};
+    long got = 0, misordered = 0;
+    BusMsg out = msg(0, 0);
+    while (got < (long)producers * each)
+    {
+        if (!busRingTake(ring, out))
+        {
+            std::this_thread::yield(); // the host may have a single core
+            continue;
+        }
+        if (out.cmd.value != next[out.cmd.id])
+            misordered++;
+        next[out.cmd.id] = out.cmd.value + 1;
+        got++;
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+    CHECK_EQ(misordered, 0);
+    CHECK(!busRingTake(ring, out));
+}
+
+int main()
+{
+    RUN(testFifoAndStamp);
+    RUN(testFullRejects);
+    RUN(testManyLaps);
+    RUN(testProducersKeepOrder);
+    return checkReport();
+}
@@ -0,0 +1,159 @@
+// MQTT command topics and payloads (core/command.h).
+#include "core/command.h"
+#include "check.h"
+
+static const char *prefix = "gateway/gw-0a0b0c/cmd/";
+
+static int parse(const char *topic, const char *payload, GatewayCommand *out, int max = 16)
+{
+    char t[96];
+    snprintf(t, sizeof(t), "%s%s", prefix, topic);
+    return parseCommandMessage(prefix, topic[0] == '!' ? topic + 1 : t, (const uint8_t *)payload,
+                               strlen(payload), out, max);
+}
+static void testRelay()
+{
+    GatewayCommand c[16];
+    CHECK_EQ(parse("relay/2", "on", c), 1);
+    CHECK_EQ(c[0].target, CMD_LOCAL_RELAY);
+    CHECK_EQ(c[0].id, 2);
+    CHECK_EQ(c[0].action, ACT_ON);
+    CHECK_EQ(c[0].source, CMD_SRC_MQTT);
+    CHECK_EQ(parse("relay/all", " toggle\n", c), 1);
+    CHECK_EQ(c[0].id, CMD_ID_ALL);
+    CHECK_EQ(c[0].action, ACT_TOGGLE);
+    CHECK_EQ(parse("relay/4", "on", c), -1);
+    CHECK_EQ(parse("relay/1", "maybe", c), -1);
+    CHECK_EQ(parse("relay/1/x", "on", c), -1);
+}
+static void testNode()
+{
+    GatewayCommand c[16];
+    CHECK_EQ(parse("node/3/relay", "off", c), 1);
+    CHECK_EQ(c[0].target, CMD_NODE);
+    CHECK_EQ(c[0].id, 3);
+    CHECK_EQ(c[0].action, ACT_OFF);
+    CHECK_EQ(parse("node/3/dim", "255", c), 1);
+    CHECK_EQ(c[0].action, ACT_DIM);
+    CHECK_EQ(c[0].value, 255);
+    CHECK_EQ(parse("node/3/dim", "256", c), -1);
+    CHECK_EQ(parse("node/0/relay", "on", c), -1);
+    CHECK_EQ(parse("node/11/relay", "on", c), -1);
+    CHECK_EQ(parse("node/3/dim", "-1", c), -1);
+}
+static void testFade()
+{
+    GatewayCommand c[16];
+    CHECK_EQ(parse("node/2/fade", "200,1500,ease", c), 1);
+    CHECK_EQ(c[0].action, ACT_FADE);
+    CHECK_EQ(c[0].value, 200);
+    CHECK_EQ(c[0].fadeMs, 1500);
+    CHECK_EQ(c[0].curve, FADE_EASE);
+    CHECK_EQ(parse("node/2/fade", "10", c), 1);
+    CHECK_EQ(c[0].fadeMs, FADE_DEFAULT_MS);
+    CHECK_EQ(c[0].curve, FADE_LINEAR);
+    CHECK_EQ(parse("node/2/fade", "10,100,bounce", c), -1);
+    CHECK_EQ(parse("node/2/fade", "10,70000", c), -1);
+    CHECK_EQ(parse("group/2/fade", "10", c), -1);
+}
+static void testGroupAndScene()
+{
+    GatewayCommand c[16];
+    CHECK_EQ(parse("group/all/dim", "40", c), 1);
+    CHECK_EQ(c[0].target, CMD_GROUP);
+    CHECK_EQ(c[0].id, 0);
+    CHECK_EQ(c[0].value, 40);
+    CHECK_EQ(parse("group/7/relay", "on", c), 1);
+    CHECK_EQ(c[0].id, 7);
+    CHECK_EQ(parse("scene/4", "activate", c), 1);
+    CHECK_EQ(c[0].target, CMD_SCENE);
+    CHECK_EQ(c[0].id, 4);
+    CHECK_EQ(parse("scene/0", "on", c), -1);
+    CHECK_EQ(parse("scene/4", "off", c), -1);
+}
+static void testBatch()
+{
+    GatewayCommand c[16];
+    CHECK_EQ(parse("batch", "relay/0=on; node/1/dim=10;\n group/all/relay=off;", c), 3);
+    CHECK_EQ(c[0].target, CMD_LOCAL_RELAY);
+    CHECK_EQ(c[1].target, CMD_NODE);
+    CHECK_EQ(c[1].value, 10);
+    CHECK_EQ(c[2].target, CMD_GROUP);
+    for (int i = 0; i < 3; i++)
+        CHECK_EQ(c[i].source, CMD_SRC_MQTT);
+    // all-or-nothing
+    CHECK_EQ(parse("batch", "relay/0=on;node/99/relay=on", c), -1);
+    CHECK_EQ(parse("batch", "relay/0=on;relay/1=on;relay/2=on", c, 2), -1);
+    CHECK_EQ(parse("batch", "", c), 0);
+}
+static void testLegacyAndForeign()
+{
+    GatewayCommand c[16];
+    CHECK_EQ(parse("!esp32/relay/cmd", "all_on", c), 1);
+    CHECK_EQ(c[0].id, CMD_ID_ALL);
+    CHECK_EQ(c[0].action, ACT_ON);
+    CHECK_EQ(parse("!esp32/relay/cmd", "3", c), 1);
+    CHECK_EQ(c[0].action, ACT_TOGGLE);
+    CHECK_EQ(parse("!esp32/relay/cmd", "9", c), -1);
+    CHECK_EQ(parse("!gateway/other/cmd/relay/0", "on", c), -1);
+    CHECK_EQ(parseCommandMessage("", "relay/0", (const uint8_t *)"on", 2, c, 16), -1);
+}
+static void testNoTerminatorNeeded()
+{
+    // the payload is not NUL-terminated in the client buffer
+    const char raw[] = {'o', 'f', 'f', 'X'};
+    GatewayCommand c[1];
+    char topic[64];
+    snprintf(topic, sizeof(topic), "%snode/1/relay", prefix);
+    CHECK_EQ(parseCommandMessage(prefix, topic, (const uint8_t *)raw, 3, c, 1), 1);
+    CHECK_EQ(c[0].action, ACT_OFF);
+}
+static void testDefaultsFromDirtyBuffer()
+{
+    // the caller's array is not cleared (stack garbage on the device)
+    GatewayCommand c[16];
+    memset(c, 0xAB, sizeof(c));
+    CHECK_EQ(parse("batch", "relay/1=on;node/2/dim=9", c), 2);
+    for (int i = 0; i < 2; i++)
+    {
+        CHECK_EQ(c[i].priority, PRIO_DEFAULT);
+        CHECK_EQ(c[i].fadeMs, 0);
+        CHECK_EQ(c[i].curve, 0);
+        CHECK_EQ(cmdPriority(c[i]), PRIO_NORMAL);
+    }
+    memset(c, 0xAB, sizeof(c));
+    CHECK_EQ(parse("relay/0", "toggle", c), 1);
+    CHECK_EQ(cmdPriority(c[0]), PRIO_NORMAL);
+    memset(c, 0xAB, sizeof(c));
+    CHECK_EQ(parse("!esp32/relay/cmd", "all_off", c), 1);
+    CHECK_EQ(cmdPriority(c[0]), PRIO_NORMAL);
+}
+static void testPriorityOrder()
+{
+    GatewayCommand c = {};
+    c.source = CMD_SRC_BUTTON;
+    uint8_t button = cmdPriority(c);
+    c.source = CMD_SRC_HTTP;
+    uint8_t http = cmdPriority(c);
+    c.source = CMD_SRC_MQTT;
+    uint8_t mqtt = cmdPriority(c);
+    c.source = CMD_SRC_SCHEDULE;
+    uint8_t sched = cmdPriority(c);
+    CHECK(button > http && http > mqtt && mqtt > sched);
+    c.priority = PRIO_MANUAL;
+    CHECK_EQ(cmdPriority(c), PRIO_MANUAL);
+}
+
+int main()
+{
+    RUN(testRelay);
+    RUN(testNode);
+    RUN(testFade);
+    RUN(testGroupAndScene);
+    RUN(testBatch);
+    RUN(testLegacyAndForeign);
+    RUN(testNoTerminatorNeeded);
+    RUN(testDefaultsFromDirtyBuffer);
+    RUN(testPriorityOrder);
+    return checkReport();
+}
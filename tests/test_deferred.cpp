@@ -0,0 +1,32 @@
+// Deferred flash writes (core/deferred.h).
+#include "core/deferred.h"
+#include "check.h"
+
+static void testQuietPeriod()
+{
+    Deferred d = {};
+    CHECK_EQ(deferWait(d, 1000, 500), DEFER_NONE);
+    deferMark(d, 1000);
+    CHECK_EQ(deferWait(d, 1000, 500), 500);
+    CHECK_EQ(deferWait(d, 1300, 500), 200);
+    deferMark(d, 1300); // another change restarts the wait
+    CHECK_EQ(deferWait(d, 1600, 500), 200);
+    CHECK_EQ(deferWait(d, 1800, 500), 0);
+    CHECK_EQ(deferWait(d, 9000, 500), 0);
+    deferDone(d);
+    CHECK_EQ(deferWait(d, 9000, 500), DEFER_NONE);
+}
+static void testWrap()
+{
+    Deferred d = {};
+    deferMark(d, 0xFFFFFF00UL);
+    CHECK_EQ(deferWait(d, 0x100, 1000), 1000 - 0x200);
+    CHECK_EQ(deferWait(d, 0x300, 1000), 0);
+}
+
+int main()
+{
+    RUN(testQuietPeriod);
+    RUN(testWrap);
+    return checkReport();
+}
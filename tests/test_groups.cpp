@@ -0,0 +1,136 @@
+// Group membership, slots, record checks and the NVS blobs
+// (core/groups.h).
+#include <string.h>
+#include "core/groups.h"
+#include "host/fake_hal.h"
+#include "check.h"
+
+static NodeGroup groups[GROUP_MAX];
+static Scene scenes[SCENE_MAX];
+
+static void reset()
+{
+    memset(groups, 0, sizeof(groups));
+    memset(scenes, 0, sizeof(scenes));
+}
+static void testMembership()
+{
+    NodeGroup g = {};
+    groupAdd(g, 1);
+    groupAdd(g, NODE_SLOTS);
+    groupAdd(g, 0);              // ignored
+    groupAdd(g, NODE_SLOTS + 1); // ignored
+    CHECK(groupHas(g, 1));
+    CHECK(groupHas(g, NODE_SLOTS));
+    CHECK(!groupHas(g, 2));
+    CHECK(!groupHas(g, 0));
+    CHECK(!groupHas(g, NODE_SLOTS + 1));
+    CHECK(groupValid(g));
+}
+static void testJoinMask()
+{
+    reset();
+    groups[0].id = 3;
+    groupAdd(groups[0], 2);
+    groups[5].id = 1;
+    groupAdd(groups[5], 2);
+    groupAdd(groups[5], 4);
+    groups[7].id = 0; // free slot, stale members
+    groupAdd(groups[7], 2);
+    CHECK_EQ(groupJoinMask(groups, 2), 0x5);
+    CHECK_EQ(groupJoinMask(groups, 4), 0x1);
+    CHECK_EQ(groupJoinMask(groups, 5), 0);
+}
+static void testSlot()
+{
+    reset();
+    CHECK(groupSlot(groups, GROUP_MAX, 4) == &groups[0]); // first free
+    groups[0].id = 4;
+    groups[2].id = 9;
+    CHECK(groupSlot(groups, GROUP_MAX, 9) == &groups[2]);
+    CHECK(groupSlot(groups, GROUP_MAX, 5) == &groups[1]);
+    for (int i = 0; i < SCENE_MAX; i++)
+        scenes[i].id = i + 1;
+    CHECK(groupSlot(scenes, SCENE_MAX, SCENE_MAX) == &scenes[SCENE_MAX - 1]);
+    CHECK(groupSlot(scenes, SCENE_MAX, 200) == NULL); // full
+}
+static void testRecordCheck()
+{
+    NodeGroup g = {};
+    g.id = GROUP_MAX;
+    CHECK(groupValid(g));
+    g.id = GROUP_MAX + 1;
+    CHECK(!groupValid(g));
+    g.id = 1;
+    memset(g.name, 'x', sizeof(g.name));
+    CHECK(!groupValid(g));
+    g.name[0] = 0;
+    if (NODE_SLOTS % 8)
+    {
+        g.members[sizeof(g.members) - 1] = 0x80; // past NODE_SLOTS
+        CHECK(!groupValid(g));
+    }
+
+    Scene sc = {};
+    sc.id = 1;
+    sc.count = 1;
+    sc.entries[0].node = 1;
+    sc.entries[0].relay = 1;
+    sc.entries[0].dim = 255;
+    CHECK(sceneValid(sc));
+    Scene bad = sc;
+    bad.entries[0].relay = 2;
+    CHECK(!sceneValid(bad));
+    bad = sc;
+    bad.entries[0].node = NODE_SLOTS + 1;
+    CHECK(!sceneValid(bad));
+    bad = sc;
+    bad.count = NODE_SLOTS + 1;
+    CHECK(!sceneValid(bad));
+}
+static void testSaveLoad()
+{
+    FakeStorage st;
+    reset();
+    groups[0].id = 2; // left over from before the load
+    CHECK_EQ(groupsLoad(st, groups, scenes), 0); // no blobs: empty
+    CHECK_EQ(groups[0].id, 0);
+
+    groups[3].id = 5;
+    snprintf(groups[3].name, sizeof(groups[3].name), "Hall");
+    groupAdd(groups[3], 2);
+    scenes[1].id = 40;
+    scenes[1].count = 1;
+    scenes[1].entries[0].node = 2;
+    scenes[1].entries[0].dim = 90;
+    scenes[2].id = 41;
+    scenes[2].count = 1;
+    scenes[2].entries[0].node = 0; // damaged
+    CHECK(groupsSave(st, groups, scenes));
+    CHECK_EQ(st.writes, 2);
+
+    reset();
+    CHECK_EQ(groupsLoad(st, groups, scenes), 1);
+    CHECK_EQ(groups[3].id, 5);
+    CHECK(groupHas(groups[3], 2));
+    CHECK(strcmp(groups[3].name, "Hall") == 0);
+    CHECK_EQ(scenes[1].entries[0].dim, 90);
+    CHECK_EQ(scenes[2].id, 0);
+
+    // a blob of another size (older firmware) reads as missing
+    uint8_t old[10] = {};
+    st.save("groups", "s", old, sizeof(old));
+    CHECK_EQ(groupsLoad(st, groups, scenes), 0);
+    CHECK_EQ(groups[3].id, 5);
+    CHECK_EQ(scenes[1].id, 0);
+}
+
+int main()
+{
+    RUN(testMembership);
+    RUN(testJoinMask);
+    RUN(testSlot);
+    RUN(testRecordCheck);
+    RUN(testSaveLoad);
+    return checkReport();
+}
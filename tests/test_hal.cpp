@@ -0,0 +1,93 @@
+// Fake HAL behaviour the other tests rely on, and the display tile diff
+// (core/display.h) on top of FakeDisplay.
+#include "host/fake_hal.h"
+#include "check.h"
+
+static void testStorage()
+{
+    FakeStorage st;
+    uint32_t v = 0xA5A5A5A5, out = 0;
+    CHECK_EQ(st.load("groups", "g", &out, sizeof(out)), 0);
+    CHECK(st.save("groups", "g", &v, sizeof(v)));
+    CHECK_EQ(st.load("groups", "g", &out, sizeof(out)), sizeof(out));
+    CHECK_EQ(out, 0xA5A5A5A5);
+    uint16_t small;
+    CHECK_EQ(st.load("groups", "g", &small, sizeof(small)), 0); // wrong size reads as missing
+    CHECK_EQ(st.load("other", "g", &out, sizeof(out)), 0);
+}
+static void testStorageFiles()
+{
+    FakeStorage st;
+    uint8_t buf[8];
+    CHECK_EQ(st.readFile("/t.bin", 0, buf, sizeof(buf)), 0);
+    const uint8_t a[] = {1, 2, 3}, b[] = {4, 5};
+    CHECK(st.writeFile("/t.bin", 0, a, sizeof(a)));
+    CHECK(st.writeFile("/t.bin", 3, b, sizeof(b)));
+    CHECK(!st.writeFile("/t.bin", 2, b, sizeof(b))); // not the end
+    CHECK_EQ(st.readFile("/t.bin", 0, buf, sizeof(buf)), 5); // short at the end
+    CHECK_EQ(buf[4], 5);
+    CHECK_EQ(st.readFile("/t.bin", 3, buf, 1), 1);
+    CHECK_EQ(buf[0], 4);
+    CHECK_EQ(st.readFile("/t.bin", 5, buf, 1), 0);
+    CHECK(st.writeFile("/t.bin", 0, b, sizeof(b))); // starts over
+    CHECK_EQ(st.readFile("/t.bin", 0, buf, sizeof(buf)), 2);
+}
+static void testClockAndGpio()
+{
+    FakeClock c;
+    CHECK_EQ(c.unixMs(), 0);
+    c.unix0 = 1700000000000ULL;
+    c.advance(1500);
+    CHECK_EQ(c.ms(), 1500);
+    CHECK_EQ(c.unixMs(), 1700000001500ULL);
+
+    FakeGpio g;
+    g.write(12, true);
+    CHECK(g.read(12));
+    CHECK(!g.read(14));
+    g.pwm(2, 128);
+    CHECK_EQ(g.duty[2], 128);
+}
+static void testRadioTruncates()
+{
+    FakeRadio r;
+    uint8_t big[20] = {1, 2, 3};
+    r.inject(big, sizeof(big));
+    uint8_t buf[4];
+    CHECK_EQ(r.receive(buf, sizeof(buf)), 20); // full length reported
+    CHECK_EQ(buf[2], 3);
+    CHECK_EQ(r.receive(buf, sizeof(buf)), 0);
+    r.send(big, 6);
+    CHECK_EQ(r.sent.size(), 1);
+    CHECK_EQ(r.sent[0].size(), 6);
+}
+static void testDisplayTiles()
+{
+    FakeDisplay d;
+    uint8_t shadow[OLED_BUF_SIZE];
+    bool valid = false;
+    CHECK_EQ(displaySendChanged(d, shadow, &valid), OLED_TILES_X * OLED_TILES_Y);
+    CHECK_EQ(d.fullSends, 1);
+    CHECK(valid);
+    CHECK_EQ(displaySendChanged(d, shadow, &valid), 0);
+
+    // row 2: tiles 3 and 9 changed -> one area of 7 tiles
+    d.frame()[(2 * OLED_TILES_X + 3) * 8] = 0xFF;
+    d.frame()[(2 * OLED_TILES_X + 9) * 8 + 7] = 0x01;
+    // row 5: tile 0
+    d.frame()[(5 * OLED_TILES_X) * 8 + 4] = 0x10;
+    CHECK_EQ(displaySendChanged(d, shadow, &valid), 8);
+    CHECK_EQ(d.areas, 2);
+    CHECK_EQ(d.fullSends, 1);
+    CHECK_EQ(displaySendChanged(d, shadow, &valid), 0);
+}
+
+int main()
+{
+    RUN(testStorage);
+    RUN(testStorageFiles);
+    RUN(testClockAndGpio);
+    RUN(testRadioTruncates);
+    RUN(testDisplayTiles);
+    return checkReport();
+}
@@ -0,0 +1,106 @@
+// Metrics text and wake-up latency (core/metrics.h, core/seqlock.h):
+// exposition format, overflow, and wake counts surviving the seqlock copy
+// into the rendered text, also while a writer thread keeps recording.
+#include <string.h>
+#include <thread>
+#include "core/metrics.h"
+#include "check.h"
+
+enum
+{
+    W_RADIO,
+    W_BUTTON,
+    W_COUNT
+};
+static WakeStats live[W_COUNT] = {{"radio", 0, 0, 0}, {"button", 0, 0, 0}};
+static std::atomic<uint32_t> seq[W_COUNT];
+
+static void testFormat()
+{
+    char buf[256];
+    TextOut t = {buf, sizeof(buf), 0};
+    gauge(t, "uptime_seconds", 42);
+    metricType(t, "cpu_load_ratio", "gauge");
+    metricF(t, "cpu_load_ratio", "core=\"0\"", 0.25f);
+    CHECK(t.len < t.cap);
+    CHECK(strcmp(buf, "# TYPE gw_uptime_seconds gauge\n"
+                      "gw_uptime_seconds 42\n"
+                      "# TYPE gw_cpu_load_ratio gauge\n"
+                      "gw_cpu_load_ratio{core=\"0\"} 0.250\n") == 0);
+}
+static void testOverflow()
+{
+    char buf[24];
+    TextOut t = {buf, sizeof(buf), 0};
+    counter(t, "stall_resets_total", 1);
+    CHECK(t.len >= t.cap);
+    size_t len = t.len;
+    counter(t, "more", 2); // ignored once full
+    CHECK_EQ(t.len, len);
+}
+static void testWakeRendered()
+{
+    wakeAdd(live[W_RADIO], seq[W_RADIO], 120);
+    wakeAdd(live[W_RADIO], seq[W_RADIO], 80);
+    wakeAdd(live[W_RADIO], seq[W_RADIO], 300);
+    wakeAdd(live[W_BUTTON], seq[W_BUTTON], 5000);
+    CHECK_EQ(seq[W_RADIO].load(), 6); // even: no write open
+
+    WakeStats copy[W_COUNT];
+    memset(copy, 0, sizeof(copy));
+    CHECK_EQ(wakeSnapshot(copy, live, seq, W_COUNT, NULL), 0);
+    CHECK_EQ(copy[W_RADIO].events, 3);
+    CHECK_EQ(copy[W_RADIO].latTotalUs, 500);
+    CHECK_EQ(copy[W_RADIO].latMaxUs, 300);
+    CHECK(copy[W_BUTTON].name && strcmp(copy[W_BUTTON].name, "button") == 0);
+
+    char buf[1024];
+    TextOut t = {buf, sizeof(buf), 0};
+    metricsWake(t, copy, W_COUNT);
+    CHECK(t.len < t.cap);
+    CHECK(strstr(buf, "# TYPE gw_wake_events_total counter\n") != NULL);
+    CHECK(strstr(buf, "gw_wake_events_total{path=\"radio\"} 3\n") != NULL);
+    CHECK(strstr(buf, "gw_wake_events_total{path=\"button\"} 1\n") != NULL);
+    CHECK(strstr(buf, "gw_wake_latency_us_total{path=\"radio\"} 500\n") != NULL);
+    CHECK(strstr(buf, "gw_wake_latency_max_us{path=\"button\"} 5000\n") != NULL);
+}
+// A reader copying while the path's task records never sees a torn
+// record: events and latTotalUs move together.
+static void testWakeConcurrent()
+{
+    static WakeStats w[1] = {{"mqtt", 0, 0, 0}};
+    static std::atomic<uint32_t> s[1];
+    const int N = 200000;
+    std::thread writer([] {
+        for (int i = 0; i < N; i++)
+            wakeAdd(w[0], s[0], 10);
+    });
+    int torn = 0;
+    uint32_t last = 0;
+    bool monotonic = true;
+    for (int i = 0; i < 20000; i++)
+    {
+        WakeStats k;
+        wakeSnapshot(&k, w, s, 1, std::this_thread::yield);
+        if (k.latTotalUs != (uint64_t)k.events * 10)
+            torn++;
+        if (k.events < last)
+            monotonic = false;
+        last = k.events;
+    }
+    writer.join();
+    CHECK_EQ(torn, 0);
+    CHECK(monotonic);
+    WakeStats k;
+    wakeSnapshot(&k, w, s, 1, NULL);
+    CHECK_EQ(k.events, N);
+}
+
+int main()
+{
+    RUN(testFormat);
+    RUN(testOverflow);
+    RUN(testWakeRendered);
+    RUN(testWakeConcurrent);
+    return checkReport();
+}
@@ -0,0 +1,82 @@
+// JSON and CBOR output of the payload writer and schemas (core/payload.h).
+#include <string.h>
+#include "core/payload.h"
+#include "check.h"
+
+static uint8_t buf[256];
+
+static void testJsonNodeState()
+{
+    PayloadWriter w(buf, sizeof(buf), false);
+    schemaNodeState(w, 3, true, 128, false);
+    CHECK(strcmp((const char *)buf, "{\"id\":3,\"relay\":1,\"dimming\":128,\"connected\":0}") == 0);
+    CHECK_EQ(w.size(), (int)strlen((const char *)buf));
+}
+static void testJsonGatewayState()
+{
+    const bool relays[4] = {true, false, false, true};
+    PayloadWriter w(buf, sizeof(buf), false);
+    schemaGatewayState(w, 24.25f, true, relays);
+    CHECK(strcmp((const char *)buf, "{\"temp\":24.2,\"fan\":1,\"relays\":[1,0,0,1]}") == 0 ||
+          strcmp((const char *)buf, "{\"temp\":24.3,\"fan\":1,\"relays\":[1,0,0,1]}") == 0);
+}
+static void testJsonEscapesAndNan()
+{
+    PayloadWriter w(buf, sizeof(buf), false);
+    w.beginMap();
+    w.key("s");
+    w.str("a\"b\\c\n");
+    w.key("t");
+    w.real(NAN, 2);
+    w.endMap();
+    CHECK(strcmp((const char *)buf, "{\"s\":\"a\\\"b\\\\c\\u000a\",\"t\":null}") == 0);
+}
+static void testCborNodeTelemetry()
+{
+    PayloadWriter w(buf, sizeof(buf), true);
+    schemaNodeTelemetry(w, 2, 1.5f, 300, 0);
+    static const uint8_t want[] = {
+        0xBF,                                                             // map, indefinite
+        0x62, 'i', 'd', 0x02,                                             // "id": 2
+        0x6B, 't', 'e', 'm', 'p', 'e', 'r', 'a', 't', 'u', 'r', 'e',      // "temperature":
+        0xFA, 0x3F, 0xC0, 0x00, 0x00,                                     // 1.5f
+        0x66, 'u', 'p', 't', 'i', 'm', 'e', 0x19, 0x01, 0x2C,             // "uptime": 300
+        0xFF};
+    CHECK_EQ(w.size(), sizeof(want));
+    CHECK(memcmp(buf, want, sizeof(want)) == 0);
+}
+static void testCborIntegers()
+{
+    PayloadWriter w(buf, sizeof(buf), true);
+    w.num(23);
+    w.num(24);
+    w.num(-1);
+    w.num(-500);
+    w.num(70000);
+    w.num(5000000000LL);
+    static const uint8_t want[] = {0x17, 0x18, 0x18, 0x20, 0x39, 0x01, 0xF3, 0x1A, 0x00, 0x01, 0x11, 0x70,
+                                   0x1B, 0x00, 0x00, 0x00, 0x01, 0x2A, 0x05, 0xF2, 0x00};
+    CHECK_EQ(w.size(), sizeof(want));
+    CHECK(memcmp(buf, want, sizeof(want)) == 0);
+}
+static void testOverflow()
+{
+    PayloadWriter j(buf, 10, false);
+    schemaNodeState(j, 3, true, 128, false);
+    CHECK_EQ(j.size(), -1);
+    CHECK(strlen((const char *)buf) < 10); // still terminated
+    PayloadWriter c(buf, 10, true);
+    schemaNodeState(c, 3, true, 128, false);
+    CHECK_EQ(c.size(), -1);
+}
+
+int main()
+{
+    RUN(testJsonNodeState);
+    RUN(testJsonGatewayState);
+    RUN(testJsonEscapesAndNan);
+    RUN(testCborNodeTelemetry);
+    RUN(testCborIntegers);
+    RUN(testOverflow);
+    return checkReport();
+}
@@ -0,0 +1,116 @@
+// Frame builders, uplink parsing and fade curves (core/protocol.h).
+#include "core/protocol.h"
+#include "host/fake_hal.h"
+#include "check.h"
+
+static void testStateFrame()
+{
+    uint8_t buf[LORA_FRAME_MAX];
+    CHECK_EQ(frameState(buf, 5, true, 200), 12);
+    const uint8_t want[12] = {5, 0, 0, 0, 1, 0, 0, 0, 200, 0, 0, 0};
+    CHECK(memcmp(buf, want, 12) == 0);
+    CHECK_EQ(frameProbe(buf, 7), 12);
+    CHECK_EQ(buf[0], 7);
+    for (int i = 4; i < 12; i++)
+        CHECK_EQ(buf[i], 0);
+}
+static void testExtendedFrames()
+{
+    uint8_t buf[LORA_FRAME_MAX];
+    CHECK_EQ(frameGroup(buf, 3, 1, 0), 6);
+    const uint8_t group[6] = {LORA_EXT_MAGIC, LORA_EXT_GROUP, 0, 3, 1, 0};
+    CHECK(memcmp(buf, group, 6) == 0);
+
+    CHECK_EQ(frameJoin(buf, 9, 0x8102), 6);
+    const uint8_t join[6] = {LORA_EXT_MAGIC, LORA_EXT_JOIN, 0, 9, 0x02, 0x81};
+    CHECK(memcmp(buf, join, 6) == 0);
+
+    CHECK_EQ(frameFade(buf, 4, 128, FADE_EASE, 1500), 8);
+    const uint8_t fade[8] = {LORA_EXT_MAGIC, LORA_EXT_FADE, 0, 4, 128, FADE_EASE, 0xDC, 0x05};
+    CHECK(memcmp(buf, fade, 8) == 0);
+
+    frameStamp(buf, 42);
+    CHECK_EQ(buf[2], 42);
+    CHECK_EQ(buf[3], 4);
+}
+static void testSceneFrame()
+{
+    uint8_t entries[3 * LORA_SCENE_PER_FRAME];
+    for (int i = 0; i < LORA_SCENE_PER_FRAME; i++)
+    {
+        entries[3 * i] = i + 1;
+        entries[3 * i + 1] = i & 1;
+        entries[3 * i + 2] = i;
+    }
+    uint8_t buf[LORA_FRAME_MAX];
+    int n = frameScene(buf, 2, entries, 2);
+    CHECK_EQ(n, 11);
+    const uint8_t want[11] = {LORA_EXT_MAGIC, LORA_EXT_SCENE, 0, 2, 2, 1, 0, 0, 2, 1, 1};
+    CHECK(memcmp(buf, want, 11) == 0);
+    // a full scene still fits the largest frame the queue carries
+    CHECK_EQ(frameScene(buf, 1, entries, LORA_SCENE_PER_FRAME), LORA_FRAME_MAX);
+    // never 12 bytes, so it cannot be taken for a unicast frame
+    for (int k = 0; k <= LORA_SCENE_PER_FRAME; k++)
+        CHECK(5 + 3 * k != (int)sizeof(LoRaPacket));
+}
+static void testParseUplink()
+{
+    LoRaPacketRec in;
+    memset(&in, 0, sizeof(in));
+    in.id = 3;
+    in.data1 = 21.5f;
+    in.data2 = 86400;
+    uint8_t buf[16];
+    memcpy(buf, &in, sizeof(in));
+
+    LoRaPacketRec out;
+    CHECK(frameParseUplink(buf, 12, out));
+    CHECK_EQ(out.id, 3);
+    CHECK(out.data1 == 21.5f);
+    CHECK_EQ(out.data2, 86400);
+
+    CHECK(!frameParseUplink(buf, 11, out));
+    CHECK(!frameParseUplink(buf, 13, out));
+    CHECK(!frameParseUplink(buf, 0, out));
+}
+static void testUplinkThroughRadio()
+{
+    FakeRadio radio;
+    uint8_t f[12];
+    frameProbe(f, 6);
+    radio.inject(f, 12);
+    radio.inject(f, 6); // truncated frame
+    CHECK(radio.rxPending());
+
+    uint8_t buf[LORA_FRAME_MAX];
+    LoRaPacketRec p = {0, 0, 0};
+    int n = radio.receive(buf, sizeof(buf));
+    CHECK(frameParseUplink(buf, n, p));
+    CHECK_EQ(p.id, 6);
+    n = radio.receive(buf, sizeof(buf));
+    CHECK(!frameParseUplink(buf, n, p));
+    CHECK(!radio.rxPending());
+}
+static void testFadeLevel()
+{
+    CHECK_EQ(fadeLevel(0, 200, 0, 1000, FADE_LINEAR), 0);
+    CHECK_EQ(fadeLevel(0, 200, 500, 1000, FADE_LINEAR), 100);
+    CHECK_EQ(fadeLevel(0, 200, 1000, 1000, FADE_LINEAR), 200);
+    CHECK_EQ(fadeLevel(0, 200, 5000, 1000, FADE_LINEAR), 200);
+    CHECK_EQ(fadeLevel(50, 200, 10, 0, FADE_LINEAR), 200);
+    CHECK_EQ(fadeLevel(0, 200, 500, 1000, FADE_EASE), 100);
+    CHECK(fadeLevel(0, 200, 250, 1000, FADE_EASE) < 50);
+    CHECK_EQ(fadeLevel(0, 200, 500, 1000, FADE_SQUARE), 50);
+    CHECK_EQ(fadeLevel(200, 0, 500, 1000, FADE_SQUARE), 150);
+}
+
+int main()
+{
+    RUN(testStateFrame);
+    RUN(testExtendedFrames);
+    RUN(testSceneFrame);
+    RUN(testParseUplink);
+    RUN(testUplinkThroughRadio);
+    RUN(testFadeLevel);
+    return checkReport();
+}
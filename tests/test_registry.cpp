@@ -0,0 +1,120 @@
+// Node registry and its NVS blob (core/registry.h).
+#include "core/registry.h"
+#include "host/fake_hal.h"
+#include "check.h"
+
+static void testAddFind()
+{
+    static NodeRegistry r;
+    registryClear(r);
+    CHECK_EQ(r.nextId, 1);
+    CHECK_EQ(registryAdd(r, 3, "Kitchen", true), 0);
+    CHECK_EQ(registryAdd(r, 1, "Hall", false), 1);
+    CHECK_EQ(registryAdd(r, 3, "Again", false), -1);
+    CHECK_EQ(r.count, 2);
+    CHECK_EQ(r.nextId, 4);
+    CHECK_EQ(registryFind(r, 1), 1);
+    CHECK_EQ(registryFind(r, 2), -1);
+    CHECK(r.nodes[0].relay);
+    CHECK(r.nodes[0].online);
+    CHECK(strcmp(r.nodes[0].label, "Kitchen") == 0);
+}
+static void testLabelTruncated()
+{
+    static NodeRegistry r;
+    registryClear(r);
+    CHECK_EQ(registryAdd(r, 1, "a label that is far longer than the field", false), 0);
+    CHECK_EQ((int)strlen(r.nodes[0].label), NODE_LABEL_LEN - 1);
+}
+static void testFull()
+{
+    static NodeRegistry r;
+    registryClear(r);
+    for (int i = 0; i < MAX_NODES; i++)
+        CHECK_EQ(registryAdd(r, i + 1, "n", false), i);
+    CHECK_EQ(registryAdd(r, 100, "n", false), -1);
+    CHECK_EQ(r.count, MAX_NODES);
+}
+static void testRemoveKeepsOrder()
+{
+    static NodeRegistry r;
+    registryClear(r);
+    registryAdd(r, 5, "a", false);
+    registryAdd(r, 6, "b", false);
+    registryAdd(r, 7, "c", false);
+    CHECK(registryRemove(r, 6));
+    CHECK(!registryRemove(r, 6));
+    CHECK_EQ(r.count, 2);
+    CHECK_EQ(r.nodes[0].id, 5);
+    CHECK_EQ(r.nodes[1].id, 7);
+    CHECK_EQ(r.nextId, 8); // ids are not reused
+}
+static void testEdit()
+{
+    static NodeRegistry r;
+    registryClear(r);
+    registryAdd(r, 2, "two", false);
+    registryAdd(r, 4, "four", false);
+    CHECK(!registryEdit(r, 2, 4, "x")); // taken
+    CHECK(!registryEdit(r, 9, 1, "x")); // unknown
+    CHECK(registryEdit(r, 2, 12, ""));
+    CHECK_EQ(r.nodes[0].id, 12);
+    CHECK(strcmp(r.nodes[0].label, "two") == 0);
+    CHECK_EQ(r.nextId, 13);
+    CHECK(registryEdit(r, 4, 4, "renamed"));
+    CHECK(strcmp(r.nodes[1].label, "renamed") == 0);
+}
+static void testSaveLoad()
+{
+    FakeStorage st;
+    static NodeRegistry r, back;
+    uint32_t classA = 7;
+    CHECK_EQ(registryLoad(st, back, classA), -1); // no blob
+    CHECK_EQ(back.count, 0);
+    CHECK_EQ(back.nextId, 1);
+    CHECK_EQ(classA, 0);
+
+    registryClear(r);
+    registryAdd(r, 3, "Kitchen", true);
+    registryAdd(r, 1, "Hall", false);
+    r.nodes[0].voltage = 3.3f;
+    r.nodes[1].online = false;
+    CHECK(registrySave(st, r, 0x5));
+    CHECK_EQ(registryLoad(st, back, classA), 0);
+    CHECK_EQ(back.count, 2);
+    CHECK_EQ(back.nextId, 4);
+    CHECK_EQ(classA, 0x5);
+    CHECK(strcmp(back.nodes[0].label, "Kitchen") == 0);
+    CHECK(back.nodes[0].relay);
+    CHECK(back.nodes[0].voltage == 3.3f);
+    CHECK(back.nodes[1].online);
+
+    // damaged entries are dropped, nextId raised past what is kept
+    registryAdd(r, 9, "Porch", false);
+    registryAdd(r, 20, "Yard", false);
+    r.nodes[1].id = 3; // duplicate
+    memset(r.nodes[2].label, 'x', NODE_LABEL_LEN); // unterminated
+    r.nodes[3].id = 0;
+    r.nextId = 0;
+    registrySave(st, r, 0);
+    CHECK_EQ(registryLoad(st, back, classA), 3);
+    CHECK_EQ(back.count, 1);
+    CHECK_EQ(back.nodes[0].id, 3);
+    CHECK_EQ(back.nextId, 4);
+
+    r.count = MAX_NODES + 1; // not a registry
+    registrySave(st, r, 0);
+    CHECK_EQ(registryLoad(st, back, classA), -1);
+    CHECK_EQ(back.count, 0);
+}
+
+int main()
+{
+    RUN(testAddFind);
+    RUN(testLabelTruncated);
+    RUN(testFull);
+    RUN(testRemoveKeepsOrder);
+    RUN(testEdit);
+    RUN(testSaveLoad);
+    return checkReport();
+}
@@ -0,0 +1,262 @@
+// Rule index, evaluation, record checks, edits and the rule file
+// (core/rules.h).
+#include <string.h>
+#include <vector>
+#include "core/rules.h"
+#include "host/fake_hal.h"
+#include "check.h"
+
+static RuleTable table;
+static RuleStats stats;
+static bool relays[RULE_RELAYS];
+static std::vector<uint16_t> fired; // targetId of each firing
+static bool accept = true;
+
+static bool fire(const Rule &r)
+{
+    if (accept)
+        fired.push_back(r.targetId);
+    return accept;
+}
+static void reset()
+{
+    memset(&table, 0, sizeof(table));
+    memset(&stats, 0, sizeof(stats));
+    memset(relays, 0, sizeof(relays));
+    fired.clear();
+    accept = true;
+}
+static Rule &add(int slot, uint8_t src, uint8_t op, float threshold, uint16_t tid)
+{
+    Rule &r = table.rules[slot];
+    memset(&r, 0, sizeof(r));
+    r.id = slot + 1;
+    r.src = src;
+    r.field = RULE_F_TEMP;
+    r.op = op;
+    r.threshold = threshold;
+    r.guardRelay = -1;
+    r.target = CMD_NODE;
+    r.targetId = tid;
+    r.action = ACT_ON;
+    table.count++;
+    return r;
+}
+static void eval(uint8_t src, float temp, uint32_t nowMs = 1000, uint16_t minute = 0)
+{
+    RuleInputs in;
+    for (int f = 0; f < RULE_FIELDS; f++)
+        in.fields[f] = temp;
+    in.relays = relays;
+    in.nowMs = nowMs;
+    in.minute = minute;
+    in.fire = fire;
+    rulesEval(table, ruleBucket(src), in, stats);
+}
+static void testBuckets()
+{
+    CHECK_EQ(ruleBucket(1), 0);
+    CHECK_EQ(ruleBucket(NODE_SLOTS), NODE_SLOTS - 1);
+    CHECK_EQ(ruleBucket(RULE_SRC_RELAY + 3), RULE_BUCKETS - 1);
+    CHECK_EQ(ruleBucket(0), -1);
+    CHECK_EQ(ruleBucket(NODE_SLOTS + 1), -1);
+    CHECK_EQ(ruleBucket(RULE_SRC_RELAY + RULE_RELAYS), -1);
+}
+static void testIndexWalksOneSource()
+{
+    reset();
+    add(0, 2, RULE_GT, 10, 1);
+    add(5, 3, RULE_GT, 10, 2);
+    add(9, 2, RULE_GT, 10, 3);
+    rulesIndex(table);
+    eval(2, 20);
+    CHECK_EQ(stats.evals, 2); // node 3's rule is not touched
+    CHECK_EQ(fired.size(), 2);
+    CHECK_EQ(fired[0], 1); // table order
+    CHECK_EQ(fired[1], 3);
+}
+static void testEdgeAndHysteresis()
+{
+    reset();
+    add(0, 1, RULE_GT, 30, 7).hyst = 2;
+    rulesIndex(table);
+    eval(1, 31);
+    eval(1, 35);
+    CHECK_EQ(fired.size(), 1); // once per crossing
+    eval(1, 29); // inside the hysteresis band: still latched
+    eval(1, 31);
+    CHECK_EQ(fired.size(), 1);
+    eval(1, 27); // cleared by more than hyst
+    eval(1, 31);
+    CHECK_EQ(fired.size(), 2);
+}
+static void testGuards()
+{
+    reset();
+    Rule &g = add(0, 1, RULE_GE, 0, 1);
+    g.guardRelay = 2;
+    g.guardOn = 1;
+    rulesIndex(table);
+    eval(1, 5);
+    CHECK_EQ(fired.size(), 0);
+    CHECK_EQ(stats.blocked, 1);
+    relays[2] = true;
+    eval(1, 5);
+    CHECK_EQ(fired.size(), 1);
+
+    reset();
+    add(0, 1, RULE_GT, 10, 1).cooldownS = 60;
+    rulesIndex(table);
+    eval(1, 20, 1000);
+    eval(1, 0, 2000); // re-arm
+    eval(1, 20, 30000); // within the cooldown
+    CHECK_EQ(fired.size(), 1);
+    eval(1, 20, 62000);
+    CHECK_EQ(fired.size(), 2);
+}
+static void testWindow()
+{
+    reset();
+    Rule &r = add(0, 1, RULE_GT, 10, 1);
+    r.fromMin = 22 * 60; // 22:00..06:00, past midnight
+    r.toMin = 6 * 60;
+    rulesIndex(table);
+    eval(1, 20, 1000, 12 * 60);
+    CHECK_EQ(fired.size(), 0);
+    eval(1, 20, 1000, 23 * 60);
+    CHECK_EQ(fired.size(), 1);
+    eval(1, 0);
+    eval(1, 20, 1000, 5 * 60);
+    CHECK_EQ(fired.size(), 2);
+}
+static void testBusFullStaysArmed()
+{
+    reset();
+    add(0, RULE_SRC_RELAY + 1, RULE_EQ, 1, 4);
+    rulesIndex(table);
+    accept = false;
+    eval(RULE_SRC_RELAY + 1, 1);
+    CHECK_EQ(stats.busFull, 1);
+    accept = true;
+    eval(RULE_SRC_RELAY + 1, 1);
+    CHECK_EQ(fired.size(), 1);
+    CHECK_EQ(stats.fired, 1);
+}
+static void testRecordCheck()
+{
+    reset();
+    Rule ok = add(0, 1, RULE_GT, 10, 3);
+    CHECK(ruleValid(ok));
+    Rule bad = ok;
+    bad.src = 0;
+    CHECK(!ruleValid(bad));
+    bad = ok;
+    bad.field = RULE_FIELDS;
+    CHECK(!ruleValid(bad));
+    bad = ok;
+    bad.op = RULE_NE + 1;
+    CHECK(!ruleValid(bad));
+    bad = ok;
+    bad.guardRelay = RULE_RELAYS;
+    CHECK(!ruleValid(bad));
+    bad = ok;
+    bad.toMin = 1440;
+    CHECK(!ruleValid(bad));
+    bad = ok;
+    bad.target = CMD_CONFIG;
+    CHECK(!ruleValid(bad));
+    bad = ok;
+    bad.action = ACT_FADE;
+    CHECK(!ruleValid(bad));
+    bad = ok;
+    bad.targetId = NODE_SLOTS + 1;
+    CHECK(!ruleValid(bad));
+}
+static Rule newRule(uint8_t src, float threshold, uint16_t tid)
+{
+    Rule r;
+    memset(&r, 0, sizeof(r));
+    r.src = src;
+    r.field = RULE_F_TEMP;
+    r.op = RULE_GT;
+    r.threshold = threshold;
+    r.guardRelay = -1;
+    r.target = CMD_NODE;
+    r.targetId = tid;
+    r.action = ACT_ON;
+    return r;
+}
+static void testPutDelete()
+{
+    reset();
+    uint16_t a = rulesPut(table, newRule(2, 10, 3));
+    uint16_t b = rulesPut(table, newRule(2, 20, 4));
+    CHECK(a && b && a != b);
+    CHECK_EQ(table.count, 2);
+    eval(2, 25);
+    CHECK_EQ(fired.size(), 2); // both indexed under node 2
+    // replacing re-arms and moves it to another source
+    Rule r = newRule(5, 10, 6);
+    r.id = a;
+    CHECK_EQ(rulesPut(table, r), a);
+    CHECK_EQ(table.count, 2);
+    CHECK(!table.latched[ruleFind(table, a)]);
+    fired.clear();
+    eval(2, 30);
+    eval(5, 30);
+    CHECK_EQ(fired.size(), 1);
+    CHECK_EQ(fired[0], 6);
+    r.id = 999;
+    CHECK_EQ(rulesPut(table, r), 0);
+    CHECK(rulesDelete(table, b));
+    CHECK(!rulesDelete(table, b));
+    CHECK_EQ(table.count, 1);
+    CHECK_EQ(table.head[ruleBucket(2)], RULE_NONE);
+    CHECK(rulesDelete(table, 0));
+    CHECK_EQ(table.count, 0);
+}
+static void testSaveLoad()
+{
+    FakeStorage st;
+    reset();
+    CHECK_EQ(rulesLoad(st, "/r.bin", table), 0); // no file
+    CHECK_EQ(table.count, 0);
+    for (int i = 0; i < 20; i++)
+        rulesPut(table, newRule(1 + i % NODE_SLOTS, i, 1 + i % NODE_SLOTS));
+    rulesDelete(table, 4);
+    CHECK(rulesSave(st, "/r.bin", table));
+    CHECK_EQ(st.files["/r.bin"].size(), 8 + 19 * sizeof(Rule));
+
+    static RuleTable back;
+    CHECK_EQ(rulesLoad(st, "/r.bin", back), 0);
+    CHECK_EQ(back.count, 19);
+    CHECK_EQ(back.lastId, 20);
+    CHECK_EQ(ruleFind(back, 4), -1);
+    CHECK_EQ(back.rules[ruleFind(back, 5)].threshold, 4);
+    CHECK_EQ(back.head[ruleBucket(1)], ruleFind(back, 1)); // indexed
+    CHECK_EQ(rulesPut(back, newRule(1, 0, 1)), 21);
+
+    // a damaged record is dropped, a foreign file loads nothing
+    Rule bad = newRule(NODE_SLOTS + 1, 0, 1);
+    bad.id = 2;
+    memcpy(&st.files["/r.bin"][8 + sizeof(Rule)], &bad, sizeof(bad));
+    CHECK_EQ(rulesLoad(st, "/r.bin", back), 1);
+    CHECK_EQ(back.count, 18);
+    st.files["/r.bin"][0] ^= 1;
+    CHECK_EQ(rulesLoad(st, "/r.bin", back), 0);
+    CHECK_EQ(back.count, 0);
+}
+
+int main()
+{
+    RUN(testBuckets);
+    RUN(testIndexWalksOneSource);
+    RUN(testEdgeAndHysteresis);
+    RUN(testGuards);
+    RUN(testWindow);
+    RUN(testBusFullStaysArmed);
+    RUN(testRecordCheck);
+    RUN(testPutDelete);
+    RUN(testSaveLoad);
+    return checkReport();
+}
@@ -0,0 +1,294 @@
+// Next-fire arithmetic, record checks, the table's heap and its file
+// (core/schedule.h).
+#include <string.h>
+#include <vector>
+#include "core/schedule.h"
+#include "host/fake_hal.h"
+#include "check.h"
+
+static const uint32_t MON = 1704067200; // 2024-01-01 00:00:00, a Monday
+static const uint8_t ALL_DAYS = 0x7F;
+
+static SchedEntry entry(uint8_t kind, uint32_t at, uint8_t days)
+{
+    SchedEntry e;
+    memset(&e, 0, sizeof(e));
+    e.id = 1;
+    e.kind = kind;
+    e.at = at;
+    e.days = days;
+    return e;
+}
+static void testRecordSize()
+{
+    CHECK_EQ(sizeof(SchedEntry), 16);
+}
+static void testOnce()
+{
+    SchedEntry e = entry(SCHED_ONCE, MON + 100, 0);
+    CHECK_EQ(schedNextFire(e, MON), MON + 100);
+    CHECK_EQ(schedNextFire(e, MON + 99), MON + 100);
+    CHECK_EQ(schedNextFire(e, MON + 100), 0); // strictly after
+    CHECK_EQ(schedNextFire(e, MON + 500), 0);
+}
+static void testDaily()
+{
+    SchedEntry e = entry(SCHED_DAILY, 7 * 3600, ALL_DAYS);
+    CHECK_EQ(schedNextFire(e, MON), MON + 7 * 3600);
+    CHECK_EQ(schedNextFire(e, MON + 7 * 3600), MON + 86400 + 7 * 3600);
+    // weekdays only: Friday after the time -> Monday
+    e.days = 0x3E;
+    uint32_t fri = MON + 4 * 86400;
+    CHECK_EQ(schedNextFire(e, fri + 8 * 3600), MON + 7 * 86400 + 7 * 3600);
+    // Sunday only
+    e.days = 0x01;
+    CHECK_EQ(schedNextFire(e, MON), MON + 6 * 86400 + 7 * 3600);
+    // no days: never
+    e.days = 0;
+    CHECK_EQ(schedNextFire(e, MON), 0);
+}
+static void testHourly()
+{
+    SchedEntry e = entry(SCHED_HOURLY, 15 * 60, ALL_DAYS);
+    CHECK_EQ(schedNextFire(e, MON), MON + 15 * 60);
+    CHECK_EQ(schedNextFire(e, MON + 15 * 60), MON + 3600 + 15 * 60);
+    CHECK_EQ(schedNextFire(e, MON + 23 * 3600 + 20 * 60), MON + 86400 + 15 * 60);
+    // Mondays only, from Monday 23:30 -> next Monday 00:15
+    e.days = 0x02;
+    CHECK_EQ(schedNextFire(e, MON + 23 * 3600 + 30 * 60), MON + 7 * 86400 + 15 * 60);
+}
+static void testAlwaysAfter()
+{
+    SchedEntry d = entry(SCHED_DAILY, 12 * 3600 + 34, 0x55);
+    SchedEntry h = entry(SCHED_HOURLY, 59 * 60 + 59, 0x2A);
+    for (uint32_t t = MON; t < MON + 14 * 86400; t += 1237)
+    {
+        uint32_t nd = schedNextFire(d, t), nh = schedNextFire(h, t);
+        CHECK(nd > t && nd - t <= 7 * 86400);
+        CHECK(nh > t && nh - t <= 7 * 86400);
+        CHECK_EQ((nd % 86400), 12 * 3600 + 34);
+        CHECK_EQ((nh % 3600), 59 * 60 + 59);
+    }
+}
+static void testRecordCheck()
+{
+    SchedEntry e = entry(SCHED_DAILY, 7 * 3600, ALL_DAYS);
+    e.target = CMD_NODE;
+    e.targetId = 3;
+    e.action = ACT_ON;
+    CHECK(schedEntryValid(e));
+    SchedEntry bad = e;
+    bad.kind = 3;
+    CHECK(!schedEntryValid(bad));
+    bad = e;
+    bad.at = 86400;
+    CHECK(!schedEntryValid(bad));
+    bad = e;
+    bad.target = CMD_NODE_REMOVE;
+    CHECK(!schedEntryValid(bad));
+    bad = e;
+    bad.action = ACT_FADE;
+    CHECK(!schedEntryValid(bad));
+    bad = e;
+    bad.targetId = NODE_SLOTS + 1;
+    CHECK(!schedEntryValid(bad));
+    bad.targetId = 0;
+    CHECK(!schedEntryValid(bad));
+    // ids per target
+    CHECK(cmdStoredValid(CMD_LOCAL_RELAY, 3, ACT_TOGGLE));
+    CHECK(cmdStoredValid(CMD_LOCAL_RELAY, CMD_ID_ALL, ACT_OFF));
+    CHECK(!cmdStoredValid(CMD_LOCAL_RELAY, 4, ACT_OFF));
+    CHECK(cmdStoredValid(CMD_GROUP, 0, ACT_DIM));
+    CHECK(!cmdStoredValid(CMD_GROUP, CMD_ID_ALL, ACT_DIM));
+    CHECK(cmdStoredValid(CMD_SCENE, 255, ACT_ON));
+    CHECK(!cmdStoredValid(CMD_SCENE, 0, ACT_ON));
+    CHECK(!cmdStoredValid(CMD_SCENE, 256, ACT_ON));
+}
+// ---------------- Table ---------------------------
+static SchedTable table;
+static std::vector<uint16_t> fired; // ids, in firing order
+static bool accept = true;
+
+static bool fire(const SchedEntry &e)
+{
+    if (accept)
+        fired.push_back(e.id);
+    return accept;
+}
+static SchedEntry cmdEntry(uint8_t kind, uint32_t at)
+{
+    SchedEntry e = entry(kind, at, ALL_DAYS);
+    e.id = 0;
+    e.target = CMD_NODE;
+    e.targetId = 2;
+    e.action = ACT_ON;
+    return e;
+}
+static void resetTable()
+{
+    schedTableInit(table);
+    fired.clear();
+    accept = true;
+}
+// The heap top is the earliest queued time, and every slot knows its
+// heap index.
+static bool heapOk()
+{
+    for (int i = 0; i < table.heapLen; i++)
+    {
+        if (table.heapPos[table.heap[i]] != i)
+            return false;
+        if (i && table.nextAt[table.heap[i]] < table.nextAt[table.heap[(i - 1) / 2]])
+            return false;
+    }
+    return true;
+}
+static void testPutDelete()
+{
+    resetTable();
+    CHECK_EQ(schedClock(table, (uint64_t)MON * 1000, 0), 0); // first valid clock builds, not a step
+    uint16_t a = schedPut(table, cmdEntry(SCHED_ONCE, MON + 300), MON);
+    uint16_t b = schedPut(table, cmdEntry(SCHED_ONCE, MON + 100), MON);
+    uint16_t c = schedPut(table, cmdEntry(SCHED_DAILY, 200), MON); // 00:03:20
+    CHECK(a && b && c && a != b && b != c);
+    CHECK_EQ(table.count, 3);
+    CHECK_EQ(table.heapLen, 3);
+    CHECK(table.dirty);
+    CHECK_EQ(table.entries[table.heap[0]].id, b);
+    // replace moves it in the heap
+    SchedEntry e = cmdEntry(SCHED_ONCE, MON + 50);
+    e.id = a;
+    CHECK_EQ(schedPut(table, e, MON), a);
+    CHECK_EQ(table.count, 3);
+    CHECK_EQ(table.entries[table.heap[0]].id, a);
+    CHECK(heapOk());
+    e.id = 999;
+    CHECK_EQ(schedPut(table, e, MON), 0); // unknown id
+    CHECK(schedDelete(table, a));
+    CHECK(!schedDelete(table, a));
+    CHECK_EQ(table.count, 2);
+    CHECK_EQ(table.heapLen, 2);
+    CHECK_EQ(table.entries[table.heap[0]].id, b);
+    CHECK(schedDelete(table, 0)); // every entry
+    CHECK_EQ(table.count, 0);
+    CHECK_EQ(table.heapLen, 0);
+}
+static void testRunDue()
+{
+    resetTable();
+    uint16_t once = schedPut(table, cmdEntry(SCHED_ONCE, MON + 10), MON);
+    uint16_t hourly = schedPut(table, cmdEntry(SCHED_HOURLY, 5), MON);
+    CHECK_EQ(table.heapLen, 0); // no clock yet: nothing queued
+    CHECK_EQ(schedRunDue(table, (uint64_t)MON * 1000, fire), 0xFFFFFFFF);
+    schedClock(table, (uint64_t)MON * 1000, 0);
+    CHECK_EQ(schedRunDue(table, (uint64_t)MON * 1000, fire), 5000);
+    CHECK_EQ(schedRunDue(table, (uint64_t)(MON + 20) * 1000 + 300, fire), 3600 * 1000 + 5000 - 20300);
+    CHECK_EQ(fired.size(), 2);
+    CHECK_EQ(fired[0], hourly);
+    CHECK_EQ(fired[1], once);
+    CHECK_EQ(table.count, 1); // the one-shot is gone
+    CHECK_EQ(table.stats.fired, 2);
+    CHECK_EQ(table.stats.late, 2); // 15.3 s and 10.3 s after
+    // refused: stays on top and is retried
+    accept = false;
+    CHECK_EQ(schedRunDue(table, (uint64_t)(MON + 3605) * 1000, fire), 0);
+    CHECK_EQ(table.stats.busFull, 1);
+    accept = true;
+    schedRunDue(table, (uint64_t)(MON + 3605) * 1000, fire);
+    CHECK_EQ(fired.size(), 3);
+    CHECK_EQ(table.stats.late, 2);
+}
+static void testClockStep()
+{
+    resetTable();
+    schedClock(table, (uint64_t)MON * 1000, 0);
+    schedPut(table, cmdEntry(SCHED_ONCE, MON + 100), MON);
+    schedPut(table, cmdEntry(SCHED_DAILY, 3600), MON);
+    CHECK_EQ(schedClock(table, (uint64_t)MON * 1000 + 1000, 1000), 0); // in step with the tick
+    uint32_t rebuilds = table.stats.rebuilds;
+    // set forward an hour: the one-shot is past and dropped, not fired
+    CHECK_EQ(schedClock(table, (uint64_t)(MON + 3601) * 1000, 2000), 3600 * 1000 - 1000);
+    CHECK_EQ(table.stats.rebuilds, rebuilds + 1);
+    CHECK_EQ(table.stats.missed, 1);
+    CHECK_EQ(table.count, 1);
+    CHECK_EQ(table.nextAt[table.heap[0]], MON + 86400 + 3600);
+    // clock lost: nothing runs until it is back
+    schedClock(table, 1000, 3000);
+    CHECK(!table.clockOk);
+    CHECK_EQ(schedRunDue(table, (uint64_t)(MON + 2 * 86400) * 1000, fire), 0xFFFFFFFF);
+    CHECK(fired.empty());
+}
+static void testHeapOrder()
+{
+    resetTable();
+    schedClock(table, (uint64_t)MON * 1000, 0);
+    uint32_t x = 12345;
+    for (int i = 0; i < 500; i++)
+    {
+        x = x * 1103515245 + 12345;
+        schedPut(table, cmdEntry(SCHED_ONCE, MON + 1 + x % 100000), MON);
+    }
+    for (int i = 1; i <= 500; i += 3)
+        schedDelete(table, i);
+    CHECK(heapOk());
+    uint32_t last = 0;
+    int n = 0;
+    while (table.heapLen)
+    {
+        uint32_t at = table.nextAt[table.heap[0]];
+        CHECK(at >= last);
+        last = at;
+        schedUnqueue(table, table.heap[0]);
+        n++;
+    }
+    CHECK_EQ(n, table.count);
+}
+static void testSaveLoad()
+{
+    FakeStorage st;
+    resetTable();
+    CHECK_EQ(schedLoad(st, "/s.bin", table), 0); // no file
+    CHECK_EQ(table.count, 0);
+    for (int i = 0; i < 40; i++) // more than one TABLE_IO_CHUNK
+        schedPut(table, cmdEntry(SCHED_DAILY, i * 60), MON);
+    schedDelete(table, 7);
+    CHECK(schedSave(st, "/s.bin", table));
+    CHECK(!table.dirty);
+    CHECK_EQ(table.stats.saves, 1);
+    CHECK_EQ(st.files["/s.bin"].size(), 8 + 39 * sizeof(SchedEntry));
+
+    static SchedTable back;
+    CHECK_EQ(schedLoad(st, "/s.bin", back), 0);
+    CHECK_EQ(back.count, 39);
+    CHECK_EQ(back.lastId, 40);
+    CHECK_EQ(schedFind(back, 7), -1);
+    CHECK_EQ(back.entries[schedFind(back, 8)].at, 7 * 60);
+    // new ids continue after the stored ones
+    CHECK_EQ(schedPut(back, cmdEntry(SCHED_DAILY, 0), MON), 41);
+
+    // a damaged record is dropped, a foreign file loads nothing
+    SchedEntry bad = cmdEntry(SCHED_DAILY, 86400);
+    bad.id = 3;
+    memcpy(&st.files["/s.bin"][8], &bad, sizeof(bad));
+    CHECK_EQ(schedLoad(st, "/s.bin", back), 1);
+    CHECK_EQ(back.count, 38);
+    st.files["/s.bin"][0] ^= 1;
+    CHECK_EQ(schedLoad(st, "/s.bin", back), 0);
+    CHECK_EQ(back.count, 0);
+}
+
+int main()
+{
+    RUN(testRecordSize);
+    RUN(testOnce);
+    RUN(testDaily);
+    RUN(testHourly);
+    RUN(testAlwaysAfter);
+    RUN(testRecordCheck);
+    RUN(testPutDelete);
+    RUN(testRunDue);
+    RUN(testClockStep);
+    RUN(testHeapOrder);
+    RUN(testSaveLoad);
+    return checkReport();
+}
@@ -0,0 +1,168 @@
+// Downlink queue classes, supersede and deadlines (core/txqueue.h).
+#include "core/txqueue.h"
+#include "check.h"
+
+static void reset(TxQueue &q)
+{
+    memset(&q, 0, sizeof(q));
+}
+static bool push(TxQueue &q, uint8_t cls, uint8_t kind, uint16_t node, uint32_t now, uint8_t tag = 0)
+{
+    uint8_t f[12] = {tag};
+    return txqPush(q, cls, kind, node, f, kind == TXK_REFRESH ? 0 : 12, now);
+}
+static int next(TxQueue &q, uint32_t now, TxEntry &e, uint8_t &cls)
+{
+    return txqNext(q, now, e, cls);
+}
+static void testStrictFirst()
+{
+    static TxQueue q;
+    reset(q);
+    push(q, TX_REFRESH, TXK_REFRESH, 1, 0);
+    push(q, TX_SCHEDULED, TXK_OTHER, 0, 0);
+    push(q, TX_INTERACTIVE, TXK_UNICAST, 2, 0);
+    push(q, TX_WINDOW, TXK_UNICAST, 3, 0);
+    TxEntry e = {};
+    uint8_t cls = 0;
+    CHECK_EQ(next(q, 10, e, cls), TXQ_SEND);
+    CHECK_EQ(cls, TX_WINDOW);
+    CHECK_EQ(next(q, 10, e, cls), TXQ_SEND);
+    CHECK_EQ(cls, TX_INTERACTIVE);
+    CHECK_EQ(e.node, 2);
+    CHECK_EQ(next(q, 10, e, cls), TXQ_SEND);
+    CHECK_EQ(next(q, 10, e, cls), TXQ_SEND);
+    CHECK_EQ(next(q, 10, e, cls), TXQ_EMPTY);
+    CHECK(!txqPending(q));
+    CHECK_EQ(q.stats[TX_INTERACTIVE].sent, 1);
+    CHECK_EQ(q.stats[TX_INTERACTIVE].waitTotalMs, 10);
+}
+static void testSupersede()
+{
+    static TxQueue q;
+    reset(q);
+    CHECK(push(q, TX_SCHEDULED, TXK_UNICAST, 4, 0, 1));
+    CHECK(push(q, TX_INTERACTIVE, TXK_UNICAST, 4, 0, 2));
+    CHECK_EQ(q.stats[TX_SCHEDULED].superseded, 1);
+    // a refresh behind a queued frame for the node adds nothing
+    CHECK(push(q, TX_REFRESH, TXK_REFRESH, 4, 0));
+    CHECK_EQ(q.stats[TX_REFRESH].queued, 0);
+    // fades replace fades but not state frames, and the other way round
+    CHECK(push(q, TX_INTERACTIVE, TXK_FADE, 4, 0, 3));
+    CHECK(push(q, TX_INTERACTIVE, TXK_FADE, 4, 0, 4));
+    CHECK_EQ(q.stats[TX_INTERACTIVE].superseded, 1);
+
+    TxEntry e = {};
+    uint8_t cls = 0;
+    CHECK_EQ(next(q, 1, e, cls), TXQ_SEND);
+    CHECK_EQ(e.kind, TXK_UNICAST);
+    CHECK_EQ(e.buf[0], 2);
+    CHECK_EQ(next(q, 1, e, cls), TXQ_SEND);
+    CHECK_EQ(e.kind, TXK_FADE);
+    CHECK_EQ(e.buf[0], 4);
+    CHECK_EQ(next(q, 1, e, cls), TXQ_EMPTY);
+}
+static void testDeadline()
+{
+    static TxQueue q;
+    reset(q);
+    push(q, TX_DISCOVERY, TXK_PROBE, 5, 0);
+    push(q, TX_INTERACTIVE, TXK_UNICAST, 6, 0);
+    TxEntry e = {};
+    uint8_t cls = 0;
+    uint32_t late = txDeadlineMs[TX_INTERACTIVE] + 1;
+    CHECK_EQ(next(q, late, e, cls), TXQ_EXPIRED);
+    CHECK_EQ(e.node, 6);
+    // an expired probe is handed back so the owner can answer its caller
+    CHECK_EQ(next(q, late, e, cls), TXQ_EXPIRED);
+    CHECK_EQ(e.kind, TXK_PROBE);
+    CHECK_EQ(q.stats[TX_INTERACTIVE].expired, 1);
+    CHECK_EQ(q.stats[TX_DISCOVERY].expired, 1);
+    CHECK_EQ(next(q, late, e, cls), TXQ_EMPTY);
+}
+static void testFull()
+{
+    static TxQueue q;
+    reset(q);
+    for (int i = 0; i < TX_DEPTH; i++)
+        CHECK(push(q, TX_SCHEDULED, TXK_OTHER, 0, 0));
+    CHECK(!push(q, TX_SCHEDULED, TXK_OTHER, 0, 0));
+    CHECK_EQ(q.stats[TX_SCHEDULED].full, 1);
+    uint8_t big[LORA_FRAME_MAX + 1] = {0};
+    CHECK(!txqPush(q, TX_INTERACTIVE, TXK_OTHER, 0, big, sizeof(big), 0));
+}
+static void testWeights()
+{
+    // scheduled : refresh : discovery share by txWeights while all are busy
+    static TxQueue q;
+    reset(q);
+    int sent[TX_CLASSES] = {0};
+    for (int round = 0; round < 70; round++)
+    {
+        if (q.rings[TX_SCHEDULED].count < 4)
+            push(q, TX_SCHEDULED, TXK_OTHER, 0, 0);
+        if (q.rings[TX_REFRESH].count < 4)
+            push(q, TX_REFRESH, TXK_OTHER, 0, 0);
+        if (q.rings[TX_DISCOVERY].count < 4)
+            push(q, TX_DISCOVERY, TXK_OTHER, 0, 0);
+        TxEntry e = {};
+        uint8_t cls = 0;
+        CHECK_EQ(next(q, 0, e, cls), TXQ_SEND);
+        sent[cls]++;
+    }
+    CHECK_EQ(sent[TX_SCHEDULED], 40);
+    CHECK_EQ(sent[TX_REFRESH], 20);
+    CHECK_EQ(sent[TX_DISCOVERY], 10);
+}
+static void testRefreshRoundFits()
+{
+    // one REFRESH_MS pass queues every node before anything is sent,
+    // with a fan-out already waiting in the same weighted share
+    static TxQueue q;
+    reset(q);
+    for (int n = 1; n <= NODE_SLOTS; n++)
+        CHECK(push(q, TX_REFRESH, TXK_REFRESH, n, 0));
+    CHECK_EQ(q.stats[TX_REFRESH].full, 0);
+    TxEntry e = {};
+    uint8_t cls = 0;
+    int last = 0;
+    for (int n = 1; n <= NODE_SLOTS; n++)
+    {
+        CHECK_EQ(next(q, 0, e, cls), TXQ_SEND);
+        last = e.node;
+    }
+    CHECK_EQ(last, NODE_SLOTS); // the last node is not starved
+}
+static void testDeadEntriesFreed()
+{
+    // repeated updates for the same nodes leave superseded entries
+    // behind; they must not make the ring look full
+    static TxQueue q;
+    reset(q);
+    for (int round = 0; round < 5; round++)
+        for (int n = 1; n <= NODE_SLOTS; n++)
+            CHECK(push(q, TX_SCHEDULED, TXK_UNICAST, n, 0, round));
+    CHECK_EQ(q.stats[TX_SCHEDULED].full, 0);
+    CHECK_EQ(q.rings[TX_SCHEDULED].count, NODE_SLOTS);
+    TxEntry e = {};
+    uint8_t cls = 0;
+    for (int n = 1; n <= NODE_SLOTS; n++)
+    {
+        CHECK_EQ(next(q, 0, e, cls), TXQ_SEND);
+        CHECK_EQ(e.node, n); // order kept by compaction
+        CHECK_EQ(e.buf[0], 4);
+    }
+    CHECK_EQ(next(q, 0, e, cls), TXQ_EMPTY);
+}
+
+int main()
+{
+    RUN(testStrictFirst);
+    RUN(testSupersede);
+    RUN(testDeadline);
+    RUN(testFull);
+    RUN(testWeights);
+    RUN(testRefreshRoundFits);
+    RUN(testDeadEntriesFreed);
+    return checkReport();
+}